@@ -0,0 +1,131 @@
+// Tuning transfer sizes on two simulated links: an RP2040 plugged in directly
+// (the per-packet full-speed model) and an RP2350 behind a hub whose
+// throughput peaks at 8 KiB writes and falls off for larger transfers. The
+// RP2350 is configured with bandwidth curves. For each link, --autotune's
+// sweep picks chunk sizes and timeouts. A 192 KiB RAM image, a 1 MiB flash
+// image and a 1 MiB dump are then run with the built-in sizes and with the
+// tuned profile, checked, and timed. The profile is also stored to a file and
+// read back. Device time is simulated.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "flash_dump.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "sim_device.h"
+#include "transfer_profile.h"
+
+namespace {
+constexpr uint32_t kRamImageSize = 192 * 1024;
+constexpr uint32_t kFlashImageSize = 1024 * 1024;
+
+struct RunResult {
+    double ram_ms = 0;
+    double flash_ms = 0;
+    double dump_ms = 0;
+    uint32_t timeouts = 0;
+    bool ok = false;
+};
+
+RunResult run_loads(const SimDeviceProfile &profile, const TransferProfile *tuned) {
+    RunResult result;
+    std::vector<uint8_t> ram = synthetic_payload(kRamImageSize, 1);
+    std::vector<uint8_t> flash = synthetic_payload(kFlashImageSize, 2);
+    LoadOptions options;
+    options.exec_after = false;
+    DumpOptions dump;
+    SimulatedDevice device(profile);
+    if (tuned) {
+        apply_transfer_profile(*tuned, options);
+        apply_transfer_profile(*tuned, dump);
+        device.set_timeouts(tuned->timeouts);
+    }
+
+    std::vector<ImageSegment> ram_segments = {{kSramStart, ram.data(), kRamImageSize}};
+    LoadPlan ram_plan = build_load_plan(ram_segments, kSramStart, profile.layout, false);
+    bool loaded = load_plan_to_device(device, ram_plan, options) == kTransportOk;
+    result.ram_ms = device.stats().elapsed_us / 1000.0;
+    std::vector<uint8_t> actual(kRamImageSize);
+    result.ok = loaded && device.read_memory(kSramStart, actual.data(), kRamImageSize) && actual == ram;
+    result.timeouts += device.stats().failed_commands;
+
+    device.reset_stats();
+    std::vector<ImageSegment> flash_segments = {{kFlashStart, flash.data(), kFlashImageSize}};
+    LoadPlan flash_plan = build_load_plan(flash_segments, kFlashStart, profile.layout, true);
+    loaded = load_plan_to_device(device, flash_plan, options) == kTransportOk;
+    result.flash_ms = device.stats().elapsed_us / 1000.0;
+    actual.resize(kFlashImageSize);
+    result.ok = result.ok && loaded && device.read_memory(kFlashStart, actual.data(), kFlashImageSize) &&
+                actual == flash;
+    result.timeouts += device.stats().failed_commands;
+
+    device.reset_stats();
+    DumpStats stats;
+    std::string path = "/tmp/dapico-autotune-bench.bin";
+    result.ok = result.ok && dump_memory(device, kFlashStart, kFlashImageSize, path, dump, stats) == kTransportOk;
+    result.dump_ms = device.stats().elapsed_us / 1000.0;
+    result.timeouts += device.stats().failed_commands;
+    std::remove(path.c_str());
+    return result;
+}
+
+void print_run(const char *label, const RunResult &run, const RunResult *baseline) {
+    std::printf("  %-9s RAM %7.1f ms  flash %7.1f ms  dump %7.1f ms  %u timeouts", label, run.ram_ms, run.flash_ms,
+                run.dump_ms, run.timeouts);
+    if (baseline) {
+        double before = baseline->ram_ms + baseline->flash_ms + baseline->dump_ms;
+        std::printf("  %.2fx", before / (run.ram_ms + run.flash_ms + run.dump_ms));
+    }
+    std::printf("%s\n", run.ok ? "" : "  MISMATCH");
+}
+
+bool same_profile(const TransferProfile &a, const TransferProfile &b) {
+    return a.product_id == b.product_id && a.host == b.host && a.ram_write_chunk == b.ram_write_chunk &&
+           a.flash_write_chunk == b.flash_write_chunk && a.read_chunk == b.read_chunk &&
+           a.timeouts.data_fixed_ms == b.timeouts.data_fixed_ms;
+}
+
+bool run_link(const char *name, const SimDeviceProfile &profile, const std::string &profile_path) {
+    SimulatedDevice device(profile);
+    AutotuneResult tuned;
+    auto now_us = [&device] { return device.stats().elapsed_us; };
+    if (autotune_transfers(device, profile.product_id, AutotuneOptions{}, now_us, tuned) != kTransportOk) {
+        return false;
+    }
+    tuned.profile.host = kSimulatedProfileHost;
+    std::printf("%s: sweep %.1f ms; RAM writes %u, flash writes %u, reads %u bytes; timeout %u ms + %.2f ms/KiB\n",
+                name, device.stats().elapsed_us / 1000.0, tuned.profile.ram_write_chunk,
+                tuned.profile.flash_write_chunk, tuned.profile.read_chunk, tuned.profile.timeouts.data_fixed_ms,
+                tuned.profile.timeouts.data_ms_per_kib);
+
+    store_transfer_profile(profile_path, tuned.profile);
+    std::vector<TransferProfile> stored = read_transfer_profiles(profile_path);
+    const TransferProfile *reread = find_transfer_profile(stored, profile.product_id, kSimulatedProfileHost);
+    bool ok = reread && same_profile(*reread, tuned.profile);
+
+    RunResult defaults = run_loads(profile, nullptr);
+    RunResult with_profile = run_loads(profile, reread ? reread : &tuned.profile);
+    print_run("built-in", defaults, nullptr);
+    print_run("tuned", with_profile, &defaults);
+    return ok && defaults.ok && with_profile.ok && with_profile.timeouts == 0;
+}
+} // namespace
+
+int main() {
+    std::string profile_path = "/tmp/dapico-autotune-bench.profiles";
+    std::remove(profile_path.c_str());
+
+    SimDeviceProfile hub = sim_profile_rp2350();
+    hub.link.out_curve = {{256, 250}, {1024, 600}, {4096, 900}, {8192, 950}, {16384, 700}, {65536, 420}};
+    hub.link.in_curve = {{256, 280}, {2048, 800}, {16384, 1050}, {65536, 1000}};
+
+    bool ok = run_link("rp2040, direct", sim_profile_rp2040(), profile_path);
+    ok = run_link("rp2350, hub   ", hub, profile_path) && ok;
+    size_t profiles = read_transfer_profiles(profile_path).size();
+    std::printf("%zu profiles in %s\n", profiles, profile_path.c_str());
+    std::remove(profile_path.c_str());
+    return ok && profiles == 2 ? 0 : 1;
+}
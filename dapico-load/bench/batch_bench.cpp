@@ -0,0 +1,187 @@
+// Batch dry run over a CI-sized build directory: 300 unstripped ELF variants
+// (128-576 KiB of flash each, plus 1 MiB of debug sections), every 50th one
+// without an entry point, and 20 latest-*.elf links to builds already in the
+// set. The serial baseline checks one file per invocation, as a CI loop of
+// `dapico-load --dryrun` does, without the process start it would also pay;
+// that cost is reported apart, as the median time to spawn /usr/bin/true.
+// The time per stage (parsing, page building, cost estimate) for the corpus
+// is then broken down, and validate_images runs with 1, 2, 4 and 8 worker
+// threads (median of 5 each, page cache warm), checking every result.
+
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch_dryrun.h"
+#include "bench_util.h"
+#include "cost_model.h"
+#include "load_image.h"
+#include "load_plan.h"
+
+extern char **environ;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kVariants = 300;
+constexpr uint32_t kLinks = 20;
+constexpr uint32_t kBrokenEvery = 50;
+constexpr size_t kDebugBytes = 1024 * 1024;
+constexpr int kRounds = 5;
+constexpr int kSpawns = 50;
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+std::string variant_name(const std::string &dir, uint32_t i) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "/variant-%03u/app.elf", i);
+    return dir + name;
+}
+
+// Writes the corpus and returns its directory.
+std::string write_corpus() {
+    char dir_template[] = "/tmp/dapico-batch-bench-XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        std::perror("mkdtemp");
+        std::exit(1);
+    }
+    std::string dir = dir_template;
+    for (uint32_t i = 0; i < kVariants; ++i) {
+        std::string path = variant_name(dir, i);
+        mkdir(path.substr(0, path.rfind('/')).c_str(), 0755);
+        std::vector<uint8_t> flash = synthetic_payload((128 + 64 * (i % 8)) * 1024, i);
+        uint32_t entry = i % kBrokenEvery == kBrokenEvery - 1 ? 0 : kFlashStart + 0x101;
+        std::string elf = synthetic_elf({{kFlashStart, flash}}, entry, kDebugBytes);
+        std::ofstream(path, std::ios::binary).write(elf.data(), static_cast<std::streamsize>(elf.size()));
+    }
+    for (uint32_t i = 0; i < kLinks; ++i) {
+        char link[64];
+        std::snprintf(link, sizeof(link), "/latest-%02u.elf", i);
+        // Multiples of 5 below 100 miss the broken variants (49, 99, ...).
+        std::string target = variant_name(dir, i * 5);
+        if (symlink(target.c_str(), (dir + link).c_str()) != 0) {
+            std::perror("symlink");
+            std::exit(1);
+        }
+    }
+    return dir;
+}
+
+void remove_corpus(const std::string &dir, const std::vector<std::string> &files) {
+    for (const auto &file : files) {
+        std::remove(file.c_str());
+    }
+    for (uint32_t i = 0; i < kVariants; ++i) {
+        std::string path = variant_name(dir, i);
+        rmdir(path.substr(0, path.rfind('/')).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+double spawn_ms() {
+    std::vector<double> times;
+    char *argv[] = {const_cast<char *>("true"), nullptr};
+    for (int i = 0; i < kSpawns; ++i) {
+        Clock::time_point start = Clock::now();
+        pid_t pid = 0;
+        int status = 0;
+        if (posix_spawnp(&pid, "true", nullptr, nullptr, argv, environ) != 0 || waitpid(pid, &status, 0) != pid) {
+            return -1;
+        }
+        times.push_back(elapsed_ms(start));
+    }
+    return median(times);
+}
+
+bool check_report(const BatchReport &report, size_t files) {
+    size_t failed = 0;
+    for (const auto &image : report.images) {
+        failed += !image.error.empty();
+    }
+    return report.images.size() == files && failed == kVariants / kBrokenEvery && report.parses == kVariants;
+}
+} // namespace
+
+int main() {
+    std::string dir = write_corpus();
+    std::vector<std::string> files = expand_batch_paths({dir});
+    DryrunOptions options;
+    options.allow_flash = true;
+    options.product_id = kProductIdRp2350UsbBoot;
+    CostModel model = cost_model_for_product(options.product_id, "");
+    MemoryLayout layout = memory_layout_for_product(options.product_id);
+    bool ok = files.size() == kVariants + kLinks;
+
+    // Warm the page cache, then one file per invocation.
+    validate_images(files, options, model, 1);
+    std::vector<double> serial;
+    for (int round = 0; round < kRounds; ++round) {
+        Clock::time_point start = Clock::now();
+        for (const auto &file : files) {
+            CostModel own_model = cost_model_for_product(options.product_id, "");
+            ok = validate_images({file}, options, own_model, 1).images.size() == 1 && ok;
+        }
+        serial.push_back(elapsed_ms(start));
+    }
+    double spawn = spawn_ms();
+
+    double parse_ms = 0;
+    double plan_ms = 0;
+    double estimate_ms = 0;
+    for (const auto &file : files) {
+        Clock::time_point start = Clock::now();
+        LoadImage image = open_load_image(file, options.product_id, options.image);
+        parse_ms += elapsed_ms(start);
+        start = Clock::now();
+        LoadPlan plan = build_load_plan(image.segments, image.entry_point, layout, true);
+        plan_ms += elapsed_ms(start);
+        start = Clock::now();
+        estimate_load_cost(plan, model, true);
+        estimate_ms += elapsed_ms(start);
+    }
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::printf("%zu files (%u variants, %u links), %u cores\n", files.size(), kVariants, kLinks, cores);
+    std::printf("one invocation per file %8.1f ms (+ %.2f ms to start each process: %.0f ms)\n", median(serial),
+                spawn, spawn * files.size());
+    std::printf("stages, one thread: parse %.1f ms, page building %.1f ms, estimate %.2f ms\n", parse_ms, plan_ms,
+                estimate_ms);
+
+    double one_thread_ms = 0;
+    for (unsigned threads : {1u, 2u, 4u, 8u}) {
+        std::vector<double> times;
+        for (int round = 0; round < kRounds; ++round) {
+            BatchReport report = validate_images(files, options, model, threads);
+            ok = check_report(report, files.size()) && ok;
+            times.push_back(report.elapsed_ms);
+        }
+        double ms = median(times);
+        if (threads == 1) {
+            one_thread_ms = ms;
+        }
+        double speedup = one_thread_ms / ms;
+        std::printf("batch, %u thread%s %8.1f ms  %5.2fx  efficiency %3.0f%%%s\n", threads, threads == 1 ? " " : "s",
+                    ms, speedup, speedup / std::min(threads, cores) * 100.0,
+                    threads > cores ? "  (more threads than cores)" : "");
+    }
+
+    remove_corpus(dir, files);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Deterministic pseudo-random firmware payload.
+inline std::vector<uint8_t> synthetic_payload(size_t size, uint32_t seed) {
+    std::vector<uint8_t> data(size);
+    uint32_t state = seed * 2654435761u + 1;
+    for (auto &byte : data) {
+        state = state * 1664525u + 1013904223u;
+        byte = static_cast<uint8_t>(state >> 24);
+    }
+    return data;
+}
+
+// Minimal little-endian ELF32 with one PT_LOAD segment per payload, followed by
+// `debug_bytes` of non-loadable data standing in for DWARF sections.
+inline std::string synthetic_elf(const std::vector<std::pair<uint32_t, std::vector<uint8_t>>> &segments,
+                                 uint32_t entry, size_t debug_bytes = 0) {
+    constexpr uint32_t kHeaderSize = 52;
+    constexpr uint32_t kPhEntrySize = 32;
+    auto put16 = [](std::string &out, size_t at, uint16_t v) {
+        out[at] = static_cast<char>(v);
+        out[at + 1] = static_cast<char>(v >> 8);
+    };
+    auto put32 = [](std::string &out, size_t at, uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            out[at + i] = static_cast<char>(v >> (8 * i));
+        }
+    };
+
+    uint32_t data_offset = kHeaderSize + kPhEntrySize * static_cast<uint32_t>(segments.size());
+    std::string out(data_offset, '\0');
+    out[0] = 0x7f;
+    out[1] = 'E';
+    out[2] = 'L';
+    out[3] = 'F';
+    out[4] = 1;
+    out[5] = 1;
+    out[6] = 1;
+    put16(out, 16, 2);
+    put16(out, 18, 40);
+    put32(out, 20, 1);
+    put32(out, 24, entry);
+    put32(out, 28, kHeaderSize);
+    put16(out, 40, kHeaderSize);
+    put16(out, 42, kPhEntrySize);
+    put16(out, 44, static_cast<uint16_t>(segments.size()));
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const auto &segment = segments[i];
+        size_t base = kHeaderSize + kPhEntrySize * i;
+        uint32_t size = static_cast<uint32_t>(segment.second.size());
+        put32(out, base + 0, 1);
+        put32(out, base + 4, static_cast<uint32_t>(out.size()));
+        put32(out, base + 8, segment.first);
+        put32(out, base + 12, segment.first);
+        put32(out, base + 16, size);
+        put32(out, base + 20, size);
+        put32(out, base + 24, 5);
+        put32(out, base + 28, 4);
+        out.append(reinterpret_cast<const char *>(segment.second.data()), size);
+    }
+    out.append(debug_bytes, '\x5a');
+    return out;
+}
+
+// UF2 file carrying `payload` at `addr` in 256-byte blocks. When `shuffle_seed`
+// is non-zero the blocks are written in a deterministic shuffled order.
+inline std::string synthetic_uf2(uint32_t addr, const std::vector<uint8_t> &payload, uint32_t family_id,
+                                 uint32_t shuffle_seed = 0) {
+    constexpr uint32_t kPayloadSize = 256;
+    uint32_t count = static_cast<uint32_t>((payload.size() + kPayloadSize - 1) / kPayloadSize);
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        order[i] = i;
+    }
+    uint32_t state = shuffle_seed;
+    for (uint32_t i = count; shuffle_seed != 0 && i > 1; --i) {
+        state = state * 1664525u + 1013904223u;
+        std::swap(order[i - 1], order[state % i]);
+    }
+
+    std::string out(static_cast<size_t>(count) * 512, '\0');
+    for (uint32_t n = 0; n < count; ++n) {
+        uint32_t block = order[n];
+        uint32_t offset = block * kPayloadSize;
+        uint32_t size = std::min<uint32_t>(kPayloadSize, static_cast<uint32_t>(payload.size()) - offset);
+        const uint32_t header[8] = {0x0a324655, 0x9e5d5157, 0x00002000, addr + offset, kPayloadSize,
+                                    block,      count,      family_id};
+        char *dst = &out[static_cast<size_t>(n) * 512];
+        std::memcpy(dst, header, sizeof(header));
+        std::memcpy(dst + 32, payload.data() + offset, size);
+        const uint32_t magic_end = 0x0ab16f30;
+        std::memcpy(dst + 508, &magic_end, sizeof(magic_end));
+    }
+    return out;
+}
+
+// Intel HEX text for `payload` at `addr`: extended linear address records at
+// every 64 KiB boundary, `record_size`-byte data records and an EOF record.
+inline std::string synthetic_ihex(uint32_t addr, const std::vector<uint8_t> &payload, uint32_t record_size) {
+    static const char kDigits[] = "0123456789ABCDEF";
+    std::string out;
+    out.reserve(payload.size() * 2 + payload.size() / record_size * 12 + 64);
+    auto record = [&](uint8_t type, uint16_t offset, const uint8_t *data, uint32_t size) {
+        uint8_t header[4] = {static_cast<uint8_t>(size), static_cast<uint8_t>(offset >> 8),
+                             static_cast<uint8_t>(offset), type};
+        uint8_t sum = 0;
+        out.push_back(':');
+        auto put = [&](uint8_t byte) {
+            out.push_back(kDigits[byte >> 4]);
+            out.push_back(kDigits[byte & 0xf]);
+            sum += byte;
+        };
+        for (uint8_t byte : header) {
+            put(byte);
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            put(data[i]);
+        }
+        put(static_cast<uint8_t>(-sum));
+        out.push_back('\n');
+    };
+
+    uint32_t upper = ~0u;
+    for (uint32_t offset = 0; offset < payload.size(); offset += record_size) {
+        uint32_t target = addr + offset;
+        if (target >> 16 != upper) {
+            upper = target >> 16;
+            const uint8_t value[2] = {static_cast<uint8_t>(upper >> 8), static_cast<uint8_t>(upper)};
+            record(0x04, 0, value, 2);
+        }
+        uint32_t size = std::min<uint32_t>(record_size, static_cast<uint32_t>(payload.size()) - offset);
+        record(0x00, static_cast<uint16_t>(target), payload.data() + offset, size);
+    }
+    record(0x01, 0, nullptr, 0);
+    return out;
+}
@@ -0,0 +1,330 @@
+// Chunk store over 20 successive builds of a 1 MiB flash image. Each build
+// inserts 16-512 bytes of code at a random point (moving everything after it),
+// changes eight scattered literal words and rewrites a 32-byte build-info
+// block; the last 64 KiB (assets) never change. Reported: bytes stored in
+// memory by content-defined chunks against fixed 4 KiB blocks and against
+// keeping every build whole; the same on disk, apparent and allocated; add()
+// throughput (chunking and SHA-256); reconstruction throughput for load(),
+// which hands out chunk spans, against copying the chunks back into one
+// buffer, and plan building from either; and version-to-version change lists.
+// Every version is checked to plan the same flash pages as the original,
+// again after reopening the store from disk, and after pruning all but the
+// last five versions; a failed chunk write must leave nothing in the store.
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "chunk_store.h"
+#include "load_image.h"
+#include "load_plan.h"
+#include "sha256.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kImageSize = 1024 * 1024;
+constexpr uint32_t kAssetSize = 64 * 1024;
+constexpr uint32_t kBuildInfo = 0x100;
+constexpr int kVersions = 20;
+constexpr int kKept = 5;
+constexpr int kRounds = 20;
+constexpr double kMiB = 1024.0 * 1024.0;
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+std::vector<std::vector<uint8_t>> successive_builds() {
+    std::vector<uint8_t> code = synthetic_payload(kImageSize - kAssetSize, 1);
+    std::vector<uint8_t> assets = synthetic_payload(kAssetSize, 2);
+    uint32_t state = 12345;
+    auto next = [&state](uint32_t bound) {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) % bound;
+    };
+    std::vector<std::vector<uint8_t>> builds;
+    for (int version = 0; version < kVersions; ++version) {
+        if (version > 0) {
+            std::vector<uint8_t> inserted = synthetic_payload(16 + next(497), 100 + version);
+            code.insert(code.begin() + kBuildInfo + 32 + next(static_cast<uint32_t>(code.size()) / 2), inserted.begin(),
+                        inserted.end());
+            code.resize(kImageSize - kAssetSize);
+            for (int i = 0; i < 8; ++i) {
+                uint32_t word = next(static_cast<uint32_t>(code.size()) - 4) & ~3u;
+                uint32_t value = kFlashStart + next(kImageSize);
+                std::memcpy(code.data() + word, &value, sizeof(value));
+            }
+        }
+        std::vector<uint8_t> info = synthetic_payload(32, 1000 + version);
+        std::copy(info.begin(), info.end(), code.begin() + kBuildInfo);
+        std::vector<uint8_t> build = code;
+        build.insert(build.end(), assets.begin(), assets.end());
+        builds.push_back(std::move(build));
+    }
+    return builds;
+}
+
+LoadImage flat_image(const std::vector<uint8_t> &bytes) {
+    LoadImage image;
+    image.segments.push_back(ImageSegment{kFlashStart, bytes.data(), static_cast<uint32_t>(bytes.size())});
+    image.entry_point = kFlashStart + 0x101;
+    return image;
+}
+
+bool same_flash(const LoadImage &a, const LoadImage &b) {
+    MemoryLayout layout = memory_layout_for_product(kProductIdRp2350UsbBoot);
+    LoadPlan plan_a = build_load_plan(a.segments, a.entry_point, layout, true);
+    LoadPlan plan_b = build_load_plan(b.segments, b.entry_point, layout, true);
+    if (plan_a.flash_extents.size() != plan_b.flash_extents.size() || plan_a.entry_point != plan_b.entry_point) {
+        return false;
+    }
+    for (size_t i = 0; i < plan_a.flash_extents.size(); ++i) {
+        if (plan_a.flash_extents[i].addr != plan_b.flash_extents[i].addr ||
+            plan_a.flash_extents[i].data != plan_b.flash_extents[i].data) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct DiskUsage {
+    uint64_t apparent = 0;
+    uint64_t allocated = 0;
+    uint32_t files = 0;
+};
+
+void disk_usage(const std::string &path, DiskUsage &usage) {
+    struct stat st {};
+    if (::lstat(path.c_str(), &st) != 0) {
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        usage.apparent += static_cast<uint64_t>(st.st_size);
+        usage.allocated += static_cast<uint64_t>(st.st_blocks) * 512;
+        usage.files++;
+        return;
+    }
+    DIR *dir = ::opendir(path.c_str());
+    while (const dirent *entry = dir ? ::readdir(dir) : nullptr) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            disk_usage(path + "/" + name, usage);
+        }
+    }
+    if (dir) {
+        ::closedir(dir);
+    }
+}
+
+void remove_tree(const std::string &path) {
+    DIR *dir = ::opendir(path.c_str());
+    while (const dirent *entry = dir ? ::readdir(dir) : nullptr) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string child = path + "/" + name;
+        struct stat st {};
+        if (::lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            remove_tree(child);
+        } else {
+            std::remove(child.c_str());
+        }
+    }
+    if (dir) {
+        ::closedir(dir);
+    }
+    ::rmdir(path.c_str());
+}
+} // namespace
+
+int main() {
+    std::vector<std::vector<uint8_t>> builds = successive_builds();
+    uint64_t raw_bytes = 0;
+    for (const auto &build : builds) {
+        raw_bytes += build.size();
+    }
+    bool ok = true;
+
+    // Fixed 4 KiB blocks, for comparison.
+    std::set<Sha256Digest> blocks;
+    for (const auto &build : builds) {
+        for (size_t offset = 0; offset < build.size(); offset += kFlashSectorSize) {
+            blocks.insert(sha256(build.data() + offset, kFlashSectorSize));
+        }
+    }
+
+    char dir_template[] = "/tmp/dapico-chunk-bench-XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = dir_template;
+    std::vector<ChunkedImage> versions;
+    double add_ms = 0;
+    {
+        // The directory store keeps nothing in memory after add(); the same
+        // builds in an in-memory store give the memory figures.
+        ChunkStore store(dir + "/store");
+        ChunkStore in_memory;
+        for (int version = 0; version < kVersions; ++version) {
+            LoadImage image = flat_image(builds[version]);
+            Clock::time_point start = Clock::now();
+            versions.push_back(store.add(image));
+            add_ms += elapsed_ms(start);
+            store.save_manifest("v" + std::to_string(version), versions.back());
+            in_memory.add(image);
+        }
+        ok = ok && store.chunk_count() == 0 && store.stored_bytes() == 0;
+
+        size_t refs = 0;
+        for (const auto &version : versions) {
+            refs += version.segments.front().chunks.size();
+        }
+        std::printf("%d builds of 1 MiB, %.1f MiB in all\n", kVersions, raw_bytes / kMiB);
+        std::printf("memory: whole builds %.2f MiB, 4 KiB blocks %.2f MiB (%zu), content-defined chunks %.2f MiB "
+                    "(%zu, %.0f bytes average) + %.1f KiB of chunk lists: %.1fx smaller\n",
+                    raw_bytes / kMiB, blocks.size() * kFlashSectorSize / kMiB, blocks.size(),
+                    in_memory.stored_bytes() / kMiB, in_memory.chunk_count(),
+                    static_cast<double>(in_memory.stored_bytes()) / in_memory.chunk_count(),
+                    refs * sizeof(ChunkRef) / 1024.0,
+                    static_cast<double>(raw_bytes) / (in_memory.stored_bytes() + refs * sizeof(ChunkRef)));
+        std::printf("add: %.0f MiB/s (chunking and SHA-256, writing chunk files)\n", raw_bytes / kMiB / (add_ms / 1000));
+
+        // Reconstruction from the mapped chunk files.
+        double spans_ms = 0;
+        double copy_ms = 0;
+        double plan_spans_ms = 0;
+        double plan_flat_ms = 0;
+        MemoryLayout layout = memory_layout_for_product(kProductIdRp2350UsbBoot);
+        std::vector<uint8_t> buffer(kImageSize);
+        for (int round = 0; round < kRounds; ++round) {
+            for (int version = 0; version < kVersions; ++version) {
+                Clock::time_point start = Clock::now();
+                LoadImage image = store.load(versions[version]);
+                spans_ms += elapsed_ms(start);
+
+                start = Clock::now();
+                uint8_t *out = buffer.data();
+                for (const auto &segment : image.segments) {
+                    std::memcpy(out, segment.data, segment.size);
+                    out += segment.size;
+                }
+                copy_ms += elapsed_ms(start);
+
+                start = Clock::now();
+                LoadPlan from_spans = build_load_plan(image.segments, image.entry_point, layout, true);
+                plan_spans_ms += elapsed_ms(start);
+                start = Clock::now();
+                LoadImage flat = flat_image(builds[version]);
+                LoadPlan from_flat = build_load_plan(flat.segments, flat.entry_point, layout, true);
+                plan_flat_ms += elapsed_ms(start);
+                ok = ok && from_spans.flash_page_count() == from_flat.flash_page_count();
+            }
+        }
+        double handed_out = raw_bytes / kMiB * kRounds / 1024.0;
+        std::printf("reconstruct: chunk spans %.1f GiB/s (%.1f us per build), copied into one buffer %.1f GiB/s\n",
+                    handed_out / (spans_ms / 1000), spans_ms * 1000 / (kRounds * kVersions),
+                    handed_out / (copy_ms / 1000));
+        std::printf("plan flash pages: from chunk spans %.2f ms, from one buffer %.2f ms per build\n",
+                    plan_spans_ms / (kRounds * kVersions), plan_flat_ms / (kRounds * kVersions));
+
+        // Change lists.
+        double diff_ms = 0;
+        uint64_t changed = 0;
+        uint64_t added = 0;
+        for (int version = 1; version < kVersions; ++version) {
+            Clock::time_point start = Clock::now();
+            ChunkDiff diff = diff_chunked_images(versions[version - 1], versions[version]);
+            diff_ms += elapsed_ms(start);
+            changed += diff.changed_bytes;
+            added += diff.new_bytes;
+        }
+        std::printf("changes between builds: %.0f KiB rewritten at new addresses, %.1f KiB of new chunks on "
+                    "average, %.1f us each\n",
+                    changed / 1024.0 / (kVersions - 1), added / 1024.0 / (kVersions - 1),
+                    diff_ms * 1000 / (kVersions - 1));
+
+        for (int version = 0; version < kVersions; ++version) {
+            ok = same_flash(store.load(versions[version]), flat_image(builds[version])) && ok;
+        }
+    }
+
+    // Disk, against every build kept as a raw binary.
+    DiskUsage chunked;
+    disk_usage(dir + "/store", chunked);
+    std::string raw_dir = dir + "/raw";
+    ::mkdir(raw_dir.c_str(), 0755);
+    for (int version = 0; version < kVersions; ++version) {
+        std::ofstream(raw_dir + "/v" + std::to_string(version) + ".bin", std::ios::binary)
+            .write(reinterpret_cast<const char *>(builds[version].data()), kImageSize);
+    }
+    DiskUsage raw;
+    disk_usage(raw_dir, raw);
+    std::printf("disk: raw builds %.2f MiB apparent, %.2f MiB allocated; chunk store %.2f MiB apparent, %.2f MiB "
+                "allocated in %u files\n",
+                raw.apparent / kMiB, raw.allocated / kMiB, chunked.apparent / kMiB, chunked.allocated / kMiB,
+                chunked.files);
+
+    // Reopened from disk: manifests read back, chunks mapped from their files.
+    {
+        ChunkStore store(dir + "/store");
+        for (int version = 0; version < kVersions; ++version) {
+            ChunkedImage read = store.read_manifest("v" + std::to_string(version));
+            ok = same_flash(store.load(read), flat_image(builds[version])) && ok;
+        }
+        std::vector<const ChunkedImage *> keep;
+        for (int version = kVersions - kKept; version < kVersions; ++version) {
+            keep.push_back(&versions[version]);
+        }
+        size_t dropped = store.prune(keep);
+        for (int version = kVersions - kKept; version < kVersions; ++version) {
+            ok = same_flash(store.load(versions[version]), flat_image(builds[version])) && ok;
+        }
+        bool old_gone = false;
+        try {
+            store.load(versions[0]);
+        } catch (const std::runtime_error &) {
+            old_gone = true;
+        }
+        DiskUsage pruned;
+        disk_usage(dir + "/store/chunks", pruned);
+        std::printf("prune to the last %d builds: %zu chunks dropped, %u chunk files and %.2f MiB left\n", kKept,
+                    dropped, pruned.files, pruned.apparent / kMiB);
+        ok = ok && old_gone && dropped > 0;
+    }
+
+    // A file where the first chunk's subdirectory belongs makes its write
+    // fail; the store must not keep the chunk.
+    {
+        ChunkStore store(dir + "/broken");
+        uint32_t first = content_chunk_sizes(builds[0].data(), builds[0].size()).front();
+        std::string blocker = dir + "/broken/chunks/" + sha256_hex(sha256(builds[0].data(), first)).substr(0, 2);
+        std::ofstream(blocker).put('x');
+        bool thrown = false;
+        try {
+            store.add(flat_image(builds[0]));
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        std::printf("failed chunk write: %s, %zu chunks left in the store\n", thrown ? "thrown" : "not thrown",
+                    store.chunk_count());
+        ok = ok && thrown && store.chunk_count() == 0 && store.stored_bytes() == 0;
+    }
+
+    remove_tree(dir);
+    return ok ? 0 : 1;
+}
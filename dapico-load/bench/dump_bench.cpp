@@ -0,0 +1,144 @@
+// Dumping a 16 MiB RP2350 flash to a sparse file from a SimulatedDevice holding
+// 2 MiB of firmware and a 1 MiB filesystem region with erased gaps. Compares
+// sector-sized reads, one at a time, against 64 KiB reads queued ahead of the
+// writer, and the 64-bit-lane erased check against a byte loop. Device time is
+// simulated; host time and the erased check are wall time.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "flash_dump.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "sim_device.h"
+
+namespace {
+constexpr uint32_t kDumpSize = 16 * 1024 * 1024;
+constexpr uint32_t kFirmwareSize = 2 * 1024 * 1024;
+constexpr uint32_t kFilesystemOffset = 8 * 1024 * 1024;
+constexpr uint32_t kFilesystemSize = 1024 * 1024;
+constexpr int kScanRounds = 20;
+constexpr double kMiB = 1024.0 * 1024.0;
+
+double elapsed_s(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool byte_loop_erased(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Firmware, then a filesystem where every fourth 4 KiB block is erased.
+void program_device(SimulatedDevice &device) {
+    std::vector<uint8_t> firmware = synthetic_payload(kFirmwareSize, 1);
+    std::vector<uint8_t> filesystem = synthetic_payload(kFilesystemSize, 2);
+    for (uint32_t block = 0; block < kFilesystemSize; block += 4 * kDumpBlockSize) {
+        std::fill(filesystem.begin() + block, filesystem.begin() + block + kDumpBlockSize, 0xff);
+    }
+    std::vector<ImageSegment> segments = {
+        {kFlashStart, firmware.data(), kFirmwareSize},
+        {kFlashStart + kFilesystemOffset, filesystem.data(), kFilesystemSize},
+    };
+    LoadOptions options;
+    options.exec_after = false;
+    load_plan_to_device(device, build_load_plan(segments, 0, device.profile().layout, true), options);
+    device.reset_stats();
+}
+
+// The dump matches the device, with erased blocks either holes (zeros) or 0xff.
+bool dump_matches(const SimulatedDevice &device, const std::string &path, bool holes) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> dumped((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<uint8_t> expected(kDumpSize);
+    if (dumped.size() != kDumpSize || !device.read_memory(kFlashStart, expected.data(), kDumpSize)) {
+        return false;
+    }
+    for (uint32_t block = 0; block < kDumpSize; block += kDumpBlockSize) {
+        const uint8_t *want = expected.data() + block;
+        const uint8_t *got = dumped.data() + block;
+        bool erased = holes && byte_loop_erased(want, kDumpBlockSize);
+        for (uint32_t i = 0; i < kDumpBlockSize; ++i) {
+            if (got[i] != (erased ? 0 : want[i])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool run(const char *label, const DumpOptions &options, const std::string &path, double &device_s) {
+    SimulatedDevice device(sim_profile_rp2350());
+    program_device(device);
+    DumpStats stats;
+    bool ok = dump_memory(device, kFlashStart, kDumpSize, path, options, stats) == kTransportOk &&
+              dump_matches(device, path, options.erased_as_holes);
+    struct stat st {};
+    ::stat(path.c_str(), &st);
+    device_s = device.stats().elapsed_us / 1e6;
+    std::printf("%-26s %5u reads  device %6.2f s %5.2f MiB/s  host %6.3f s  %6.2f MiB allocated of %.0f%s\n", label,
+                stats.reads, device_s, kDumpSize / kMiB / device_s, stats.elapsed_s, st.st_blocks * 512.0 / kMiB,
+                kDumpSize / kMiB, ok ? "" : "  MISMATCH");
+    return ok;
+}
+} // namespace
+
+int main() {
+    char path_template[] = "/tmp/dapico-dump-XXXXXX";
+    int fd = ::mkstemp(path_template);
+    if (fd < 0) {
+        std::perror("mkstemp");
+        return 1;
+    }
+    ::close(fd);
+    const std::string path = path_template;
+
+    std::printf("16 MiB RP2350 flash dump: %u KiB firmware, %u KiB filesystem (1 in 4 blocks erased)\n",
+                kFirmwareSize / 1024, kFilesystemSize / 1024);
+    DumpOptions sector_reads;
+    sector_reads.read_size = kFlashSectorSize;
+    sector_reads.queue_depth = 1;
+    sector_reads.erased_as_holes = false;
+    DumpOptions large_reads;
+    double sector_s = 0;
+    double large_s = 0;
+    bool ok = run("4 KiB reads, dense", sector_reads, path, sector_s);
+    ok = run("64 KiB reads x4, sparse", large_reads, path, large_s) && ok;
+    std::printf("large reads %.2fx faster on the link\n", sector_s / large_s);
+
+    std::vector<uint8_t> erased(kDumpSize, 0xff);
+    auto start = std::chrono::steady_clock::now();
+    size_t blocks = 0;
+    for (int round = 0; round < kScanRounds; ++round) {
+        for (uint32_t block = 0; block < kDumpSize; block += kDumpBlockSize) {
+            blocks += is_erased(erased.data() + block, kDumpBlockSize);
+        }
+    }
+    double lanes_s = elapsed_s(start);
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kScanRounds; ++round) {
+        for (uint32_t block = 0; block < kDumpSize; block += kDumpBlockSize) {
+            blocks += byte_loop_erased(erased.data() + block, kDumpBlockSize);
+        }
+    }
+    double bytes_s = elapsed_s(start);
+    double scanned = static_cast<double>(kDumpSize) * kScanRounds;
+    std::printf("erased check: %.1f GB/s (byte loop %.1f GB/s), %zu blocks\n", scanned / lanes_s / 1e9,
+                scanned / bytes_s / 1e9, blocks);
+
+    ::unlink(path.c_str());
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+// Reading an unstripped ELF: the whole file slurped into memory (the old
+// reader) against positioned reads of just the headers and PT_LOAD bytes.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "byte_source.h"
+#include "elf/elf.h"
+#include "load_plan.h"
+
+namespace {
+constexpr uint32_t kLoadableSize = 2 * 1024 * 1024;
+constexpr int kRounds = 5;
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string write_temp_file(const std::string &contents) {
+    std::string path = "/tmp/dapico-elf-bench-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0 || write(fd, contents.data(), contents.size()) != static_cast<ssize_t>(contents.size())) {
+        std::perror("temp file");
+        std::exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+// The old reader: size the file, read all of it, then parse from memory.
+class WholeFileReader : public elf_reader {
+public:
+    explicit WholeFileReader(const std::string &path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        data_.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char *>(data_.data()), static_cast<std::streamsize>(data_.size()));
+    }
+
+    bool read_at(uint64_t offset, uint8_t *out, size_t size) override {
+        if (offset + size > data_.size()) {
+            return false;
+        }
+        std::memcpy(out, data_.data() + offset, size);
+        return true;
+    }
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+size_t loadable_bytes(const elf_file &elf) {
+    size_t total = 0;
+    for (const auto &segment : elf_image_segments(elf)) {
+        total += segment.size;
+    }
+    return total;
+}
+
+void bench_file(size_t debug_bytes) {
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> segments;
+    segments.emplace_back(kFlashStart, synthetic_payload(kLoadableSize, 11));
+    std::string path = write_temp_file(synthetic_elf(segments, kFlashStart + 0x100, debug_bytes));
+    size_t file_size = kLoadableSize + debug_bytes;
+
+    double slurp_ms = 1e9;
+    double pread_ms = 1e9;
+    uint64_t pread_bytes = 0;
+    for (int round = 0; round < kRounds; ++round) {
+        auto start = std::chrono::steady_clock::now();
+        WholeFileReader whole_file(path);
+        elf_file slurped;
+        slurped.read(whole_file);
+        size_t slurped_loadable = loadable_bytes(slurped);
+        slurp_ms = std::min(slurp_ms, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        PreadElfReader reader(path);
+        elf_file selective;
+        selective.read(reader);
+        size_t selective_loadable = loadable_bytes(selective);
+        pread_ms = std::min(pread_ms, elapsed_ms(start));
+        pread_bytes = reader.bytes_read();
+
+        if (slurped_loadable != selective_loadable) {
+            std::fprintf(stderr, "loadable size mismatch\n");
+            std::exit(1);
+        }
+    }
+    std::remove(path.c_str());
+
+    std::printf("%3zu MiB file  whole file %7.2f ms (%3zu MiB read)  selective %6.2f ms (%.2f MiB read)  %.1fx\n",
+                file_size >> 20, slurp_ms, file_size >> 20, pread_ms, pread_bytes / 1048576.0, slurp_ms / pread_ms);
+}
+} // namespace
+
+int main() {
+    std::printf("2 MiB loadable ELF with growing debug info (best of %d, warm page cache)\n", kRounds);
+    for (size_t debug_mib : {0, 30, 78}) {
+        bench_file(debug_mib * 1024 * 1024);
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Loading a 1 MiB flash image on a simulated RP2040 while the host keeps
+// probing the BOOTSEL drive: a 4 KiB read every 20 ms, one access in 200 being
+// a write. Shared, the reads compete with the load for the link and a write
+// makes the next flash command fail with INTERLEAVED_WRITE, so the load is
+// retried until it gets through. With EXCLUSIVE the drive only answers
+// not-ready; with EXCLUSIVE_AND_EJECT the host stops asking. Each mode is
+// timed over every attempt, checked against the image, and compared with the
+// same load on an idle link. Device time is simulated.
+
+#include <cstdio>
+#include <vector>
+
+#include "bench_util.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "sim_device.h"
+
+namespace {
+constexpr uint32_t kFirmwareSize = 1024 * 1024;
+constexpr int kMaxAttempts = 50;
+
+struct ModeResult {
+    int attempts = 0;
+    double device_ms = 0;
+    bool ok = false;
+};
+
+ModeResult run_mode(const SimDeviceProfile &profile, const LoadPlan &plan, const std::vector<uint8_t> &firmware,
+                    picoboot_exclusive_type exclusive, SimStats &stats) {
+    SimulatedDevice device(profile);
+    LoadOptions options;
+    options.exec_after = false;
+    options.exclusive = exclusive;
+    ModeResult result;
+    while (result.attempts < kMaxAttempts && !result.ok) {
+        result.attempts++;
+        result.ok = load_plan_to_device(device, plan, options) == kTransportOk;
+    }
+    std::vector<uint8_t> actual(firmware.size());
+    result.ok = result.ok && device.read_memory(kFlashStart, actual.data(), kFirmwareSize) && actual == firmware &&
+                device.exclusive() == NOT_EXCLUSIVE;
+    result.device_ms = device.stats().elapsed_us / 1000.0;
+    stats = device.stats();
+    return result;
+}
+} // namespace
+
+int main() {
+    std::vector<uint8_t> firmware = synthetic_payload(kFirmwareSize, 1);
+    SimDeviceProfile idle = sim_profile_rp2040();
+    std::vector<ImageSegment> segments = {{kFlashStart, firmware.data(), kFirmwareSize}};
+    LoadPlan plan = build_load_plan(segments, kFlashStart + 0x100, idle.layout, true);
+
+    SimDeviceProfile busy = idle;
+    busy.mass_storage.interval_us = 20000;
+    busy.mass_storage.read_bytes = 4096;
+    busy.mass_storage.write_every = 200;
+
+    SimStats stats;
+    ModeResult baseline = run_mode(idle, plan, firmware, EXCLUSIVE, stats);
+    double kib = kFirmwareSize / 1024.0;
+    std::printf("idle link, EXCLUSIVE     %2d attempts  device %7.1f ms  %6.1f KiB/s%s\n", baseline.attempts,
+                baseline.device_ms, kib * 1000.0 / baseline.device_ms, baseline.ok ? "" : "  MISMATCH");
+
+    struct Mode {
+        const char *name;
+        picoboot_exclusive_type type;
+    };
+    const Mode modes[] = {
+        {"busy drive, shared      ", NOT_EXCLUSIVE},
+        {"busy drive, EXCLUSIVE   ", EXCLUSIVE},
+        {"busy drive, EJECT       ", EXCLUSIVE_AND_EJECT},
+    };
+    bool ok = baseline.ok;
+    double shared_ms = 0;
+    for (const auto &mode : modes) {
+        ModeResult result = run_mode(busy, plan, firmware, mode.type, stats);
+        if (mode.type == NOT_EXCLUSIVE) {
+            shared_ms = result.device_ms;
+        }
+        std::printf("%s%2d attempts  device %7.1f ms  %6.1f KiB/s  %3u drive accesses, %3u refused  %.2fx%s\n",
+                    mode.name, result.attempts, result.device_ms, kib * 1000.0 / result.device_ms, stats.msd_accesses,
+                    stats.msd_refused, shared_ms / result.device_ms, result.ok ? "" : "  MISMATCH");
+        ok = ok && result.ok;
+    }
+    return ok ? 0 : 1;
+}
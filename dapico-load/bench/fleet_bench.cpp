@@ -0,0 +1,188 @@
+// Putting a simulated rack of 24 boards into BOOTSEL: two hubs of 12 boards,
+// each running an application with the stdio_usb reset interface. A reset
+// request takes a 1 ms control transfer. The board then drops off the bus and
+// comes back in BOOTSEL after a pseudo-random 40-250 ms. The one-board-at-a-time
+// loop (find the board, reboot it, wait for it) is compared against
+// reboot_fleet, which sends every request at once and polls one enumeration
+// for all of them. Both report reboot-to-ready percentiles and the wall time
+// for the rack. Also checks that a hub's location filter selects its 12 boards.
+// Times are wall-clock.
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fleet_reboot.h"
+#include "load_plan.h"
+#include "pico/usb_reset_interface.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kHubs = 2;
+constexpr uint32_t kBoardsPerHub = 12;
+constexpr uint32_t kHubLocation = 0x14100000;
+constexpr auto kControlRequest = std::chrono::milliseconds(1);
+constexpr uint32_t kMinDelayMs = 40;
+constexpr uint32_t kMaxDelayMs = 250;
+
+class SimRack {
+public:
+    SimRack() {
+        uint32_t state = 12345;
+        for (uint32_t hub = 0; hub < kHubs; ++hub) {
+            for (uint32_t port = 0; port < kBoardsPerHub; ++port) {
+                Board board;
+                board.identity.product_id = kProductIdRp2040StdioUsb;
+                board.identity.location = kHubLocation + (hub << 20) + ((port + 1) << 16);
+                char serial[17];
+                std::snprintf(serial, sizeof(serial), "E6605838%08X", hub * kBoardsPerHub + port);
+                board.identity.serial = serial;
+                state = state * 1664525u + 1013904223u;
+                board.delay = std::chrono::milliseconds(kMinDelayMs + (state >> 8) % (kMaxDelayMs - kMinDelayMs));
+                boards_.push_back(std::move(board));
+            }
+        }
+        for (size_t i = 0; i < boards_.size(); ++i) {
+            ports_.emplace_back(*this, i);
+        }
+    }
+
+    size_t size() const { return boards_.size(); }
+    const UsbDeviceIdentity &identity(size_t index) const { return boards_[index].identity; }
+    ResetInterfaceTransport *reset_port(size_t index) { return &ports_[index]; }
+
+    std::vector<UsbDeviceIdentity> enumerate() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Clock::time_point now = Clock::now();
+        std::vector<UsbDeviceIdentity> present;
+        for (auto &board : boards_) {
+            if (board.rebooting && now >= board.back_at) {
+                board.rebooting = false;
+                board.identity.product_id = kProductIdRp2040UsbBoot;
+            }
+            if (!board.rebooting) {
+                present.push_back(board.identity);
+            }
+        }
+        return present;
+    }
+
+    bool all_in_bootsel() {
+        for (const auto &identity : enumerate()) {
+            if (identity.product_id != kProductIdRp2040UsbBoot) {
+                return false;
+            }
+        }
+        return enumerate().size() == boards_.size();
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &board : boards_) {
+            board.rebooting = false;
+            board.identity.product_id = kProductIdRp2040StdioUsb;
+        }
+    }
+
+private:
+    struct Board {
+        UsbDeviceIdentity identity;
+        std::chrono::milliseconds delay{0};
+        bool rebooting = false;
+        Clock::time_point back_at;
+    };
+
+    class ResetPort : public ResetInterfaceTransport {
+    public:
+        ResetPort(SimRack &rack, size_t index) : rack_(rack), index_(index) {}
+
+        TransportResult reset_request(uint8_t request, uint16_t value) override {
+            (void)value;
+            std::this_thread::sleep_for(kControlRequest);
+            if (request != RESET_REQUEST_BOOTSEL) {
+                return kTransportError;
+            }
+            std::lock_guard<std::mutex> lock(rack_.mutex_);
+            Board &board = rack_.boards_[index_];
+            board.rebooting = true;
+            board.back_at = Clock::now() + board.delay;
+            return kTransportOk;
+        }
+
+    private:
+        SimRack &rack_;
+        size_t index_;
+    };
+
+    std::mutex mutex_;
+    std::vector<Board> boards_;
+    std::vector<ResetPort> ports_;
+};
+
+FleetDevice fleet_device(SimRack &rack, size_t index) {
+    const UsbDeviceIdentity &identity = rack.identity(index);
+    return FleetDevice{identity, RebootTarget{identity.product_id, nullptr, rack.reset_port(index)}};
+}
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+bool report(const char *label, const std::vector<FleetRebootResult> &results, double wall_ms, SimRack &rack) {
+    LatencySummary summary = summarize_fleet_latency(results);
+    bool ok = summary.count == rack.size() && rack.all_in_bootsel();
+    std::printf("%s %2zu ready  p50 %5.1f ms  p90 %5.1f ms  p99 %5.1f ms  max %5.1f ms  rack %7.1f ms%s\n", label,
+                summary.count, summary.p50_ms, summary.p90_ms, summary.p99_ms, summary.max_ms, wall_ms,
+                ok ? "" : "  MISSING");
+    return ok;
+}
+} // namespace
+
+int main() {
+    SimRack rack;
+    UsbEnumerator enumerate = [&rack] { return rack.enumerate(); };
+    FleetRebootOptions options;
+    options.bootsel = true;
+    options.wait = true;
+
+    DeviceFilter hub;
+    hub.location = kHubLocation + (1u << 20);
+    size_t selected = 0;
+    for (const auto &identity : rack.enumerate()) {
+        selected += hub.matches(identity);
+    }
+    std::printf("%zu boards on %u hubs; location filter 0x%08x selects %zu\n", rack.size(), kHubs, hub.location,
+                selected);
+
+    Clock::time_point start = Clock::now();
+    std::vector<FleetRebootResult> sequential;
+    for (size_t i = 0; i < rack.size(); ++i) {
+        // What a shell loop over dapico-reboot does: enumerate, pick the board, reboot it, wait.
+        DeviceFilter board;
+        board.serial = rack.identity(i).serial;
+        for (const auto &identity : rack.enumerate()) {
+            if (board.matches(identity)) {
+                auto results = reboot_fleet({fleet_device(rack, i)}, options, enumerate);
+                sequential.insert(sequential.end(), results.begin(), results.end());
+            }
+        }
+    }
+    double sequential_ms = elapsed_ms(start);
+    bool ok = report("one at a time", sequential, sequential_ms, rack);
+
+    rack.reset();
+    std::vector<FleetDevice> fleet;
+    for (size_t i = 0; i < rack.size(); ++i) {
+        fleet.push_back(fleet_device(rack, i));
+    }
+    start = Clock::now();
+    std::vector<FleetRebootResult> concurrent = reboot_fleet(fleet, options, enumerate);
+    double concurrent_ms = elapsed_ms(start);
+    ok = report("concurrent   ", concurrent, concurrent_ms, rack) && ok;
+    std::printf("%.1fx faster for the rack\n", sequential_ms / concurrent_ms);
+    return ok && selected == kBoardsPerHub ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+// Intel HEX decode throughput: the word-at-a-time decoder used by
+// open_load_image against a conventional character-by-character parser.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "ihex.h"
+#include "load_plan.h"
+
+namespace {
+constexpr uint32_t kImageSize = 16 * 1024 * 1024;
+constexpr int kRounds = 5;
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int nibble(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    throw std::runtime_error("invalid hex digit");
+}
+
+// Reference decoder in the style of most HEX tools: one character at a time,
+// checksum accumulated as each byte is read, data copied into a flat image.
+std::vector<uint8_t> scalar_decode(const std::string &text, uint32_t base_addr, size_t image_size) {
+    std::vector<uint8_t> image(image_size, 0xff);
+    uint32_t upper = 0;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        if (text[pos] != ':') {
+            throw std::runtime_error("expected record mark");
+        }
+        ++pos;
+        auto read_byte = [&]() {
+            int value = nibble(text[pos]) << 4 | nibble(text[pos + 1]);
+            pos += 2;
+            return static_cast<uint8_t>(value);
+        };
+        uint8_t length = read_byte();
+        uint8_t addr_hi = read_byte();
+        uint8_t addr_lo = read_byte();
+        uint8_t type = read_byte();
+        uint8_t sum = length + addr_hi + addr_lo + type;
+        uint8_t data[256];
+        for (uint8_t i = 0; i < length; ++i) {
+            data[i] = read_byte();
+            sum += data[i];
+        }
+        sum += read_byte();
+        if (sum != 0) {
+            throw std::runtime_error("checksum mismatch");
+        }
+        while (pos < text.size() && (text[pos] == '\r' || text[pos] == '\n')) {
+            ++pos;
+        }
+        if (type == 0x01) {
+            break;
+        }
+        if (type == 0x04) {
+            upper = static_cast<uint32_t>(data[0] << 8 | data[1]) << 16;
+        } else if (type == 0x00) {
+            uint32_t addr = upper + (addr_hi << 8 | addr_lo) - base_addr;
+            std::memcpy(image.data() + addr, data, length);
+        }
+    }
+    return image;
+}
+
+void bench_records(uint32_t record_size, const std::vector<uint8_t> &payload) {
+    std::string text = synthetic_ihex(kFlashStart, payload, record_size);
+    const auto *chars = reinterpret_cast<const uint8_t *>(text.data());
+
+    double fast_ms = 1e9;
+    double scalar_ms = 1e9;
+    std::vector<uint8_t> decoded;
+    std::vector<ImageSegment> segments;
+    std::vector<uint8_t> reference;
+    for (int round = 0; round < kRounds; ++round) {
+        auto start = std::chrono::steady_clock::now();
+        uint32_t entry_point = 0;
+        segments = intel_hex_image_segments(chars, text.size(), decoded, entry_point);
+        fast_ms = std::min(fast_ms, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        reference = scalar_decode(text, kFlashStart, payload.size());
+        scalar_ms = std::min(scalar_ms, elapsed_ms(start));
+    }
+
+    bool match = segments.size() == 1 && segments[0].addr == kFlashStart && segments[0].size == payload.size() &&
+                 std::memcmp(segments[0].data, payload.data(), payload.size()) == 0 && reference == payload;
+    double text_mb = text.size() / 1e6;
+    std::printf("%3u-byte records  %6.1f MB text  word-at-a-time %7.2f ms (%5.2f GB/s)  scalar %7.2f ms "
+                "(%5.2f GB/s)  %.1fx%s\n",
+                record_size, text_mb, fast_ms, text_mb / fast_ms, scalar_ms, text_mb / scalar_ms, scalar_ms / fast_ms,
+                match ? "" : "  MISMATCH");
+}
+} // namespace
+
+int main() {
+    std::vector<uint8_t> payload = synthetic_payload(kImageSize, 3);
+    std::printf("Intel HEX decode of a 16 MiB image (best of %d)\n", kRounds);
+    for (uint32_t record_size : {16u, 32u, 255u}) {
+        bench_records(record_size, payload);
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+// End-to-end load benchmark: synthetic ELF -> parse -> plan -> full PICOBOOT
+// session against SimulatedDevice. Reported times are simulated link/flash
+// time, not host wall time. Also registered as a CTest test: it fails if a
+// load does not read back, or if the command counts drift from what the image
+// size alone calls for.
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "cost_model.h"
+#include "elf/elf.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "sim_device.h"
+
+namespace {
+struct LoadCase {
+    const char *flags;
+    bool allow_flash;
+    bool exec_after;
+};
+
+const LoadCase kCases[] = {
+    {"(ram)", false, true},
+    {"--no-exec", false, false},
+    {"--flash", true, true},
+    {"--flash --no-exec", true, false},
+};
+
+const uint32_t kImageSizes[] = {4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+
+std::string format_size(uint32_t bytes) {
+    if (bytes >= 1024 * 1024) {
+        return std::to_string(bytes / (1024 * 1024)) + " MiB";
+    }
+    return std::to_string(bytes / 1024) + " KiB";
+}
+
+bool verify_plan(const SimulatedDevice &device, const LoadPlan &plan) {
+    std::vector<uint8_t> readback;
+    for (const auto &segment : plan.ram_segments) {
+        readback.resize(segment.size);
+        if (!device.read_memory(segment.addr, readback.data(), segment.size) ||
+            std::memcmp(readback.data(), segment.data, segment.size) != 0) {
+            return false;
+        }
+    }
+    for (const auto &extent : plan.flash_extents) {
+        readback.resize(extent.data.size());
+        if (!device.read_memory(extent.addr, readback.data(), static_cast<uint32_t>(readback.size())) ||
+            readback != extent.data) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Commands a load of `image_size` bytes should take: 1 KiB RAM writes or
+// 256-byte flash pages, one erase range, exclusive access and either the exec
+// or the release of exclusive access, plus exit XIP for flash.
+struct ExpectedCounts {
+    uint32_t commands;
+    uint32_t writes;
+    uint32_t erases;
+};
+
+ExpectedCounts expected_counts(uint32_t image_size, const LoadCase &load_case) {
+    if (!load_case.allow_flash) {
+        uint32_t writes = image_size / kRamWriteChunkSize;
+        return {writes + 2, writes, 0};
+    }
+    uint32_t writes = image_size / kFlashPageSize;
+    return {writes + 4, writes, 1};
+}
+
+// Returns false if the load, the read-back check or the command counts failed.
+bool run_case(const SimDeviceProfile &profile, uint32_t image_size, const LoadCase &load_case) {
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> segments;
+    segments.emplace_back(kFlashStart, synthetic_payload(image_size, image_size));
+    auto stream = std::make_shared<std::stringstream>(synthetic_elf(segments, kFlashStart + 0x100));
+
+    elf_file elf;
+    elf.read_file(stream);
+    LoadPlan plan = build_load_plan(elf_image_segments(elf), elf.header().entry, profile.layout,
+                                    load_case.allow_flash);
+
+    std::printf("%-8s %8s  %-18s", profile.name.c_str(), format_size(image_size).c_str(), load_case.flags);
+    if (plan.flash_extents.empty() && plan.ram_segments.empty()) {
+        std::printf(" skipped (does not fit in SRAM)\n");
+        return true;
+    }
+
+    LoadOptions options;
+    options.exec_after = load_case.exec_after;
+    if (options.exec_after && !resolve_exec_address(plan, profile.layout, load_case.allow_flash, options.exec_addr)) {
+        return false;
+    }
+
+    SimulatedDevice device(profile);
+    TransportResult ret = load_plan_to_device(device, plan, options);
+    bool verified = ret == kTransportOk && verify_plan(device, plan);
+    const SimStats &stats = device.stats();
+    double seconds = stats.elapsed_us / 1e6;
+    double predicted = estimate_load_cost(plan, cost_model_for_profile(profile), options.exec_after).predicted_ms;
+    ExpectedCounts expected = expected_counts(image_size, load_case);
+    bool counted = stats.commands == expected.commands && stats.count(PC_WRITE) == expected.writes &&
+                   stats.count(PC_FLASH_ERASE) == expected.erases;
+    std::printf(" %9.3f %9.3f %7u %7u %6u %5u %9.1f%s", seconds, predicted / 1000.0, stats.commands,
+                stats.count(PC_WRITE), stats.count(PC_FLASH_ERASE), stats.control_requests,
+                image_size / 1024.0 / seconds, verified ? "" : "  FAILED");
+    if (!counted) {
+        std::printf("  expected %u cmds, %u writes, %u erases", expected.commands, expected.writes, expected.erases);
+    }
+    std::printf("\n");
+    return verified && counted;
+}
+// Bootloader, application and filesystem image loaded as three separate
+// sessions (the old one-file-per-invocation flow) and as one merged session.
+bool run_multi_image(const SimDeviceProfile &profile) {
+    std::vector<uint8_t> boot = synthetic_payload(256, 1);
+    std::vector<uint8_t> app = synthetic_payload(512 * 1024, 2);
+    std::vector<uint8_t> data = synthetic_payload(256 * 1024, 3);
+    const std::vector<ImageSegment> images[] = {
+        {ImageSegment{kFlashStart, boot.data(), static_cast<uint32_t>(boot.size())}},
+        {ImageSegment{kFlashStart + 0x100, app.data(), static_cast<uint32_t>(app.size())}},
+        {ImageSegment{kFlashStart + 0x100000, data.data(), static_cast<uint32_t>(data.size())}},
+    };
+    const uint32_t entry = kFlashStart + 0x101;
+    LoadOptions options;
+    options.exec_addr = entry;
+
+    std::vector<ImageSegment> all;
+    SimulatedDevice sequential(profile);
+    for (size_t i = 0; i < 3; ++i) {
+        all.insert(all.end(), images[i].begin(), images[i].end());
+        options.exec_after = i == 2;
+        if (load_plan_to_device(sequential, build_load_plan(images[i], entry, profile.layout, true), options) !=
+            kTransportOk) {
+            return false;
+        }
+    }
+
+    LoadPlan merged = build_load_plan(all, entry, profile.layout, true);
+    SimulatedDevice combined(profile);
+    options.exec_after = true;
+    bool ok = load_plan_to_device(combined, merged, options) == kTransportOk && verify_plan(combined, merged) &&
+              sequential.stats().count(PC_FLASH_ERASE) == 3 && combined.stats().count(PC_FLASH_ERASE) == 2;
+
+    double sequential_s = sequential.stats().elapsed_us / 1e6;
+    double combined_s = combined.stats().elapsed_us / 1e6;
+    std::printf("%-8s 3 images (256 B + 512 KiB + 256 KiB): sequential %.3f s, %u erases%s; "
+                "one session %.3f s, %u erases; saves %.3f s%s\n",
+                profile.name.c_str(), sequential_s, sequential.stats().count(PC_FLASH_ERASE),
+                verify_plan(sequential, merged) ? "" : " (shared sector re-erased, bootloader lost)", combined_s,
+                combined.stats().count(PC_FLASH_ERASE), sequential_s - combined_s, ok ? "" : "  FAILED");
+    return ok;
+}
+} // namespace
+
+int main() {
+    std::printf("%-8s %8s  %-18s %9s %9s %7s %7s %6s %5s %9s\n", "chip", "image", "flags", "sim_s", "model_s",
+                "cmds", "writes", "erases", "ctrl", "KiB/s");
+    bool ok = true;
+    for (const auto &profile : {sim_profile_rp2040(), sim_profile_rp2350()}) {
+        for (uint32_t size : kImageSizes) {
+            for (const auto &load_case : kCases) {
+                ok = run_case(profile, size, load_case) && ok;
+            }
+        }
+    }
+    std::printf("\n");
+    for (const auto &profile : {sim_profile_rp2040(), sim_profile_rp2350()}) {
+        ok = run_multi_image(profile) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+// Metrics for a simulated flashing station. First, LogHistogram::observe is
+// timed with 1, 4 and 8 threads recording into one histogram, against the
+// same buckets behind a mutex. Then a station of 16 ports loads 1 MiB of
+// flash 8 times per port through MeteredTransport, shared (no exclusive
+// access), with --retries 2. On four ports the host keeps probing the BOOTSEL
+// drive and writes to it at its own rate, so flash commands fail with
+// INTERLEAVED_WRITE and loads are retried; the simulator is deterministic, so
+// each port fails or recovers the same way every time. The textfile is
+// written after every load, read back, and its totals, failure counts and
+// per-port success ratios checked. Last, what the meter adds to each command
+// in host time (median of 15 loads each way). Device time is simulated.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "metrics.h"
+#include "sim_device.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kObservations = 4000000;
+constexpr uint32_t kImageSize = 1024 * 1024;
+constexpr uint32_t kPorts = 16;
+constexpr uint32_t kBusyPorts = 4;
+constexpr uint32_t kLoadsPerPort = 8;
+constexpr uint32_t kRetries = 2;
+constexpr int kRounds = 15;
+
+class MutexHistogram {
+public:
+    void observe(uint64_t value) {
+        size_t i = value <= 1 ? 0 : 64 - static_cast<size_t>(__builtin_clzll(value - 1));
+        std::lock_guard<std::mutex> lock(mutex_);
+        buckets_[std::min(i, LogHistogram::kBuckets)]++;
+        count_++;
+        sum_ += value;
+    }
+    uint64_t count() const { return count_; }
+
+private:
+    std::mutex mutex_;
+    std::array<uint64_t, LogHistogram::kBuckets + 1> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+};
+
+// Nanoseconds per observation with `threads` threads sharing the histogram.
+template <typename Histogram>
+double time_observe(Histogram &histogram, unsigned threads) {
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&histogram, threads, t] {
+            uint32_t state = t + 1;
+            for (uint64_t i = 0; i < kObservations / threads; ++i) {
+                state = state * 1664525u + 1013904223u;
+                histogram.observe(state >> 12);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / kObservations;
+}
+
+// The value of the exposition line starting with `series`, or -1.
+double series_value(const std::string &text, const std::string &series) {
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, series.size() + 1, series + " ") == 0) {
+            return std::stod(line.substr(series.size() + 1));
+        }
+    }
+    return -1;
+}
+
+uint32_t port_location(uint32_t port) {
+    return 0x14100000u + ((port + 1) << 16);
+}
+} // namespace
+
+int main() {
+    bool ok = true;
+    std::printf("observe, %llu values\n", static_cast<unsigned long long>(kObservations));
+    for (unsigned threads : {1u, 4u, 8u}) {
+        LogHistogram lock_free;
+        MutexHistogram locked;
+        double lock_free_ns = time_observe(lock_free, threads);
+        double locked_ns = time_observe(locked, threads);
+        uint64_t expected = kObservations / threads * threads;
+        ok = ok && lock_free.count() == expected && locked.count() == expected;
+        std::printf("  %u thread%s  lock-free %6.2f ns  mutex %6.2f ns\n", threads, threads == 1 ? " " : "s",
+                    lock_free_ns, locked_ns);
+    }
+
+    std::vector<uint8_t> firmware = synthetic_payload(kImageSize, 3);
+    std::vector<ImageSegment> segments = {{kFlashStart, firmware.data(), kImageSize}};
+    SimDeviceProfile idle = sim_profile_rp2040();
+    LoadPlan plan = build_load_plan(segments, kFlashStart, idle.layout, true);
+
+    LoaderMetrics metrics;
+    LoadOptions options;
+    options.exec_after = false;
+    options.exclusive = NOT_EXCLUSIVE;
+    std::string path = "/tmp/dapico-metrics-bench.prom";
+    uint32_t failed = 0;
+    uint32_t retried = 0;
+    double export_us = 0;
+    for (uint32_t round = 0; round < kLoadsPerPort; ++round) {
+        for (uint32_t port = 0; port < kPorts; ++port) {
+            SimDeviceProfile profile = idle;
+            if (port < kBusyPorts) {
+                // Each busy port's host writes to the drive at its own rate.
+                profile.mass_storage.interval_us = 20000;
+                profile.mass_storage.read_bytes = 4096;
+                profile.mass_storage.write_every = 50 * (port + 1);
+            }
+            SimulatedDevice device(profile);
+            MeteredTransport metered(device, metrics, [&device] { return device.stats().elapsed_us; });
+            TransportResult ret = kTransportOk;
+            for (uint32_t attempt = 0;; ++attempt) {
+                ret = load_plan_to_device(metered, plan, options);
+                if (ret == kTransportOk || attempt == kRetries) {
+                    break;
+                }
+                metrics.retries.fetch_add(1, std::memory_order_relaxed);
+                retried++;
+                metered.reset_interface();
+            }
+            failed += ret != kTransportOk;
+            metrics.record_load(port_location(port), ret == kTransportOk, device.stats().elapsed_us);
+            Clock::time_point start = Clock::now();
+            write_prometheus_textfile(path, metrics);
+            export_us += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        }
+    }
+
+    std::ifstream in(path);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::remove(path.c_str());
+    uint32_t loads = kPorts * kLoadsPerPort;
+    double ok_loads = series_value(text, "dapico_loads_total{result=\"ok\"}");
+    double interleaved = series_value(text, "dapico_command_failures_total{status=\"INTERLEAVED_WRITE\"}");
+    double write_count = series_value(text, "dapico_command_duration_seconds_count{command=\"write\"}");
+    std::printf("station: %u loads on %u ports (%u with a busy drive), %u retries, %u failed after %u retries\n",
+                loads, kPorts, kBusyPorts, retried, failed, kRetries);
+    std::printf("  textfile %zu bytes, %.1f us per export; %.0f ok, %.0f INTERLEAVED_WRITE, %.0f writes timed\n",
+                text.size(), export_us / loads, ok_loads, interleaved, write_count);
+    std::printf("  success ratio by port:");
+    double lowest = 1.0;
+    for (uint32_t port = 0; port < kPorts; ++port) {
+        char series[96];
+        std::snprintf(series, sizeof(series), "dapico_location_success_ratio{location=\"0x%08x\"}",
+                      port_location(port));
+        double ratio = series_value(text, series);
+        std::printf(" %.2f", ratio);
+        ok = ok && (port < kBusyPorts || ratio == 1.0);
+        lowest = std::min(lowest, ratio);
+    }
+    std::printf("\n");
+    ok = ok && ok_loads == loads - failed && interleaved == retried + failed && lowest < 1.0 &&
+         series_value(text, "dapico_load_retries_total") == retried && write_count > 0;
+
+    // What the meter costs a load on the host.
+    std::vector<double> plain_ms;
+    std::vector<double> metered_ms;
+    options.exclusive = EXCLUSIVE;
+    for (int round = 0; round < kRounds; ++round) {
+        SimulatedDevice plain_device(idle);
+        Clock::time_point start = Clock::now();
+        ok = load_plan_to_device(plain_device, plan, options) == kTransportOk && ok;
+        plain_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+        SimulatedDevice device(idle);
+        MeteredTransport metered(device, metrics, [&device] { return device.stats().elapsed_us; });
+        start = Clock::now();
+        ok = load_plan_to_device(metered, plan, options) == kTransportOk && ok;
+        metered_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    std::sort(plain_ms.begin(), plain_ms.end());
+    std::sort(metered_ms.begin(), metered_ms.end());
+    double added_ms = metered_ms[kRounds / 2] - plain_ms[kRounds / 2];
+    SimulatedDevice timing(idle);
+    ok = load_plan_to_device(timing, plan, options) == kTransportOk && ok;
+    std::printf("meter: %.0f ns host time per command, %.4f%% of a %.0f ms load's device time\n",
+                added_ms * 1e6 / timing.stats().commands, added_ms / (timing.stats().elapsed_us / 1000.0) * 100.0,
+                timing.stats().elapsed_us / 1000.0);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+// Serializing 1000 units with a unique 256-byte calibration/serial block each:
+// generating, parsing and planning a per-board ELF for every unit versus one
+// shared plan with a per-device PatchOverlay. Both flows load every unit into
+// a SimulatedDevice; host time is wall time, device time is simulated.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "block_hash.h"
+#include "elf/elf.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "patch_overlay.h"
+#include "sim_device.h"
+
+namespace {
+constexpr uint32_t kImageSize = 1024 * 1024;
+constexpr uint32_t kCalibrationOffset = 0x80000;
+constexpr uint32_t kCalibrationSize = 256;
+constexpr uint32_t kUnits = 1000;
+constexpr uint64_t kFirstSerial = 0x5e71a1000000ull;
+
+double elapsed_s(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The unit's calibration block: serial number followed by per-board trim values.
+std::vector<uint8_t> calibration_block(uint32_t unit) {
+    std::vector<uint8_t> block = synthetic_payload(kCalibrationSize, unit + 7);
+    DevicePatch serial = serial_patch(0, kFirstSerial + unit, 8);
+    std::memcpy(block.data(), serial.bytes.data(), serial.bytes.size());
+    return block;
+}
+
+LoadPlan plan_elf(const std::string &elf_bytes, const MemoryLayout &layout, elf_file &elf) {
+    elf.read_file(std::make_shared<std::stringstream>(elf_bytes));
+    return build_load_plan(elf_image_segments(elf), elf.header().entry, layout, true);
+}
+
+bool unit_has_block(const SimulatedDevice &device, uint32_t unit) {
+    std::vector<uint8_t> readback(kCalibrationSize);
+    return device.read_memory(kFlashStart + kCalibrationOffset, readback.data(), kCalibrationSize) &&
+           readback == calibration_block(unit);
+}
+
+struct FlowResult {
+    double host_s = 0;
+    double device_s = 0;
+    bool ok = true;
+};
+
+void report(const char *label, const FlowResult &result) {
+    double per_unit_s = (result.host_s + result.device_s) / kUnits;
+    std::printf("%-22s host %8.3f ms/unit  device %6.3f s/unit  %7.1f units/hour%s\n", label,
+                result.host_s * 1000.0 / kUnits, result.device_s / kUnits, 3600.0 / per_unit_s,
+                result.ok ? "" : "  FAILED");
+}
+} // namespace
+
+int main() {
+    const SimDeviceProfile profile = sim_profile_rp2040();
+    const std::vector<uint8_t> firmware = synthetic_payload(kImageSize, 1);
+    LoadOptions options;
+    options.exec_addr = kFlashStart + 0x101;
+
+    // Old flow: a per-board ELF, parsed and planned for every unit.
+    FlowResult per_elf;
+    for (uint32_t unit = 0; unit < kUnits; ++unit) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<uint8_t> board = firmware;
+        std::vector<uint8_t> block = calibration_block(unit);
+        std::memcpy(board.data() + kCalibrationOffset, block.data(), block.size());
+        std::string elf_bytes = synthetic_elf({{kFlashStart, std::move(board)}}, options.exec_addr);
+        elf_file elf;
+        LoadPlan plan = plan_elf(elf_bytes, profile.layout, elf);
+        per_elf.host_s += elapsed_s(start);
+
+        SimulatedDevice device(profile);
+        per_elf.ok = load_plan_to_device(device, plan, options) == kTransportOk && unit_has_block(device, unit) &&
+                     per_elf.ok;
+        per_elf.device_s += device.stats().elapsed_us / 1e6;
+    }
+
+    // Overlay flow: one shared plan, a few hundred patched bytes per unit.
+    FlowResult overlay;
+    auto start = std::chrono::steady_clock::now();
+    elf_file elf;
+    const LoadPlan shared = plan_elf(synthetic_elf({{kFlashStart, firmware}}, options.exec_addr), profile.layout, elf);
+    overlay.host_s += elapsed_s(start);
+    const std::vector<uint8_t> &shared_flash = shared.flash_extents.front().data;
+    uint64_t shared_hash = hash_bytes(shared_flash.data(), shared_flash.size());
+    for (uint32_t unit = 0; unit < kUnits; ++unit) {
+        start = std::chrono::steady_clock::now();
+        PatchOverlay patches(shared, {DevicePatch{kFlashStart + kCalibrationOffset, calibration_block(unit)}});
+        overlay.host_s += elapsed_s(start);
+
+        SimulatedDevice device(profile);
+        options.patches = &patches;
+        overlay.ok = load_plan_to_device(device, shared, options) == kTransportOk && unit_has_block(device, unit) &&
+                     overlay.ok;
+        overlay.device_s += device.stats().elapsed_us / 1e6;
+    }
+    bool shared_intact = hash_bytes(shared_flash.data(), shared_flash.size()) == shared_hash;
+
+    std::printf("%u units, %u KiB image, %u-byte calibration block at 0x%08x (%s)\n", kUnits, kImageSize / 1024,
+                kCalibrationSize, kFlashStart + kCalibrationOffset, profile.name.c_str());
+    report("per-unit ELF + plan", per_elf);
+    report("shared plan + overlay", overlay);
+    std::printf("host preparation %.0fx faster; shared plan %s after %u units\n", per_elf.host_s / overlay.host_s,
+                shared_intact ? "unchanged" : "MODIFIED", kUnits);
+    return per_elf.ok && overlay.ok && shared_intact ? 0 : 1;
+}
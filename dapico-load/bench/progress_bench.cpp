@@ -0,0 +1,165 @@
+// Progress reporting cost and ETA accuracy for a 16 MiB flash load on the
+// simulated RP2350. The host time of the load (planning excluded; the
+// simulated device's memcpy and bookkeeping stand in for the USB stack) is
+// the median of 15 interleaved runs each: with no progress, with LoadCounters
+// only, with counters and a ProgressReporter writing JSON lines to /dev/null
+// at the default 200 ms and at 1 ms, and with a LoadProgress callback that
+// prints every write, as a per-page progress line would. Then the
+// ProgressEstimator is fed the counters every 200 ms of simulated device time
+// on a link that slows to half speed halfway through the writes, and its ETA
+// (the cost model's prediction at the start) is compared with the time the
+// load actually took.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include "bench_util.h"
+#include "cost_model.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "progress.h"
+#include "sim_device.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kImageSize = 16 * 1024 * 1024;
+constexpr int kRounds = 15;
+
+using Load = std::function<bool()>;
+// Adjusts the options, keeps what has to live for the duration, and runs `load`.
+using Setup = std::function<bool(LoadOptions &, const Load &)>;
+
+struct Variant {
+    const char *label;
+    Setup setup;
+    std::vector<double> times;
+};
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// Host milliseconds for one load.
+double time_load(const LoadPlan &plan, const Setup &setup, bool &ok) {
+    SimulatedDevice device(sim_profile_rp2350());
+    LoadOptions options;
+    options.exec_after = false;
+    Clock::time_point start = Clock::now();
+    ok = setup(options, [&] { return load_plan_to_device(device, plan, options) == kTransportOk; }) && ok;
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+} // namespace
+
+int main() {
+    std::vector<uint8_t> image = synthetic_payload(kImageSize, 7);
+    std::vector<ImageSegment> segments = {{kFlashStart, image.data(), kImageSize}};
+    SimDeviceProfile profile = sim_profile_rp2350();
+    LoadPlan plan = build_load_plan(segments, kFlashStart, profile.layout, true);
+    CostModel model = cost_model_for_profile(profile);
+    FILE *null_out = std::fopen("/dev/null", "w");
+    if (!null_out) {
+        return 1;
+    }
+
+    auto with_reporter = [&](uint32_t interval_ms) {
+        return [&, interval_ms](LoadOptions &options, const Load &load) {
+            LoadCounters counters;
+            options.counters = &counters;
+            ProgressReporter reporter(counters, progress_totals(plan, model, options), ProgressFormat::json, null_out,
+                                      interval_ms);
+            return load();
+        };
+    };
+    std::vector<Variant> variants = {
+        {"no progress", [](LoadOptions &, const Load &load) { return load(); }, {}},
+        {"counters only",
+         [](LoadOptions &options, const Load &load) {
+             LoadCounters counters;
+             options.counters = &counters;
+             return load();
+         },
+         {}},
+        {"counters + reporter, 200 ms", with_reporter(kProgressIntervalMs), {}},
+        {"counters + reporter, 1 ms", with_reporter(1), {}},
+        {"print every write",
+         [null_out](LoadOptions &options, const Load &load) {
+             options.progress = [null_out](LoadPhase phase, uint64_t done, uint64_t total) {
+                 std::fprintf(null_out, "%d %llu/%llu\n", static_cast<int>(phase),
+                              static_cast<unsigned long long>(done), static_cast<unsigned long long>(total));
+                 std::fflush(null_out);
+             };
+             return load();
+         },
+         {}},
+    };
+    // Interleaved, so drift in the host's speed hits every variant alike.
+    bool ok = true;
+    for (int round = 0; round < kRounds; ++round) {
+        for (auto &variant : variants) {
+            variant.times.push_back(time_load(plan, variant.setup, ok));
+        }
+    }
+    std::fclose(null_out);
+
+    std::printf("16 MiB flash load on the simulated rp2350, host time, median of %d\n", kRounds);
+    double baseline_ms = median(variants.front().times);
+    for (const auto &variant : variants) {
+        double ms = median(variant.times);
+        std::printf("%-30s %8.2f ms  %+6.2f%%\n", variant.label, ms, (ms / baseline_ms - 1.0) * 100.0);
+    }
+
+    // ETA on the simulated clock. The estimator is fed from the load's own
+    // thread here, since the simulated clock is not safe to read from another.
+    SimulatedDevice device(profile);
+    LoadCounters counters;
+    LoadOptions options;
+    options.exec_after = false;
+    options.counters = &counters;
+    ProgressTotals totals = progress_totals(plan, model, options);
+    ProgressEstimator estimator(totals);
+    struct Reading {
+        double at_s;
+        double fraction;
+        double eta_s;
+    };
+    std::vector<Reading> readings = {{0, 0, estimator.update(0, 0, 0, 0).eta_s}};
+    double next_s = 0.2;
+    bool slowed = false;
+    options.progress = [&](LoadPhase, uint64_t, uint64_t) {
+        double now_s = device.stats().elapsed_us / 1e6;
+        if (!slowed && counters.written.load(std::memory_order_relaxed) >= kImageSize / 2) {
+            // Another device on the hub starts streaming.
+            UsbLinkModel link = profile.link;
+            link.packet_us *= 2;
+            device.set_link(link);
+            slowed = true;
+        }
+        if (now_s >= next_s) {
+            ProgressSample sample = estimator.update(now_s, counters.erased.load(), counters.written.load(),
+                                                     counters.commands.load());
+            readings.push_back({now_s, sample.fraction, sample.eta_s});
+            next_s += 0.2;
+        }
+    };
+    ok = load_plan_to_device(device, plan, options) == kTransportOk && ok;
+    double total_s = device.stats().elapsed_us / 1e6;
+    std::printf("simulated load %.2f s; link at half speed from half the writes; %u of %u commands\n", total_s,
+                counters.commands.load(), totals.commands);
+    ok = ok && counters.commands.load() == totals.commands && counters.written.load() == totals.write_bytes;
+    for (double mark : {0.0, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9}) {
+        auto reading = std::find_if(readings.begin(), readings.end(),
+                                    [mark](const Reading &r) { return r.fraction >= mark; });
+        if (reading == readings.end()) {
+            continue;
+        }
+        double actual_s = total_s - reading->at_s;
+        std::printf("  %3.0f%% at %5.2f s: ETA %6.2f s, actual %6.2f s (%+5.1f%%)\n", reading->fraction * 100.0,
+                    reading->at_s, reading->eta_s, actual_s, (reading->eta_s / actual_s - 1.0) * 100.0);
+    }
+    return ok ? 0 : 1;
+}
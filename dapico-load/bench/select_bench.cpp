@@ -0,0 +1,199 @@
+// Picking one board out of a simulated registry of 50 USB devices: 30
+// Raspberry Pi boards in BOOTSEL, 6 running an application and 14 from other
+// vendors, in shuffled registry order. Each of the 30 BOOTSEL boards is
+// selected once by serial number, as a job runner handing boards to jobs would.
+// Three ways are compared: opening every BOOTSEL board and its PICOBOOT
+// interface to read the serial until the right one turns up; selecting on
+// registry metadata with a fresh walk each time; and selecting through
+// DeviceEnumerationCache, which walks once per process. Reading an entry's
+// properties is taken to cost 0.05 ms, opening a device 3 ms and an interface
+// 1 ms (representative, not measured); device time is simulated. Also checks
+// --location and --index picks, and that a board unplugged after the walk is
+// not opened from the stale cache.
+
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "device_select.h"
+#include "load_plan.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kBootselBoards = 30;
+constexpr size_t kApplicationBoards = 6;
+constexpr size_t kOtherDevices = 14;
+constexpr uint16_t kOtherVendorId = 0x05ac;
+constexpr double kPropertyReadMs = 0.05;
+constexpr double kDeviceOpenMs = 3.0;
+constexpr double kInterfaceOpenMs = 1.0;
+
+struct SimUsbDevice {
+    uint16_t vendor_id = 0;
+    UsbDeviceEntry entry;
+    bool present = true;
+};
+
+class SimRegistry {
+public:
+    SimRegistry() {
+        size_t total = kBootselBoards + kApplicationBoards + kOtherDevices;
+        for (size_t i = 0; i < total; ++i) {
+            SimUsbDevice device;
+            device.vendor_id = i < kBootselBoards + kApplicationBoards ? kVendorIdRaspberryPi : kOtherVendorId;
+            device.entry.identity.product_id = i < kBootselBoards ? kProductIdRp2040UsbBoot
+                                               : i < kBootselBoards + kApplicationBoards ? kProductIdRp2040StdioUsb
+                                                                                          : 0x8290;
+            // Three hubs of up to 17 ports on bus 0x14.
+            device.entry.identity.location = 0x14000000u + ((i / 17 + 1) << 20) + ((i % 17 + 1) << 16);
+            char serial[17];
+            std::snprintf(serial, sizeof(serial), "E6605838%08zX", i);
+            device.entry.identity.serial = serial;
+            device.entry.registry_id = 0x100000500ull + i;
+            devices_.push_back(device);
+        }
+        // Registry order has nothing to do with ports.
+        uint32_t state = 2024;
+        for (size_t i = devices_.size() - 1; i > 0; --i) {
+            state = state * 1664525u + 1013904223u;
+            std::swap(devices_[i], devices_[(state >> 8) % (i + 1)]);
+        }
+    }
+
+    const std::vector<SimUsbDevice> &devices() const { return devices_; }
+
+    // What the IOKit walk does: read each entry's properties, keep Raspberry Pi devices.
+    std::vector<UsbDeviceEntry> enumerate() {
+        std::vector<UsbDeviceEntry> entries;
+        for (const auto &device : devices_) {
+            device_ms += kPropertyReadMs;
+            if (device.present && device.vendor_id == kVendorIdRaspberryPi) {
+                entries.push_back(device.entry);
+            }
+        }
+        return entries;
+    }
+
+    // Opens the device and its PICOBOOT interface; fails for a board no longer on the bus.
+    std::optional<UsbDeviceIdentity> open(uint64_t registry_id) {
+        for (const auto &device : devices_) {
+            if (device.entry.registry_id == registry_id) {
+                if (!device.present) {
+                    return std::nullopt;
+                }
+                opens++;
+                device_ms += kDeviceOpenMs + kInterfaceOpenMs;
+                return device.entry.identity;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void unplug(const std::string &serial) {
+        for (auto &device : devices_) {
+            device.present = device.present && device.entry.identity.serial != serial;
+        }
+    }
+
+    double device_ms = 0;
+    unsigned opens = 0;
+
+private:
+    std::vector<SimUsbDevice> devices_;
+};
+
+// Open every BOOTSEL board in registry order and check its serial.
+std::optional<UsbDeviceIdentity> open_to_check(SimRegistry &registry, const DeviceFilter &filter) {
+    for (const auto &device : registry.devices()) {
+        registry.device_ms += kPropertyReadMs;
+        if (!device.present || device.vendor_id != kVendorIdRaspberryPi ||
+            !is_bootsel_product(device.entry.identity.product_id)) {
+            continue;
+        }
+        auto opened = registry.open(device.entry.registry_id);
+        if (opened && filter.matches(*opened)) {
+            return opened;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<UsbDeviceIdentity> select_fresh(SimRegistry &registry, const DeviceSelector &selector) {
+    if (auto entry = select_device(registry.enumerate(), selector, is_bootsel_product)) {
+        return registry.open(entry->registry_id);
+    }
+    return std::nullopt;
+}
+
+std::optional<UsbDeviceIdentity> select_cached(SimRegistry &registry, DeviceEnumerationCache &cache,
+                                               const DeviceSelector &selector) {
+    return cache.open_selected(selector, is_bootsel_product,
+                               [&](const UsbDeviceEntry &entry) { return registry.open(entry.registry_id); });
+}
+
+std::vector<std::string> bootsel_serials(const SimRegistry &registry) {
+    std::vector<std::string> serials;
+    for (const auto &device : registry.devices()) {
+        if (device.vendor_id == kVendorIdRaspberryPi && is_bootsel_product(device.entry.identity.product_id)) {
+            serials.push_back(device.entry.identity.serial);
+        }
+    }
+    return serials;
+}
+
+template <typename Select>
+bool run(const char *label, SimRegistry &registry, Select select) {
+    std::vector<std::string> serials = bootsel_serials(registry);
+    bool ok = true;
+    Clock::time_point start = Clock::now();
+    for (const auto &serial : serials) {
+        DeviceSelector selector;
+        selector.filter.serial = serial;
+        auto picked = select(registry, selector);
+        ok = ok && picked && picked->serial == serial;
+    }
+    double host_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    std::printf("%s %5.2f opens  device %6.2f ms  host %6.2f us per selection%s\n", label,
+                static_cast<double>(registry.opens) / serials.size(), registry.device_ms / serials.size(),
+                host_us / serials.size(), ok ? "" : "  WRONG DEVICE");
+    return ok;
+}
+} // namespace
+
+int main() {
+    std::printf("%zu devices in the registry, %zu BOOTSEL boards selected by serial\n",
+                kBootselBoards + kApplicationBoards + kOtherDevices, kBootselBoards);
+    SimRegistry checked;
+    bool ok = run("open to check    ", checked, [](SimRegistry &registry, const DeviceSelector &selector) {
+        return open_to_check(registry, selector.filter);
+    });
+    SimRegistry fresh;
+    ok = run("metadata, fresh  ", fresh, select_fresh) && ok;
+    SimRegistry registry;
+    DeviceEnumerationCache walk([&registry] { return registry.enumerate(); });
+    ok = run("metadata, cached ", registry, [&walk](SimRegistry &sim, const DeviceSelector &selector) {
+        return select_cached(sim, walk, selector);
+    }) && ok;
+
+    DeviceSelector hub;
+    hub.filter.location = 0x14200000;
+    std::vector<UsbDeviceEntry> on_hub = matching_devices(*walk.cached(), hub.filter, is_bootsel_product);
+    hub.index = on_hub.size() - 1;
+    auto last = select_cached(registry, walk, hub);
+    bool hub_ok = last && last->location == on_hub.back().identity.location;
+    std::printf("location 0x%08x: %zu BOOTSEL boards, --index %zu is 0x%08x%s\n", hub.filter.location, on_hub.size(),
+                hub.index, last ? last->location : 0, hub_ok ? "" : "  WRONG DEVICE");
+
+    DeviceSelector gone;
+    gone.filter.serial = last ? last->serial : "";
+    registry.unplug(gone.filter.serial);
+    size_t walks = walk.enumerations();
+    bool stale_ok = !select_cached(registry, walk, gone) && walk.enumerations() == walks + 1;
+    std::printf("unplugged board: %s after %zu fresh walk\n", stale_ok ? "not found" : "FOUND",
+                walk.enumerations() - walks);
+    return ok && hub_ok && stale_ok ? 0 : 1;
+}
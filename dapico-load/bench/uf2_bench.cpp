@@ -0,0 +1,98 @@
+// Host-side cost of loading a 16 MiB UF2: indexing the mapped file directly
+// versus the old workflow of converting it to an ELF first and loading that.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "load_image.h"
+#include "load_plan.h"
+#include "uf2.h"
+
+namespace {
+constexpr uint32_t kImageSize = 16 * 1024 * 1024;
+constexpr int kRounds = 5;
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string write_temp_file(const std::string &contents, const char *suffix) {
+    std::string path = std::string("/tmp/dapico-uf2-bench-XXXXXX") + suffix;
+    int fd = mkstemps(&path[0], static_cast<int>(std::strlen(suffix)));
+    if (fd < 0 || write(fd, contents.data(), contents.size()) != static_cast<ssize_t>(contents.size())) {
+        std::perror("temp file");
+        std::exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+// What a uf2-to-elf converter does: read the file, order the blocks, copy the
+// payloads into one contiguous segment and emit an ELF around it.
+std::string convert_uf2_to_elf(const std::string &filename, uint16_t product_id) {
+    std::ifstream file(filename, std::ios::binary);
+    std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<ImageSegment> blocks = uf2_image_segments(contents.data(), contents.size(), product_id);
+    uint32_t base = blocks.front().addr;
+    std::vector<uint8_t> flat(blocks.back().addr + blocks.back().size - base, 0xff);
+    for (const auto &block : blocks) {
+        std::memcpy(flat.data() + (block.addr - base), block.data, block.size);
+    }
+    return synthetic_elf({{base, std::move(flat)}}, vector_table_entry_point(blocks, product_id));
+}
+
+size_t plan_file(const std::string &filename, uint16_t product_id, const MemoryLayout &layout) {
+    LoadImage image = open_load_image(filename, product_id);
+    LoadPlan plan = build_load_plan(image.segments, image.entry_point, layout, true);
+    return plan.flash_page_count();
+}
+
+void bench_uf2(const char *label, const std::string &uf2) {
+    const MemoryLayout layout{kFlashEndRp2350, kSramEndRp2350};
+    std::string uf2_path = write_temp_file(uf2, ".uf2");
+
+    double direct_ms = 1e9;
+    double convert_ms = 1e9;
+    double elf_ms = 1e9;
+    size_t pages = 0;
+    for (int round = 0; round < kRounds; ++round) {
+        auto start = std::chrono::steady_clock::now();
+        pages = plan_file(uf2_path, kProductIdRp2350UsbBoot, layout);
+        direct_ms = std::min(direct_ms, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        std::string elf_path = write_temp_file(convert_uf2_to_elf(uf2_path, kProductIdRp2350UsbBoot), ".elf");
+        convert_ms = std::min(convert_ms, elapsed_ms(start));
+        start = std::chrono::steady_clock::now();
+        size_t elf_pages = plan_file(elf_path, kProductIdRp2350UsbBoot, layout);
+        elf_ms = std::min(elf_ms, elapsed_ms(start));
+        std::remove(elf_path.c_str());
+        if (elf_pages != pages) {
+            std::fprintf(stderr, "page count mismatch: %zu vs %zu\n", elf_pages, pages);
+            std::exit(1);
+        }
+    }
+    std::remove(uf2_path.c_str());
+
+    std::printf("%-10s %6zu pages  direct %7.2f ms  via ELF %7.2f ms (convert %.2f + load %.2f)  %.1fx\n", label,
+                pages, direct_ms, convert_ms + elf_ms, convert_ms, elf_ms, (convert_ms + elf_ms) / direct_ms);
+}
+} // namespace
+
+int main() {
+    std::vector<uint8_t> payload = synthetic_payload(kImageSize, 7);
+    std::printf("16 MiB UF2 -> flash plan (best of %d)\n", kRounds);
+    bench_uf2("in-order", synthetic_uf2(kFlashStart, payload, kUf2FamilyRp2350ArmSecure));
+    bench_uf2("shuffled", synthetic_uf2(kFlashStart, payload, kUf2FamilyRp2350ArmSecure, 12345));
+    return 0;
+}
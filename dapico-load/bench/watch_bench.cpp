@@ -0,0 +1,159 @@
+// Edit-build-run loop under --watch: a "linker" rewrites an ELF in several
+// writes, one code byte changing per build, and run_watch reloads it into a
+// SimulatedDevice. Latency runs from the last write to the end of the exec,
+// counting debounce and host time on the wall clock and device time on the
+// simulated clock. A RAM image and a 1 MiB flash image are measured.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "sim_device.h"
+#include "watch.h"
+
+namespace {
+constexpr size_t kRebuilds = 10;
+constexpr double kTargetMs = 200.0;
+constexpr auto kEditInterval = std::chrono::milliseconds(300);
+constexpr size_t kLinkerWrites = 4;
+constexpr auto kLinkerWriteGap = std::chrono::milliseconds(5);
+
+using Segments = std::vector<std::pair<uint32_t, std::vector<uint8_t>>>;
+
+// Writes the ELF the way a linker does: truncate, then several writes.
+void link(const std::string &path, const std::string &elf) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    size_t chunk = (elf.size() + kLinkerWrites - 1) / kLinkerWrites;
+    for (size_t offset = 0; offset < elf.size(); offset += chunk) {
+        if (::write(fd, elf.data() + offset, std::min(chunk, elf.size() - offset)) < 0) {
+            break;
+        }
+        std::this_thread::sleep_for(kLinkerWriteGap);
+    }
+    ::close(fd);
+}
+
+struct Scenario {
+    const char *label;
+    Segments segments;
+    uint32_t entry;
+    bool flash;
+};
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0 : values[values.size() / 2];
+}
+
+// Device time of loading the whole image into a blank device, for comparison.
+double full_load_ms(const Scenario &scenario, const SimDeviceProfile &profile) {
+    std::vector<ImageSegment> segments;
+    for (const auto &segment : scenario.segments) {
+        segments.push_back(ImageSegment{segment.first, segment.second.data(),
+                                        static_cast<uint32_t>(segment.second.size())});
+    }
+    LoadPlan plan = build_load_plan(segments, scenario.entry, profile.layout, scenario.flash);
+    SimulatedDevice device(profile);
+    LoadOptions options;
+    options.exec_addr = scenario.entry;
+    load_plan_to_device(device, plan, options);
+    return device.stats().elapsed_us / 1000.0;
+}
+
+bool run_scenario(Scenario scenario, const std::string &path, const SimDeviceProfile &profile) {
+    link(path, synthetic_elf(scenario.segments, scenario.entry));
+
+    std::thread linker([&scenario, &path] {
+        for (size_t build = 1; build <= kRebuilds; ++build) {
+            std::this_thread::sleep_for(kEditInterval);
+            std::vector<uint8_t> &code = scenario.segments.front().second;
+            code[(build * 7919) % code.size()] ^= 0x5a;
+            link(path, synthetic_elf(scenario.segments, scenario.entry));
+        }
+    });
+
+    SimulatedDevice device(profile);
+    WatchOptions options;
+    options.allow_flash = scenario.flash;
+        options.max_reloads = kRebuilds;
+    WatchEnvironment env;
+    env.product_id = profile.product_id;
+    env.acquire = [&device]() -> PicobootTransport * {
+        device.reconnect();
+        return &device;
+    };
+    env.device_us = [&device] { return device.stats().elapsed_us; };
+    std::vector<WatchCycle> cycles;
+    env.on_reload = [&cycles](const WatchCycle &cycle) { cycles.push_back(cycle); };
+    int ret = run_watch(path, options, env);
+    linker.join();
+
+    // The device must hold the last build, delta after delta.
+    bool ok = ret == 0 && cycles.size() == kRebuilds;
+    for (const auto &segment : scenario.segments) {
+        uint32_t addr = segment.first;
+        uint32_t mapped = addr;
+        if (!scenario.flash && !is_sram_address(addr, profile.layout)) {
+            map_flash_to_sram(addr, static_cast<uint32_t>(segment.second.size()), profile.layout, mapped);
+        }
+        std::vector<uint8_t> readback(segment.second.size());
+        ok = ok && device.read_memory(mapped, readback.data(), static_cast<uint32_t>(readback.size())) &&
+             readback == segment.second;
+    }
+
+    std::vector<double> latency, debounce, host, device_ms;
+    uint32_t sectors = 0;
+    for (const auto &cycle : cycles) {
+        latency.push_back(cycle.latency_ms);
+        debounce.push_back(cycle.debounce_ms);
+        host.push_back(cycle.host_ms);
+        device_ms.push_back(cycle.device_ms);
+        sectors = std::max(sectors, cycle.flash_sectors);
+    }
+    double worst = latency.empty() ? 0 : *std::max_element(latency.begin(), latency.end());
+    std::printf("\n%s: %zu reloads, latency median %.1f ms, max %.1f ms (debounce %.1f, host %.2f, device %.1f ms)\n",
+                scenario.label, cycles.size(), median(latency), worst, median(debounce), median(host), median(device_ms));
+    if (scenario.flash) {
+        std::printf("  up to %u flash sectors per reload; a full reload takes %.1f ms of device time\n", sectors,
+                    full_load_ms(scenario, profile));
+    } else {
+        std::printf("  target %.0f ms from linker exit to exec: %s\n", kTargetMs, worst < kTargetMs ? "met" : "MISSED");
+    }
+    std::printf("  device contents %s\n", ok ? "match the last build" : "DO NOT MATCH");
+    return ok;
+}
+} // namespace
+
+int main() {
+    char dir_template[] = "/tmp/dapico-watch-XXXXXX";
+    if (!::mkdtemp(dir_template)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = dir_template;
+    const std::string path = dir + "/app.elf";
+    const SimDeviceProfile profile = sim_profile_rp2040();
+
+    Scenario ram{"RAM image, 96 KiB code + 8 KiB data",
+                 {{kSramStart, synthetic_payload(96 * 1024, 1)}, {kSramStart + 0x20000, synthetic_payload(8192, 2)}},
+                 kSramStart + 0x101, false};
+    Scenario flash{"Flash image, 1 MiB",
+                   {{kFlashStart, synthetic_payload(1024 * 1024, 3)}, {kSramStart, synthetic_payload(4096, 4)}},
+                   kFlashStart + 0x101, true};
+    bool ok = run_scenario(ram, path, profile);
+    ok = run_scenario(flash, path, profile) && ok;
+
+    ::unlink(path.c_str());
+    ::rmdir(dir.c_str());
+    return ok ? 0 : 1;
+}
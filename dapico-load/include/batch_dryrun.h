@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cost_model.h"
+#include "dryrun.h"
+
+// Directories are searched recursively for *.elf, *.elf.gz, *.elf.zst, *.uf2
+// and *.hex files, sorted by path; other paths are taken as given. Throws
+// std::runtime_error if a directory cannot be read.
+std::vector<std::string> expand_batch_paths(const std::vector<std::string> &paths);
+
+struct BatchImageResult {
+    std::string filename;
+    // Why the image would not load; empty when it passes.
+    std::string error;
+    bool over_budget = false;
+    uint32_t entry_point = 0;
+    uint32_t exec_addr = 0;
+    CostEstimate estimate;
+};
+
+struct BatchReport {
+    // One per file, in the order given.
+    std::vector<BatchImageResult> images;
+    unsigned threads = 0;
+    // Files parsed; links to one build and files named twice are parsed once.
+    size_t parses = 0;
+    double elapsed_ms = 0;
+};
+
+// Checks every file as its own single-image dry run with `options` (unit
+// patches are not applied), on up to `threads` worker threads that take the
+// next file as they finish one. The workers share a cache of results keyed by
+// file identity (device, inode, size and modification time); a worker that
+// reaches a file another is checking waits for that result. Parsed images are
+// dropped as soon as their file is checked.
+BatchReport validate_images(const std::vector<std::string> &filenames, const DryrunOptions &options,
+                            const CostModel &model, unsigned threads);
+
+// --dryrun --batch: expands directories, validates every image and prints one
+// summary. Returns 1 if any image fails, kDryrunOverBudget if any exceeds
+// options.budget_ms, 0 otherwise.
+int run_dryrun_batch(const std::vector<std::string> &paths, const DryrunOptions &options, unsigned threads);
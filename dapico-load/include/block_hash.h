@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64: four independent 64-bit lanes over 32-byte stripes, so it runs close
+// to memory bandwidth. Not cryptographic; used to detect changed flash blocks.
+uint64_t hash_bytes(const uint8_t *data, size_t size, uint64_t seed = 0);
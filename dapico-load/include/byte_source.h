@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "elf/elf.h"
+
+// Sequential, forward-only input: pipes, stdin and decompressors.
+class ByteSource {
+public:
+    virtual ~ByteSource() = default;
+    // Reads up to `size` bytes; returns fewer only at the end of the input.
+    // Throws std::runtime_error on I/O or decompression errors.
+    virtual size_t read(uint8_t *out, size_t size) = 0;
+};
+
+enum class Compression { none, gzip, zstd };
+
+// Recognizes gzip and zstd frames by their magic bytes.
+Compression detect_compression(const uint8_t *data, size_t size);
+
+// Wraps `source` in a streaming decompressor (or returns it unchanged for
+// Compression::none). Throws std::runtime_error if support was not built in.
+std::unique_ptr<ByteSource> decompressing_source(std::unique_ptr<ByteSource> source, Compression compression);
+
+// Reads a file descriptor until EOF; the descriptor is not closed.
+std::unique_ptr<ByteSource> fd_source(int fd);
+
+// Serves a borrowed buffer, e.g. a mapped compressed file.
+std::unique_ptr<ByteSource> memory_source(const uint8_t *data, size_t size);
+
+// Replays `prefix` before continuing with `source`; used after sniffing magic
+// bytes from a pipe.
+std::unique_ptr<ByteSource> prefixed_source(std::vector<uint8_t> prefix, std::unique_ptr<ByteSource> source);
+
+// elf_reader over a regular file using positioned reads, so only the ranges
+// elf_file asks for (headers and PT_LOAD contents) are ever read; DWARF and
+// other sections in unstripped builds are never touched.
+class PreadElfReader : public elf_reader {
+public:
+    // Throws std::runtime_error if the file cannot be opened.
+    explicit PreadElfReader(const std::string &filename);
+    ~PreadElfReader() override;
+
+    PreadElfReader(const PreadElfReader &) = delete;
+    PreadElfReader &operator=(const PreadElfReader &) = delete;
+
+    bool read_at(uint64_t offset, uint8_t *out, size_t size) override;
+    uint64_t size() const override { return size_; }
+
+    uint64_t bytes_read() const { return bytes_read_; }
+
+private:
+    int fd_ = -1;
+    uint64_t size_ = 0;
+    uint64_t bytes_read_ = 0;
+};
+
+// elf_reader over a buffer already in memory.
+class MemoryElfReader : public elf_reader {
+public:
+    MemoryElfReader(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+    bool read_at(uint64_t offset, uint8_t *out, size_t size) override;
+    uint64_t size() const override { return size_; }
+
+private:
+    const uint8_t *data_;
+    size_t size_;
+};
+
+// elf_reader over a ByteSource. The first kElfStreamHeadSize bytes are kept so
+// headers and segments inside them can be read in any order; past that, reads
+// must move forward, which holds for linker output where PT_LOAD contents
+// follow the program header table in file order.
+class StreamElfReader : public elf_reader {
+public:
+    static constexpr size_t kElfStreamHeadSize = 64 * 1024;
+
+    explicit StreamElfReader(ByteSource &source);
+
+    bool read_at(uint64_t offset, uint8_t *out, size_t size) override;
+
+private:
+    void fill_head();
+
+    ByteSource &source_;
+    std::vector<uint8_t> head_;
+    bool head_read_ = false;
+    uint64_t position_ = 0;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "load_image.h"
+#include "load_plan.h"
+#include "sha256.h"
+
+// Content-defined chunk sizes. Boundaries come from a gear rolling hash over
+// the last 64 bytes, so an insertion moves only the chunks around it and the
+// rest of a shifted image still matches the previous build.
+constexpr uint32_t kChunkMinSize = 1024;
+constexpr uint32_t kChunkAverageSize = 4096;
+constexpr uint32_t kChunkMaxSize = 16384;
+
+// Lengths of the content-defined chunks of `data`, in order.
+std::vector<uint32_t> content_chunk_sizes(const uint8_t *data, size_t size);
+
+struct ChunkRef {
+    Sha256Digest id;
+    uint32_t size;
+};
+
+struct ChunkedSegment {
+    uint32_t addr;
+    uint32_t size;
+    std::vector<ChunkRef> chunks;
+};
+
+// One stored image version: its segments as chunk lists.
+struct ChunkedImage {
+    std::vector<ChunkedSegment> segments;
+    uint32_t entry_point = 0;
+
+    uint64_t size() const;
+};
+
+// What changed from one version to the next, worked out from the chunk lists
+// without touching the bytes.
+struct ChunkDiff {
+    // Address ranges of the new image not covered by the same chunk at the
+    // same address in the old one, merged and in address order.
+    std::vector<Range> changed;
+    uint64_t changed_bytes = 0;
+    // Distinct chunks of the new image the old one does not have: what has to
+    // be stored or sent for the new version.
+    uint32_t new_chunks = 0;
+    uint64_t new_bytes = 0;
+};
+
+ChunkDiff diff_chunked_images(const ChunkedImage &old_image, const ChunkedImage &new_image);
+
+// Image payloads stored once per distinct content-defined chunk, keyed by
+// SHA-256, so successive builds share everything they have in common. Images
+// read back borrow from the chunks directly. With a directory, each new chunk
+// is written to chunks/<2 hex>/<62 hex> there (temporary file, then rename)
+// instead of being kept in memory, images are kept as named text manifests,
+// and chunks are mapped from their files when loaded. Safe to use from several
+// threads.
+class ChunkStore {
+public:
+    // In memory only.
+    ChunkStore() = default;
+    // Creates the directory if needed. Throws std::runtime_error on failure.
+    explicit ChunkStore(std::string directory);
+
+    ChunkStore(const ChunkStore &) = delete;
+    ChunkStore &operator=(const ChunkStore &) = delete;
+
+    // Splits every segment into chunks and stores those not yet present.
+    // Throws std::runtime_error if a chunk file cannot be written.
+    ChunkedImage add(const LoadImage &image);
+
+    // The image with one segment per chunk, each pointing into the chunk's
+    // bytes; nothing is copied. The image keeps its chunks alive, also through
+    // prune(). Throws std::runtime_error if a chunk is missing.
+    LoadImage load(const ChunkedImage &image);
+
+    // Writes the image as the manifest `name` (temporary file, then rename),
+    // and reads it back. Both need a directory and throw std::runtime_error.
+    void save_manifest(const std::string &name, const ChunkedImage &image) const;
+    ChunkedImage read_manifest(const std::string &name) const;
+
+    // Drops chunks, and their files, that no image in `keep` refers to.
+    // Returns the number dropped.
+    size_t prune(const std::vector<const ChunkedImage *> &keep);
+
+    // Distinct chunks, and their bytes, held in memory or mapped.
+    size_t chunk_count() const;
+    uint64_t stored_bytes() const;
+
+private:
+    struct Chunk {
+        const uint8_t *data;
+        uint32_t size;
+        // The vector or MappedFile the bytes live in.
+        std::shared_ptr<const void> owner;
+    };
+    struct IdHash {
+        size_t operator()(const Sha256Digest &id) const;
+    };
+    using ChunkPtr = std::shared_ptr<const Chunk>;
+
+    std::string chunk_path(const Sha256Digest &id) const;
+    std::string manifest_path(const std::string &name) const;
+    ChunkPtr find_locked(const Sha256Digest &id, uint32_t size);
+    // Drops `chunk` from memory unless it has been replaced since.
+    void release(const Sha256Digest &id, const ChunkPtr &chunk);
+    void write_chunk_file(const Sha256Digest &id, const uint8_t *data, uint32_t size) const;
+
+    std::string directory_;
+    mutable std::mutex mutex_;
+    std::unordered_map<Sha256Digest, ChunkPtr, IdHash> chunks_;
+    uint64_t stored_bytes_ = 0;
+};
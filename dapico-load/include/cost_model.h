@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "load_plan.h"
+#include "loader.h"
+#include "sim_device.h"
+
+// Analytic load-time model. Every PICOBOOT command pays command_overhead_us
+// (command packet, ACK and bootrom dispatch); data phases stream at
+// bytes_per_second; flash erase and program costs are charged per sector/block
+// and per page.
+struct CostModel {
+    double session_overhead_ms = 1.0;
+    double command_overhead_us = 510.0;
+    double bytes_per_second = 1216000.0;
+    double sector_erase_ms = 45.0;
+    double block_erase_ms = 150.0;
+    double page_program_us = 400.0;
+};
+
+struct CostEstimate {
+    uint32_t erase_commands = 0;
+    uint64_t erase_bytes = 0;
+    uint32_t erase_sectors = 0;
+    uint32_t erase_blocks = 0;
+    uint32_t write_commands = 0;
+    uint32_t ram_write_commands = 0;
+    uint32_t flash_write_commands = 0;
+    uint32_t flash_pages = 0;
+    uint32_t other_commands = 0;
+    // Taking exclusive access, and releasing it when nothing is executed.
+    uint32_t exclusive_commands = 0;
+    uint64_t ram_bytes = 0;
+    uint64_t flash_bytes = 0;
+    double predicted_ms = 0;
+
+    uint32_t commands() const { return erase_commands + write_commands + other_commands + exclusive_commands; }
+    uint64_t payload_bytes() const { return ram_bytes + flash_bytes; }
+};
+
+// Defaults matching the simulated device's link and flash timings.
+CostModel cost_model_for_profile(const SimDeviceProfile &profile);
+
+// Applies "key=value[,key=value...]" overrides, or reads them one per line from
+// a file when spec does not contain '='. Throws std::runtime_error on bad input.
+void apply_cost_model_spec(CostModel &model, const std::string &spec);
+
+// Profile defaults for the chip with the optional spec applied on top.
+CostModel cost_model_for_product(uint16_t product_id, const std::string &spec);
+
+// Counts the commands load_plan_to_device sends for the plan with these
+// options: RAM and flash writes in the options' chunk sizes, exit XIP, the
+// exec, and taking and (without an exec) releasing exclusive access.
+CostEstimate estimate_load_cost(const LoadPlan &plan, const CostModel &model, const LoadOptions &options);
+// The same with the default chunk sizes and exclusive access.
+CostEstimate estimate_load_cost(const LoadPlan &plan, const CostModel &model, bool exec_after);
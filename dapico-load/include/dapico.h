@@ -0,0 +1,219 @@
+#pragma once
+
+/*
+ * libdapico: load images into and reboot RP2040/RP2350 devices over PICOBOOT.
+ *
+ * This is the stable C interface of the library. Devices are opaque handles;
+ * every call that can fail returns a dapico_status and, when `error` is not
+ * NULL, fills it with the details (transport result and, for commands the
+ * device rejected, its PICOBOOT command status).
+ *
+ * USB access is only built in on macOS (IOKit). On other hosts, or to drive a
+ * device through an existing connection, pass your own transport callbacks to
+ * dapico_open_transport. dapico_open_simulated opens an in-memory device with
+ * the same timing model as the benchmarks.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define DAPICO_API __attribute__((visibility("default")))
+#else
+#define DAPICO_API
+#endif
+
+#define DAPICO_API_VERSION 1
+
+#define DAPICO_PRODUCT_RP2040 0x0003
+#define DAPICO_PRODUCT_RP2350 0x000f
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum dapico_status {
+    DAPICO_OK = 0,
+    DAPICO_ERROR_INVALID_ARG = 1,
+    /* No matching device, or it went away. */
+    DAPICO_ERROR_NO_DEVICE = 2,
+    /* No USB backend on this host; use dapico_open_transport. */
+    DAPICO_ERROR_NO_BACKEND = 3,
+    /* The image could not be parsed or does not fit the device. */
+    DAPICO_ERROR_IMAGE = 4,
+    /* A USB transfer failed; see transport_result. */
+    DAPICO_ERROR_TRANSPORT = 5,
+    /* The device rejected a command; see picoboot_status. */
+    DAPICO_ERROR_COMMAND = 6,
+} dapico_status;
+
+typedef struct dapico_error {
+    dapico_status status;
+    /* IOReturn-compatible result of the failed transfer, or 0. */
+    int32_t transport_result;
+    /* PICOBOOT_IF_CMD_STATUS of the device after the failure (0 if not queried). */
+    uint32_t picoboot_status;
+    uint8_t picoboot_cmd_id;
+    uint32_t picoboot_token;
+    char message[256];
+} dapico_error;
+
+typedef struct dapico_device dapico_device;
+
+/*
+ * Transport callbacks for dapico_open_transport. Each returns 0 on success or
+ * an IOReturn-compatible error code.
+ */
+typedef struct dapico_transport_ops {
+    /* PICOBOOT_IF_RESET control request. */
+    int32_t (*reset_interface)(void *ctx);
+    /* PICOBOOT_IF_CMD_STATUS control request; fills the 16-byte status as sent on the wire. */
+    int32_t (*get_cmd_status)(void *ctx, uint8_t status[16]);
+    /* Sends the 32-byte command, then `length` bytes of data in the direction
+     * of the command (bit 7 of the command ID set means device to host), then
+     * waits for the ACK. */
+    int32_t (*transfer)(void *ctx, const uint8_t cmd[32], uint8_t *data, uint32_t length);
+    /* Called by dapico_close; may be NULL. */
+    void (*close)(void *ctx);
+} dapico_transport_ops;
+
+/* Selects devices by USB metadata, before any is opened. A NULL or empty
+ * serial and a zero location match every device. */
+typedef struct dapico_device_filter {
+    /* USB serial number string, matched exactly. */
+    const char *serial;
+    /* macOS locationID; a hub's location matches every device below it. */
+    uint32_t location;
+} dapico_device_filter;
+
+/* Opens the first BOOTSEL device on USB, in location order. */
+DAPICO_API dapico_status dapico_open_first(dapico_device **device, dapico_error *error);
+/* Opens the `index`-th (from 0, in location order) BOOTSEL device that
+ * `filter` (may be NULL) matches. Devices are chosen by metadata; only the
+ * selected one is opened. */
+DAPICO_API dapico_status dapico_open_selected(const dapico_device_filter *filter, uint32_t index,
+                                              dapico_device **device, dapico_error *error);
+/* Opens a device reached through caller-supplied callbacks. `ops` is copied;
+ * `ctx` is passed to every callback. */
+DAPICO_API dapico_status dapico_open_transport(uint16_t product_id, const dapico_transport_ops *ops, void *ctx,
+                                               dapico_device **device, dapico_error *error);
+/* Opens a simulated RP2040 or RP2350 (DAPICO_PRODUCT_*). */
+DAPICO_API dapico_status dapico_open_simulated(uint16_t product_id, dapico_device **device, dapico_error *error);
+DAPICO_API void dapico_close(dapico_device *device);
+DAPICO_API uint16_t dapico_product_id(const dapico_device *device);
+
+typedef enum dapico_load_phase {
+    DAPICO_PHASE_ERASE = 0,
+    DAPICO_PHASE_RAM = 1,
+    DAPICO_PHASE_FLASH = 2,
+} dapico_load_phase;
+
+/* Bytes done and total for the phase, after every erase range, RAM write and flash page. */
+typedef void (*dapico_progress_fn)(void *ctx, dapico_load_phase phase, uint64_t done, uint64_t total);
+
+/* Write flash segments; without it they are mirrored into SRAM when they fit. */
+#define DAPICO_LOAD_FLASH 0x1u
+/* Do not execute the image after loading. */
+#define DAPICO_LOAD_NO_EXEC 0x2u
+/* The buffer or file is a raw binary to be written at raw_base. */
+#define DAPICO_LOAD_RAW 0x4u
+
+typedef struct dapico_load_options {
+    uint32_t flags;
+    /* Where to execute, or 0 for the image's entry point. */
+    uint32_t exec_address;
+    /* Load address of DAPICO_LOAD_RAW images, or 0 for the start of flash. */
+    uint32_t raw_base;
+    dapico_progress_fn progress;
+    void *progress_ctx;
+} dapico_load_options;
+
+/* Loads an ELF, UF2, Intel HEX, gzip/zstd-compressed ELF or raw image from
+ * memory. `options` may be NULL for the defaults (RAM load, then execute). */
+DAPICO_API dapico_status dapico_load_memory(dapico_device *device, const void *data, size_t size,
+                                            const dapico_load_options *options, dapico_error *error);
+DAPICO_API dapico_status dapico_load_file(dapico_device *device, const char *path,
+                                          const dapico_load_options *options, dapico_error *error);
+
+/* Raw access. Flash writes must cover whole 256-byte pages and erases whole
+ * 4 KiB sectors; XIP is exited before the first flash access. */
+DAPICO_API dapico_status dapico_read(dapico_device *device, uint32_t addr, void *buffer, uint32_t size,
+                                     dapico_error *error);
+DAPICO_API dapico_status dapico_write(dapico_device *device, uint32_t addr, const void *data, uint32_t size,
+                                      dapico_error *error);
+DAPICO_API dapico_status dapico_erase(dapico_device *device, uint32_t addr, uint32_t size, dapico_error *error);
+DAPICO_API dapico_status dapico_exec(dapico_device *device, uint32_t addr, dapico_error *error);
+/* Reboots a BOOTSEL device into its application. */
+DAPICO_API dapico_status dapico_reboot(dapico_device *device, dapico_error *error);
+
+typedef enum dapico_reboot_outcome {
+    DAPICO_REBOOT_SENT = 0,
+    DAPICO_REBOOT_BOOTSEL_REQUESTED = 1,
+    DAPICO_REBOOT_ALREADY_IN_BOOTSEL = 2,
+    /* The device was in BOOTSEL and is rebooting into it without the drive. */
+    DAPICO_REBOOT_BOOTSEL_REENTERED = 3,
+} dapico_reboot_outcome;
+
+/* Reboot into BOOTSEL instead of the application. */
+#define DAPICO_REBOOT_TO_BOOTSEL 0x1u
+/* With DAPICO_REBOOT_TO_BOOTSEL: come up with the PICOBOOT interface only, no
+ * mass-storage drive. An RP2350 already in BOOTSEL reboots into it again. */
+#define DAPICO_REBOOT_PICOBOOT_ONLY 0x2u
+/* List the interfaces found. */
+#define DAPICO_REBOOT_VERBOSE 0x4u
+
+/* Reboots the first Raspberry Pi device on USB, in BOOTSEL or running an
+ * application with the stdio_usb reset interface: into the application, or
+ * with `bootsel` into BOOTSEL. `verbose` lists the interfaces found. */
+DAPICO_API dapico_status dapico_reboot_first(int bootsel, int verbose, dapico_reboot_outcome *outcome,
+                                             dapico_error *error);
+/* dapico_reboot_first with DAPICO_REBOOT_* flags. */
+DAPICO_API dapico_status dapico_reboot_first_flags(uint32_t flags, dapico_reboot_outcome *outcome,
+                                                   dapico_error *error);
+/* dapico_reboot_first_flags for the `index`-th device `filter` (may be NULL)
+ * matches, counted as in dapico_open_selected. */
+DAPICO_API dapico_status dapico_reboot_selected(uint32_t flags, const dapico_device_filter *filter, uint32_t index,
+                                                dapico_reboot_outcome *outcome, dapico_error *error);
+
+/* dapico_reboot_all: wait for every device to come back in the requested mode. */
+#define DAPICO_REBOOT_WAIT 0x8u
+
+typedef struct dapico_reboot_result {
+    char serial[64];
+    uint32_t location;
+    uint16_t product_id;
+    dapico_reboot_outcome outcome;
+    /* Result of the reboot request, 0 if it was sent. */
+    int32_t transport_result;
+    /* With DAPICO_REBOOT_WAIT: whether the device came back before the
+     * timeout, and how long after its request. */
+    int ready;
+    double ready_ms;
+} dapico_reboot_result;
+
+/* Nearest-rank percentiles of the ready times of the devices that rebooted. */
+typedef struct dapico_latency_summary {
+    uint32_t count;
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double max_ms;
+} dapico_latency_summary;
+
+/* Reboots every Raspberry Pi device on USB that `filter` (may be NULL)
+ * selects, sending all requests at once. Results for up to `capacity` devices
+ * go to `results`; `count` receives the number of devices matched. With
+ * DAPICO_REBOOT_WAIT, waits up to `timeout_ms` for them to re-enumerate and
+ * fills `summary` (may be NULL). */
+DAPICO_API dapico_status dapico_reboot_all(uint32_t flags, const dapico_device_filter *filter, uint32_t timeout_ms,
+                                           dapico_reboot_result *results, size_t capacity, size_t *count,
+                                           dapico_latency_summary *summary, dapico_error *error);
+
+DAPICO_API const char *dapico_status_name(dapico_status status);
+/* Name of a PICOBOOT status code ("INVALID_ADDRESS"), or NULL if unknown. */
+DAPICO_API const char *dapico_picoboot_status_name(uint32_t picoboot_status);
+DAPICO_API int dapico_api_version(void);
+
+#ifdef __cplusplus
+}
+#endif
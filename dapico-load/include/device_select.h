@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// What the host knows about a USB device from its registry entry, before
+// anything is opened.
+struct UsbDeviceIdentity {
+    uint16_t product_id = 0;
+    std::string serial;
+    // macOS locationID: the bus in the top byte, then one nibble per hub tier.
+    uint32_t location = 0;
+};
+
+// Selects devices by metadata. An empty serial or a zero location matches
+// every device; a hub's location matches every device below it.
+struct DeviceFilter {
+    std::string serial;
+    uint32_t location = 0;
+
+    bool matches(const UsbDeviceIdentity &identity) const;
+};
+
+// Picks one device: the `index`-th of those the filter matches, counted from
+// 0 in location order so the same board is picked on every run.
+struct DeviceSelector {
+    DeviceFilter filter;
+    size_t index = 0;
+};
+
+// A Raspberry Pi device's registry entry: its identity and the ID the backend
+// opens it by (the IOKit registry entry ID).
+struct UsbDeviceEntry {
+    UsbDeviceIdentity identity;
+    uint64_t registry_id = 0;
+};
+
+bool is_bootsel_product(uint16_t product_id);
+bool is_application_product(uint16_t product_id);
+
+// Which product IDs a caller can use, e.g. is_bootsel_product.
+using ProductFilter = bool (*)(uint16_t product_id);
+
+// Entries the filter matches whose product `accept` takes, in location order.
+std::vector<UsbDeviceEntry> matching_devices(const std::vector<UsbDeviceEntry> &entries, const DeviceFilter &filter,
+                                             ProductFilter accept);
+// The entry `selector` picks, or nullopt if fewer devices match.
+std::optional<UsbDeviceEntry> select_device(const std::vector<UsbDeviceEntry> &entries,
+                                            const DeviceSelector &selector, ProductFilter accept);
+
+// Keeps the last registry walk for the rest of the process, so a tool that
+// selects a device several times (the BOOTSEL wait loops, one unit after
+// another) reads the registry once. Thread-safe.
+class DeviceEnumerationCache {
+public:
+    using Enumerate = std::function<std::vector<UsbDeviceEntry>()>;
+
+    explicit DeviceEnumerationCache(Enumerate enumerate) : enumerate_(std::move(enumerate)) {}
+
+    // The cached entries, or nullopt before the first enumeration.
+    std::optional<std::vector<UsbDeviceEntry>> cached() const;
+    // Walks the registry now and caches the result.
+    std::vector<UsbDeviceEntry> refresh();
+    size_t enumerations() const;
+
+    // Opens the device `selector` picks among those `accept` takes. `open`
+    // returns an empty optional when the entry cannot be opened. Only the
+    // selected device is opened. A cached walk that selects nothing, or whose
+    // device fails to open (it left the bus or re-enumerated), is retried once
+    // against a fresh one.
+    template <typename Open>
+    auto open_selected(const DeviceSelector &selector, ProductFilter accept, Open open)
+        -> decltype(open(std::declval<const UsbDeviceEntry &>())) {
+        if (auto entries = cached()) {
+            if (auto entry = select_device(*entries, selector, accept)) {
+                if (auto opened = open(*entry)) {
+                    return opened;
+                }
+            }
+        }
+        if (auto entry = select_device(refresh(), selector, accept)) {
+            return open(*entry);
+        }
+        return {};
+    }
+
+private:
+    Enumerate enumerate_;
+    mutable std::mutex mutex_;
+    std::optional<std::vector<UsbDeviceEntry>> entries_;
+    size_t enumerations_ = 0;
+};
@@ -1,5 +1,43 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
-int run_dryrun(const std::string &filename, bool allow_flash, bool exec_after);
+#include "cost_model.h"
+#include "load_image.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "patch_overlay.h"
+
+struct DryrunOptions {
+    bool allow_flash = false;
+    bool exec_after = true;
+    bool verbose = false;
+    bool json = false;
+    uint16_t product_id = kProductIdRp2040UsbBoot;
+    std::string cost_model_spec;
+    double budget_ms = 0;
+    // What the load would send: --shared, and the write sizes of the stored
+    // --autotune profile for the chip on this host.
+    picoboot_exclusive_type exclusive = EXCLUSIVE;
+    uint32_t ram_write_chunk = kRamWriteChunkSize;
+    uint32_t flash_write_chunk = kFlashPageSize;
+    ImageOptions image;
+    // One patch list per serialized unit; each is checked against the plan.
+    std::vector<std::vector<DevicePatch>> unit_patches;
+};
+
+// Exit code when the predicted load time exceeds DryrunOptions::budget_ms.
+constexpr int kDryrunOverBudget = 3;
+
+// The load options a load with these settings would use, for estimate_load_cost.
+LoadOptions dryrun_load_options(const DryrunOptions &options);
+
+// Predicted time to load each image of the set with its own invocation: every
+// image pays the session overhead, exclusive access, exit XIP and its own erase
+// pass, and only the last one executes.
+double estimate_sequential_ms(const ImageSet &set, const MemoryLayout &layout, bool allow_flash,
+                              const LoadOptions &options, const CostModel &model);
+
+int run_dryrun(const std::vector<std::string> &filenames, const DryrunOptions &options);
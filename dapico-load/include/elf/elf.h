@@ -25,17 +25,43 @@ struct elf32_ph_entry {
     bool is_load() const { return type == 1; }
 };
 
+// Source of ELF bytes by file offset. Forward-only sources (pipes,
+// decompressors) may throw std::runtime_error for offsets they have passed.
+class elf_reader {
+public:
+    static constexpr uint64_t kUnknownSize = UINT64_MAX;
+
+    virtual ~elf_reader() = default;
+    // Fills `out` with `size` bytes from `offset`; false if the file is too short.
+    virtual bool read_at(uint64_t offset, uint8_t *out, size_t size) = 0;
+    // Length of the file, or kUnknownSize for a stream that only ends when read
+    // to the end. Ranges past a known size are refused before any allocation.
+    virtual uint64_t size() const { return kUnknownSize; }
+};
+
 class elf_file {
 public:
     void read_file(const std::shared_ptr<std::istream> &stream);
+    // Reads the ELF header, the program header table and the PT_LOAD contents,
+    // in increasing file offset order. Nothing else in the file is touched.
+    void read(elf_reader &reader);
 
     const elf32_header &header() const { return header_; }
     const std::vector<elf32_ph_entry> &segments() const { return segments_; }
 
     std::vector<uint8_t> content(const elf32_ph_entry &segment) const;
+    const uint8_t *segment_data(const elf32_ph_entry &segment) const;
 
 private:
+    struct loaded_range {
+        uint64_t offset = 0;
+        std::vector<uint8_t> bytes;
+    };
+
+    const loaded_range *find_range(const elf32_ph_entry &segment) const;
+
     elf32_header header_{};
     std::vector<elf32_ph_entry> segments_{};
-    std::vector<uint8_t> data_{};
+    // File bytes of the PT_LOAD segments, merged where they overlap or touch.
+    std::vector<loaded_range> loaded_{};
 };
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Reports changes to one file, including replacement by rename or by unlink and
+// re-create, as linkers do. Uses inotify on Linux and kqueue on macOS, watching
+// the containing directory so a replaced file is still seen; other hosts poll.
+class FileWatcher {
+public:
+    // Throws std::runtime_error if the directory cannot be watched.
+    explicit FileWatcher(const std::string &path);
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    // Blocks until the file changes and then sees no further change for
+    // debounce_ms, so multi-write linker output is picked up once, complete.
+    // timeout_ms < 0 waits forever. Returns false on timeout.
+    bool wait_for_change(uint32_t debounce_ms, int timeout_ms = -1);
+
+    // When the last change was seen, i.e. roughly when the writer finished.
+    std::chrono::steady_clock::time_point last_change() const { return last_change_; }
+
+private:
+    struct Signature {
+        uint64_t inode = 0;
+        int64_t size = -1;
+        int64_t mtime_ns = 0;
+
+        bool operator==(const Signature &other) const {
+            return inode == other.inode && size == other.size && mtime_ns == other.mtime_ns;
+        }
+    };
+
+    Signature stat_signature() const;
+    // Waits up to timeout_ms for an event about the file; false on timeout.
+    bool wait_event(int timeout_ms);
+    void watch_file();
+
+    std::string path_;
+    std::string name_;
+    // Contents last reported as a change, and (when polling) last seen.
+    Signature signature_;
+    Signature polled_;
+    std::chrono::steady_clock::time_point last_change_{};
+    int fd_ = -1;
+    int dir_fd_ = -1;
+    int file_fd_ = -1;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "picoboot_transport.h"
+
+// Granularity of holes in the output: the usual filesystem block size.
+constexpr uint32_t kDumpBlockSize = 4096;
+
+struct DumpOptions {
+    // Bytes per PC_READ. Larger reads spend less of the link on command and
+    // ACK turnarounds.
+    uint32_t read_size = 64 * 1024;
+    // Reads in flight ahead of the writer.
+    uint32_t queue_depth = 4;
+    // Leave all-0xff blocks as holes in the output file instead of writing
+    // them. Holes read back as zeros.
+    bool erased_as_holes = true;
+};
+
+struct DumpStats {
+    uint64_t bytes = 0;
+    // Bytes written to the file, and erased bytes left as holes.
+    uint64_t data_bytes = 0;
+    uint64_t hole_bytes = 0;
+    uint32_t reads = 0;
+    double elapsed_s = 0;
+};
+
+// True if every byte is 0xff. Compares 64-byte stripes as four 64-bit lanes,
+// which compilers turn into vector compares.
+bool is_erased(const uint8_t *data, size_t size);
+
+// Reads [addr, addr + size) from the device into `filename` under exclusive
+// access, exiting XIP first for flash addresses. Reads run on their own thread,
+// up to queue_depth ahead of the scan that copies non-erased blocks into the
+// memory-mapped output, so the link stays busy while the host writes. Throws std::runtime_error if the file
+// cannot be created; transport failures are reported on stderr and returned.
+TransportResult dump_memory(PicobootTransport &transport, uint32_t addr, uint32_t size, const std::string &filename,
+                            const DumpOptions &options, DumpStats &stats);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "device_select.h"
+#include "reboot.h"
+
+struct FleetDevice {
+    UsbDeviceIdentity identity;
+    RebootTarget target;
+};
+
+struct FleetRebootOptions {
+    bool bootsel = false;
+    bool picoboot_only = false;
+    // Wait for every device to come back in the requested mode.
+    bool wait = false;
+    uint32_t timeout_ms = 10000;
+    uint32_t poll_ms = 5;
+};
+
+struct FleetRebootResult {
+    UsbDeviceIdentity identity;
+    RebootOutcome outcome = RebootOutcome::no_interface;
+    TransportResult result = kTransportError;
+    // With FleetRebootOptions::wait: whether the device came back in the
+    // requested mode before the timeout, and how long after its request.
+    bool ready = false;
+    double ready_ms = 0;
+};
+
+struct LatencySummary {
+    size_t count = 0;
+    double p50_ms = 0;
+    double p90_ms = 0;
+    double p99_ms = 0;
+    double max_ms = 0;
+};
+
+// Devices on the bus right now, from metadata only.
+using UsbEnumerator = std::function<std::vector<UsbDeviceIdentity>()>;
+
+// Sends every device its reboot request at once, one thread per device. With
+// options.wait, `enumerate` is then polled until each device is back in the
+// requested mode, matched by serial (or location if it has none). A device
+// that reboots into the mode it was already in must drop off the bus first.
+std::vector<FleetRebootResult> reboot_fleet(const std::vector<FleetDevice> &devices,
+                                            const FleetRebootOptions &options, const UsbEnumerator &enumerate);
+
+// Nearest-rank percentiles of the ready times of devices that rebooted; those
+// left alone because they were already in BOOTSEL are not counted.
+LatencySummary summarize_fleet_latency(const std::vector<FleetRebootResult> &results);
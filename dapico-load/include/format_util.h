@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+std::string json_escape(const std::string &value);
+std::string hex32(uint32_t value);
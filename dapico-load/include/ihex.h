@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "load_plan.h"
+
+// True when the buffer looks like Intel HEX (first record mark ':').
+bool is_intel_hex(const uint8_t *data, size_t size);
+
+// Decodes an Intel HEX file. Data bytes are appended to `payload` and the
+// returned segments point into it, one per run of contiguous data records.
+// Extended segment (02) and extended linear (04) address records are applied;
+// a start linear address record (05) sets `entry_point`, which is left alone
+// otherwise. Throws std::runtime_error on malformed records or bad checksums.
+std::vector<ImageSegment> intel_hex_image_segments(const uint8_t *text, size_t size, std::vector<uint8_t> &payload,
+                                                   uint32_t &entry_point);
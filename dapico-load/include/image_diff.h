@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dryrun.h"
+#include "load_plan.h"
+
+struct FlashDiff {
+    uint32_t sectors = 0;
+    uint32_t pages = 0;
+    uint32_t changed_sectors = 0;
+    uint32_t changed_pages = 0;
+    uint64_t changed_bytes = 0;
+    // Erase ranges and page-aligned contents needed to move a device from the old
+    // image to the new one; the pages cover every changed sector in full.
+    LoadPlan update_plan;
+};
+
+// Compares the flash contents two plans leave behind, sector by sector. Bytes a
+// plan does not cover read as erased (0xff). Only sectors the new plan erases are
+// considered. The comparison is split across up to `threads` worker threads.
+FlashDiff diff_flash_plans(const LoadPlan &old_plan, const LoadPlan &new_plan, unsigned threads);
+
+int run_diff_elf(const std::string &old_filename, const std::string &new_filename, const DryrunOptions &options);
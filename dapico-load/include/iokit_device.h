@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "device_select.h"
+#include "fleet_reboot.h"
+#include "picoboot_transport.h"
+#include "reboot.h"
+
+struct UsbPicobootDevice {
+    uint16_t product_id{};
+    std::unique_ptr<PicobootTransport> transport;
+    // USB location ID; 0 for a simulated device.
+    uint32_t location{};
+};
+
+// Opens the BOOTSEL device `selector` picks (by default the first in location
+// order) if it exposes a PICOBOOT interface. The choice is made on registry
+// metadata cached for the process; no other device is opened. The transport
+// closes the interface and device when destroyed.
+std::optional<UsbPicobootDevice> find_device(const DeviceSelector &selector = DeviceSelector{});
+
+// A device to reboot: a BOOTSEL device (PICOBOOT) or a running application
+// exposing the stdio_usb reset interface. Either transport may be null.
+struct UsbRebootDevice {
+    UsbDeviceIdentity identity;
+    std::unique_ptr<PicobootTransport> picoboot;
+    std::unique_ptr<ResetInterfaceTransport> reset;
+
+    RebootTarget target() const { return RebootTarget{identity.product_id, picoboot.get(), reset.get()}; }
+};
+
+// Opens the Raspberry Pi device `selector` picks among those in BOOTSEL or
+// running an application with the reset interface. `verbose` lists the
+// interfaces found.
+std::optional<UsbRebootDevice> find_reboot_device(bool verbose, const DeviceSelector &selector = DeviceSelector{});
+// Opens every such device the filter selects; devices it rules out are never opened.
+std::vector<UsbRebootDevice> find_reboot_devices(const DeviceFilter &filter, bool verbose);
+
+// Raspberry Pi devices on the bus, read from the registry without opening them.
+// Also refreshes the cached walk find_device selects from.
+std::vector<UsbDeviceIdentity> enumerate_usb_devices();
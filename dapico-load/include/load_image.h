@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "load_plan.h"
+
+// A parsed input file. The segments borrow from `storage` (ELF contents or a
+// file mapping), so keep the image alive while any plan built from it is in use.
+struct LoadImage {
+    std::vector<ImageSegment> segments;
+    uint32_t entry_point = 0;
+    std::shared_ptr<const void> storage;
+};
+
+struct ImageOptions {
+    // Load the file as a raw binary at raw_base. Files named *.bin always are.
+    bool raw_binary = false;
+    uint32_t raw_base = kFlashStart;
+    // Where to execute when non-zero, instead of the image's own entry point.
+    uint32_t entry_point = 0;
+};
+
+// Several images written in one session, e.g. bootloader, application and a
+// filesystem image.
+struct ImageSet {
+    std::vector<std::string> filenames;
+    std::vector<LoadImage> images;
+    // Segments of every image, in command-line order.
+    std::vector<ImageSegment> segments;
+    uint32_t entry_point = 0;
+};
+
+// Opens an ELF, UF2 or Intel HEX file, recognized by its contents, or a raw
+// binary, for the given BOOTSEL product. Throws std::runtime_error on failure.
+LoadImage open_load_image(const std::string &filename, uint16_t product_id, const ImageOptions &options = {});
+
+// Same as open_load_image for bytes already in memory: a mapped file, or a
+// buffer handed over by an embedding application. Raw and UF2 segments borrow
+// from `data`; `storage` is kept in the image to hold it alive and may be null
+// when the caller outlives every plan built from the image.
+LoadImage load_image_from_memory(const uint8_t *data, size_t size, std::shared_ptr<const void> storage,
+                                 uint16_t product_id, const ImageOptions &options = {});
+
+// Opens every file; "file@addr" loads that file as a raw binary at addr. Images
+// may share flash pages and sectors but not bytes. The entry point is
+// options.entry_point if set, otherwise the first image's that has one. Throws
+// std::runtime_error on failure or overlap, naming the files involved.
+ImageSet open_image_set(const std::vector<std::string> &filenames, uint16_t product_id, const ImageOptions &options);
+
+// Reset handler of the vector table at the start of the image (after the 256-byte
+// boot2 stage on RP2040 flash images), for formats that carry no entry point.
+// Returns 0 when the image does not cover it.
+uint32_t vector_table_entry_point(const std::vector<ImageSegment> &segments, uint16_t product_id);
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "elf/elf.h"
+
+constexpr uint16_t kVendorIdRaspberryPi = 0x2e8a;
+constexpr uint16_t kProductIdRp2040UsbBoot = 0x0003;
+constexpr uint16_t kProductIdRp2350UsbBoot = 0x000f;
+constexpr uint16_t kProductIdRp2040StdioUsb = 0x000a;
+constexpr uint16_t kProductIdRp2350StdioUsb = 0x0009;
+constexpr uint32_t kFlashSectorSize = 4096;
+constexpr uint32_t kFlashPageSize = 256;
+constexpr uint32_t kFlashStart = 0x10000000;
+constexpr uint32_t kSramStart = 0x20000000;
+constexpr uint32_t kFlashEndRp2040 = 0x11000000;
+constexpr uint32_t kFlashEndRp2350 = 0x14000000;
+constexpr uint32_t kSramEndRp2040 = 0x20042000;
+constexpr uint32_t kSramEndRp2350 = 0x20082000;
+
+struct Range {
+    uint32_t start;
+    uint32_t end;
+};
+
+struct MemoryLayout {
+    uint32_t flash_end;
+    uint32_t sram_end;
+};
+
+// A run of bytes to place at a target address. The bytes are borrowed from the
+// input image (ELF contents, etc.), which must outlive any plan built from it.
+struct ImageSegment {
+    uint32_t addr;
+    const uint8_t *data;
+    uint32_t size;
+};
+
+// Page-aligned flash contents; size is always a multiple of kFlashPageSize.
+struct FlashExtent {
+    uint32_t addr;
+    std::vector<uint8_t> data;
+};
+
+struct LoadPlan {
+    std::vector<ImageSegment> ram_segments;
+    std::vector<FlashExtent> flash_extents;
+    std::vector<Range> erase_ranges;
+    uint32_t entry_point = 0;
+    bool skipped_flash_segments = false;
+    bool mirrored_flash_segments = false;
+
+    size_t flash_page_count() const;
+};
+
+uint32_t align_down(uint32_t value, uint32_t align);
+uint32_t align_up(uint32_t value, uint32_t align);
+MemoryLayout memory_layout_for_product(uint16_t product_id);
+// Maps "rp2040"/"rp2350" to the BOOTSEL product ID.
+bool product_id_for_chip(const std::string &chip, uint16_t &product_id);
+const char *chip_name_for_product(uint16_t product_id);
+bool is_flash_address(uint32_t addr, const MemoryLayout &layout);
+bool is_sram_address(uint32_t addr, const MemoryLayout &layout);
+bool map_flash_to_sram(uint32_t addr, uint32_t size, const MemoryLayout &layout, uint32_t &mapped_addr);
+std::vector<Range> merge_ranges(std::vector<Range> ranges);
+
+// Opens and parses an ELF file, reading only its headers and PT_LOAD contents.
+// Throws std::runtime_error on failure.
+void read_elf_file(const std::string &filename, elf_file &elf);
+
+// Collects the loadable segments of an ELF. Throws std::runtime_error on malformed input.
+std::vector<ImageSegment> elf_image_segments(const elf_file &elf);
+
+// Splits segments into RAM writes and flash pages/erase ranges. Flash pages not
+// fully covered by the image are zero-filled; later segments win on overlap.
+LoadPlan build_load_plan(const std::vector<ImageSegment> &segments, uint32_t entry_point, const MemoryLayout &layout,
+                         bool allow_flash);
+
+// Works out where PC_EXEC should jump, printing the reason to stderr on failure.
+bool resolve_exec_address(const LoadPlan &plan, const MemoryLayout &layout, bool allow_flash, uint32_t &exec_addr);
+// Same, returning the reason in `error` instead of printing it.
+bool resolve_exec_address(const LoadPlan &plan, const MemoryLayout &layout, bool allow_flash, uint32_t &exec_addr,
+                          std::string &error);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "load_plan.h"
+#include "patch_overlay.h"
+#include "picoboot_transport.h"
+
+constexpr uint32_t kRamWriteChunkSize = 1024;
+
+enum class LoadPhase { erase, ram, flash };
+
+// Bytes done and total for the phase, reported after every erase range, RAM
+// write and flash write.
+using LoadProgress = std::function<void(LoadPhase phase, uint64_t done, uint64_t total)>;
+
+struct LoadCounters;
+
+struct LoadOptions {
+    bool exec_after = true;
+    uint32_t exec_addr = 0;
+    // Per-device bytes applied to pages and RAM chunks as they are sent; the
+    // plan itself is left untouched so it can be shared by every unit.
+    const PatchOverlay *patches = nullptr;
+    LoadProgress progress;
+    // Bumped as each command completes, for a ProgressReporter on another
+    // thread; cheaper than `progress` for a long load.
+    LoadCounters *counters = nullptr;
+    // Held for the whole session so host traffic on the BOOTSEL drive cannot
+    // compete with the load or interleave with flash writes.
+    picoboot_exclusive_type exclusive = EXCLUSIVE;
+    // Bytes per PC_WRITE into RAM, and into flash (rounded down to whole
+    // pages). --autotune measures the best sizes for a chip and host.
+    uint32_t ram_write_chunk = kRamWriteChunkSize;
+    uint32_t flash_write_chunk = kFlashPageSize;
+};
+
+// PC_WRITE commands needed for the plan's RAM segments. Runs of contiguous
+// segments (UF2 blocks, for instance) are gathered into `chunk`-byte writes.
+uint32_t ram_write_command_count(const LoadPlan &plan, uint32_t chunk = kRamWriteChunkSize);
+
+// Runs a whole PICOBOOT load session: interface reset, exclusive access, exit
+// XIP, erase, RAM writes, flash page writes and the optional exec. Exclusive
+// access is released on the way out unless the image was executed. Failures
+// are reported on stderr.
+TransportResult load_plan_to_device(PicobootTransport &transport, const LoadPlan &plan, const LoadOptions &options);
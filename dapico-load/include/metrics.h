@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "picoboot_transport.h"
+
+// Counts of observations in fixed log2 buckets: bucket i holds values up to
+// 2^i, the last bucket everything larger. observe() is two relaxed atomic
+// adds (bucket and sum), so any number of threads can record, and an exporter
+// read, without a lock.
+class LogHistogram {
+public:
+    static constexpr size_t kBuckets = 28;
+
+    void observe(uint64_t value);
+
+    // Upper bound of bucket i; the last bucket has none.
+    static uint64_t bucket_bound(size_t i) { return uint64_t{1} << i; }
+    uint64_t bucket(size_t i) const { return buckets_[i].load(std::memory_order_relaxed); }
+    uint64_t count() const;
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets + 1> buckets_{};
+    std::atomic<uint64_t> sum_{0};
+};
+
+// PICOBOOT commands, grouped for per-command latency.
+enum class MetricCommand { exit_xip, erase, write, read, exec, reboot, exclusive, other, count };
+
+const char *metric_command_name(MetricCommand command);
+
+// Cumulative counters for a long-running process (serialized units, --watch).
+// Command-level updates come from a MeteredTransport and are lock-free; loads
+// are recorded once each, and only the per-location table takes a lock.
+struct LoaderMetrics {
+    static constexpr size_t kStatusCodes = 32;
+    static constexpr size_t kCommands = static_cast<size_t>(MetricCommand::count);
+
+    std::atomic<uint64_t> loads_ok{0};
+    std::atomic<uint64_t> loads_failed{0};
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> bytes_erased{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> bytes_read{0};
+    // Microseconds per command, and per whole load.
+    std::array<LogHistogram, kCommands> command_us;
+    LogHistogram load_us;
+    // Failed commands by the picoboot_status code the device reported;
+    // those whose status could not be read are counted apart.
+    std::array<std::atomic<uint64_t>, kStatusCodes> failures_by_status{};
+    std::atomic<uint64_t> failures_without_status{0};
+
+    struct LocationCounts {
+        uint64_t ok = 0;
+        uint64_t failed = 0;
+    };
+
+    // One load on the device at `location` (0 when unknown), `us` long.
+    void record_load(uint32_t location, bool ok, double us);
+    std::map<uint32_t, LocationCounts> locations() const;
+
+private:
+    mutable std::mutex locations_mutex_;
+    std::map<uint32_t, LocationCounts> locations_;
+};
+
+// Forwards to another transport, timing every command into `metrics` and
+// asking the device for the status of each one that fails. `now_us` is the
+// clock: wall time on USB, simulated time on a SimulatedDevice. Timeouts
+// belong to the inner transport.
+class MeteredTransport : public PicobootTransport {
+public:
+    MeteredTransport(PicobootTransport &inner, LoaderMetrics &metrics, std::function<double()> now_us);
+
+    TransportResult reset_interface() override;
+    TransportResult get_cmd_status(picoboot_cmd_status &status) override;
+    TransportResult transfer(const picoboot_cmd &cmd, uint8_t *buffer) override;
+
+private:
+    PicobootTransport &inner_;
+    LoaderMetrics &metrics_;
+    std::function<double()> now_us_;
+};
+
+// Prometheus text exposition format, metric names prefixed dapico_.
+std::string format_prometheus(const LoaderMetrics &metrics);
+// Writes the exposition to a temporary beside `filename` and renames it over
+// the old file, so a textfile collector never reads half of it. Throws
+// std::runtime_error if the file cannot be written.
+void write_prometheus_textfile(const std::string &filename, const LoaderMetrics &metrics);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "picoboot_transport.h"
+
+// RP2350 OTP: 4096 rows of 24 bits. Programming can only set bits.
+constexpr uint32_t kOtpRowCount = 4096;
+constexpr uint32_t kOtpRowMask = 0xffffff;
+
+// How a row is read or written. ECC rows hold 16 data bits protected by a
+// 6-bit Hamming code and two bit-repair-by-polarity (BRBP) flags; PC_OTP_READ
+// and PC_OTP_WRITE move them as 2 bytes per row. Raw rows are 24 bits moved as
+// 4 bytes per row.
+enum class OtpLayout { ecc, raw };
+
+constexpr uint32_t otp_row_bytes(OtpLayout layout) {
+    return layout == OtpLayout::ecc ? 2 : 4;
+}
+
+enum class OtpEccStatus { ok, corrected, uncorrectable };
+
+// The 22-bit codeword for `value` (BRBP flags clear). Table-driven: the
+// parity bits are linear in the data, so they are the XOR of one lookup per
+// data byte.
+uint32_t otp_ecc_encode(uint16_t value);
+// Decodes a raw row, undoing BRBP inversion and correcting a single flipped
+// bit. `value` is not set for uncorrectable rows.
+OtpEccStatus otp_ecc_decode(uint32_t row, uint16_t &value);
+// The codeword for `value` that can be programmed over `current` (only
+// setting bits): the plain codeword, else its BRBP inversion. False if
+// neither fits.
+bool otp_ecc_program_value(uint32_t current, uint16_t value, uint32_t &row);
+
+// Reads `count` rows starting at `row` with one PC_OTP_READ. `values`
+// receives 16-bit data (ECC) or 24-bit rows (raw). Failures are reported on
+// stderr.
+TransportResult read_otp_rows(PicobootTransport &transport, uint16_t row, uint32_t count, OtpLayout layout,
+                              std::vector<uint32_t> &values);
+
+// One manifest line: `values` fill consecutive rows from `row`.
+struct OtpEntry {
+    uint16_t row = 0;
+    OtpLayout layout = OtpLayout::ecc;
+    std::vector<uint32_t> values;
+};
+
+// Manifest lines are "<row> <ecc|raw> <value>...", e.g. "0x0c0 ecc 0x1234
+// 0x5678"; '#' starts a comment. Throws std::runtime_error naming the line for
+// malformed entries, values too wide for the layout, and rows listed twice.
+std::vector<OtpEntry> parse_otp_manifest(std::istream &input, const std::string &name);
+// Writes rows in manifest form, eight values per line.
+void write_otp_manifest(std::ostream &output, uint16_t row, OtpLayout layout, const std::vector<uint32_t> &values);
+
+// A run of consecutive rows to program, as raw 24-bit values (ECC rows are
+// encoded on the host so ECC and raw rows share one command).
+struct OtpWrite {
+    uint16_t row = 0;
+    std::vector<uint32_t> rows;
+};
+
+struct OtpPlan {
+    std::vector<OtpWrite> writes;
+    uint32_t rows = 0;
+    uint32_t changed = 0;
+    uint32_t unchanged = 0;
+    // ECC rows that read back through a single-bit correction.
+    uint32_t corrected = 0;
+    // Rows whose programmed bits cannot become the manifest value.
+    std::vector<std::string> conflicts;
+    // PC_OTP_READ commands used to fetch the current contents.
+    uint32_t read_commands = 0;
+};
+
+// Reads the current raw contents of every manifest row, one command per
+// maximal run of consecutive rows, and diffs them against the manifest. Only
+// rows whose value differs are planned.
+TransportResult plan_otp_update(PicobootTransport &transport, const std::vector<OtpEntry> &entries, OtpPlan &plan);
+
+// Programs each planned run with one raw PC_OTP_WRITE, then reads the runs
+// back and compares. Failures are reported on stderr.
+TransportResult write_otp_plan(PicobootTransport &transport, const OtpPlan &plan);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "load_plan.h"
+#include "picoboot_transport.h"
+
+// get_partition_table_info flags (PT_INFO_*) and the partition words it
+// returns, as laid out by the RP2350 bootrom.
+constexpr uint32_t kPtInfoPtInfo = 0x0001;
+constexpr uint32_t kPtInfoLocationAndFlags = 0x0010;
+constexpr uint32_t kPartitionFirstSectorMask = 0x00001fff;
+constexpr uint32_t kPartitionLastSectorShift = 13;
+constexpr uint32_t kPartitionLastSectorMask = 0x03ffe000;
+constexpr uint32_t kPartitionLinkTypeShift = 1;
+constexpr uint32_t kPartitionLinkTypeMask = 0x00000006;
+constexpr uint32_t kPartitionLinkValueShift = 3;
+constexpr uint32_t kPartitionLinkValueMask = 0x00000078;
+constexpr uint32_t kPartitionLinkTypeAPartition = 1;
+
+// UF2 family the bootrom picks a target partition for.
+constexpr uint32_t kFamilyIdRp2350ArmSecure = 0xe48bff59;
+
+struct Partition {
+    uint32_t permissions_and_location = 0;
+    uint32_t permissions_and_flags = 0;
+
+    // Absolute flash addresses of the partition, e.g. 0x10002000.
+    uint32_t start() const;
+    uint32_t end() const;
+    // Index of the A partition this one is the B of, or -1.
+    int a_partition() const;
+};
+
+struct PartitionTable {
+    bool present = false;
+    std::vector<Partition> partitions;
+
+    // The other partition of index's A/B pair, or -1 if it has none.
+    int ab_partner(int index) const;
+};
+
+// Builds the words of a partition location and flags, for tables made by hand
+// (the simulated device) rather than read from a device.
+Partition make_partition(uint32_t offset, uint32_t size, int a_partition = -1);
+
+// Decodes a PICOBOOT_GET_INFO_PARTTION_TABLE response queried with
+// kPtInfoPtInfo | kPtInfoLocationAndFlags: a count of the words that follow,
+// the flags answered, then the table info and two words per partition. Throws
+// std::runtime_error if it is truncated or answers other flags.
+PartitionTable parse_partition_table_info(const uint32_t *words, size_t count);
+// The same response for `table`, as the bootrom would send it.
+std::vector<uint32_t> partition_table_info_words(const PartitionTable &table);
+
+TransportResult query_partition_table(PicobootTransport &transport, PartitionTable &table);
+// PICOBOOT_GET_INFO_UF2_TARGET_PARTITION: the partition a UF2 of `family_id`
+// would be written to, the inactive slot of an A/B pair. -1 if none.
+TransportResult query_uf2_target_partition(PicobootTransport &transport, uint32_t family_id, int &index);
+
+struct PartitionUpdate {
+    PartitionTable table;
+    int target = -1;
+    int booted = -1;
+    // Flash address the image was built for, and where it now goes.
+    uint32_t image_base = 0;
+    uint32_t target_base = 0;
+    uint32_t erase_sectors = 0;
+    uint32_t slot_sectors = 0;
+};
+
+// Moves the plan's flash extents and erase ranges from `from` to `to`. Throws
+// std::runtime_error if any of them would land outside `slot`.
+void relocate_load_plan(LoadPlan &plan, uint32_t from, uint32_t to, const Range &slot);
+
+// Reads the partition table and the bootrom's update target, then relocates
+// the plan into that slot. An image linked at the start of flash (the address
+// the bootrom translates partitions to) or into either slot of the pair moves
+// to the target's start. Throws std::runtime_error if the device has no A/B
+// pair, the two slots overlap or the image does not fit; transport failures
+// are reported on stderr.
+TransportResult plan_partition_update(PicobootTransport &transport, LoadPlan &plan, PartitionUpdate &update);
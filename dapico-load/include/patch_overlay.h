@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "load_plan.h"
+
+// Bytes one device gets on top of the shared image: a serial number,
+// calibration data, keys.
+struct DevicePatch {
+    uint32_t addr;
+    std::vector<uint8_t> bytes;
+};
+
+// Copy-on-write view of a shared LoadPlan for one device. The plan is never
+// copied or modified; the loader asks the overlay for each page or RAM chunk
+// as it goes out, and only the few that a patch touches are copied to a
+// scratch buffer and patched.
+class PatchOverlay {
+public:
+    // Throws std::runtime_error if a patch writes bytes the plan does not, since
+    // those would need pages (and erases) the shared plan does not have.
+    PatchOverlay(const LoadPlan &plan, std::vector<DevicePatch> patches);
+
+    // Returns `data` when [addr, addr + size) is untouched, otherwise a copy in
+    // `scratch` (at least `size` bytes) with the patches applied in order.
+    const uint8_t *apply(uint32_t addr, const uint8_t *data, uint32_t size, uint8_t *scratch) const;
+
+    const std::vector<DevicePatch> &patches() const { return patches_; }
+    uint32_t patched_bytes() const;
+    // Distinct kFlashPageSize pages holding patched bytes.
+    uint32_t patched_pages() const;
+
+private:
+    std::vector<DevicePatch> patches_;
+    uint32_t low_ = UINT32_MAX;
+    uint32_t high_ = 0;
+};
+
+// Reads per-device patches from a CSV file with one unit per row, each row a
+// list of `addr,hexbytes` pairs (e.g. `0x100ff000,0102a0ff`). Blank lines and
+// lines starting with '#' are skipped. Throws std::runtime_error on bad rows.
+std::vector<std::vector<DevicePatch>> read_patch_csv(const std::string &filename);
+
+// `serial` as a little-endian integer of `width` bytes (1-8) at `addr`.
+DevicePatch serial_patch(uint32_t addr, uint64_t serial, uint32_t width);
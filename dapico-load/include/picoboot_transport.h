@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+
+#include "boot/picoboot.h"
+
+// Transport results use IOReturn values so the IOKit backend can pass them through
+// unchanged; other backends report the closest equivalent.
+using TransportResult = int32_t;
+constexpr TransportResult kTransportOk = 0;
+constexpr TransportResult kTransportError = static_cast<TransportResult>(0xe00002bc);    // kIOReturnError
+constexpr TransportResult kTransportNoDevice = static_cast<TransportResult>(0xe00002c0); // kIOReturnNoDevice
+constexpr TransportResult kTransportStalled = static_cast<TransportResult>(0xe000404f);  // kIOUSBPipeStalled
+constexpr TransportResult kTransportTimeout = static_cast<TransportResult>(0xe00002d6);  // kIOReturnTimeout
+
+constexpr uint32_t kUsbTimeoutMs = 3000;
+
+// How long a transfer may take. Command packets and ACKs (which wait for flash
+// erases and programs) get command_ms; a data phase gets data_fixed_ms plus
+// data_ms_per_kib for every KiB it moves. The defaults allow every data phase
+// three command timeouts; --autotune fits them to the link.
+struct TransferTimeouts {
+    uint32_t command_ms = kUsbTimeoutMs;
+    uint32_t data_fixed_ms = kUsbTimeoutMs * 3;
+    double data_ms_per_kib = 0;
+
+    uint32_t data_ms(uint32_t bytes) const {
+        return data_fixed_ms + static_cast<uint32_t>(data_ms_per_kib * bytes / 1024.0 + 0.5);
+    }
+};
+
+// One open PICOBOOT interface. Implementations move bytes only; command framing
+// (magic, tokens) and the command helpers below are shared.
+class PicobootTransport {
+public:
+    virtual ~PicobootTransport() = default;
+
+    // PICOBOOT_IF_RESET control request: un-stall the endpoints and reset the command state.
+    virtual TransportResult reset_interface() = 0;
+    // PICOBOOT_IF_CMD_STATUS control request.
+    virtual TransportResult get_cmd_status(picoboot_cmd_status &status) = 0;
+    // Command packet, optional IN/OUT data phase of cmd.dTransferLength bytes, then the ACK.
+    virtual TransportResult transfer(const picoboot_cmd &cmd, uint8_t *buffer) = 0;
+
+    // Backends that can time out a transfer (IOKit, the simulator) follow these.
+    void set_timeouts(const TransferTimeouts &timeouts) { timeouts_ = timeouts; }
+    const TransferTimeouts &timeouts() const { return timeouts_; }
+
+protected:
+    TransferTimeouts timeouts_;
+};
+
+// Name of a picoboot_cmd_status code ("INVALID_ADDRESS"), or nullptr if unknown.
+const char *picoboot_status_name(uint32_t status_code);
+
+TransportResult send_picoboot_command(PicobootTransport &transport, picoboot_cmd &cmd, uint8_t *buffer);
+TransportResult picoboot_exit_xip(PicobootTransport &transport);
+TransportResult picoboot_flash_erase(PicobootTransport &transport, uint32_t addr, uint32_t size);
+TransportResult picoboot_write(PicobootTransport &transport, uint32_t addr, const uint8_t *buffer, uint32_t size);
+TransportResult picoboot_read(PicobootTransport &transport, uint32_t addr, uint8_t *buffer, uint32_t size);
+// PC_EXCLUSIVE_ACCESS: NOT_EXCLUSIVE, EXCLUSIVE (the mass-storage interface
+// stops accepting host traffic) or EXCLUSIVE_AND_EJECT (the drive is also
+// ejected, so the host stops probing it).
+TransportResult picoboot_exclusive_access(PicobootTransport &transport, picoboot_exclusive_type type);
+// RP2350 OTP rows: 2 bytes per row with `ecc`, else 4 (24 bits raw).
+TransportResult picoboot_otp_read(PicobootTransport &transport, uint16_t row, uint16_t count, bool ecc,
+                                  uint8_t *buffer);
+TransportResult picoboot_otp_write(PicobootTransport &transport, uint16_t row, uint16_t count, bool ecc,
+                                   const uint8_t *buffer);
+TransportResult picoboot_exec(PicobootTransport &transport, uint32_t addr);
+// Reboots into the normal boot path: PC_REBOOT on RP2040, PC_REBOOT2 on RP2350.
+TransportResult picoboot_reboot(PicobootTransport &transport, uint16_t product_id, uint32_t delay_ms);
+// RP2350 PC_REBOOT2 with REBOOT2_FLAG_* flags and the type's parameters.
+TransportResult picoboot_reboot2(PicobootTransport &transport, uint32_t flags, uint32_t delay_ms, uint32_t param0,
+                                 uint32_t param1);
+// RP2350 PC_GET_INFO; the device fills up to `size` bytes of `buffer`.
+TransportResult picoboot_get_info(PicobootTransport &transport, const picoboot_get_info_cmd &info, uint8_t *buffer,
+                                  uint32_t size);
+
+// Holds exclusive access for one session and gives it back on every exit
+// path. A failed request is reported on stderr and the session continues
+// shared.
+class ExclusiveAccess {
+public:
+    ExclusiveAccess(PicobootTransport &transport, picoboot_exclusive_type type);
+    ~ExclusiveAccess();
+    ExclusiveAccess(const ExclusiveAccess &) = delete;
+    ExclusiveAccess &operator=(const ExclusiveAccess &) = delete;
+
+    bool held() const { return held_; }
+    // The device executed or rebooted, which ends exclusive access by itself.
+    void dismiss() { held_ = false; }
+
+private:
+    PicobootTransport &transport_;
+    bool held_ = false;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "cost_model.h"
+#include "load_plan.h"
+#include "loader.h"
+
+constexpr uint32_t kProgressIntervalMs = 200;
+
+// Bumped by the load as each command completes and read by a ProgressReporter
+// on another thread. The load is the only writer, so a bump is a relaxed load
+// and store rather than a locked read-modify-write: the transfer loop pays
+// about what a plain increment costs and never waits on the reader.
+struct LoadCounters {
+    std::atomic<uint64_t> erased{0};
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint32_t> commands{0};
+
+    void add_erase(uint64_t bytes) {
+        bump(erased, bytes);
+        bump(commands, 1u);
+    }
+    void add_write(uint64_t bytes) {
+        bump(written, bytes);
+        bump(commands, 1u);
+    }
+    void add_command() { bump(commands, 1u); }
+    void reset();
+
+private:
+    template <typename T>
+    static void bump(std::atomic<T> &counter, T by) {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+};
+
+// Everything a load session will do, with the cost model's time for its erase
+// and write parts, so a remaining erase byte and a remaining write byte count
+// for what they cost rather than the same.
+struct ProgressTotals {
+    uint64_t erase_bytes = 0;
+    uint64_t write_bytes = 0;
+    uint32_t commands = 0;
+    double erase_us = 0;
+    double write_us = 0;
+};
+
+// Counts commands with the chunk sizes in `options`, as load_plan_to_device sends them.
+ProgressTotals progress_totals(const LoadPlan &plan, const CostModel &model, const LoadOptions &options);
+
+struct ProgressSample {
+    double elapsed_s = 0;
+    uint64_t erased = 0;
+    uint64_t written = 0;
+    uint32_t commands = 0;
+    // Of the predicted work, 0..1.
+    double fraction = 0;
+    // Smoothed erase plus write bytes per second.
+    double bytes_per_s = 0;
+    double eta_s = 0;
+};
+
+// Smoothed throughput and ETA from successive counter readings. Progress is
+// measured in predicted microseconds of work, and the rate at which the
+// device gets through them is an exponentially weighted moving average with
+// the given half-life, so the ETA follows a slow link or a fast erase without
+// jumping at every reading. Until the first command completes, the ETA is the
+// cost model's prediction for the whole plan.
+class ProgressEstimator {
+public:
+    explicit ProgressEstimator(const ProgressTotals &totals, double half_life_s = 2.0);
+
+    ProgressSample update(double elapsed_s, uint64_t erased, uint64_t written, uint32_t commands);
+
+private:
+    double work_us(uint64_t erased, uint64_t written) const;
+
+    ProgressTotals totals_;
+    double half_life_s_;
+    double last_s_ = 0;
+    double last_work_us_ = 0;
+    uint64_t last_bytes_ = 0;
+    // Predicted microseconds of work per second (the model's own pace until
+    // measured), and bytes per second.
+    double work_rate_ = 1e6;
+    double byte_rate_ = 0;
+    bool rated_ = false;
+};
+
+enum class ProgressFormat { none, tty, json };
+
+// tty when stderr is a terminal, otherwise none.
+ProgressFormat default_progress_format();
+bool parse_progress_format(const std::string &text, ProgressFormat &format);
+
+// One progress line: a bar redrawn in place for tty, a JSON object per line
+// for json.
+std::string format_progress(const ProgressSample &sample, const ProgressTotals &totals, ProgressFormat format,
+                            bool done);
+
+// Renders `counters` to `out` every interval_ms from its own low-priority
+// thread until stop(), then renders the final state once more. The load never
+// calls into it.
+class ProgressReporter {
+public:
+    ProgressReporter(const LoadCounters &counters, const ProgressTotals &totals, ProgressFormat format, FILE *out,
+                     uint32_t interval_ms = kProgressIntervalMs);
+    ~ProgressReporter();
+
+    ProgressReporter(const ProgressReporter &) = delete;
+    ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+    void stop();
+
+private:
+    void run();
+    void render(bool done);
+
+    const LoadCounters &counters_;
+    ProgressTotals totals_;
+    ProgressFormat format_;
+    FILE *out_;
+    uint32_t interval_ms_;
+    ProgressEstimator estimator_;
+    std::chrono::steady_clock::time_point start_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "load_plan.h"
+#include "loader.h"
+#include "picoboot_transport.h"
+
+// RAM images go out in 64 KiB PC_WRITEs rather than kRamWriteChunkSize ones.
+// Gaps between segments up to kRamImageGapFill bytes are sent as zeros, which
+// costs the link less than another command.
+constexpr uint32_t kRamImageWriteSize = 64 * 1024;
+constexpr uint32_t kRamImageGapFill = 512;
+// Long enough for the REBOOT2 ACK to get out; the usual 500 ms would
+// dominate a RAM image load.
+constexpr uint32_t kRamImageRebootDelayMs = 10;
+
+// Start of a PICOBIN block; the bootrom looks for an IMAGE_DEF in the first
+// 4 KiB of the region.
+constexpr uint32_t kPicobinBlockMarkerStart = 0xffffded3;
+constexpr uint32_t kRamImageBlockSearch = 4096;
+
+struct RamImageRun {
+    uint32_t addr;
+    std::vector<uint8_t> data;
+};
+
+// An SRAM-linked image packed into the contiguous region REBOOT2 RAM_IMAGE
+// boots from.
+struct RamImage {
+    // 4 KiB-aligned region handed to the bootrom, from the first run to the
+    // last. SRAM between runs that are not coalesced (main SRAM and a stack in
+    // SCRATCH_X, say) lies inside it unwritten; that is intended, as the
+    // bootrom only boots what the image's IMAGE_DEF describes.
+    Range region{0, 0};
+    std::vector<RamImageRun> runs;
+    uint32_t segments = 0;
+    uint64_t bytes = 0;
+    uint64_t filled_bytes = 0;
+    bool has_block = false;
+
+    uint32_t write_count() const;
+};
+
+// Packs the segments into runs, coalescing segments that touch, overlap (later
+// wins) or sit within kRamImageGapFill of each other. Throws std::runtime_error
+// for segments outside SRAM: flash-linked images cannot boot as RAM images.
+RamImage pack_ram_image(const std::vector<ImageSegment> &segments, const MemoryLayout &layout);
+
+// Writes the runs in kRamImageWriteSize transfers, then reboots with
+// REBOOT2_FLAG_REBOOT_TYPE_RAM_IMAGE over the region so the bootrom validates
+// and launches the image. Failures are reported on stderr.
+TransportResult boot_ram_image(PicobootTransport &transport, const RamImage &image, const LoadProgress &progress);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+#include "picoboot_transport.h"
+
+// Vendor reset interface that pico_stdio_usb adds to a running application.
+class ResetInterfaceTransport {
+public:
+    virtual ~ResetInterfaceTransport() = default;
+    // RESET_REQUEST_BOOTSEL or RESET_REQUEST_FLASH control request.
+    virtual TransportResult reset_request(uint8_t request, uint16_t value) = 0;
+};
+
+// A device to reboot: in BOOTSEL it has a PICOBOOT interface, running an
+// application it may have a reset interface. Either may be null.
+struct RebootTarget {
+    uint16_t product_id = 0;
+    PicobootTransport *picoboot = nullptr;
+    ResetInterfaceTransport *reset = nullptr;
+};
+
+// bootsel_reentered: the device was in BOOTSEL and reboots into it again.
+enum class RebootOutcome { sent, bootsel_requested, bootsel_reentered, already_in_bootsel, no_interface };
+
+constexpr uint32_t kRebootDelayMs = 500;
+// Nothing runs after a reboot back into BOOTSEL, so it only has to outlast the ACK.
+constexpr uint32_t kBootselRebootDelayMs = 10;
+
+// wValue of RESET_REQUEST_BOOTSEL. pico_stdio_usb passes bits 0-6 to
+// reset_usb_boot as the BOOTSEL interfaces to disable; bits 8 and up select an
+// activity LED.
+constexpr uint16_t kResetBootselInterfaceMask = 0x7f;
+constexpr uint16_t kResetBootselDisableMsd = 0x01;
+
+// Reboots into the application (PICOBOOT reboot, else the reset interface's
+// flash request) or, with `bootsel`, into BOOTSEL through the reset interface.
+// With `picoboot_only` as well, BOOTSEL comes up without the mass-storage
+// drive, so the host has nothing to mount or index before PICOBOOT is usable;
+// an RP2350 already in BOOTSEL re-enters it that way with REBOOT2. Any other
+// device already in BOOTSEL is left alone.
+TransportResult reboot_device(const RebootTarget &target, bool bootsel, bool picoboot_only, RebootOutcome &outcome);
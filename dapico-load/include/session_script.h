@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "load_image.h"
+#include "load_plan.h"
+#include "picoboot_transport.h"
+
+enum class ScriptOp { erase, write, read, load, exec, reboot, status, wait_ms, wait_device };
+
+struct ScriptStep {
+    ScriptOp op;
+    uint32_t line = 0;
+    // The command as written, for the step report.
+    std::string text;
+    uint32_t addr = 0;
+    // Erase or read length, reboot delay, wait time or reconnect timeout (ms).
+    uint32_t size = 0;
+    // Output file of a read.
+    std::string filename;
+    // Payload of a write.
+    std::vector<uint8_t> data;
+    // Image and plan of a load.
+    LoadImage image;
+    LoadPlan plan;
+};
+
+// Parses a session script, one command per line ('#' starts a comment):
+//   erase <addr> <size>          write <addr> <file>       read <addr> <size> <file>
+//   load <image>                 exec <addr>               reboot [delay_ms]
+//   status                       wait <ms>                 wait device [timeout_ms]
+// Files to write and images to load are read and planned here, before the
+// session starts, so the steps run back to back. Throws std::runtime_error
+// naming the line on bad commands or unreadable files.
+std::vector<ScriptStep> parse_script(std::istream &input, uint16_t product_id);
+
+struct ScriptEnvironment {
+    uint16_t product_id = kProductIdRp2040UsbBoot;
+    // Clock used to time each step, in microseconds.
+    std::function<double()> now_us;
+    std::function<void(uint32_t ms)> sleep_ms;
+    // Returns the device once it is back in BOOTSEL after an exec or reboot,
+    // or nullptr if it did not reappear within the timeout.
+    std::function<PicobootTransport *(uint32_t timeout_ms)> reconnect;
+};
+
+// Runs the steps in order on one open session, printing each with its time.
+// Stops at the first failure. Returns 0 on success and 1 on failure.
+int run_script(PicobootTransport &transport, const std::vector<ScriptStep> &steps, const ScriptEnvironment &env);
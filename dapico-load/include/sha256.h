@@ -0,0 +1,17 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using Sha256Digest = std::array<uint8_t, 32>;
+
+// FIPS 180-4 SHA-256, portable C++. Used where a hash has to identify content
+// (chunk store keys); block_hash.h is the fast, non-cryptographic one.
+Sha256Digest sha256(const uint8_t *data, size_t size);
+
+// Lower-case hex, 64 characters.
+std::string sha256_hex(const Sha256Digest &digest);
+// Throws std::runtime_error unless `hex` is 64 hex digits.
+Sha256Digest parse_sha256_hex(const std::string &hex);
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "load_plan.h"
+#include "partition_table.h"
+#include "picoboot_transport.h"
+
+// Throughput of a bulk data phase of `bytes`, for links whose speed depends on
+// the transfer size (a hub's transaction translator, a host controller that
+// splits large transfers).
+struct BandwidthPoint {
+    uint32_t bytes;
+    double kib_per_s;
+};
+
+// Full-speed USB bulk/control timing. Defaults follow the 12 Mbit/s frame budget
+// of 19 x 64-byte bulk packets per 1 ms frame.
+struct UsbLinkModel {
+    uint32_t max_packet_size = 64;
+    double packet_us = 1000.0 / 19.0;
+    double transfer_turnaround_us = 125.0;
+    double control_request_us = 1000.0;
+    // Data-phase throughput by size for OUT (host to device) and IN
+    // transfers, interpolated in log2(bytes) and held flat past either end.
+    // Empty keeps the per-packet model.
+    std::vector<BandwidthPoint> out_curve;
+    std::vector<BandwidthPoint> in_curve;
+};
+
+// Bootrom and QSPI flash costs. Erases use 64 KiB block erase when aligned,
+// like the bootrom's flash_range_erase, and 4 KiB sector erase otherwise.
+struct FlashTiming {
+    double command_us = 30.0;
+    double exit_xip_us = 50.0;
+    double sector_erase_us = 45000.0;
+    double block_erase_us = 150000.0;
+    double page_program_us = 400.0;
+    double ram_write_us_per_kib = 2.0;
+    // RP2350 OTP: reading a row, and programming one (set bits only).
+    double otp_read_us_per_row = 1.0;
+    double otp_program_us_per_row = 400.0;
+};
+
+// Host traffic to the BOOTSEL mass-storage drive (a file manager or indexer
+// probing it) every interval_us, 0 for none. Shared, each access holds the
+// link for a read of read_bytes, and one in write_every (drawn from a fixed
+// pseudo-random sequence) is a write that
+// makes the next flash erase or write fail with PICOBOOT_INTERLEAVED_WRITE.
+// Under EXCLUSIVE the drive answers not-ready; after EXCLUSIVE_AND_EJECT the
+// host stops asking.
+struct MassStorageTraffic {
+    double interval_us = 0;
+    uint32_t read_bytes = 32 * 1024;
+    uint32_t write_every = 0;
+};
+
+struct SimDeviceProfile {
+    std::string name;
+    uint16_t product_id = kProductIdRp2040UsbBoot;
+    MemoryLayout layout{kFlashEndRp2040, kSramEndRp2040};
+    UsbLinkModel link{};
+    FlashTiming flash{};
+    // Answered to GET_INFO; the RP2350 profile has an A/B pair.
+    PartitionTable partition_table{};
+    MassStorageTraffic mass_storage{};
+};
+
+SimDeviceProfile sim_profile_rp2040();
+SimDeviceProfile sim_profile_rp2350();
+SimDeviceProfile sim_profile_for_product(uint16_t product_id);
+
+struct SimStats {
+    double elapsed_us = 0;
+    uint32_t commands = 0;
+    uint32_t control_requests = 0;
+    uint32_t failed_commands = 0;
+    uint64_t bytes_out = 0;
+    uint64_t bytes_in = 0;
+    std::array<uint32_t, 256> by_command{};
+    // Mass-storage accesses served, and those refused under exclusive access.
+    uint32_t msd_accesses = 0;
+    uint32_t msd_refused = 0;
+
+    uint32_t count(uint8_t cmd_id) const { return by_command[cmd_id]; }
+};
+
+// Loopback PICOBOOT device. Commands are executed against in-memory flash and
+// SRAM and charged against a simulated clock instead of wall time. A data
+// phase that would outlast timeouts().data_ms fails with kTransportTimeout.
+class SimulatedDevice : public PicobootTransport {
+public:
+    explicit SimulatedDevice(SimDeviceProfile profile);
+
+    TransportResult reset_interface() override;
+    TransportResult get_cmd_status(picoboot_cmd_status &status) override;
+    TransportResult transfer(const picoboot_cmd &cmd, uint8_t *buffer) override;
+
+    const SimDeviceProfile &profile() const { return profile_; }
+    // Changes the link mid-session, as another device on the same hub would.
+    void set_link(const UsbLinkModel &link) { profile_.link = link; }
+    const SimStats &stats() const { return stats_; }
+    void reset_stats() {
+        stats_ = SimStats{};
+        next_msd_us_ = profile_.mass_storage.interval_us;
+    }
+
+    bool read_memory(uint32_t addr, uint8_t *out, uint32_t size) const;
+    bool executed() const { return executed_; }
+    bool rebooted() const { return rebooted_; }
+    uint32_t exec_address() const { return exec_address_; }
+    // Flags and parameters of the last PC_REBOOT2.
+    uint32_t reboot_flags() const { return reboot_flags_; }
+    uint32_t reboot_param0() const { return reboot_param0_; }
+    uint32_t reboot_param1() const { return reboot_param1_; }
+    // The partition the bootrom would boot; a FLASH_UPDATE reboot into the
+    // other slot of its A/B pair makes that slot the booted one.
+    int booted_partition() const { return booted_partition_; }
+    picoboot_exclusive_type exclusive() const { return exclusive_; }
+    // Raw 24-bit OTP rows; empty on RP2040.
+    const std::vector<uint32_t> &otp() const { return otp_; }
+    // Comes back in BOOTSEL after an exec or reboot, as if the running image
+    // had rebooted into it. Flash and SRAM keep their contents; exclusive
+    // access is dropped.
+    void reconnect();
+
+private:
+    double bulk_us(uint32_t bytes) const;
+    double data_phase_us(uint32_t bytes, bool in) const;
+    void serve_mass_storage();
+    uint32_t execute(const picoboot_cmd &cmd, uint8_t *buffer);
+    uint32_t erase_flash(uint32_t addr, uint32_t size);
+    uint32_t write_memory(uint32_t addr, const uint8_t *data, uint32_t size);
+    uint8_t *flash_sector(uint32_t sector_addr);
+    uint32_t otp_access(const picoboot_cmd &cmd, uint8_t *buffer);
+    uint32_t get_info(const picoboot_cmd &cmd, uint8_t *buffer);
+
+    SimDeviceProfile profile_;
+    SimStats stats_{};
+    std::unordered_map<uint32_t, std::vector<uint8_t>> flash_sectors_;
+    std::vector<uint8_t> sram_;
+    std::vector<uint32_t> otp_;
+    picoboot_cmd_status last_status_{};
+    bool halted_ = false;
+    bool xip_exited_ = false;
+    bool executed_ = false;
+    bool rebooted_ = false;
+    uint32_t exec_address_ = 0;
+    uint32_t reboot_flags_ = 0;
+    uint32_t reboot_param0_ = 0;
+    uint32_t reboot_param1_ = 0;
+    int booted_partition_ = 0;
+    picoboot_exclusive_type exclusive_ = NOT_EXCLUSIVE;
+    double next_msd_us_ = 0;
+    uint32_t msd_random_ = 1;
+    bool interleaved_ = false;
+};
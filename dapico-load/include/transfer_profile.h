@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "flash_dump.h"
+#include "loader.h"
+#include "picoboot_transport.h"
+
+// Latency of one PICOBOOT command with a data phase of `bytes`:
+// fixed_us + us_per_byte * bytes, least-squares fitted to a sweep.
+struct LatencyFit {
+    double fixed_us = 0;
+    double us_per_byte = 0;
+
+    double predict_us(uint32_t bytes) const { return fixed_us + us_per_byte * bytes; }
+};
+
+// Transfer sizes and timeouts for one chip (BOOTSEL product ID) on one host,
+// as measured by --autotune.
+struct TransferProfile {
+    uint16_t product_id = 0;
+    std::string host;
+    uint32_t ram_write_chunk = kRamWriteChunkSize;
+    uint32_t flash_write_chunk = kFlashPageSize;
+    uint32_t read_chunk = DumpOptions{}.read_size;
+    LatencyFit write;
+    LatencyFit read;
+    TransferTimeouts timeouts;
+};
+
+struct AutotuneOptions {
+    // SRAM the sweep writes and reads back; a load overwrites it anyway.
+    uint32_t scratch_addr = kSramStart;
+    std::vector<uint32_t> sizes = {256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536};
+    // Commands timed per size and direction; the median counts.
+    uint32_t repeats = 5;
+    // The smallest size within this fraction of the best measured throughput
+    // wins, so a flat curve does not buy ever larger transfers.
+    double plateau = 0.95;
+    // Data-phase timeouts allow this many times the fitted latency, and never
+    // less than min_timeout_ms.
+    double timeout_margin = 4.0;
+    uint32_t min_timeout_ms = 250;
+};
+
+struct SweepPoint {
+    uint32_t bytes = 0;
+    double write_us = 0;
+    double read_us = 0;
+};
+
+struct AutotuneResult {
+    std::vector<SweepPoint> points;
+    TransferProfile profile;
+};
+
+// Times PC_WRITE and PC_READ of each size against scratch SRAM under
+// exclusive access, checks that the bytes read back match, fits a latency
+// model per direction, and picks the chunk sizes and timeouts. `now_us` is
+// the clock: wall time on USB, simulated time on a SimulatedDevice. Failures
+// are reported on stderr.
+TransportResult autotune_transfers(PicobootTransport &transport, uint16_t product_id, const AutotuneOptions &options,
+                                   const std::function<double()> &now_us, AutotuneResult &result);
+
+LatencyFit fit_latency(const std::vector<uint32_t> &bytes, const std::vector<double> &us);
+
+// Profiles measured on a SimulatedDevice are kept under this host name.
+constexpr const char *kSimulatedProfileHost = "sim";
+
+// This host's name, the key profiles are stored under.
+std::string transfer_profile_host();
+// $DAPICO_PROFILES, or ~/.dapico-load-profiles.
+std::string default_transfer_profile_path();
+
+// Profiles from `filename`: one "[0xPID host]" section per chip and host,
+// then key = value lines; '#' starts a comment. A missing file holds no
+// profiles. Throws std::runtime_error on bad content.
+std::vector<TransferProfile> read_transfer_profiles(const std::string &filename);
+// Replaces (or adds) the profile for its chip and host. The file is written
+// to a temporary and renamed over the old one, so readers never see half of it.
+void store_transfer_profile(const std::string &filename, const TransferProfile &profile);
+// The profile for this chip and host, or nullptr.
+const TransferProfile *find_transfer_profile(const std::vector<TransferProfile> &profiles, uint16_t product_id,
+                                             const std::string &host);
+
+// Chunk sizes for a load, and the read size for a dump.
+void apply_transfer_profile(const TransferProfile &profile, LoadOptions &options);
+void apply_transfer_profile(const TransferProfile &profile, DumpOptions &options);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "load_plan.h"
+
+constexpr uint32_t kUf2BlockSize = 512;
+constexpr uint32_t kUf2MaxPayloadSize = 476;
+constexpr uint32_t kUf2MagicStart0 = 0x0a324655;
+constexpr uint32_t kUf2MagicStart1 = 0x9e5d5157;
+constexpr uint32_t kUf2MagicEnd = 0x0ab16f30;
+
+constexpr uint32_t kUf2FlagNotMainFlash = 0x00000001;
+constexpr uint32_t kUf2FlagFileContainer = 0x00001000;
+constexpr uint32_t kUf2FlagFamilyIdPresent = 0x00002000;
+
+constexpr uint32_t kUf2FamilyRp2040 = 0xe48bff56;
+constexpr uint32_t kUf2FamilyAbsolute = 0xe48bff57;
+constexpr uint32_t kUf2FamilyData = 0xe48bff58;
+constexpr uint32_t kUf2FamilyRp2350ArmSecure = 0xe48bff59;
+constexpr uint32_t kUf2FamilyRp2350RiscV = 0xe48bff5a;
+constexpr uint32_t kUf2FamilyRp2350ArmNonSecure = 0xe48bff5b;
+
+// True when the buffer starts with a UF2 block header.
+bool is_uf2(const uint8_t *data, size_t size);
+
+// Indexes the payloads of a UF2 file for the given BOOTSEL product. Blocks for
+// other families, non-flash blocks and file-container blocks are ignored. The
+// returned segments point straight into `data` (one per block), sorted by
+// address; when blocks repeat an address the last one in the file wins. Throws
+// std::runtime_error on malformed or overlapping blocks.
+std::vector<ImageSegment> uf2_image_segments(const uint8_t *data, size_t size, uint16_t product_id);
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "load_image.h"
+#include "load_plan.h"
+#include "picoboot_transport.h"
+
+struct SegmentDigest {
+    uint32_t addr;
+    uint32_t size;
+    uint64_t hash;
+
+    bool operator==(const SegmentDigest &other) const {
+        return addr == other.addr && size == other.size && hash == other.hash;
+    }
+};
+
+std::vector<SegmentDigest> digest_segments(const std::vector<ImageSegment> &segments);
+
+// What one reload sent and how long it took.
+struct WatchCycle {
+    size_t segments = 0;
+    size_t changed_segments = 0;
+    uint32_t flash_sectors = 0;
+    uint64_t ram_bytes = 0;
+    // From the last write to the file to the end of the load, including the
+    // debounce and the device time.
+    double latency_ms = 0;
+    double debounce_ms = 0;
+    // Parsing, hashing and planning.
+    double host_ms = 0;
+    // USB and flash time, measured on the simulated clock when the device is simulated.
+    double device_ms = 0;
+};
+
+// Plans reloads against what the last load left on the device. Segment digests
+// tell which segments changed. Flash keeps its contents between runs, so only
+// the sectors whose bytes differ are erased and rewritten. SRAM does not
+// survive the image running (and the bootrom reusing it), so RAM segments are
+// always sent again.
+class IncrementalPlanner {
+public:
+    IncrementalPlanner(const MemoryLayout &layout, bool allow_flash);
+
+    // The plan that moves the device from the last committed image to this
+    // one: a full plan the first time and after reset(). Fills the segment and
+    // sector counts of `cycle`.
+    LoadPlan plan(const std::vector<ImageSegment> &segments, uint32_t entry_point, WatchCycle &cycle);
+    // False when the image last planned has nothing to write.
+    bool loadable() const;
+    // True when the image last planned matches the one on the device.
+    bool unchanged() const;
+    // The image last planned is now on the device.
+    void commit();
+    // The device contents are unknown (failed load, another board).
+    void reset();
+
+private:
+    MemoryLayout layout_;
+    bool allow_flash_;
+    bool loaded_ = false;
+    std::vector<SegmentDigest> loaded_digests_;
+    std::vector<SegmentDigest> pending_digests_;
+    uint32_t loaded_entry_ = 0;
+    // Full plans; only their flash extents (which own their bytes) are kept.
+    LoadPlan loaded_plan_;
+    LoadPlan pending_plan_;
+};
+
+struct WatchOptions {
+    bool allow_flash = false;
+    bool exec_after = true;
+    ImageOptions image;
+    uint32_t debounce_ms = 30;
+    picoboot_exclusive_type exclusive = EXCLUSIVE;
+    // Stop after this many reloads, not counting the first load; 0 watches
+    // until interrupted.
+    size_t max_reloads = 0;
+};
+
+struct WatchEnvironment {
+    uint16_t product_id = kProductIdRp2040UsbBoot;
+    // Returns the device once it is in BOOTSEL, or nullptr to stop watching.
+    std::function<PicobootTransport *()> acquire;
+    // Simulated device time in microseconds, or empty for a real device, whose
+    // time is part of the wall clock.
+    std::function<double()> device_us;
+    // Called after every reload.
+    std::function<void(const WatchCycle &)> on_reload;
+    // Called after every load attempt, the first included, with its outcome
+    // and device time.
+    std::function<void(bool ok, double device_ms)> on_load;
+};
+
+// Loads `filename`, then reloads it whenever it is rebuilt, sending only what
+// changed. Parse errors (a half-written file) wait for the next change; load
+// failures stop watching. Returns 0 after max_reloads, 1 on failure.
+int run_watch(const std::string &filename, const WatchOptions &options, const WatchEnvironment &env);
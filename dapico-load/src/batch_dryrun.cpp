@@ -0,0 +1,348 @@
+#include "batch_dryrun.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+#include "format_util.h"
+#include "load_image.h"
+#include "load_plan.h"
+
+namespace {
+const char *const kImageSuffixes[] = {".elf", ".elf.gz", ".elf.zst", ".uf2", ".hex"};
+
+bool has_image_suffix(const std::string &name) {
+    for (const char *suffix : kImageSuffixes) {
+        size_t length = std::strlen(suffix);
+        if (name.size() > length && name.compare(name.size() - length, length, suffix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Symlinked directories are not followed, so a link loop cannot recurse.
+void collect_images(const std::string &directory, std::vector<std::string> &files) {
+    DIR *dir = ::opendir(directory.c_str());
+    if (!dir) {
+        throw std::runtime_error("Failed to read directory " + directory + ": " + std::strerror(errno));
+    }
+    std::vector<std::string> subdirectories;
+    while (const dirent *entry = ::readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.empty() || name[0] == '.') {
+            continue;
+        }
+        std::string path = directory + (directory.back() == '/' ? "" : "/") + name;
+        struct stat st {};
+        if (::lstat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            subdirectories.push_back(path);
+        } else if (has_image_suffix(name) && (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))) {
+            files.push_back(path);
+        }
+    }
+    ::closedir(dir);
+    for (const auto &subdirectory : subdirectories) {
+        collect_images(subdirectory, files);
+    }
+}
+
+BatchImageResult check_image(const std::string &filename, const DryrunOptions &options, const MemoryLayout &layout,
+                             const CostModel &model) {
+    BatchImageResult result;
+    result.filename = filename;
+    // Runs on a worker thread: whatever one file throws (std::bad_alloc
+    // included) becomes that file's error rather than ending the batch.
+    LoadImage image;
+    try {
+        image = open_load_image(filename, options.product_id, options.image);
+    } catch (const std::bad_alloc &) {
+        result.error = "Image parse failed: out of memory";
+        return result;
+    } catch (const std::exception &err) {
+        result.error = std::string("Image parse failed: ") + err.what();
+        return result;
+    }
+
+    try {
+        result.entry_point = options.image.entry_point != 0 ? options.image.entry_point : image.entry_point;
+        LoadPlan plan = build_load_plan(image.segments, result.entry_point, layout, options.allow_flash);
+        if (!options.allow_flash && plan.flash_extents.empty() && plan.ram_segments.empty()) {
+            result.error = "No loadable RAM segments found (flash segments skipped).";
+            return result;
+        }
+        if (options.exec_after &&
+            !resolve_exec_address(plan, layout, options.allow_flash, result.exec_addr, result.error)) {
+            return result;
+        }
+        result.estimate = estimate_load_cost(plan, model, dryrun_load_options(options));
+        result.over_budget = options.budget_ms > 0 && result.estimate.predicted_ms > options.budget_ms;
+    } catch (const std::exception &err) {
+        result.error = std::string("Image check failed: ") + err.what();
+    }
+    return result;
+}
+
+// Results by file identity, shared by the workers of a batch.
+class ResultCache {
+public:
+    using Check = std::function<BatchImageResult()>;
+
+    BatchImageResult get(const std::string &filename, const Check &check) {
+        struct stat st {};
+        if (::stat(filename.c_str(), &st) != 0) {
+            return run(check);
+        }
+#if defined(__APPLE__)
+        int64_t mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+        Key key{static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino),
+                static_cast<int64_t>(st.st_size), mtime_ns};
+
+        std::promise<BatchImageResult> checked;
+        std::shared_future<BatchImageResult> result;
+        bool first = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto [it, inserted] = results_.try_emplace(key);
+            if (inserted) {
+                it->second = checked.get_future().share();
+                first = true;
+            }
+            result = it->second;
+        }
+        if (first) {
+            checked.set_value(run(check));
+        }
+        BatchImageResult copy = result.get();
+        copy.filename = filename;
+        return copy;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return results_.size();
+    }
+
+private:
+    using Key = std::tuple<uint64_t, uint64_t, int64_t, int64_t>;
+
+    // The promise is always fulfilled, so workers waiting on the same file
+    // never see a broken promise.
+    static BatchImageResult run(const Check &check) {
+        try {
+            return check();
+        } catch (const std::exception &err) {
+            BatchImageResult failed;
+            failed.error = std::string("Image check failed: ") + err.what();
+            return failed;
+        } catch (...) {
+            BatchImageResult failed;
+            failed.error = "Image check failed";
+            return failed;
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::map<Key, std::shared_future<BatchImageResult>> results_;
+};
+
+struct Totals {
+    size_t ok = 0;
+    size_t failed = 0;
+    size_t over_budget = 0;
+    double predicted_ms = 0;
+    const BatchImageResult *slowest = nullptr;
+};
+
+Totals batch_totals(const BatchReport &report) {
+    Totals totals;
+    for (const auto &image : report.images) {
+        if (!image.error.empty()) {
+            totals.failed++;
+            continue;
+        }
+        (image.over_budget ? totals.over_budget : totals.ok)++;
+        totals.predicted_ms += image.estimate.predicted_ms;
+        if (!totals.slowest || image.estimate.predicted_ms > totals.slowest->estimate.predicted_ms) {
+            totals.slowest = &image;
+        }
+    }
+    return totals;
+}
+
+void print_batch_text(const BatchReport &report, const DryrunOptions &options) {
+    for (const auto &image : report.images) {
+        if (!image.error.empty()) {
+            std::printf("  failed  %s: %s\n", image.filename.c_str(), image.error.c_str());
+            continue;
+        }
+        const CostEstimate &estimate = image.estimate;
+        std::printf("  %-6s  %9.1f ms  %4u commands  %9llu bytes  %s\n", image.over_budget ? "over" : "ok",
+                    estimate.predicted_ms, estimate.commands(),
+                    static_cast<unsigned long long>(estimate.payload_bytes()), image.filename.c_str());
+    }
+
+    Totals totals = batch_totals(report);
+    std::printf("Dry run batch summary:\n");
+    std::printf("  images:    %zu (%zu ok, %zu failed", report.images.size(), totals.ok, totals.failed);
+    if (options.budget_ms > 0) {
+        std::printf(", %zu over the %.1f ms budget", totals.over_budget, options.budget_ms);
+    }
+    std::printf(")\n");
+    if (totals.slowest) {
+        std::printf("  predicted: %.1f ms for all, %.1f ms at most (%s)\n", totals.predicted_ms,
+                    totals.slowest->estimate.predicted_ms, totals.slowest->filename.c_str());
+    }
+    std::printf("  checked:   %zu parsed on %u thread%s in %.1f ms\n", report.parses, report.threads,
+                report.threads == 1 ? "" : "s", report.elapsed_ms);
+}
+
+void print_batch_json(const BatchReport &report, const DryrunOptions &options) {
+    Totals totals = batch_totals(report);
+    std::cout << "{\"chip\":\"" << chip_name_for_product(options.product_id) << "\""
+              << ",\"allow_flash\":" << (options.allow_flash ? "true" : "false")
+              << ",\"images\":" << report.images.size() << ",\"ok\":" << totals.ok
+              << ",\"failed\":" << totals.failed << ",\"over_budget\":" << totals.over_budget
+              << ",\"parses\":" << report.parses << ",\"threads\":" << report.threads;
+    char numbers[96];
+    std::snprintf(numbers, sizeof(numbers), ",\"elapsed_ms\":%.3f,\"predicted_ms\":%.3f", report.elapsed_ms,
+                  totals.predicted_ms);
+    std::cout << numbers;
+    if (options.budget_ms > 0) {
+        std::cout << ",\"budget_ms\":" << options.budget_ms;
+    }
+    std::cout << ",\"results\":[";
+    for (size_t i = 0; i < report.images.size(); ++i) {
+        const BatchImageResult &image = report.images[i];
+        std::cout << (i ? "," : "") << "{\"file\":\"" << json_escape(image.filename) << "\"";
+        if (!image.error.empty()) {
+            std::cout << ",\"error\":\"" << json_escape(image.error) << "\"}";
+            continue;
+        }
+        const CostEstimate &estimate = image.estimate;
+        std::cout << ",\"entry_point\":\"" << hex32(image.entry_point) << "\"";
+        if (options.exec_after) {
+            std::cout << ",\"exec_address\":\"" << hex32(image.exec_addr) << "\"";
+        }
+        std::snprintf(numbers, sizeof(numbers), "%.3f", estimate.predicted_ms);
+        std::cout << ",\"erase_bytes\":" << estimate.erase_bytes << ",\"flash_pages\":" << estimate.flash_pages
+                  << ",\"ram_bytes\":" << estimate.ram_bytes << ",\"flash_bytes\":" << estimate.flash_bytes
+                  << ",\"commands\":" << estimate.commands() << ",\"predicted_ms\":" << numbers;
+        if (options.budget_ms > 0) {
+            std::cout << ",\"within_budget\":" << (image.over_budget ? "false" : "true");
+        }
+        std::cout << "}";
+    }
+    std::cout << "]}\n";
+}
+} // namespace
+
+std::vector<std::string> expand_batch_paths(const std::vector<std::string> &paths) {
+    std::vector<std::string> files;
+    for (const auto &path : paths) {
+        struct stat st {};
+        if (::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            std::vector<std::string> found;
+            collect_images(path, found);
+            std::sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        } else {
+            files.push_back(path);
+        }
+    }
+    return files;
+}
+
+BatchReport validate_images(const std::vector<std::string> &filenames, const DryrunOptions &options,
+                            const CostModel &model, unsigned threads) {
+    auto start = std::chrono::steady_clock::now();
+    MemoryLayout layout = memory_layout_for_product(options.product_id);
+    ResultCache cache;
+    BatchReport report;
+    report.images.resize(filenames.size());
+    report.threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, filenames.size())));
+
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+        for (size_t i = next.fetch_add(1); i < filenames.size(); i = next.fetch_add(1)) {
+            const std::string &filename = filenames[i];
+            report.images[i] = cache.get(filename, [&] { return check_image(filename, options, layout, model); });
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < report.threads; ++t) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (auto &worker : pool) {
+        worker.join();
+    }
+
+    report.parses = cache.size();
+    report.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+int run_dryrun_batch(const std::vector<std::string> &paths, const DryrunOptions &options, unsigned threads) {
+    CostModel cost_model;
+    std::vector<std::string> filenames;
+    try {
+        cost_model = cost_model_for_product(options.product_id, options.cost_model_spec);
+    } catch (const std::runtime_error &err) {
+        std::cerr << "Cost model error: " << err.what() << "\n";
+        return 2;
+    }
+    try {
+        filenames = expand_batch_paths(paths);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+    if (filenames.empty()) {
+        std::cerr << "No image files found.\n";
+        return 1;
+    }
+
+    if (!options.json) {
+        MemoryLayout memory_layout = memory_layout_for_product(options.product_id);
+        std::cout << "Dry run batch: " << filenames.size() << " images, assuming "
+                  << (options.product_id == kProductIdRp2040UsbBoot ? "RP2040" : "RP2350")
+                  << " memory layout (flash end 0x" << std::hex << memory_layout.flash_end << ", SRAM end 0x"
+                  << memory_layout.sram_end << std::dec << ")"
+                  << (options.allow_flash ? ", flash writes allowed" : "") << ".\n";
+        std::cout.flush();
+    }
+    BatchReport report = validate_images(filenames, options, cost_model, threads);
+    if (options.json) {
+        print_batch_json(report, options);
+    } else {
+        print_batch_text(report, options);
+    }
+
+    Totals totals = batch_totals(report);
+    if (totals.failed != 0) {
+        return 1;
+    }
+    return totals.over_budget != 0 ? kDryrunOverBudget : 0;
+}
@@ -0,0 +1,299 @@
+#include "byte_source.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef DAPICO_LOAD_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+constexpr size_t kInputChunkSize = 64 * 1024;
+
+class FdSource : public ByteSource {
+public:
+    explicit FdSource(int fd) : fd_(fd) {}
+
+    size_t read(uint8_t *out, size_t size) override {
+        size_t total = 0;
+        while (total < size) {
+            ssize_t n = ::read(fd_, out + total, size - total);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                throw std::runtime_error(std::string("Read failed: ") + std::strerror(errno));
+            }
+            if (n == 0) {
+                break;
+            }
+            total += static_cast<size_t>(n);
+        }
+        return total;
+    }
+
+private:
+    int fd_;
+};
+
+class MemorySource : public ByteSource {
+public:
+    MemorySource(const uint8_t *data, size_t size) : data_(data), remaining_(size) {}
+
+    size_t read(uint8_t *out, size_t size) override {
+        size_t take = std::min(size, remaining_);
+        std::memcpy(out, data_, take);
+        data_ += take;
+        remaining_ -= take;
+        return take;
+    }
+
+private:
+    const uint8_t *data_;
+    size_t remaining_;
+};
+
+class PrefixedSource : public ByteSource {
+public:
+    PrefixedSource(std::vector<uint8_t> prefix, std::unique_ptr<ByteSource> source)
+        : prefix_(std::move(prefix)), source_(std::move(source)) {}
+
+    size_t read(uint8_t *out, size_t size) override {
+        size_t take = std::min(size, prefix_.size() - used_);
+        std::memcpy(out, prefix_.data() + used_, take);
+        used_ += take;
+        return take + (take < size ? source_->read(out + take, size - take) : 0);
+    }
+
+private:
+    std::vector<uint8_t> prefix_;
+    size_t used_ = 0;
+    std::unique_ptr<ByteSource> source_;
+};
+
+class GzipSource : public ByteSource {
+public:
+    explicit GzipSource(std::unique_ptr<ByteSource> source) : source_(std::move(source)), input_(kInputChunkSize) {
+        // 32 added to the window bits accepts both gzip and zlib headers.
+        if (inflateInit2(&stream_, 15 + 32) != Z_OK) {
+            throw std::runtime_error("Failed to initialize gzip decompression");
+        }
+    }
+
+    ~GzipSource() override { inflateEnd(&stream_); }
+
+    size_t read(uint8_t *out, size_t size) override {
+        stream_.next_out = out;
+        stream_.avail_out = static_cast<uInt>(size);
+        while (stream_.avail_out > 0) {
+            if (stream_.avail_in == 0) {
+                refill();
+            }
+            if (finished_) {
+                if (stream_.avail_in == 0) {
+                    break;
+                }
+                // Another gzip member follows (e.g. concatenated .gz files).
+                inflateReset(&stream_);
+                finished_ = false;
+            }
+            // Inflate runs even without new input: it may still owe output from a match.
+            int ret = inflate(&stream_, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                finished_ = true;
+            } else if (ret == Z_BUF_ERROR && stream_.avail_in == 0) {
+                throw std::runtime_error("Compressed input is truncated");
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                throw std::runtime_error(std::string("gzip: ") + (stream_.msg ? stream_.msg : "corrupt input"));
+            }
+        }
+        return size - stream_.avail_out;
+    }
+
+private:
+    void refill() {
+        size_t n = source_->read(input_.data(), input_.size());
+        stream_.next_in = input_.data();
+        stream_.avail_in = static_cast<uInt>(n);
+    }
+
+    std::unique_ptr<ByteSource> source_;
+    std::vector<uint8_t> input_;
+    z_stream stream_{};
+    bool finished_ = false;
+};
+
+#ifdef DAPICO_LOAD_HAVE_ZSTD
+class ZstdSource : public ByteSource {
+public:
+    explicit ZstdSource(std::unique_ptr<ByteSource> source)
+        : source_(std::move(source)), input_(ZSTD_DStreamInSize()), stream_(ZSTD_createDStream()) {
+        if (!stream_) {
+            throw std::runtime_error("Failed to initialize zstd decompression");
+        }
+    }
+
+    ~ZstdSource() override { ZSTD_freeDStream(stream_); }
+
+    size_t read(uint8_t *out, size_t size) override {
+        ZSTD_outBuffer output{out, size, 0};
+        while (output.pos < output.size) {
+            if (in_.pos == in_.size) {
+                in_ = ZSTD_inBuffer{input_.data(), source_->read(input_.data(), input_.size()), 0};
+            }
+            size_t before = output.pos;
+            size_t ret = ZSTD_decompressStream(stream_, &output, &in_);
+            if (ZSTD_isError(ret)) {
+                throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(ret));
+            }
+            frame_remaining_ = ret;
+            if (in_.size == 0 && output.pos == before) {
+                if (frame_remaining_ != 0) {
+                    throw std::runtime_error("Compressed input is truncated");
+                }
+                break;
+            }
+        }
+        return output.pos;
+    }
+
+private:
+    std::unique_ptr<ByteSource> source_;
+    std::vector<uint8_t> input_;
+    ZSTD_DStream *stream_;
+    ZSTD_inBuffer in_{nullptr, 0, 0};
+    size_t frame_remaining_ = 0;
+};
+#endif
+} // namespace
+
+Compression detect_compression(const uint8_t *data, size_t size) {
+    if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+        return Compression::gzip;
+    }
+    if (size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd) {
+        return Compression::zstd;
+    }
+    return Compression::none;
+}
+
+std::unique_ptr<ByteSource> decompressing_source(std::unique_ptr<ByteSource> source, Compression compression) {
+    switch (compression) {
+    case Compression::gzip:
+        return std::make_unique<GzipSource>(std::move(source));
+    case Compression::zstd:
+#ifdef DAPICO_LOAD_HAVE_ZSTD
+        return std::make_unique<ZstdSource>(std::move(source));
+#else
+        throw std::runtime_error("zstd input is not supported by this build");
+#endif
+    case Compression::none:
+        break;
+    }
+    return source;
+}
+
+std::unique_ptr<ByteSource> fd_source(int fd) {
+    return std::make_unique<FdSource>(fd);
+}
+
+std::unique_ptr<ByteSource> memory_source(const uint8_t *data, size_t size) {
+    return std::make_unique<MemorySource>(data, size);
+}
+
+std::unique_ptr<ByteSource> prefixed_source(std::vector<uint8_t> prefix, std::unique_ptr<ByteSource> source) {
+    return std::make_unique<PrefixedSource>(std::move(prefix), std::move(source));
+}
+
+PreadElfReader::PreadElfReader(const std::string &filename) {
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+    struct stat st {};
+    if (::fstat(fd_, &st) != 0) {
+        int error = errno;
+        ::close(fd_);
+        throw std::runtime_error("Failed to stat " + filename + ": " + std::strerror(error));
+    }
+    size_ = static_cast<uint64_t>(st.st_size);
+}
+
+PreadElfReader::~PreadElfReader() {
+    ::close(fd_);
+}
+
+bool PreadElfReader::read_at(uint64_t offset, uint8_t *out, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::pread(fd_, out, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error(std::string("Read failed: ") + std::strerror(errno));
+        }
+        if (n == 0) {
+            return false;
+        }
+        bytes_read_ += static_cast<uint64_t>(n);
+        offset += static_cast<uint64_t>(n);
+        out += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool MemoryElfReader::read_at(uint64_t offset, uint8_t *out, size_t size) {
+    if (offset > size_ || size > size_ - offset) {
+        return false;
+    }
+    std::memcpy(out, data_ + offset, size);
+    return true;
+}
+
+StreamElfReader::StreamElfReader(ByteSource &source) : source_(source) {}
+
+void StreamElfReader::fill_head() {
+    if (!head_read_) {
+        head_.resize(kElfStreamHeadSize);
+        head_.resize(source_.read(head_.data(), head_.size()));
+        position_ = head_.size();
+        head_read_ = true;
+    }
+}
+
+bool StreamElfReader::read_at(uint64_t offset, uint8_t *out, size_t size) {
+    fill_head();
+    if (offset < head_.size()) {
+        size_t take = static_cast<size_t>(std::min<uint64_t>(size, head_.size() - offset));
+        std::memcpy(out, head_.data() + offset, take);
+        offset += take;
+        out += take;
+        size -= take;
+    }
+    if (size == 0) {
+        return true;
+    }
+    if (offset < position_) {
+        throw std::runtime_error("ELF contents are out of file order; a streamed input cannot seek back");
+    }
+    uint8_t skip[4096];
+    while (position_ < offset) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(sizeof(skip), offset - position_));
+        size_t got = source_.read(skip, want);
+        position_ += got;
+        if (got < want) {
+            return false;
+        }
+    }
+    size_t got = source_.read(out, size);
+    position_ += got;
+    return got == size;
+}
@@ -0,0 +1,419 @@
+#include "chunk_store.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include "format_util.h"
+#include "mapped_file.h"
+
+namespace {
+constexpr uint32_t kWindowSize = 64;
+// log2(kChunkAverageSize). Before the average size a cut needs two more hash
+// bits to match, after it two fewer, which keeps sizes near the average
+// (FastCDC's normalized chunking).
+constexpr int kAverageBits = 12;
+static_assert(uint32_t{1} << kAverageBits == kChunkAverageSize, "kAverageBits must match kChunkAverageSize");
+
+constexpr std::array<uint64_t, 256> make_gear_table() {
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x64617069636f0001ull;
+    for (auto &entry : table) {
+        // splitmix64
+        state += 0x9e3779b97f4a7c15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        entry = z ^ (z >> 31);
+    }
+    return table;
+}
+
+constexpr std::array<uint64_t, 256> kGear = make_gear_table();
+
+// The hash shifts left once per byte, so its top bits depend on the last 64
+// bytes only; those are the ones compared.
+constexpr uint64_t top_bits(int count) {
+    return ~uint64_t{0} << (64 - count);
+}
+
+size_t next_chunk_size(const uint8_t *data, size_t size) {
+    if (size <= kChunkMinSize) {
+        return size;
+    }
+    size_t end = std::min<size_t>(size, kChunkMaxSize);
+    size_t average = std::min<size_t>(size, kChunkAverageSize);
+    uint64_t hash = 0;
+    // Prime the window so the first candidate cut depends on its 64 bytes
+    // only, not on where this chunk started.
+    for (size_t i = kChunkMinSize - kWindowSize; i < kChunkMinSize; ++i) {
+        hash = (hash << 1) + kGear[data[i]];
+    }
+    size_t i = kChunkMinSize;
+    for (; i < average; ++i) {
+        hash = (hash << 1) + kGear[data[i]];
+        if ((hash & top_bits(kAverageBits + 2)) == 0) {
+            return i + 1;
+        }
+    }
+    for (; i < end; ++i) {
+        hash = (hash << 1) + kGear[data[i]];
+        if ((hash & top_bits(kAverageBits - 2)) == 0) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+bool valid_name(const std::string &name) {
+    return !name.empty() && name.find('/') == std::string::npos && name[0] != '.';
+}
+} // namespace
+
+std::vector<uint32_t> content_chunk_sizes(const uint8_t *data, size_t size) {
+    std::vector<uint32_t> sizes;
+    for (size_t offset = 0; offset < size;) {
+        size_t chunk = next_chunk_size(data + offset, size - offset);
+        sizes.push_back(static_cast<uint32_t>(chunk));
+        offset += chunk;
+    }
+    return sizes;
+}
+
+uint64_t ChunkedImage::size() const {
+    uint64_t total = 0;
+    for (const auto &segment : segments) {
+        total += segment.size;
+    }
+    return total;
+}
+
+ChunkDiff diff_chunked_images(const ChunkedImage &old_image, const ChunkedImage &new_image) {
+    std::map<uint32_t, const ChunkRef *> old_at;
+    std::set<Sha256Digest> old_ids;
+    for (const auto &segment : old_image.segments) {
+        uint32_t addr = segment.addr;
+        for (const auto &chunk : segment.chunks) {
+            old_at[addr] = &chunk;
+            old_ids.insert(chunk.id);
+            addr += chunk.size;
+        }
+    }
+
+    ChunkDiff diff;
+    std::vector<Range> changed;
+    std::set<Sha256Digest> counted;
+    for (const auto &segment : new_image.segments) {
+        uint32_t addr = segment.addr;
+        for (const auto &chunk : segment.chunks) {
+            auto old = old_at.find(addr);
+            bool same = old != old_at.end() && old->second->size == chunk.size && old->second->id == chunk.id;
+            if (!same) {
+                changed.push_back(Range{addr, addr + chunk.size});
+            }
+            if (old_ids.count(chunk.id) == 0 && counted.insert(chunk.id).second) {
+                diff.new_chunks++;
+                diff.new_bytes += chunk.size;
+            }
+            addr += chunk.size;
+        }
+    }
+    diff.changed = merge_ranges(std::move(changed));
+    for (const auto &range : diff.changed) {
+        diff.changed_bytes += range.end - range.start;
+    }
+    return diff;
+}
+
+size_t ChunkStore::IdHash::operator()(const Sha256Digest &id) const {
+    size_t value;
+    std::memcpy(&value, id.data(), sizeof(value));
+    return value;
+}
+
+ChunkStore::ChunkStore(std::string directory) : directory_(std::move(directory)) {
+    for (const std::string &path : {directory_, directory_ + "/chunks"}) {
+        if (::mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::runtime_error("Failed to create " + path + ": " + std::strerror(errno));
+        }
+    }
+}
+
+std::string ChunkStore::chunk_path(const Sha256Digest &id) const {
+    std::string hex = sha256_hex(id);
+    return directory_ + "/chunks/" + hex.substr(0, 2) + "/" + hex.substr(2);
+}
+
+std::string ChunkStore::manifest_path(const std::string &name) const {
+    if (directory_.empty()) {
+        throw std::runtime_error("Chunk store has no directory for manifest " + name);
+    }
+    if (!valid_name(name)) {
+        throw std::runtime_error("Invalid manifest name: " + name);
+    }
+    return directory_ + "/" + name + ".chunks";
+}
+
+void ChunkStore::write_chunk_file(const Sha256Digest &id, const uint8_t *data, uint32_t size) const {
+    std::string path = chunk_path(id);
+    struct stat st {};
+    if (::stat(path.c_str(), &st) == 0 && st.st_size == static_cast<off_t>(size)) {
+        return;
+    }
+    std::string subdirectory = path.substr(0, path.rfind('/'));
+    if (::mkdir(subdirectory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Failed to create " + subdirectory + ": " + std::strerror(errno));
+    }
+    // Per process, so two servers sharing the directory never interleave.
+    std::string temp = path + ".tmp." + std::to_string(::getpid());
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Failed to create " + temp);
+        }
+        out.write(reinterpret_cast<const char *>(data), size);
+        if (!out.flush()) {
+            throw std::runtime_error("Failed to write " + temp);
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("Failed to replace " + path);
+    }
+}
+
+ChunkedImage ChunkStore::add(const LoadImage &image) {
+    ChunkedImage chunked;
+    chunked.entry_point = image.entry_point;
+    for (const auto &segment : image.segments) {
+        ChunkedSegment stored{segment.addr, segment.size, {}};
+        const uint8_t *data = segment.data;
+        for (uint32_t size : content_chunk_sizes(segment.data, segment.size)) {
+            ChunkRef ref{sha256(data, size), size};
+            ChunkPtr added;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (chunks_.find(ref.id) == chunks_.end()) {
+                    auto bytes = std::make_shared<const std::vector<uint8_t>>(data, data + size);
+                    added = std::make_shared<const Chunk>(Chunk{bytes->data(), size, bytes});
+                    chunks_.emplace(ref.id, added);
+                    stored_bytes_ += size;
+                }
+            }
+            if (added && !directory_.empty()) {
+                // The copy only covers the write (and keeps another thread
+                // from writing the same file); find_locked maps the file back
+                // when the chunk is loaded. A failed write leaves no chunk.
+                try {
+                    write_chunk_file(ref.id, data, size);
+                } catch (...) {
+                    release(ref.id, added);
+                    throw;
+                }
+                release(ref.id, added);
+            }
+            stored.chunks.push_back(ref);
+            data += size;
+        }
+        chunked.segments.push_back(std::move(stored));
+    }
+    return chunked;
+}
+
+void ChunkStore::release(const Sha256Digest &id, const ChunkPtr &chunk) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = chunks_.find(id);
+    if (it != chunks_.end() && it->second == chunk) {
+        stored_bytes_ -= chunk->size;
+        chunks_.erase(it);
+    }
+}
+
+ChunkStore::ChunkPtr ChunkStore::find_locked(const Sha256Digest &id, uint32_t size) {
+    auto it = chunks_.find(id);
+    if (it != chunks_.end()) {
+        return it->second;
+    }
+    if (directory_.empty()) {
+        throw std::runtime_error("Chunk " + sha256_hex(id) + " is not in the store");
+    }
+    auto mapping = std::make_shared<MappedFile>(chunk_path(id));
+    if (mapping->size() != size) {
+        throw std::runtime_error("Chunk file " + chunk_path(id) + " has the wrong size");
+    }
+    auto chunk = std::make_shared<const Chunk>(Chunk{mapping->data(), size, mapping});
+    chunks_.emplace(id, chunk);
+    stored_bytes_ += size;
+    return chunk;
+}
+
+LoadImage ChunkStore::load(const ChunkedImage &image) {
+    auto held = std::make_shared<std::vector<ChunkPtr>>();
+    LoadImage loaded;
+    loaded.entry_point = image.entry_point;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &segment : image.segments) {
+        uint32_t addr = segment.addr;
+        for (const auto &ref : segment.chunks) {
+            ChunkPtr chunk = find_locked(ref.id, ref.size);
+            loaded.segments.push_back(ImageSegment{addr, chunk->data, chunk->size});
+            held->push_back(std::move(chunk));
+            addr += ref.size;
+        }
+    }
+    loaded.storage = std::move(held);
+    return loaded;
+}
+
+void ChunkStore::save_manifest(const std::string &name, const ChunkedImage &image) const {
+    std::string filename = manifest_path(name);
+    std::string temp = filename + ".tmp." + std::to_string(::getpid());
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Failed to create " + temp);
+        }
+        out << "# dapico chunked image\nentry " << hex32(image.entry_point) << "\n";
+        for (const auto &segment : image.segments) {
+            out << "segment " << hex32(segment.addr) << " " << segment.size << "\n";
+            for (const auto &chunk : segment.chunks) {
+                out << sha256_hex(chunk.id) << " " << chunk.size << "\n";
+            }
+        }
+        if (!out.flush()) {
+            throw std::runtime_error("Failed to write " + temp);
+        }
+    }
+    if (std::rename(temp.c_str(), filename.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("Failed to replace " + filename);
+    }
+}
+
+ChunkedImage ChunkStore::read_manifest(const std::string &name) const {
+    std::string filename = manifest_path(name);
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        throw std::runtime_error("Failed to open " + filename);
+    }
+    ChunkedImage image;
+    std::string line;
+    size_t line_number = 0;
+    uint64_t covered = 0;
+    auto check_segment = [&] {
+        if (!image.segments.empty() && covered != image.segments.back().size) {
+            throw std::runtime_error(filename + ": chunks of segment " + hex32(image.segments.back().addr) +
+                                     " do not add up to its size");
+        }
+        covered = 0;
+    };
+    while (std::getline(in, line)) {
+        line_number++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string first;
+        fields >> first;
+        unsigned long long a = 0;
+        unsigned long long b = 0;
+        bool ok = true;
+        if (first == "entry") {
+            ok = static_cast<bool>(fields >> std::hex >> a) && a <= UINT32_MAX;
+            image.entry_point = static_cast<uint32_t>(a);
+        } else if (first == "segment") {
+            check_segment();
+            ok = static_cast<bool>(fields >> std::hex >> a >> std::dec >> b) && a <= UINT32_MAX && b <= UINT32_MAX;
+            image.segments.push_back(ChunkedSegment{static_cast<uint32_t>(a), static_cast<uint32_t>(b), {}});
+        } else {
+            ok = !image.segments.empty() && static_cast<bool>(fields >> b) && b != 0 && b <= kChunkMaxSize;
+            if (ok) {
+                image.segments.back().chunks.push_back(ChunkRef{parse_sha256_hex(first), static_cast<uint32_t>(b)});
+                covered += b;
+            }
+        }
+        if (!ok) {
+            throw std::runtime_error(filename + ":" + std::to_string(line_number) + ": unexpected line: " + line);
+        }
+    }
+    check_segment();
+    return image;
+}
+
+size_t ChunkStore::prune(const std::vector<const ChunkedImage *> &keep) {
+    std::set<Sha256Digest> kept;
+    for (const ChunkedImage *image : keep) {
+        for (const auto &segment : image->segments) {
+            for (const auto &chunk : segment.chunks) {
+                kept.insert(chunk.id);
+            }
+        }
+    }
+    std::set<Sha256Digest> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = chunks_.begin(); it != chunks_.end();) {
+            if (kept.count(it->first) != 0) {
+                ++it;
+                continue;
+            }
+            stored_bytes_ -= it->second->size;
+            dropped.insert(it->first);
+            it = chunks_.erase(it);
+        }
+    }
+    if (directory_.empty()) {
+        return dropped.size();
+    }
+    // Chunk files this process never loaded are dropped too.
+    std::string root = directory_ + "/chunks";
+    DIR *chunks = ::opendir(root.c_str());
+    if (!chunks) {
+        return dropped.size();
+    }
+    while (const dirent *prefix = ::readdir(chunks)) {
+        std::string prefix_name = prefix->d_name;
+        DIR *files = prefix_name.size() == 2 ? ::opendir((root + "/" + prefix_name).c_str()) : nullptr;
+        if (!files) {
+            continue;
+        }
+        while (const dirent *file = ::readdir(files)) {
+            std::string hex = prefix_name + file->d_name;
+            if (hex.size() != 64) {
+                continue;
+            }
+            try {
+                Sha256Digest id = parse_sha256_hex(hex);
+                if (kept.count(id) == 0 && std::remove(chunk_path(id).c_str()) == 0) {
+                    dropped.insert(id);
+                }
+            } catch (const std::runtime_error &) {
+                // Not a chunk file.
+            }
+        }
+        ::closedir(files);
+    }
+    ::closedir(chunks);
+    return dropped.size();
+}
+
+size_t ChunkStore::chunk_count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return chunks_.size();
+}
+
+uint64_t ChunkStore::stored_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stored_bytes_;
+}
@@ -0,0 +1,160 @@
+#include "cost_model.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "loader.h"
+
+namespace {
+constexpr uint32_t kFlashBlockSize = 65536;
+
+std::string trim(const std::string &value) {
+    size_t begin = value.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return {};
+    }
+    size_t end = value.find_last_not_of(" \t\r\n");
+    return value.substr(begin, end - begin + 1);
+}
+
+void apply_cost_model_entry(CostModel &model, const std::string &entry) {
+    size_t eq = entry.find('=');
+    if (eq == std::string::npos) {
+        throw std::runtime_error("Expected key=value in cost model: " + entry);
+    }
+    std::string key = trim(entry.substr(0, eq));
+    std::string text = trim(entry.substr(eq + 1));
+    char *end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0' || value < 0) {
+        throw std::runtime_error("Invalid cost model value for " + key + ": " + text);
+    }
+
+    if (key == "session_overhead_ms") {
+        model.session_overhead_ms = value;
+    } else if (key == "command_overhead_us") {
+        model.command_overhead_us = value;
+    } else if (key == "bytes_per_second") {
+        if (value == 0) {
+            throw std::runtime_error("bytes_per_second must be positive");
+        }
+        model.bytes_per_second = value;
+    } else if (key == "sector_erase_ms") {
+        model.sector_erase_ms = value;
+    } else if (key == "block_erase_ms") {
+        model.block_erase_ms = value;
+    } else if (key == "page_program_us") {
+        model.page_program_us = value;
+    } else {
+        throw std::runtime_error("Unknown cost model key: " + key);
+    }
+}
+} // namespace
+
+CostModel cost_model_for_profile(const SimDeviceProfile &profile) {
+    const UsbLinkModel &link = profile.link;
+    double small_transfer_us = link.transfer_turnaround_us + link.packet_us;
+
+    CostModel model;
+    model.session_overhead_ms = link.control_request_us / 1000.0;
+    model.command_overhead_us = 2 * small_transfer_us + link.transfer_turnaround_us + profile.flash.command_us;
+    model.bytes_per_second = link.max_packet_size / (link.packet_us / 1e6);
+    model.sector_erase_ms = profile.flash.sector_erase_us / 1000.0;
+    model.block_erase_ms = profile.flash.block_erase_us / 1000.0;
+    model.page_program_us = profile.flash.page_program_us;
+    return model;
+}
+
+void apply_cost_model_spec(CostModel &model, const std::string &spec) {
+    if (spec.find('=') != std::string::npos) {
+        std::stringstream entries(spec);
+        std::string entry;
+        while (std::getline(entries, entry, ',')) {
+            if (!trim(entry).empty()) {
+                apply_cost_model_entry(model, entry);
+            }
+        }
+        return;
+    }
+
+    std::ifstream file(spec);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open cost model: " + spec);
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (!line.empty()) {
+            apply_cost_model_entry(model, line);
+        }
+    }
+}
+
+CostModel cost_model_for_product(uint16_t product_id, const std::string &spec) {
+    CostModel model = cost_model_for_profile(sim_profile_for_product(product_id));
+    if (!spec.empty()) {
+        apply_cost_model_spec(model, spec);
+    }
+    return model;
+}
+
+CostEstimate estimate_load_cost(const LoadPlan &plan, const CostModel &model, const LoadOptions &options) {
+    CostEstimate estimate;
+
+    for (const auto &segment : plan.ram_segments) {
+        estimate.ram_bytes += segment.size;
+    }
+    estimate.ram_write_commands = ram_write_command_count(plan, std::max(options.ram_write_chunk, 1u));
+
+    if (!plan.flash_extents.empty()) {
+        estimate.other_commands++;
+        estimate.flash_pages = static_cast<uint32_t>(plan.flash_page_count());
+        estimate.flash_bytes = static_cast<uint64_t>(estimate.flash_pages) * kFlashPageSize;
+        // Whole pages per write, as the loader sends them.
+        uint32_t flash_chunk = std::max(options.flash_write_chunk / kFlashPageSize, 1u) * kFlashPageSize;
+        for (const auto &extent : plan.flash_extents) {
+            estimate.flash_write_commands +=
+                static_cast<uint32_t>((extent.data.size() + flash_chunk - 1) / flash_chunk);
+        }
+        for (const auto &range : plan.erase_ranges) {
+            estimate.erase_commands++;
+            estimate.erase_bytes += range.end - range.start;
+            // Same split as the bootrom: 64 KiB block erase where aligned, 4 KiB sectors elsewhere.
+            for (uint32_t addr = range.start; addr < range.end;) {
+                if (addr % kFlashBlockSize == 0 && range.end - addr >= kFlashBlockSize) {
+                    estimate.erase_blocks++;
+                    addr += kFlashBlockSize;
+                } else {
+                    estimate.erase_sectors++;
+                    addr += kFlashSectorSize;
+                }
+            }
+        }
+    }
+    if (options.exec_after) {
+        estimate.other_commands++;
+    }
+    // An exec ends exclusive access; otherwise it is released on the way out.
+    if (options.exclusive != NOT_EXCLUSIVE) {
+        estimate.exclusive_commands = options.exec_after ? 1 : 2;
+    }
+    estimate.write_commands = estimate.ram_write_commands + estimate.flash_write_commands;
+
+    double us = model.session_overhead_ms * 1000.0;
+    us += estimate.commands() * model.command_overhead_us;
+    us += estimate.payload_bytes() / model.bytes_per_second * 1e6;
+    us += estimate.erase_sectors * model.sector_erase_ms * 1000.0;
+    us += estimate.erase_blocks * model.block_erase_ms * 1000.0;
+    us += estimate.flash_pages * model.page_program_us;
+    estimate.predicted_ms = us / 1000.0;
+    return estimate;
+}
+
+CostEstimate estimate_load_cost(const LoadPlan &plan, const CostModel &model, bool exec_after) {
+    LoadOptions options;
+    options.exec_after = exec_after;
+    return estimate_load_cost(plan, model, options);
+}
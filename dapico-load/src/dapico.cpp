@@ -0,0 +1,498 @@
+#include "dapico.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+
+#include "device_select.h"
+#include "fleet_reboot.h"
+#include "load_image.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "picoboot_transport.h"
+#include "reboot.h"
+#include "sim_device.h"
+
+#if DAPICO_HAVE_IOKIT
+#include "iokit_device.h"
+#endif
+
+static_assert(sizeof(picoboot_cmd) == 32 && sizeof(picoboot_cmd_status) == 16,
+              "dapico_transport_ops passes PICOBOOT packets in wire format");
+
+struct dapico_device {
+    uint16_t product_id = 0;
+    std::unique_ptr<PicobootTransport> transport;
+    bool xip_exited = false;
+};
+
+namespace {
+constexpr uint32_t kReadChunkSize = kFlashSectorSize;
+
+class CallbackTransport : public PicobootTransport {
+public:
+    CallbackTransport(const dapico_transport_ops &ops, void *ctx) : ops_(ops), ctx_(ctx) {}
+
+    ~CallbackTransport() override {
+        if (ops_.close) {
+            ops_.close(ctx_);
+        }
+    }
+
+    TransportResult reset_interface() override { return ops_.reset_interface ? ops_.reset_interface(ctx_) : 0; }
+
+    TransportResult get_cmd_status(picoboot_cmd_status &status) override {
+        if (!ops_.get_cmd_status) {
+            return kTransportError;
+        }
+        uint8_t raw[sizeof(status)] = {};
+        TransportResult ret = ops_.get_cmd_status(ctx_, raw);
+        std::memcpy(&status, raw, sizeof(status));
+        return ret;
+    }
+
+    TransportResult transfer(const picoboot_cmd &cmd, uint8_t *buffer) override {
+        uint8_t raw[sizeof(cmd)];
+        std::memcpy(raw, &cmd, sizeof(cmd));
+        return ops_.transfer(ctx_, raw, buffer, cmd.dTransferLength);
+    }
+
+private:
+    dapico_transport_ops ops_;
+    void *ctx_;
+};
+
+dapico_status fail(dapico_error *error, dapico_status status, TransportResult transport_result, const char *format,
+                   ...) {
+    if (error) {
+        *error = dapico_error{};
+        error->status = status;
+        error->transport_result = transport_result;
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(error->message, sizeof(error->message), format, args);
+        va_end(args);
+    }
+    return status;
+}
+
+dapico_status succeed(dapico_error *error) {
+    if (error) {
+        *error = dapico_error{};
+    }
+    return DAPICO_OK;
+}
+
+// Classifies a failed transfer. The device is asked for its command status,
+// so a rejected command reports why, then the interface is reset to leave the
+// handle usable for the next call.
+dapico_status transport_failure(dapico_device &device, TransportResult ret, const char *what, dapico_error *error) {
+    if (ret == kTransportNoDevice) {
+        return fail(error, DAPICO_ERROR_NO_DEVICE, ret, "%s failed: device disconnected", what);
+    }
+    picoboot_cmd_status status{};
+    if (device.transport->get_cmd_status(status) != kTransportOk || status.dStatusCode == PICOBOOT_OK) {
+        device.transport->reset_interface();
+        return fail(error, DAPICO_ERROR_TRANSPORT, ret, "%s failed (IOKit error %d)", what, ret);
+    }
+    device.transport->reset_interface();
+    const char *name = picoboot_status_name(status.dStatusCode);
+    fail(error, DAPICO_ERROR_COMMAND, ret, "%s failed: %s", what, name ? name : "unknown PICOBOOT status");
+    if (error) {
+        error->picoboot_status = status.dStatusCode;
+        error->picoboot_cmd_id = status.bCmdId;
+        error->picoboot_token = status.dToken;
+    }
+    return DAPICO_ERROR_COMMAND;
+}
+
+dapico_status exit_xip(dapico_device &device, dapico_error *error) {
+    if (device.xip_exited) {
+        return DAPICO_OK;
+    }
+    TransportResult ret = picoboot_exit_xip(*device.transport);
+    if (ret != kTransportOk) {
+        return transport_failure(device, ret, "Exit XIP", error);
+    }
+    device.xip_exited = true;
+    return DAPICO_OK;
+}
+
+dapico_status open_handle(uint16_t product_id, std::unique_ptr<PicobootTransport> transport, dapico_device **device,
+                          dapico_error *error) {
+    *device = new dapico_device{product_id, std::move(transport)};
+    return succeed(error);
+}
+
+dapico_status load_image(dapico_device &device, LoadImage image, const dapico_load_options &options,
+                         dapico_error *error) {
+    bool allow_flash = (options.flags & DAPICO_LOAD_FLASH) != 0;
+    MemoryLayout layout = memory_layout_for_product(device.product_id);
+    if (options.exec_address != 0) {
+        image.entry_point = options.exec_address;
+    }
+    LoadPlan plan = build_load_plan(image.segments, image.entry_point, layout, allow_flash);
+    if (plan.flash_extents.empty() && plan.ram_segments.empty()) {
+        return fail(error, DAPICO_ERROR_IMAGE, 0,
+                    allow_flash ? "Image has no loadable segments"
+                                : "No loadable RAM segments (flash segments need DAPICO_LOAD_FLASH)");
+    }
+
+    LoadOptions load_options;
+    load_options.exec_after = (options.flags & DAPICO_LOAD_NO_EXEC) == 0;
+    if (load_options.exec_after && !resolve_exec_address(plan, layout, allow_flash, load_options.exec_addr)) {
+        return fail(error, DAPICO_ERROR_IMAGE, 0, "No valid exec address for this image");
+    }
+    if (options.progress) {
+        load_options.progress = [&options](LoadPhase phase, uint64_t done, uint64_t total) {
+            options.progress(options.progress_ctx, static_cast<dapico_load_phase>(phase), done, total);
+        };
+    }
+
+    TransportResult ret = load_plan_to_device(*device.transport, plan, load_options);
+    device.xip_exited = device.xip_exited || !plan.flash_extents.empty();
+    if (ret != kTransportOk) {
+        return transport_failure(device, ret, "Load", error);
+    }
+    return succeed(error);
+}
+
+#if DAPICO_HAVE_IOKIT
+dapico_reboot_outcome public_outcome(RebootOutcome outcome) {
+    return outcome == RebootOutcome::bootsel_requested    ? DAPICO_REBOOT_BOOTSEL_REQUESTED
+           : outcome == RebootOutcome::bootsel_reentered  ? DAPICO_REBOOT_BOOTSEL_REENTERED
+           : outcome == RebootOutcome::already_in_bootsel ? DAPICO_REBOOT_ALREADY_IN_BOOTSEL
+                                                          : DAPICO_REBOOT_SENT;
+}
+
+DeviceSelector device_selector(const dapico_device_filter *filter, uint32_t index) {
+    DeviceSelector selector;
+    if (filter) {
+        selector.filter.serial = filter->serial ? filter->serial : "";
+        selector.filter.location = filter->location;
+    }
+    selector.index = index;
+    return selector;
+}
+#endif
+
+ImageOptions image_options(const dapico_load_options &options) {
+    ImageOptions image;
+    image.raw_binary = (options.flags & DAPICO_LOAD_RAW) != 0;
+    if (options.raw_base != 0) {
+        image.raw_base = options.raw_base;
+    }
+    return image;
+}
+} // namespace
+
+extern "C" {
+
+dapico_status dapico_open_first(dapico_device **device, dapico_error *error) {
+    return dapico_open_selected(nullptr, 0, device, error);
+}
+
+dapico_status dapico_open_selected(const dapico_device_filter *filter, uint32_t index, dapico_device **device,
+                                   dapico_error *error) {
+    if (!device) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device is NULL");
+    }
+    *device = nullptr;
+#if DAPICO_HAVE_IOKIT
+    auto match = find_device(device_selector(filter, index));
+    if (!match) {
+        return fail(error, DAPICO_ERROR_NO_DEVICE, 0, "No matching Raspberry Pi BOOTSEL device found");
+    }
+    return open_handle(match->product_id, std::move(match->transport), device, error);
+#else
+    (void)filter;
+    (void)index;
+    return fail(error, DAPICO_ERROR_NO_BACKEND, 0, "No USB backend on this host; use dapico_open_transport");
+#endif
+}
+
+dapico_status dapico_open_transport(uint16_t product_id, const dapico_transport_ops *ops, void *ctx,
+                                    dapico_device **device, dapico_error *error) {
+    if (!device || !ops || !ops->transfer) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device, ops and ops->transfer are required");
+    }
+    *device = nullptr;
+    if (!is_bootsel_product(product_id)) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "Unsupported product ID 0x%04x", product_id);
+    }
+    return open_handle(product_id, std::make_unique<CallbackTransport>(*ops, ctx), device, error);
+}
+
+dapico_status dapico_open_simulated(uint16_t product_id, dapico_device **device, dapico_error *error) {
+    if (!device) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device is NULL");
+    }
+    *device = nullptr;
+    if (!is_bootsel_product(product_id)) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "Unsupported product ID 0x%04x", product_id);
+    }
+    return open_handle(product_id, std::make_unique<SimulatedDevice>(sim_profile_for_product(product_id)), device,
+                       error);
+}
+
+void dapico_close(dapico_device *device) {
+    delete device;
+}
+
+uint16_t dapico_product_id(const dapico_device *device) {
+    return device ? device->product_id : 0;
+}
+
+dapico_status dapico_load_memory(dapico_device *device, const void *data, size_t size,
+                                 const dapico_load_options *options, dapico_error *error) {
+    if (!device || !data || size == 0) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device and a non-empty buffer are required");
+    }
+    dapico_load_options defaults{};
+    const dapico_load_options &opts = options ? *options : defaults;
+    try {
+        // The load finishes before returning, so the image may borrow the buffer.
+        LoadImage image = load_image_from_memory(static_cast<const uint8_t *>(data), size, nullptr,
+                                                 device->product_id, image_options(opts));
+        return load_image(*device, std::move(image), opts, error);
+    } catch (const std::exception &err) {
+        return fail(error, DAPICO_ERROR_IMAGE, 0, "%s", err.what());
+    }
+}
+
+dapico_status dapico_load_file(dapico_device *device, const char *path, const dapico_load_options *options,
+                               dapico_error *error) {
+    if (!device || !path) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device and path are required");
+    }
+    dapico_load_options defaults{};
+    const dapico_load_options &opts = options ? *options : defaults;
+    try {
+        LoadImage image = open_load_image(path, device->product_id, image_options(opts));
+        return load_image(*device, std::move(image), opts, error);
+    } catch (const std::exception &err) {
+        return fail(error, DAPICO_ERROR_IMAGE, 0, "%s", err.what());
+    }
+}
+
+dapico_status dapico_read(dapico_device *device, uint32_t addr, void *buffer, uint32_t size, dapico_error *error) {
+    if (!device || (!buffer && size != 0)) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device and buffer are required");
+    }
+    if (addr < kSramStart) {
+        dapico_status status = exit_xip(*device, error);
+        if (status != DAPICO_OK) {
+            return status;
+        }
+    }
+    auto *out = static_cast<uint8_t *>(buffer);
+    for (uint32_t offset = 0; offset < size; offset += kReadChunkSize) {
+        uint32_t chunk = std::min(kReadChunkSize, size - offset);
+        TransportResult ret = picoboot_read(*device->transport, addr + offset, out + offset, chunk);
+        if (ret != kTransportOk) {
+            return transport_failure(*device, ret, "Read", error);
+        }
+    }
+    return succeed(error);
+}
+
+dapico_status dapico_write(dapico_device *device, uint32_t addr, const void *data, uint32_t size,
+                           dapico_error *error) {
+    if (!device || (!data && size != 0)) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device and data are required");
+    }
+    const auto *in = static_cast<const uint8_t *>(data);
+    uint32_t chunk_size = kRamWriteChunkSize;
+    if (addr < kSramStart) {
+        if (addr % kFlashPageSize != 0 || size % kFlashPageSize != 0) {
+            return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "Flash writes must cover whole %u-byte pages",
+                        kFlashPageSize);
+        }
+        dapico_status status = exit_xip(*device, error);
+        if (status != DAPICO_OK) {
+            return status;
+        }
+        chunk_size = kFlashPageSize;
+    }
+    for (uint32_t offset = 0; offset < size; offset += chunk_size) {
+        uint32_t chunk = std::min(chunk_size, size - offset);
+        TransportResult ret = picoboot_write(*device->transport, addr + offset, in + offset, chunk);
+        if (ret != kTransportOk) {
+            return transport_failure(*device, ret, "Write", error);
+        }
+    }
+    return succeed(error);
+}
+
+dapico_status dapico_erase(dapico_device *device, uint32_t addr, uint32_t size, dapico_error *error) {
+    if (!device) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device is NULL");
+    }
+    if (addr % kFlashSectorSize != 0 || size % kFlashSectorSize != 0 || size == 0) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "Erase range must be whole %u-byte sectors",
+                    kFlashSectorSize);
+    }
+    dapico_status status = exit_xip(*device, error);
+    if (status != DAPICO_OK) {
+        return status;
+    }
+    TransportResult ret = picoboot_flash_erase(*device->transport, addr, size);
+    if (ret != kTransportOk) {
+        return transport_failure(*device, ret, "Erase", error);
+    }
+    return succeed(error);
+}
+
+dapico_status dapico_exec(dapico_device *device, uint32_t addr, dapico_error *error) {
+    if (!device) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device is NULL");
+    }
+    TransportResult ret = picoboot_exec(*device->transport, addr);
+    if (ret != kTransportOk) {
+        return transport_failure(*device, ret, "Exec", error);
+    }
+    return succeed(error);
+}
+
+dapico_status dapico_reboot(dapico_device *device, dapico_error *error) {
+    if (!device) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "device is NULL");
+    }
+    TransportResult ret = picoboot_reboot(*device->transport, device->product_id, kRebootDelayMs);
+    if (ret != kTransportOk) {
+        return transport_failure(*device, ret, "Reboot", error);
+    }
+    return succeed(error);
+}
+
+dapico_status dapico_reboot_first(int bootsel, int verbose, dapico_reboot_outcome *outcome, dapico_error *error) {
+    return dapico_reboot_first_flags((bootsel ? DAPICO_REBOOT_TO_BOOTSEL : 0u) | (verbose ? DAPICO_REBOOT_VERBOSE : 0u),
+                                     outcome, error);
+}
+
+dapico_status dapico_reboot_first_flags(uint32_t flags, dapico_reboot_outcome *outcome, dapico_error *error) {
+    return dapico_reboot_selected(flags, nullptr, 0, outcome, error);
+}
+
+dapico_status dapico_reboot_selected(uint32_t flags, const dapico_device_filter *filter, uint32_t index,
+                                     dapico_reboot_outcome *outcome, dapico_error *error) {
+#if DAPICO_HAVE_IOKIT
+    auto match = find_reboot_device((flags & DAPICO_REBOOT_VERBOSE) != 0, device_selector(filter, index));
+    if (!match) {
+        return fail(error, DAPICO_ERROR_NO_DEVICE, 0, "No matching Raspberry Pi USB device found.");
+    }
+    RebootOutcome result = RebootOutcome::no_interface;
+    TransportResult ret = reboot_device(match->target(), (flags & DAPICO_REBOOT_TO_BOOTSEL) != 0,
+                                        (flags & DAPICO_REBOOT_PICOBOOT_ONLY) != 0, result);
+    if (result == RebootOutcome::no_interface) {
+        return fail(error, DAPICO_ERROR_NO_DEVICE, ret, "Device does not expose a reset or picoboot interface.");
+    }
+    if (ret != kTransportOk) {
+        return fail(error, DAPICO_ERROR_TRANSPORT, ret, "Reboot request failed (IOReturn %d).", ret);
+    }
+    if (outcome) {
+        *outcome = public_outcome(result);
+    }
+    return succeed(error);
+#else
+    (void)flags;
+    (void)filter;
+    (void)index;
+    (void)outcome;
+    return fail(error, DAPICO_ERROR_NO_BACKEND, 0, "No USB backend on this host");
+#endif
+}
+
+dapico_status dapico_reboot_all(uint32_t flags, const dapico_device_filter *filter, uint32_t timeout_ms,
+                                dapico_reboot_result *results, size_t capacity, size_t *count,
+                                dapico_latency_summary *summary, dapico_error *error) {
+    if (!count || (!results && capacity != 0)) {
+        return fail(error, DAPICO_ERROR_INVALID_ARG, 0, "count and results are required");
+    }
+    *count = 0;
+#if DAPICO_HAVE_IOKIT
+    std::vector<UsbRebootDevice> devices =
+        find_reboot_devices(device_selector(filter, 0).filter, (flags & DAPICO_REBOOT_VERBOSE) != 0);
+    if (devices.empty()) {
+        return fail(error, DAPICO_ERROR_NO_DEVICE, 0, "No matching Raspberry Pi USB device found.");
+    }
+    std::vector<FleetDevice> fleet;
+    for (const auto &device : devices) {
+        fleet.push_back(FleetDevice{device.identity, device.target()});
+    }
+    FleetRebootOptions options;
+    options.bootsel = (flags & DAPICO_REBOOT_TO_BOOTSEL) != 0;
+    options.picoboot_only = (flags & DAPICO_REBOOT_PICOBOOT_ONLY) != 0;
+    options.wait = (flags & DAPICO_REBOOT_WAIT) != 0;
+    options.timeout_ms = timeout_ms;
+    std::vector<FleetRebootResult> fleet_results = reboot_fleet(fleet, options, enumerate_usb_devices);
+
+    *count = fleet_results.size();
+    size_t failed = 0;
+    for (size_t i = 0; i < fleet_results.size(); ++i) {
+        const FleetRebootResult &result = fleet_results[i];
+        failed += result.result != kTransportOk;
+        if (i >= capacity) {
+            continue;
+        }
+        dapico_reboot_result &out = results[i];
+        out = dapico_reboot_result{};
+        std::snprintf(out.serial, sizeof(out.serial), "%s", result.identity.serial.c_str());
+        out.location = result.identity.location;
+        out.product_id = result.identity.product_id;
+        out.outcome = public_outcome(result.outcome);
+        out.transport_result = result.result;
+        out.ready = result.ready;
+        out.ready_ms = result.ready_ms;
+    }
+    if (summary) {
+        LatencySummary latency = summarize_fleet_latency(fleet_results);
+        *summary = dapico_latency_summary{static_cast<uint32_t>(latency.count), latency.p50_ms, latency.p90_ms,
+                                          latency.p99_ms, latency.max_ms};
+    }
+    if (failed) {
+        return fail(error, DAPICO_ERROR_TRANSPORT, 0, "%zu of %zu reboot requests failed.", failed,
+                    fleet_results.size());
+    }
+    return succeed(error);
+#else
+    (void)flags;
+    (void)filter;
+    (void)timeout_ms;
+    (void)summary;
+    return fail(error, DAPICO_ERROR_NO_BACKEND, 0, "No USB backend on this host");
+#endif
+}
+
+const char *dapico_status_name(dapico_status status) {
+    switch (status) {
+    case DAPICO_OK:
+        return "OK";
+    case DAPICO_ERROR_INVALID_ARG:
+        return "INVALID_ARG";
+    case DAPICO_ERROR_NO_DEVICE:
+        return "NO_DEVICE";
+    case DAPICO_ERROR_NO_BACKEND:
+        return "NO_BACKEND";
+    case DAPICO_ERROR_IMAGE:
+        return "IMAGE";
+    case DAPICO_ERROR_TRANSPORT:
+        return "TRANSPORT";
+    case DAPICO_ERROR_COMMAND:
+        return "COMMAND";
+    }
+    return "UNKNOWN";
+}
+
+const char *dapico_picoboot_status_name(uint32_t picoboot_status) {
+    return picoboot_status_name(picoboot_status);
+}
+
+int dapico_api_version(void) {
+    return DAPICO_API_VERSION;
+}
+
+} // extern "C"
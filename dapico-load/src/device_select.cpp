@@ -0,0 +1,72 @@
+#include "device_select.h"
+
+#include <algorithm>
+
+#include "load_plan.h"
+
+bool DeviceFilter::matches(const UsbDeviceIdentity &identity) const {
+    if (!serial.empty() && identity.serial != serial) {
+        return false;
+    }
+    if (location == 0) {
+        return true;
+    }
+    // Compare down to the filter's last non-zero nibble, so a hub matches its ports.
+    uint32_t mask = 0xffffffffu;
+    while ((mask << 4) != 0 && (location & ~(mask << 4)) == 0) {
+        mask <<= 4;
+    }
+    return (identity.location & mask) == location;
+}
+
+bool is_bootsel_product(uint16_t product_id) {
+    return product_id == kProductIdRp2040UsbBoot || product_id == kProductIdRp2350UsbBoot;
+}
+
+bool is_application_product(uint16_t product_id) {
+    return product_id == kProductIdRp2040StdioUsb || product_id == kProductIdRp2350StdioUsb;
+}
+
+std::vector<UsbDeviceEntry> matching_devices(const std::vector<UsbDeviceEntry> &entries, const DeviceFilter &filter,
+                                             ProductFilter accept) {
+    std::vector<UsbDeviceEntry> matches;
+    for (const auto &entry : entries) {
+        if (accept(entry.identity.product_id) && filter.matches(entry.identity)) {
+            matches.push_back(entry);
+        }
+    }
+    std::sort(matches.begin(), matches.end(), [](const UsbDeviceEntry &a, const UsbDeviceEntry &b) {
+        if (a.identity.location != b.identity.location) {
+            return a.identity.location < b.identity.location;
+        }
+        return a.identity.serial < b.identity.serial;
+    });
+    return matches;
+}
+
+std::optional<UsbDeviceEntry> select_device(const std::vector<UsbDeviceEntry> &entries,
+                                            const DeviceSelector &selector, ProductFilter accept) {
+    std::vector<UsbDeviceEntry> matches = matching_devices(entries, selector.filter, accept);
+    if (selector.index >= matches.size()) {
+        return std::nullopt;
+    }
+    return matches[selector.index];
+}
+
+std::optional<std::vector<UsbDeviceEntry>> DeviceEnumerationCache::cached() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_;
+}
+
+std::vector<UsbDeviceEntry> DeviceEnumerationCache::refresh() {
+    std::vector<UsbDeviceEntry> entries = enumerate_();
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_ = entries;
+    enumerations_++;
+    return entries;
+}
+
+size_t DeviceEnumerationCache::enumerations() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return enumerations_;
+}
@@ -1,210 +1,219 @@
 #include <algorithm>
 #include <cstdint>
-#include <fstream>
+#include <cstdio>
 #include <iostream>
-#include <map>
-#include <memory>
 #include <stdexcept>
 #include <string>
-#include <vector>
 
+#include "cost_model.h"
 #include "dryrun.h"
-#include "elf/elf.h"
+#include "format_util.h"
+#include "load_image.h"
+#include "load_plan.h"
+#include "patch_overlay.h"
 
 namespace {
-constexpr uint32_t kFlashSectorSize = 4096;
-constexpr uint32_t kFlashPageSize = 256;
-constexpr uint32_t kFlashStart = 0x10000000;
-constexpr uint32_t kSramStart = 0x20000000;
-constexpr uint32_t kFlashEndRp2040 = 0x11000000;
-constexpr uint32_t kSramEndRp2040 = 0x20042000;
-
-struct Range {
-    uint32_t start;
-    uint32_t end;
-};
-
-struct MemoryLayout {
-    uint32_t flash_end;
-    uint32_t sram_end;
-};
-
-uint32_t align_down(uint32_t value, uint32_t align) {
-    return value & ~(align - 1);
-}
+void print_operations(const LoadPlan &plan) {
+    if (!plan.flash_extents.empty()) {
+        std::cout << "Dry run: would exit XIP mode.\n";
+        for (const auto &range : plan.erase_ranges) {
+            std::cout << "Dry run: would erase flash 0x" << std::hex << range.start << "-0x" << range.end << " ("
+                      << std::dec << (range.end - range.start) << " bytes).\n";
+        }
+    }
 
-uint32_t align_up(uint32_t value, uint32_t align) {
-    return (value + align - 1) & ~(align - 1);
-}
+    for (const auto &segment : plan.ram_segments) {
+        std::cout << "Dry run: would write RAM 0x" << std::hex << segment.addr << " (" << std::dec << segment.size
+                  << " bytes).\n";
+    }
 
-bool is_flash_address(uint32_t addr, const MemoryLayout &layout) {
-    return addr >= kFlashStart && addr < layout.flash_end;
+    for (const auto &extent : plan.flash_extents) {
+        for (uint32_t offset = 0; offset < extent.data.size(); offset += kFlashPageSize) {
+            std::cout << "Dry run: would write flash page 0x" << std::hex << (extent.addr + offset) << " ("
+                      << std::dec << kFlashPageSize << " bytes).\n";
+        }
+    }
 }
 
-bool is_sram_address(uint32_t addr, const MemoryLayout &layout) {
-    return addr >= kSramStart && addr < layout.sram_end;
+void print_summary(const CostEstimate &estimate) {
+    std::cout << "Dry run summary:\n"
+              << "  erase:     " << estimate.erase_commands << " PC_FLASH_ERASE, " << estimate.erase_bytes
+              << " bytes\n"
+              << "  writes:    " << estimate.write_commands << " PC_WRITE (" << estimate.ram_write_commands
+              << " RAM, " << estimate.flash_write_commands << " flash), " << estimate.flash_pages
+              << " flash pages\n"
+              << "  payload:   " << estimate.payload_bytes() << " bytes (" << estimate.ram_bytes << " RAM, "
+              << estimate.flash_bytes << " flash)\n"
+              << "  commands:  " << estimate.commands() << "\n";
+    std::printf("  predicted: %.1f ms\n", estimate.predicted_ms);
 }
 
-uint32_t segment_address(const elf32_ph_entry &segment) {
-    if (segment.paddr != 0) {
-        return segment.paddr;
+void print_json(const std::vector<std::string> &filenames, const DryrunOptions &options, const LoadPlan &plan,
+                const CostEstimate &estimate, bool has_exec, uint32_t exec_addr, double sequential_ms,
+                uint32_t patched_pages) {
+    std::cout << "{\"file\":\"" << json_escape(filenames.front()) << "\"";
+    if (filenames.size() > 1) {
+        std::cout << ",\"files\":[";
+        for (size_t i = 0; i < filenames.size(); ++i) {
+            std::cout << (i ? "," : "") << "\"" << json_escape(filenames[i]) << "\"";
+        }
+        std::cout << "]";
     }
-    return segment.vaddr;
-}
-
-bool map_flash_to_sram(uint32_t addr, uint32_t size, const MemoryLayout &layout, uint32_t &mapped_addr) {
-    if (addr < kFlashStart) {
-        return false;
+    std::cout
+              << ",\"chip\":\"" << chip_name_for_product(options.product_id) << "\""
+              << ",\"allow_flash\":" << (options.allow_flash ? "true" : "false")
+              << ",\"mirrored_flash_segments\":" << (plan.mirrored_flash_segments ? "true" : "false")
+              << ",\"skipped_flash_segments\":" << (plan.skipped_flash_segments ? "true" : "false")
+              << ",\"entry_point\":\"" << hex32(plan.entry_point) << "\"";
+    if (has_exec) {
+        std::cout << ",\"exec_address\":\"" << hex32(exec_addr) << "\"";
     }
-    uint32_t offset = addr - kFlashStart;
-    mapped_addr = kSramStart + offset;
-    if (mapped_addr < kSramStart || mapped_addr + size > layout.sram_end) {
-        return false;
+    std::cout << ",\"erase_commands\":" << estimate.erase_commands << ",\"erase_bytes\":" << estimate.erase_bytes
+              << ",\"write_commands\":" << estimate.write_commands
+              << ",\"ram_write_commands\":" << estimate.ram_write_commands
+              << ",\"flash_write_commands\":" << estimate.flash_write_commands
+              << ",\"exclusive_commands\":" << estimate.exclusive_commands
+              << ",\"flash_pages\":" << estimate.flash_pages << ",\"ram_bytes\":" << estimate.ram_bytes
+              << ",\"flash_bytes\":" << estimate.flash_bytes << ",\"payload_bytes\":" << estimate.payload_bytes()
+              << ",\"commands\":" << estimate.commands();
+    char predicted[32];
+    std::snprintf(predicted, sizeof(predicted), "%.3f", estimate.predicted_ms);
+    std::cout << ",\"predicted_ms\":" << predicted;
+    if (filenames.size() > 1) {
+        char sequential[64];
+        std::snprintf(sequential, sizeof(sequential), "%.3f,\"saved_ms\":%.3f", sequential_ms,
+                      sequential_ms - estimate.predicted_ms);
+        std::cout << ",\"sequential_ms\":" << sequential;
     }
-    return true;
-}
-
-std::vector<Range> merge_ranges(std::vector<Range> ranges) {
-    if (ranges.empty()) {
-        return ranges;
-    }
-    std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) { return a.start < b.start; });
-    std::vector<Range> merged;
-    merged.push_back(ranges.front());
-    for (size_t i = 1; i < ranges.size(); ++i) {
-        Range &last = merged.back();
-        if (ranges[i].start <= last.end) {
-            last.end = std::max(last.end, ranges[i].end);
-        } else {
-            merged.push_back(ranges[i]);
-        }
+    if (!options.unit_patches.empty()) {
+        std::cout << ",\"units\":" << options.unit_patches.size() << ",\"patched_pages\":" << patched_pages;
+    }
+    if (options.budget_ms > 0) {
+        std::cout << ",\"budget_ms\":" << options.budget_ms
+                  << ",\"within_budget\":" << (estimate.predicted_ms <= options.budget_ms ? "true" : "false");
     }
-    return merged;
+    std::cout << "}\n";
 }
 } // namespace
 
-int run_dryrun(const std::string &filename, bool allow_flash, bool exec_after) {
-    MemoryLayout memory_layout{kFlashEndRp2040, kSramEndRp2040};
-    std::cout << "Dry run: assuming RP2040 memory layout (flash end 0x" << std::hex << memory_layout.flash_end
-              << ", SRAM end 0x" << memory_layout.sram_end << ").\n";
+LoadOptions dryrun_load_options(const DryrunOptions &options) {
+    LoadOptions load;
+    load.exec_after = options.exec_after;
+    load.exclusive = options.exclusive;
+    load.ram_write_chunk = options.ram_write_chunk;
+    load.flash_write_chunk = options.flash_write_chunk;
+    return load;
+}
 
-    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> ram_segments;
-    std::map<uint32_t, std::vector<uint8_t>> flash_pages;
-    std::vector<Range> flash_erase_ranges;
-    bool skipped_flash_segments = false;
-    bool mirrored_flash_segments = false;
-    uint32_t entry_point = 0;
+double estimate_sequential_ms(const ImageSet &set, const MemoryLayout &layout, bool allow_flash,
+                              const LoadOptions &options, const CostModel &model) {
+    double total_ms = 0;
+    LoadOptions each = options;
+    for (size_t i = 0; i < set.images.size(); ++i) {
+        const LoadImage &image = set.images[i];
+        LoadPlan plan = build_load_plan(image.segments, image.entry_point, layout, allow_flash);
+        each.exec_after = options.exec_after && i + 1 == set.images.size();
+        total_ms += estimate_load_cost(plan, model, each).predicted_ms;
+    }
+    return total_ms;
+}
 
+int run_dryrun(const std::vector<std::string> &filenames, const DryrunOptions &options) {
+    MemoryLayout memory_layout = memory_layout_for_product(options.product_id);
+    CostModel cost_model;
     try {
-        auto stream = std::make_shared<std::fstream>(filename, std::ios::in | std::ios::binary);
-        if (!stream->is_open()) {
-            throw std::runtime_error("Failed to open file: " + filename);
+        cost_model = cost_model_for_product(options.product_id, options.cost_model_spec);
+    } catch (const std::runtime_error &err) {
+        std::cerr << "Cost model error: " << err.what() << "\n";
+        return 2;
+    }
+    if (!options.json) {
+        std::cout << "Dry run: assuming " << (options.product_id == kProductIdRp2040UsbBoot ? "RP2040" : "RP2350")
+                  << " memory layout (flash end 0x" << std::hex << memory_layout.flash_end << ", SRAM end 0x"
+                  << memory_layout.sram_end << std::dec << ").\n";
+        if (options.ram_write_chunk != kRamWriteChunkSize || options.flash_write_chunk != kFlashPageSize) {
+            std::cout << "Dry run: counting " << options.ram_write_chunk << "-byte RAM writes and "
+                      << options.flash_write_chunk << "-byte flash writes from the transfer profile.\n";
         }
-        elf_file elf;
-        elf.read_file(stream);
+    }
 
-        entry_point = elf.header().entry;
-        for (const auto &segment : elf.segments()) {
-            if (!segment.is_load() || segment.filez == 0) {
-                continue;
-            }
-            uint32_t addr = segment_address(segment);
-            if (addr == 0) {
-                throw std::runtime_error("ELF segment has no load address");
-            }
-            std::vector<uint8_t> data = elf.content(segment);
-            if (data.empty()) {
-                continue;
-            }
-            if (is_flash_address(addr, memory_layout)) {
-                if (!allow_flash) {
-                    uint32_t mapped_addr = 0;
-                    if (!map_flash_to_sram(addr, static_cast<uint32_t>(data.size()), memory_layout, mapped_addr)) {
-                        skipped_flash_segments = true;
-                        continue;
-                    }
-                    mirrored_flash_segments = true;
-                    ram_segments.emplace_back(mapped_addr, std::move(data));
-                    continue;
-                }
-                uint32_t end = addr + static_cast<uint32_t>(data.size());
-                uint32_t erase_start = align_down(addr, kFlashSectorSize);
-                uint32_t erase_end = align_up(end, kFlashSectorSize);
-                flash_erase_ranges.push_back(Range{erase_start, erase_end});
-                for (size_t i = 0; i < data.size(); ++i) {
-                    uint32_t byte_addr = addr + static_cast<uint32_t>(i);
-                    uint32_t page_base = align_down(byte_addr, kFlashPageSize);
-                    uint32_t page_offset = byte_addr - page_base;
-                    auto &page = flash_pages[page_base];
-                    if (page.empty()) {
-                        page.assign(kFlashPageSize, 0);
-                    }
-                    page[page_offset] = data[i];
-                }
-            } else {
-                ram_segments.emplace_back(addr, std::move(data));
-            }
+    ImageSet images;
+    LoadPlan plan;
+    double sequential_ms = 0;
+    try {
+        images = open_image_set(filenames, options.product_id, options.image);
+        plan = build_load_plan(images.segments, images.entry_point, memory_layout, options.allow_flash);
+        if (images.images.size() > 1) {
+            sequential_ms = estimate_sequential_ms(images, memory_layout, options.allow_flash,
+                                                   dryrun_load_options(options), cost_model);
         }
     } catch (const std::runtime_error &err) {
-        std::cerr << "ELF parse failed: " << err.what() << "\n";
+        std::cerr << "Image parse failed: " << err.what() << "\n";
         return 1;
     }
 
-    if (!allow_flash && flash_pages.empty() && ram_segments.empty()) {
+    if (!options.allow_flash && plan.flash_extents.empty() && plan.ram_segments.empty()) {
         std::cerr << "No loadable RAM segments found (flash segments skipped). Use --flash to enable flash writes.\n";
         return 1;
     }
-    if (mirrored_flash_segments) {
-        std::cout << "Mirroring flash segments into SRAM (use --flash to write flash instead).\n";
-    }
-    if (skipped_flash_segments) {
-        std::cout << "Skipping flash segments that do not fit in SRAM (use --flash to enable flash writes).\n";
-    }
-
-    if (!flash_pages.empty()) {
-        std::cout << "Dry run: would exit XIP mode.\n";
-        auto merged_ranges = merge_ranges(std::move(flash_erase_ranges));
-        for (const auto &range : merged_ranges) {
-            std::cout << "Dry run: would erase flash 0x" << std::hex << range.start << "-0x" << range.end << " ("
-                      << std::dec << (range.end - range.start) << " bytes).\n";
+    if (!options.json) {
+        if (plan.mirrored_flash_segments) {
+            std::cout << "Mirroring flash segments into SRAM (use --flash to write flash instead).\n";
+        }
+        if (plan.skipped_flash_segments) {
+            std::cout << "Skipping flash segments that do not fit in SRAM (use --flash to enable flash writes).\n";
+        }
+        if (options.verbose) {
+            print_operations(plan);
         }
     }
 
-    for (const auto &segment : ram_segments) {
-        uint32_t addr = segment.first;
-        const auto &data = segment.second;
-        std::cout << "Dry run: would write RAM 0x" << std::hex << addr << " (" << std::dec << data.size()
-                  << " bytes).\n";
+    // Patches change page contents only, so every unit costs the same as the
+    // shared plan; check that each unit's patches land inside it.
+    uint32_t patched_pages = 0;
+    uint32_t patched_bytes = 0;
+    for (size_t unit = 0; unit < options.unit_patches.size(); ++unit) {
+        try {
+            PatchOverlay overlay(plan, options.unit_patches[unit]);
+            patched_pages = std::max(patched_pages, overlay.patched_pages());
+            patched_bytes = std::max(patched_bytes, overlay.patched_bytes());
+        } catch (const std::runtime_error &err) {
+            std::cerr << "Unit " << (unit + 1) << ": " << err.what() << "\n";
+            return 1;
+        }
     }
 
-    for (const auto &page : flash_pages) {
-        std::cout << "Dry run: would write flash page 0x" << std::hex << page.first << " (" << std::dec
-                  << page.second.size() << " bytes).\n";
+    uint32_t exec_addr = 0;
+    if (options.exec_after && !resolve_exec_address(plan, memory_layout, options.allow_flash, exec_addr)) {
+        return 1;
     }
 
-    if (exec_after) {
-        if (entry_point == 0) {
-            std::cerr << "ELF entry point is zero; cannot execute.\n";
-            return 1;
+    CostEstimate estimate = estimate_load_cost(plan, cost_model, dryrun_load_options(options));
+    if (options.json) {
+        print_json(filenames, options, plan, estimate, options.exec_after, exec_addr, sequential_ms, patched_pages);
+    } else {
+        if (options.exec_after) {
+            std::cout << "Dry run: would execute at 0x" << std::hex << exec_addr << std::dec << ".\n";
         }
-        uint32_t exec_addr = entry_point;
-        if (!allow_flash && is_flash_address(entry_point, memory_layout)) {
-            uint32_t mapped_addr = 0;
-            if (map_flash_to_sram(entry_point, 4, memory_layout, mapped_addr)) {
-                exec_addr = mapped_addr;
-            } else {
-                std::cerr << "Entry point 0x" << std::hex << entry_point
-                          << " cannot be mirrored into SRAM. Use --flash to run from flash.\n";
-                return 1;
-            }
-        } else if (!allow_flash && !is_sram_address(entry_point, memory_layout) &&
-                   !is_flash_address(entry_point, memory_layout)) {
-            std::cerr << "Entry point 0x" << std::hex << entry_point << " is not in flash or SRAM.\n";
-            return 1;
+        print_summary(estimate);
+        if (images.images.size() > 1) {
+            std::printf("  separate:  %.1f ms predicted as %zu sequential loads (one session saves %.1f ms)\n",
+                        sequential_ms, images.images.size(), sequential_ms - estimate.predicted_ms);
+        }
+        if (!options.unit_patches.empty()) {
+            std::printf("  patches:   %zu units, up to %u bytes in %u pages each (%.1f s for all units)\n",
+                        options.unit_patches.size(), patched_bytes, patched_pages,
+                        estimate.predicted_ms * options.unit_patches.size() / 1000.0);
         }
-        std::cout << "Dry run: would execute at 0x" << std::hex << exec_addr << ".\n";
     }
 
-    std::cout << "Dry run complete.\n";
+    if (options.budget_ms > 0 && estimate.predicted_ms > options.budget_ms) {
+        std::fprintf(stderr, "Predicted load time %.1f ms exceeds budget of %.1f ms.\n", estimate.predicted_ms,
+                     options.budget_ms);
+        return kDryrunOverBudget;
+    }
+    if (!options.json) {
+        std::cout << "Dry run complete.\n";
+    }
     return 0;
 }
@@ -1,111 +1,165 @@
 #include "elf/elf.h"
 
 #include <algorithm>
-#include <limits>
 #include <stdexcept>
 
 namespace {
 constexpr size_t kElfHeaderSize = 52;
 constexpr size_t kIdentSize = 16;
+constexpr size_t kPhEntrySize = 32;
 constexpr uint8_t kElfClass32 = 1;
 constexpr uint8_t kElfDataLittleEndian = 1;
+// Buffer growth step when reading from a stream of unknown length.
+constexpr uint64_t kStreamReadStep = 1024 * 1024;
 
-uint16_t read_u16(const std::vector<uint8_t> &data, size_t offset) {
-    if (offset + 2 > data.size()) {
-        throw std::runtime_error("ELF file too small");
-    }
-    return static_cast<uint16_t>(data[offset]) |
-           (static_cast<uint16_t>(data[offset + 1]) << 8);
+uint16_t read_u16(const uint8_t *data) {
+    return static_cast<uint16_t>(data[0]) | (static_cast<uint16_t>(data[1]) << 8);
+}
+
+uint32_t read_u32(const uint8_t *data) {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
 }
 
-uint32_t read_u32(const std::vector<uint8_t> &data, size_t offset) {
-    if (offset + 4 > data.size()) {
-        throw std::runtime_error("ELF file too small");
+// Reads `size` bytes at `offset` into `out`; false if the file is too short.
+// A range past a known file size is refused before anything is allocated, and
+// a stream is read in steps, so a corrupt header cannot allocate much more
+// than the stream actually holds.
+bool read_range(elf_reader &reader, uint64_t offset, uint64_t size, std::vector<uint8_t> &out) {
+    uint64_t file_size = reader.size();
+    if (file_size != elf_reader::kUnknownSize) {
+        if (offset > file_size || size > file_size - offset) {
+            return false;
+        }
+        out.resize(static_cast<size_t>(size));
+        return reader.read_at(offset, out.data(), out.size());
     }
-    return static_cast<uint32_t>(data[offset]) |
-           (static_cast<uint32_t>(data[offset + 1]) << 8) |
-           (static_cast<uint32_t>(data[offset + 2]) << 16) |
-           (static_cast<uint32_t>(data[offset + 3]) << 24);
+    out.clear();
+    while (out.size() < size) {
+        size_t done = out.size();
+        size_t step = static_cast<size_t>(std::min<uint64_t>(size - done, kStreamReadStep));
+        out.resize(done + step);
+        if (!reader.read_at(offset + done, out.data() + done, step)) {
+            return false;
+        }
+    }
+    return true;
 }
+
+class istream_reader : public elf_reader {
+public:
+    explicit istream_reader(std::istream &stream) : stream_(stream) {}
+
+    bool read_at(uint64_t offset, uint8_t *out, size_t size) override {
+        stream_.clear();
+        stream_.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+        stream_.read(reinterpret_cast<char *>(out), static_cast<std::streamsize>(size));
+        return static_cast<size_t>(stream_.gcount()) == size;
+    }
+
+private:
+    std::istream &stream_;
+};
 }
 
 void elf_file::read_file(const std::shared_ptr<std::istream> &stream) {
     if (!stream || !*stream) {
         throw std::runtime_error("Invalid ELF stream");
     }
+    istream_reader reader(*stream);
+    read(reader);
+}
 
-    stream->seekg(0, std::ios::end);
-    std::streamoff size = stream->tellg();
-    if (size <= 0) {
+void elf_file::read(elf_reader &reader) {
+    uint8_t header[kElfHeaderSize];
+    if (!reader.read_at(0, header, kIdentSize)) {
         throw std::runtime_error("ELF file is empty");
     }
-    if (static_cast<uint64_t>(size) > std::numeric_limits<size_t>::max()) {
-        throw std::runtime_error("ELF file too large");
-    }
-    stream->seekg(0, std::ios::beg);
-
-    data_.assign(static_cast<size_t>(size), 0);
-    stream->read(reinterpret_cast<char *>(data_.data()), size);
-    if (!*stream) {
-        throw std::runtime_error("Failed to read ELF file");
-    }
-
-    if (data_.size() < kElfHeaderSize) {
-        throw std::runtime_error("ELF header truncated");
-    }
-
-    if (data_[0] != 0x7f || data_[1] != 'E' || data_[2] != 'L' || data_[3] != 'F') {
+    if (header[0] != 0x7f || header[1] != 'E' || header[2] != 'L' || header[3] != 'F') {
         throw std::runtime_error("Missing ELF magic");
     }
-    if (data_[4] != kElfClass32) {
+    if (header[4] != kElfClass32) {
         throw std::runtime_error("Unsupported ELF class");
     }
-    if (data_[5] != kElfDataLittleEndian) {
+    if (header[5] != kElfDataLittleEndian) {
         throw std::runtime_error("Unsupported ELF endian");
     }
+    if (!reader.read_at(kIdentSize, header + kIdentSize, kElfHeaderSize - kIdentSize)) {
+        throw std::runtime_error("ELF header truncated");
+    }
 
-    header_.entry = read_u32(data_, 24);
-    header_.phoff = read_u32(data_, 28);
-    header_.phentsize = read_u16(data_, 42);
-    header_.phnum = read_u16(data_, 44);
+    header_.entry = read_u32(header + 24);
+    header_.phoff = read_u32(header + 28);
+    header_.phentsize = read_u16(header + 42);
+    header_.phnum = read_u16(header + 44);
 
-    if (header_.phoff < kIdentSize || header_.phentsize == 0) {
+    if (header_.phoff < kIdentSize || header_.phentsize < kPhEntrySize) {
         throw std::runtime_error("ELF program header table missing");
     }
 
-    size_t ph_table_size = static_cast<size_t>(header_.phentsize) * header_.phnum;
-    if (header_.phoff + ph_table_size > data_.size()) {
+    std::vector<uint8_t> table;
+    if (!read_range(reader, header_.phoff, static_cast<uint64_t>(header_.phentsize) * header_.phnum, table)) {
         throw std::runtime_error("ELF program header table truncated");
     }
 
     segments_.clear();
     segments_.reserve(header_.phnum);
     for (uint16_t i = 0; i < header_.phnum; ++i) {
-        size_t base = header_.phoff + static_cast<size_t>(header_.phentsize) * i;
-        if (base + 32 > data_.size()) {
-            throw std::runtime_error("ELF program header truncated");
-        }
+        const uint8_t *base = table.data() + static_cast<size_t>(header_.phentsize) * i;
         elf32_ph_entry entry;
-        entry.type = read_u32(data_, base + 0);
-        entry.offset = read_u32(data_, base + 4);
-        entry.vaddr = read_u32(data_, base + 8);
-        entry.paddr = read_u32(data_, base + 12);
-        entry.filez = read_u32(data_, base + 16);
-        entry.memsz = read_u32(data_, base + 20);
-        entry.flags = read_u32(data_, base + 24);
-        entry.align = read_u32(data_, base + 28);
+        entry.type = read_u32(base + 0);
+        entry.offset = read_u32(base + 4);
+        entry.vaddr = read_u32(base + 8);
+        entry.paddr = read_u32(base + 12);
+        entry.filez = read_u32(base + 16);
+        entry.memsz = read_u32(base + 20);
+        entry.flags = read_u32(base + 24);
+        entry.align = read_u32(base + 28);
         segments_.push_back(entry);
     }
+
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    for (const auto &segment : segments_) {
+        if (segment.is_load() && segment.filez != 0) {
+            ranges.emplace_back(segment.offset, static_cast<uint64_t>(segment.offset) + segment.filez);
+        }
+    }
+    std::sort(ranges.begin(), ranges.end());
+    loaded_.clear();
+    for (size_t i = 0; i < ranges.size();) {
+        uint64_t begin = ranges[i].first;
+        uint64_t end = ranges[i].second;
+        for (++i; i < ranges.size() && ranges[i].first <= end; ++i) {
+            end = std::max(end, ranges[i].second);
+        }
+        loaded_range range;
+        range.offset = begin;
+        if (!read_range(reader, begin, end - begin, range.bytes)) {
+            throw std::runtime_error("ELF segment out of range");
+        }
+        loaded_.push_back(std::move(range));
+    }
+}
+
+const elf_file::loaded_range *elf_file::find_range(const elf32_ph_entry &segment) const {
+    uint64_t end = static_cast<uint64_t>(segment.offset) + segment.filez;
+    for (const auto &range : loaded_) {
+        if (segment.offset >= range.offset && end <= range.offset + range.bytes.size()) {
+            return &range;
+        }
+    }
+    throw std::runtime_error("ELF segment out of range");
 }
 
 std::vector<uint8_t> elf_file::content(const elf32_ph_entry &segment) const {
     if (segment.filez == 0) {
         return {};
     }
-    if (segment.offset + segment.filez > data_.size()) {
-        throw std::runtime_error("ELF segment out of range");
-    }
-    auto begin = data_.begin() + static_cast<std::ptrdiff_t>(segment.offset);
-    auto end = begin + static_cast<std::ptrdiff_t>(segment.filez);
-    return std::vector<uint8_t>(begin, end);
+    const uint8_t *data = segment_data(segment);
+    return std::vector<uint8_t>(data, data + segment.filez);
+}
+
+const uint8_t *elf_file::segment_data(const elf32_ph_entry &segment) const {
+    const loaded_range *range = find_range(segment);
+    return range->bytes.data() + (segment.offset - range->offset);
 }
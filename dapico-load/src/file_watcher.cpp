@@ -0,0 +1,184 @@
+#include "file_watcher.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#elif defined(__APPLE__)
+#include <sys/event.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+#if !defined(__linux__) && !defined(__APPLE__)
+constexpr int kPollIntervalMs = 20;
+#endif
+
+std::string parent_directory(const std::string &path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+int remaining_ms(std::chrono::steady_clock::time_point deadline, int timeout_ms) {
+    if (timeout_ms < 0) {
+        return -1;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    return static_cast<int>(std::max<int64_t>(0, left.count()));
+}
+} // namespace
+
+FileWatcher::FileWatcher(const std::string &path) : path_(path) {
+    size_t slash = path.rfind('/');
+    name_ = slash == std::string::npos ? path : path.substr(slash + 1);
+    std::string dir = parent_directory(path);
+#if defined(__linux__)
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0 || inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_MOVED_TO |
+                                                           IN_DELETE | IN_ATTRIB) < 0) {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        throw std::runtime_error("Failed to watch " + dir + ": " + std::strerror(errno));
+    }
+#elif defined(__APPLE__)
+    fd_ = kqueue();
+    dir_fd_ = ::open(dir.c_str(), O_EVTONLY);
+    if (fd_ < 0 || dir_fd_ < 0) {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        throw std::runtime_error("Failed to watch " + dir + ": " + std::strerror(errno));
+    }
+    struct kevent change;
+    EV_SET(&change, dir_fd_, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE, 0, nullptr);
+    kevent(fd_, &change, 1, nullptr, 0, nullptr);
+    watch_file();
+#endif
+    signature_ = stat_signature();
+    polled_ = signature_;
+}
+
+FileWatcher::~FileWatcher() {
+    for (int fd : {fd_, dir_fd_, file_fd_}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+}
+
+FileWatcher::Signature FileWatcher::stat_signature() const {
+    struct stat st {};
+    if (::stat(path_.c_str(), &st) != 0) {
+        return Signature{};
+    }
+#if defined(__APPLE__)
+    int64_t mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return Signature{static_cast<uint64_t>(st.st_ino), static_cast<int64_t>(st.st_size), mtime_ns};
+}
+
+// kqueue watches vnodes, not names: after the file is replaced the watch has to
+// follow the new one. Directory events cover the moment in between.
+void FileWatcher::watch_file() {
+#if defined(__APPLE__)
+    if (file_fd_ >= 0) {
+        ::close(file_fd_);
+    }
+    file_fd_ = ::open(path_.c_str(), O_EVTONLY);
+    if (file_fd_ >= 0) {
+        struct kevent change;
+        EV_SET(&change, file_fd_, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+               NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, nullptr);
+        kevent(fd_, &change, 1, nullptr, 0, nullptr);
+    }
+#endif
+}
+
+bool FileWatcher::wait_event(int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+    for (;;) {
+        int wait_ms = remaining_ms(deadline, timeout_ms);
+#if defined(__linux__)
+        pollfd pfd{fd_, POLLIN, 0};
+        if (::poll(&pfd, 1, wait_ms) <= 0) {
+            return false;
+        }
+        alignas(inotify_event) char buffer[4096];
+        bool about_file = false;
+        ssize_t length;
+        while ((length = ::read(fd_, buffer, sizeof(buffer))) > 0) {
+            for (char *p = buffer; p < buffer + length;) {
+                auto *event = reinterpret_cast<inotify_event *>(p);
+                about_file = about_file || (event->len > 0 && name_ == event->name);
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        if (about_file) {
+            return true;
+        }
+#elif defined(__APPLE__)
+        struct kevent events[4];
+        timespec timeout{wait_ms / 1000, (wait_ms % 1000) * 1000000L};
+        int count = kevent(fd_, nullptr, 0, events, 4, wait_ms < 0 ? nullptr : &timeout);
+        if (count <= 0) {
+            return false;
+        }
+        bool about_file = false;
+        for (int i = 0; i < count; ++i) {
+            about_file = about_file || static_cast<int>(events[i].ident) == file_fd_;
+        }
+        // A directory event may be another file; only a new vnode or new
+        // contents under our name count.
+        Signature current = stat_signature();
+        if (about_file || !(current == signature_)) {
+            watch_file();
+            return true;
+        }
+#else
+        std::this_thread::sleep_for(std::chrono::milliseconds(
+            wait_ms < 0 ? kPollIntervalMs : std::min(wait_ms, kPollIntervalMs)));
+        Signature current = stat_signature();
+        if (!(current == polled_)) {
+            polled_ = current;
+            return true;
+        }
+#endif
+        if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+    }
+}
+
+bool FileWatcher::wait_for_change(uint32_t debounce_ms, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+    for (;;) {
+        if (!wait_event(remaining_ms(deadline, timeout_ms))) {
+            return false;
+        }
+        last_change_ = std::chrono::steady_clock::now();
+        while (wait_event(static_cast<int>(debounce_ms))) {
+            last_change_ = std::chrono::steady_clock::now();
+        }
+        // Touching the directory entry without new contents (or deleting the
+        // file for good) is not a change worth reloading.
+        Signature current = stat_signature();
+        if (current.size > 0 && !(current == signature_)) {
+            signature_ = current;
+            return true;
+        }
+    }
+}
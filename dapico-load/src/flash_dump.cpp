@@ -0,0 +1,202 @@
+#include "flash_dump.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "load_plan.h"
+
+namespace {
+// Writable shared mapping of a new file of `size` bytes. The file starts as one
+// hole; only the pages copied into stop being sparse.
+class OutputMapping {
+public:
+    OutputMapping(const std::string &filename, size_t size) : size_(size) {
+        fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("Failed to create " + filename + ": " + std::strerror(errno));
+        }
+        if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            ::close(fd_);
+            throw std::runtime_error("Failed to size " + filename + ": " + std::strerror(errno));
+        }
+        void *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd_);
+            throw std::runtime_error("Failed to map " + filename + ": " + std::strerror(errno));
+        }
+        data_ = static_cast<uint8_t *>(mapping);
+    }
+
+    ~OutputMapping() {
+        ::munmap(data_, size_);
+        ::close(fd_);
+    }
+
+    OutputMapping(const OutputMapping &) = delete;
+    OutputMapping &operator=(const OutputMapping &) = delete;
+
+    uint8_t *data() { return data_; }
+
+private:
+    int fd_ = -1;
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+struct ReadChunk {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    std::vector<uint8_t> data;
+};
+
+// Buffers cycle from the reader thread (free -> filled) to the writer and back.
+struct ReadPipeline {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<ReadChunk *> free;
+    std::deque<ReadChunk *> filled;
+    bool reader_done = false;
+    bool writer_done = false;
+    TransportResult result = kTransportOk;
+    uint32_t failed_addr = 0;
+};
+
+void read_chunks(PicobootTransport &transport, uint32_t addr, uint32_t size, uint32_t read_size,
+                 ReadPipeline &pipeline) {
+    for (uint32_t offset = 0; offset < size; offset += read_size) {
+        ReadChunk *chunk = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.changed.wait(lock, [&pipeline] { return !pipeline.free.empty() || pipeline.writer_done; });
+            if (pipeline.writer_done) {
+                break;
+            }
+            chunk = pipeline.free.front();
+            pipeline.free.pop_front();
+        }
+        chunk->offset = offset;
+        chunk->size = std::min(read_size, size - offset);
+        TransportResult ret = picoboot_read(transport, addr + offset, chunk->data.data(), chunk->size);
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        if (ret != kTransportOk) {
+            pipeline.result = ret;
+            pipeline.failed_addr = addr + offset;
+            break;
+        }
+        pipeline.filled.push_back(chunk);
+        pipeline.changed.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    pipeline.reader_done = true;
+    pipeline.changed.notify_all();
+}
+} // namespace
+
+bool is_erased(const uint8_t *data, size_t size) {
+    constexpr uint64_t kErased = ~uint64_t{0};
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        uint64_t lanes[8];
+        std::memcpy(lanes, data + i, sizeof(lanes));
+        uint64_t a = lanes[0] & lanes[1];
+        uint64_t b = lanes[2] & lanes[3];
+        uint64_t c = lanes[4] & lanes[5];
+        uint64_t d = lanes[6] & lanes[7];
+        if (((a & b) & (c & d)) != kErased) {
+            return false;
+        }
+    }
+    for (; i < size; ++i) {
+        if (data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TransportResult dump_memory(PicobootTransport &transport, uint32_t addr, uint32_t size, const std::string &filename,
+                            const DumpOptions &options, DumpStats &stats) {
+    auto start = std::chrono::steady_clock::now();
+    OutputMapping output(filename, size);
+    stats = DumpStats{};
+    stats.bytes = size;
+
+    TransportResult ret = transport.reset_interface();
+    if (ret != kTransportOk) {
+        std::cerr << "Warning: reset interface failed (IOKit error " << ret << ").\n";
+    }
+    // Constructed before the reader thread starts and released after it joins.
+    ExclusiveAccess exclusive(transport, EXCLUSIVE);
+    if (addr < kSramStart) {
+        ret = picoboot_exit_xip(transport);
+        if (ret != kTransportOk) {
+            std::cerr << "Failed to exit XIP mode (IOKit error " << ret << ").\n";
+            return ret;
+        }
+    }
+
+    std::vector<ReadChunk> chunks(std::max<uint32_t>(options.queue_depth, 1));
+    ReadPipeline pipeline;
+    for (auto &chunk : chunks) {
+        chunk.data.resize(options.read_size);
+        pipeline.free.push_back(&chunk);
+    }
+    std::thread reader(read_chunks, std::ref(transport), addr, size, options.read_size, std::ref(pipeline));
+
+    for (;;) {
+        ReadChunk *chunk = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.changed.wait(lock, [&pipeline] { return !pipeline.filled.empty() || pipeline.reader_done; });
+            if (pipeline.filled.empty()) {
+                break;
+            }
+            chunk = pipeline.filled.front();
+            pipeline.filled.pop_front();
+        }
+        stats.reads++;
+        // Holes are per block of the file, so blocks are checked at file offsets.
+        uint32_t end = chunk->offset + chunk->size;
+        for (uint32_t offset = chunk->offset; offset < end;) {
+            uint32_t block_end = std::min(end, align_down(offset, kDumpBlockSize) + kDumpBlockSize);
+            const uint8_t *block = chunk->data.data() + (offset - chunk->offset);
+            uint32_t block_size = block_end - offset;
+            if (options.erased_as_holes && is_erased(block, block_size)) {
+                stats.hole_bytes += block_size;
+            } else {
+                std::memcpy(output.data() + offset, block, block_size);
+                stats.data_bytes += block_size;
+            }
+            offset = block_end;
+        }
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        pipeline.free.push_back(chunk);
+        pipeline.changed.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        pipeline.writer_done = true;
+        pipeline.changed.notify_all();
+    }
+    reader.join();
+
+    stats.elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (pipeline.result != kTransportOk) {
+        std::cerr << "Read failed at 0x" << std::hex << pipeline.failed_addr << " (IOKit error " << std::dec
+                  << pipeline.result << ").\n";
+    }
+    return pipeline.result;
+}
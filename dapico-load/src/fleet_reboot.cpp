@@ -0,0 +1,110 @@
+#include "fleet_reboot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+bool same_device(const UsbDeviceIdentity &a, const UsbDeviceIdentity &b) {
+    return a.serial.empty() || b.serial.empty() ? a.location == b.location : a.serial == b.serial;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+struct PendingDevice {
+    size_t index;
+    Clock::time_point sent;
+    // Still on the bus in the target mode from before the reboot.
+    bool must_leave;
+};
+
+// Updates `device` from one enumeration; true once it is back in the target mode.
+bool came_back(PendingDevice &device, FleetRebootResult &result, const std::vector<UsbDeviceIdentity> &present,
+               bool bootsel, Clock::time_point now) {
+    auto found = std::find_if(present.begin(), present.end(),
+                              [&](const UsbDeviceIdentity &identity) { return same_device(identity, result.identity); });
+    bool in_mode = found != present.end() && is_bootsel_product(found->product_id) == bootsel;
+    if (device.must_leave) {
+        device.must_leave = in_mode;
+        return false;
+    }
+    if (!in_mode) {
+        return false;
+    }
+    result.ready = true;
+    result.ready_ms = std::chrono::duration<double, std::milli>(now - device.sent).count();
+    return true;
+}
+} // namespace
+
+std::vector<FleetRebootResult> reboot_fleet(const std::vector<FleetDevice> &devices,
+                                            const FleetRebootOptions &options, const UsbEnumerator &enumerate) {
+    std::vector<FleetRebootResult> results(devices.size());
+    std::vector<Clock::time_point> sent(devices.size());
+    std::vector<std::thread> senders;
+    senders.reserve(devices.size());
+    for (size_t i = 0; i < devices.size(); ++i) {
+        senders.emplace_back([&, i] {
+            FleetRebootResult &result = results[i];
+            result.identity = devices[i].identity;
+            result.result = reboot_device(devices[i].target, options.bootsel, options.picoboot_only, result.outcome);
+            sent[i] = Clock::now();
+        });
+    }
+    for (auto &sender : senders) {
+        sender.join();
+    }
+
+    std::vector<PendingDevice> pending;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        FleetRebootResult &result = results[i];
+        if (result.outcome == RebootOutcome::already_in_bootsel) {
+            result.ready = true;
+        } else if (options.wait && result.result == kTransportOk && result.outcome != RebootOutcome::no_interface) {
+            bool was_bootsel = is_bootsel_product(result.identity.product_id);
+            pending.push_back(PendingDevice{i, sent[i], was_bootsel == options.bootsel});
+        }
+    }
+
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(options.timeout_ms);
+    while (!pending.empty() && Clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.poll_ms));
+        std::vector<UsbDeviceIdentity> present = enumerate();
+        Clock::time_point now = Clock::now();
+        for (size_t i = 0; i < pending.size();) {
+            if (came_back(pending[i], results[pending[i].index], present, options.bootsel, now)) {
+                pending[i] = pending.back();
+                pending.pop_back();
+            } else {
+                ++i;
+            }
+        }
+    }
+    return results;
+}
+
+LatencySummary summarize_fleet_latency(const std::vector<FleetRebootResult> &results) {
+    std::vector<double> samples;
+    for (const auto &result : results) {
+        if (result.ready && result.outcome != RebootOutcome::already_in_bootsel) {
+            samples.push_back(result.ready_ms);
+        }
+    }
+    LatencySummary summary;
+    summary.count = samples.size();
+    if (samples.empty()) {
+        return summary;
+    }
+    std::sort(samples.begin(), samples.end());
+    summary.p50_ms = percentile(samples, 0.50);
+    summary.p90_ms = percentile(samples, 0.90);
+    summary.p99_ms = percentile(samples, 0.99);
+    summary.max_ms = samples.back();
+    return summary;
+}
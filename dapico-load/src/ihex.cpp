@@ -0,0 +1,259 @@
+#include "ihex.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+constexpr uint64_t kOnes = 0x0101010101010101ull;
+constexpr uint64_t kHighBits = 0x8080808080808080ull;
+constexpr uint64_t kLowNibbles = 0x0f0f0f0f0f0f0f0full;
+constexpr uint64_t kLowBytes = 0x00ff00ff00ff00ffull;
+
+constexpr uint8_t kRecordData = 0x00;
+constexpr uint8_t kRecordEndOfFile = 0x01;
+constexpr uint8_t kRecordExtendedSegment = 0x02;
+constexpr uint8_t kRecordStartSegment = 0x03;
+constexpr uint8_t kRecordExtendedLinear = 0x04;
+constexpr uint8_t kRecordStartLinear = 0x05;
+
+// Characters per record besides the data: ':' LL AAAA TT ... CC.
+constexpr size_t kRecordOverhead = 11;
+
+struct HexRecord {
+    uint32_t line;
+    uint32_t text_offset;
+    uint32_t data_offset;
+    uint16_t addr;
+    uint8_t type;
+    uint8_t length;
+    // Sum of the header bytes and checksum; adding the data bytes must give 0 mod 256.
+    uint8_t check;
+};
+
+uint64_t load64(const uint8_t *p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Eight characters at a time, SIMD-within-a-register style: the high bit of
+// each byte in the result is set where the character is not a hex digit.
+uint64_t invalid_hex_mask(uint64_t chars) {
+    uint64_t ascii = ~chars & kHighBits;
+    uint64_t low7 = chars & ~kHighBits;
+    uint64_t ge_0 = low7 + kOnes * (0x80 - '0');
+    uint64_t gt_9 = low7 + kOnes * (0x7f - '9');
+    uint64_t folded = low7 | kOnes * 0x20;
+    uint64_t ge_a = folded + kOnes * (0x80 - 'a');
+    uint64_t gt_f = folded + kOnes * (0x7f - 'f');
+    return ~(((ge_0 & ~gt_9) | (ge_a & ~gt_f)) & ascii) & kHighBits;
+}
+
+// Eight hex characters to four bytes. Letters have bit 6 set and a low nibble
+// of 1-6, so adding 9 for them yields 10-15 without a lookup.
+uint32_t decode8(uint64_t chars) {
+    uint64_t nibbles = (chars & kLowNibbles) + ((chars >> 6) & kOnes) * 9;
+    uint64_t lanes = ((nibbles & kLowBytes) << 4) | ((nibbles >> 8) & kLowBytes);
+    lanes = (lanes | (lanes >> 8)) & 0x0000ffff0000ffffull;
+    return static_cast<uint32_t>(lanes | (lanes >> 16));
+}
+
+// Decodes 2 * count characters into `out`, OR-ing the validity mask into `bad`.
+void decode_hex(const uint8_t *chars, size_t count, uint8_t *out, uint64_t &bad) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint64_t group = load64(chars + 2 * i);
+        bad |= invalid_hex_mask(group);
+        uint32_t bytes = decode8(group);
+        std::memcpy(out + i, &bytes, sizeof(bytes));
+    }
+    if (i < count) {
+        uint64_t group = kOnes * '0';
+        std::memcpy(&group, chars + 2 * i, 2 * (count - i));
+        bad |= invalid_hex_mask(group);
+        uint32_t bytes = decode8(group);
+        std::memcpy(out + i, &bytes, count - i);
+    }
+}
+
+// Byte sum modulo 256, eight bytes per step in 16-bit lanes.
+uint8_t byte_sum(const uint8_t *data, size_t size) {
+    uint64_t lanes = 0;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t bytes = load64(data + i);
+        lanes += (bytes & kLowBytes) + ((bytes >> 8) & kLowBytes);
+    }
+    uint32_t sum = static_cast<uint32_t>((lanes * 0x0001000100010001ull) >> 48);
+    for (; i < size; ++i) {
+        sum += data[i];
+    }
+    return static_cast<uint8_t>(sum);
+}
+
+[[noreturn]] void record_error(uint32_t line, const std::string &what) {
+    throw std::runtime_error("Intel HEX line " + std::to_string(line) + ": " + what);
+}
+
+uint32_t big_endian(const uint8_t *data, uint8_t size) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < size; ++i) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+} // namespace
+
+bool is_intel_hex(const uint8_t *data, size_t size) {
+    return size >= kRecordOverhead && data[0] == ':';
+}
+
+std::vector<ImageSegment> intel_hex_image_segments(const uint8_t *text, size_t size, std::vector<uint8_t> &payload,
+                                                   uint32_t &entry_point) {
+    // Data bytes take two characters each, so half the file bounds the payload;
+    // sizing it up front keeps the segment pointers stable.
+    payload.assign(size / 2 + 1, 0);
+    std::vector<HexRecord> records;
+    records.reserve(size / (kRecordOverhead + 32));
+
+    // Pass 1: split lines and decode every record, accumulating invalid
+    // characters into one mask instead of branching per character.
+    uint64_t bad_chars = 0;
+    size_t cursor = 0;
+    uint32_t line = 0;
+    bool saw_end = false;
+    const uint8_t *end = text + size;
+    for (const uint8_t *p = text; p < end && !saw_end;) {
+        ++line;
+        if (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n')) {
+            p += *p == '\r' ? 2 : 1;
+            continue;
+        }
+        if (*p != ':' || static_cast<size_t>(end - p) < kRecordOverhead) {
+            record_error(line, "malformed record");
+        }
+
+        // The byte count fixes where the line must end, so no scan for the newline.
+        const uint8_t *record_text = p;
+        uint8_t header[4];
+        uint64_t bad_header = 0;
+        decode_hex(record_text + 1, 4, header, bad_header);
+        if (bad_header != 0) {
+            record_error(line, "invalid hex digit");
+        }
+        size_t chars = kRecordOverhead + 2 * static_cast<size_t>(header[0]);
+        p = record_text + chars;
+        if (p > end) {
+            record_error(line, "record is truncated");
+        }
+        if (p < end && *p == '\r') {
+            ++p;
+        }
+        if (p < end && *p++ != '\n') {
+            record_error(line, "length does not match byte count");
+        }
+
+        HexRecord record;
+        record.line = line;
+        record.text_offset = static_cast<uint32_t>(record_text - text);
+        record.data_offset = static_cast<uint32_t>(cursor);
+        record.addr = static_cast<uint16_t>((header[1] << 8) | header[2]);
+        record.type = header[3];
+        record.length = header[0];
+        // The checksum decodes into the byte after the data and is overwritten by the next record.
+        decode_hex(record_text + 9, record.length + 1, payload.data() + cursor, bad_chars);
+        record.check =
+            static_cast<uint8_t>(header[0] + header[1] + header[2] + header[3] + payload[cursor + record.length]);
+        records.push_back(record);
+        if (record.type == kRecordData) {
+            cursor += record.length;
+        }
+        saw_end = record.type == kRecordEndOfFile;
+    }
+
+    if (bad_chars != 0) {
+        for (const auto &record : records) {
+            uint64_t bad = 0;
+            uint8_t scratch[256];
+            decode_hex(text + record.text_offset + 9, record.length + 1, scratch, bad);
+            if (bad != 0) {
+                record_error(record.line, "invalid hex digit");
+            }
+        }
+    }
+
+    // Pass 2: checksums in bulk over the decoded bytes. Non-data records have
+    // their payload decoded at the cursor too, so recheck those individually.
+    uint32_t bad_sums = 0;
+    for (const auto &record : records) {
+        if (record.type == kRecordData) {
+            bad_sums |= static_cast<uint8_t>(record.check + byte_sum(payload.data() + record.data_offset,
+                                                                     record.length));
+        }
+    }
+    uint8_t scratch[256];
+    for (const auto &record : records) {
+        bool failed = false;
+        if (record.type != kRecordData) {
+            uint64_t ignored = 0;
+            decode_hex(text + record.text_offset + 9, record.length, scratch, ignored);
+            failed = static_cast<uint8_t>(record.check + byte_sum(scratch, record.length)) != 0;
+        } else if (bad_sums != 0) {
+            failed = static_cast<uint8_t>(record.check + byte_sum(payload.data() + record.data_offset,
+                                                                  record.length)) != 0;
+        }
+        if (failed) {
+            record_error(record.line, "checksum mismatch");
+        }
+    }
+    if (!saw_end) {
+        throw std::runtime_error("Intel HEX file has no end-of-file record (truncated?)");
+    }
+    payload.resize(cursor);
+
+    // Pass 3: resolve addresses and coalesce contiguous data records.
+    std::vector<ImageSegment> segments;
+    uint32_t base = 0;
+    for (const auto &record : records) {
+        switch (record.type) {
+        case kRecordData: {
+            if (record.length == 0) {
+                break;
+            }
+            uint32_t addr = base + record.addr;
+            const uint8_t *data = payload.data() + record.data_offset;
+            if (!segments.empty() && segments.back().addr + segments.back().size == addr &&
+                segments.back().data + segments.back().size == data) {
+                segments.back().size += record.length;
+            } else {
+                segments.push_back(ImageSegment{addr, data, record.length});
+            }
+            break;
+        }
+        case kRecordEndOfFile:
+        case kRecordStartSegment:
+            break;
+        case kRecordExtendedSegment:
+        case kRecordExtendedLinear:
+        case kRecordStartLinear: {
+            uint8_t expected = record.type == kRecordStartLinear ? 4 : 2;
+            if (record.length != expected) {
+                record_error(record.line, "bad address record length");
+            }
+            uint64_t ignored = 0;
+            decode_hex(text + record.text_offset + 9, record.length, scratch, ignored);
+            uint32_t value = big_endian(scratch, record.length);
+            if (record.type == kRecordStartLinear) {
+                entry_point = value;
+            } else {
+                base = record.type == kRecordExtendedLinear ? value << 16 : value << 4;
+            }
+            break;
+        }
+        default:
+            record_error(record.line, "unknown record type " + std::to_string(record.type));
+        }
+    }
+    return segments;
+}
@@ -0,0 +1,212 @@
+#include "image_diff.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "cost_model.h"
+#include "format_util.h"
+#include "load_image.h"
+
+namespace {
+constexpr uint32_t kPagesPerSector = kFlashSectorSize / kFlashPageSize;
+
+struct SectorResult {
+    uint32_t changed_pages = 0;
+    uint32_t changed_bytes = 0;
+    bool changed = false;
+};
+
+// Fills `out` with what the sector holds after `plan` is written: erased bytes
+// read as 0xff and every extent overlapping the sector is copied in.
+void materialize_sector(const LoadPlan &plan, uint32_t sector_addr, uint8_t *out) {
+    std::memset(out, 0xff, kFlashSectorSize);
+    uint32_t sector_end = sector_addr + kFlashSectorSize;
+    auto it = std::upper_bound(plan.flash_extents.begin(), plan.flash_extents.end(), sector_addr,
+                               [](uint32_t addr, const FlashExtent &extent) { return addr < extent.addr; });
+    if (it != plan.flash_extents.begin()) {
+        --it;
+    }
+    for (; it != plan.flash_extents.end() && it->addr < sector_end; ++it) {
+        uint32_t extent_end = it->addr + static_cast<uint32_t>(it->data.size());
+        if (extent_end <= sector_addr) {
+            continue;
+        }
+        uint32_t begin = std::max(sector_addr, it->addr);
+        uint32_t end = std::min(sector_end, extent_end);
+        std::memcpy(out + (begin - sector_addr), it->data.data() + (begin - it->addr), end - begin);
+    }
+}
+
+void compare_sectors(const LoadPlan &old_plan, const LoadPlan &new_plan, const std::vector<uint32_t> &sectors,
+                     size_t begin, size_t end, std::vector<SectorResult> &results) {
+    uint8_t old_sector[kFlashSectorSize];
+    uint8_t new_sector[kFlashSectorSize];
+    for (size_t i = begin; i < end; ++i) {
+        materialize_sector(old_plan, sectors[i], old_sector);
+        materialize_sector(new_plan, sectors[i], new_sector);
+        if (std::memcmp(old_sector, new_sector, kFlashSectorSize) == 0) {
+            continue;
+        }
+        SectorResult &result = results[i];
+        result.changed = true;
+        for (uint32_t page = 0; page < kPagesPerSector; ++page) {
+            const uint8_t *a = old_sector + page * kFlashPageSize;
+            const uint8_t *b = new_sector + page * kFlashPageSize;
+            if (std::memcmp(a, b, kFlashPageSize) == 0) {
+                continue;
+            }
+            result.changed_pages++;
+            for (uint32_t j = 0; j < kFlashPageSize; ++j) {
+                result.changed_bytes += a[j] != b[j];
+            }
+        }
+    }
+}
+
+bool page_is_erased(const uint8_t *page) {
+    for (uint32_t i = 0; i < kFlashPageSize; ++i) {
+        if (page[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+LoadPlan build_update_plan(const LoadPlan &new_plan, const std::vector<uint32_t> &changed_sectors) {
+    LoadPlan update;
+    update.entry_point = new_plan.entry_point;
+    std::vector<Range> ranges;
+    uint8_t sector[kFlashSectorSize];
+    for (uint32_t sector_addr : changed_sectors) {
+        ranges.push_back(Range{sector_addr, sector_addr + kFlashSectorSize});
+        materialize_sector(new_plan, sector_addr, sector);
+        for (uint32_t page = 0; page < kPagesPerSector; ++page) {
+            const uint8_t *data = sector + page * kFlashPageSize;
+            if (page_is_erased(data)) {
+                continue;
+            }
+            uint32_t page_addr = sector_addr + page * kFlashPageSize;
+            if (update.flash_extents.empty() ||
+                update.flash_extents.back().addr + update.flash_extents.back().data.size() != page_addr) {
+                update.flash_extents.push_back(FlashExtent{page_addr, {}});
+            }
+            auto &bytes = update.flash_extents.back().data;
+            bytes.insert(bytes.end(), data, data + kFlashPageSize);
+        }
+    }
+    update.erase_ranges = merge_ranges(std::move(ranges));
+    return update;
+}
+} // namespace
+
+FlashDiff diff_flash_plans(const LoadPlan &old_plan, const LoadPlan &new_plan, unsigned threads) {
+    std::vector<uint32_t> sectors;
+    for (const auto &range : new_plan.erase_ranges) {
+        for (uint32_t addr = range.start; addr < range.end; addr += kFlashSectorSize) {
+            sectors.push_back(addr);
+        }
+    }
+
+    std::vector<SectorResult> results(sectors.size());
+    size_t workers = std::max<size_t>(1, std::min<size_t>(threads, sectors.size() / 64));
+    if (workers == 1) {
+        compare_sectors(old_plan, new_plan, sectors, 0, sectors.size(), results);
+    } else {
+        std::vector<std::thread> pool;
+        size_t per_worker = (sectors.size() + workers - 1) / workers;
+        for (size_t begin = 0; begin < sectors.size(); begin += per_worker) {
+            size_t end = std::min(sectors.size(), begin + per_worker);
+            pool.emplace_back(compare_sectors, std::cref(old_plan), std::cref(new_plan), std::cref(sectors), begin,
+                              end, std::ref(results));
+        }
+        for (auto &worker : pool) {
+            worker.join();
+        }
+    }
+
+    FlashDiff diff;
+    diff.sectors = static_cast<uint32_t>(sectors.size());
+    diff.pages = diff.sectors * kPagesPerSector;
+    std::vector<uint32_t> changed_sectors;
+    for (size_t i = 0; i < sectors.size(); ++i) {
+        if (!results[i].changed) {
+            continue;
+        }
+        changed_sectors.push_back(sectors[i]);
+        diff.changed_pages += results[i].changed_pages;
+        diff.changed_bytes += results[i].changed_bytes;
+    }
+    diff.changed_sectors = static_cast<uint32_t>(changed_sectors.size());
+    diff.update_plan = build_update_plan(new_plan, changed_sectors);
+    return diff;
+}
+
+int run_diff_elf(const std::string &old_filename, const std::string &new_filename, const DryrunOptions &options) {
+    MemoryLayout memory_layout = memory_layout_for_product(options.product_id);
+    CostModel cost_model;
+    try {
+        cost_model = cost_model_for_product(options.product_id, options.cost_model_spec);
+    } catch (const std::runtime_error &err) {
+        std::cerr << "Cost model error: " << err.what() << "\n";
+        return 2;
+    }
+
+    LoadImage old_image;
+    LoadImage new_image;
+    LoadPlan old_plan;
+    LoadPlan new_plan;
+    try {
+        old_image = open_load_image(old_filename, options.product_id, options.image);
+        new_image = open_load_image(new_filename, options.product_id, options.image);
+        old_plan = build_load_plan(old_image.segments, old_image.entry_point, memory_layout, true);
+        new_plan = build_load_plan(new_image.segments, new_image.entry_point, memory_layout, true);
+    } catch (const std::runtime_error &err) {
+        std::cerr << "Image parse failed: " << err.what() << "\n";
+        return 1;
+    }
+    // Only flash is compared; RAM segments are reloaded on every boot anyway.
+    old_plan.ram_segments.clear();
+    new_plan.ram_segments.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    FlashDiff diff = diff_flash_plans(old_plan, new_plan, std::max(1u, std::thread::hardware_concurrency()));
+    double compare_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    double full_ms = estimate_load_cost(new_plan, cost_model, false).predicted_ms;
+    double update_ms = diff.changed_sectors ? estimate_load_cost(diff.update_plan, cost_model, false).predicted_ms : 0;
+    size_t update_pages = diff.update_plan.flash_page_count();
+
+    if (options.json) {
+        char times[128];
+        std::snprintf(times, sizeof(times), "\"full_flash_ms\":%.3f,\"differential_flash_ms\":%.3f", full_ms,
+                      update_ms);
+        std::cout << "{\"old\":\"" << json_escape(old_filename) << "\",\"new\":\"" << json_escape(new_filename)
+                  << "\",\"chip\":\"" << chip_name_for_product(options.product_id) << "\""
+                  << ",\"sectors\":" << diff.sectors << ",\"changed_sectors\":" << diff.changed_sectors
+                  << ",\"pages\":" << diff.pages << ",\"changed_pages\":" << diff.changed_pages
+                  << ",\"changed_bytes\":" << diff.changed_bytes << ",\"update_pages\":" << update_pages << ","
+                  << times << "}\n";
+        return 0;
+    }
+
+    std::cout << "Diff: " << old_filename << " -> " << new_filename << " ("
+              << (options.product_id == kProductIdRp2040UsbBoot ? "RP2040" : "RP2350") << " layout)\n"
+              << "  sectors: " << diff.changed_sectors << " of " << diff.sectors << " changed\n"
+              << "  pages:   " << diff.changed_pages << " of " << diff.pages << " changed (" << update_pages
+              << " to rewrite in changed sectors)\n"
+              << "  bytes:   " << diff.changed_bytes << " changed\n";
+    std::printf("  full flash:         %.1f ms predicted\n", full_ms);
+    std::printf("  differential flash: %.1f ms predicted\n", update_ms);
+    if (options.verbose) {
+        for (const auto &range : diff.update_plan.erase_ranges) {
+            std::cout << "  changed 0x" << std::hex << range.start << "-0x" << range.end << std::dec << "\n";
+        }
+        std::printf("  compared in %.1f ms\n", compare_ms);
+    }
+    return 0;
+}
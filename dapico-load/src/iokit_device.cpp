@@ -0,0 +1,478 @@
+#include "iokit_device.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOCFPlugIn.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/usb/IOUSBLib.h>
+#include <IOKit/usb/USBSpec.h>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "load_plan.h"
+#include "pico/usb_reset_interface.h"
+
+namespace {
+// Closes the device once every interface opened on it has been released.
+class IOKitDevice {
+public:
+    explicit IOKitDevice(IOUSBDeviceInterface **device) : device_(device) {}
+    ~IOKitDevice() {
+        (*device_)->USBDeviceClose(device_);
+        (*device_)->Release(device_);
+    }
+
+    IOKitDevice(const IOKitDevice &) = delete;
+    IOKitDevice &operator=(const IOKitDevice &) = delete;
+
+private:
+    IOUSBDeviceInterface **device_;
+};
+
+struct PicobootInterface {
+    UInt8 interface_number{};
+    UInt8 pipe_in{};
+    UInt8 pipe_out{};
+    IOUSBInterfaceInterface **iface{};
+};
+
+struct ResetInterface {
+    UInt8 interface_number{};
+    IOUSBInterfaceInterface **iface{};
+};
+
+struct DeviceMatch {
+    std::shared_ptr<IOKitDevice> device;
+    UsbDeviceIdentity identity;
+    std::optional<PicobootInterface> picoboot;
+    std::optional<ResetInterface> reset;
+};
+
+void close_interface(IOUSBInterfaceInterface **iface) {
+    (*iface)->USBInterfaceClose(iface);
+    (*iface)->Release(iface);
+}
+
+uint32_t cf_number_to_uint32(CFTypeRef value) {
+    if (!value || CFGetTypeID(value) != CFNumberGetTypeID()) {
+        return 0;
+    }
+    uint32_t out = 0;
+    CFNumberGetValue(static_cast<CFNumberRef>(value), kCFNumberSInt32Type, &out);
+    return out;
+}
+
+std::string cf_string_to_string(CFTypeRef value) {
+    if (!value || CFGetTypeID(value) != CFStringGetTypeID()) {
+        return {};
+    }
+    char buffer[256];
+    if (!CFStringGetCString(static_cast<CFStringRef>(value), buffer, sizeof(buffer), kCFStringEncodingUTF8)) {
+        return {};
+    }
+    return buffer;
+}
+
+uint32_t registry_number(io_service_t service, CFStringRef key) {
+    CFTypeRef value = IORegistryEntryCreateCFProperty(service, key, kCFAllocatorDefault, 0);
+    uint32_t out = cf_number_to_uint32(value);
+    if (value) {
+        CFRelease(value);
+    }
+    return out;
+}
+
+// Identity of a Raspberry Pi device from its registry entry alone, or nullopt
+// for other vendors.
+std::optional<UsbDeviceIdentity> read_identity(io_service_t device_service) {
+    if (registry_number(device_service, CFSTR(kUSBVendorID)) != kVendorIdRaspberryPi) {
+        return std::nullopt;
+    }
+    UsbDeviceIdentity identity;
+    identity.product_id = static_cast<uint16_t>(registry_number(device_service, CFSTR(kUSBProductID)));
+    identity.location = registry_number(device_service, CFSTR(kUSBDevicePropertyLocationID));
+    CFTypeRef serial = IORegistryEntryCreateCFProperty(device_service, CFSTR(kUSBSerialNumberString),
+                                                       kCFAllocatorDefault, 0);
+    identity.serial = cf_string_to_string(serial);
+    if (serial) {
+        CFRelease(serial);
+    }
+    return identity;
+}
+
+// Calls `visit` with each Raspberry Pi device's registry entry and identity.
+template <typename Visit>
+void for_each_pi_device(Visit visit) {
+    CFMutableDictionaryRef matching = IOServiceMatching(kIOUSBDeviceClassName);
+    if (!matching) {
+        return;
+    }
+    io_iterator_t iterator = 0;
+    if (IOServiceGetMatchingServices(kIOMainPortDefault, matching, &iterator) != kIOReturnSuccess) {
+        return;
+    }
+    io_service_t device_service = 0;
+    while ((device_service = IOIteratorNext(iterator)) != 0) {
+        if (auto identity = read_identity(device_service)) {
+            visit(device_service, *identity);
+        }
+        IOObjectRelease(device_service);
+    }
+    IOObjectRelease(iterator);
+}
+
+IOUSBDeviceInterface **create_device_interface(io_service_t device_service) {
+    IOCFPlugInInterface **plug_in = nullptr;
+    SInt32 score = 0;
+    IOReturn ret = IOCreatePlugInInterfaceForService(device_service, kIOUSBDeviceUserClientTypeID,
+                                                     kIOCFPlugInInterfaceID, &plug_in, &score);
+    if (ret != kIOReturnSuccess || !plug_in) {
+        return nullptr;
+    }
+
+    IOUSBDeviceInterface **device = nullptr;
+    HRESULT result = (*plug_in)->QueryInterface(plug_in, CFUUIDGetUUIDBytes(kIOUSBDeviceInterfaceID),
+                                                reinterpret_cast<void **>(&device));
+    (*plug_in)->Release(plug_in);
+    if (result || !device) {
+        return nullptr;
+    }
+    return device;
+}
+
+IOUSBInterfaceInterface **create_interface_interface(io_service_t interface_service) {
+    IOCFPlugInInterface **plug_in = nullptr;
+    SInt32 score = 0;
+    IOReturn ret = IOCreatePlugInInterfaceForService(interface_service, kIOUSBInterfaceUserClientTypeID,
+                                                     kIOCFPlugInInterfaceID, &plug_in, &score);
+    if (ret != kIOReturnSuccess || !plug_in) {
+        return nullptr;
+    }
+
+    IOUSBInterfaceInterface **iface = nullptr;
+    HRESULT result = (*plug_in)->QueryInterface(plug_in, CFUUIDGetUUIDBytes(kIOUSBInterfaceInterfaceID),
+                                                reinterpret_cast<void **>(&iface));
+    (*plug_in)->Release(plug_in);
+    if (result || !iface) {
+        return nullptr;
+    }
+    return iface;
+}
+
+bool is_rebootable_product(uint16_t product_id) {
+    return is_bootsel_product(product_id) || is_application_product(product_id);
+}
+
+// Vendor-class bulk IN/OUT pair of the PICOBOOT interface, if `iface` has one.
+std::optional<PicobootInterface> picoboot_pipes(IOUSBInterfaceInterface **iface, UInt8 interface_number) {
+    UInt8 num_endpoints = 0;
+    (*iface)->GetNumEndpoints(iface, &num_endpoints);
+
+    UInt8 pipe_in = 0;
+    UInt8 pipe_out = 0;
+    for (UInt8 pipe_ref = 1; pipe_ref <= num_endpoints; ++pipe_ref) {
+        UInt8 direction = 0;
+        UInt8 number = 0;
+        UInt8 transfer_type = 0;
+        UInt16 max_packet = 0;
+        UInt8 interval = 0;
+        if ((*iface)->GetPipeProperties(iface, pipe_ref, &direction, &number, &transfer_type, &max_packet,
+                                        &interval) != kIOReturnSuccess) {
+            continue;
+        }
+        if (transfer_type != kUSBBulk) {
+            continue;
+        }
+        if (direction == kUSBIn) {
+            pipe_in = pipe_ref;
+        } else if (direction == kUSBOut) {
+            pipe_out = pipe_ref;
+        }
+    }
+    if (pipe_in == 0 || pipe_out == 0) {
+        return std::nullopt;
+    }
+    return PicobootInterface{interface_number, pipe_in, pipe_out, iface};
+}
+
+// Opens the PICOBOOT interface of a Raspberry Pi device and, when
+// `applications` is set, the stdio_usb reset interface of a running
+// application. Returns nullopt if it has neither or cannot be opened.
+std::optional<DeviceMatch> open_iokit_device(io_service_t device_service, const UsbDeviceIdentity &identity,
+                                             bool applications, bool verbose) {
+    if (!is_bootsel_product(identity.product_id) && !(applications && is_application_product(identity.product_id))) {
+        return std::nullopt;
+    }
+
+    IOUSBDeviceInterface **device_interface = create_device_interface(device_service);
+    if (!device_interface) {
+        return std::nullopt;
+    }
+    if ((*device_interface)->USBDeviceOpen(device_interface) != kIOReturnSuccess) {
+        (*device_interface)->Release(device_interface);
+        return std::nullopt;
+    }
+    auto device = std::make_shared<IOKitDevice>(device_interface);
+
+    IOUSBFindInterfaceRequest request;
+    request.bInterfaceClass = 0xff;
+    request.bInterfaceSubClass = kIOUSBFindInterfaceDontCare;
+    request.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
+    request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
+
+    io_iterator_t iface_iterator = 0;
+    if ((*device_interface)->CreateInterfaceIterator(device_interface, &request, &iface_iterator) !=
+        kIOReturnSuccess) {
+        return std::nullopt;
+    }
+
+    std::optional<PicobootInterface> picoboot;
+    std::optional<ResetInterface> reset;
+    io_service_t interface_service = 0;
+    while ((interface_service = IOIteratorNext(iface_iterator)) != 0) {
+        IOUSBInterfaceInterface **iface = create_interface_interface(interface_service);
+        IOObjectRelease(interface_service);
+        if (!iface) {
+            continue;
+        }
+        if ((*iface)->USBInterfaceOpen(iface) != kIOReturnSuccess) {
+            (*iface)->Release(iface);
+            continue;
+        }
+
+        UInt8 interface_subclass = 0;
+        UInt8 interface_protocol = 0;
+        UInt8 interface_number = 0;
+        (*iface)->GetInterfaceSubClass(iface, &interface_subclass);
+        (*iface)->GetInterfaceProtocol(iface, &interface_protocol);
+        (*iface)->GetInterfaceNumber(iface, &interface_number);
+        if (verbose) {
+            std::cout << "Found interface " << static_cast<int>(interface_number)
+                      << " subclass=" << static_cast<int>(interface_subclass)
+                      << " protocol=" << static_cast<int>(interface_protocol) << "\n";
+        }
+
+        bool matched = false;
+        if (applications && !reset && interface_subclass == RESET_INTERFACE_SUBCLASS &&
+            interface_protocol == RESET_INTERFACE_PROTOCOL) {
+            reset = ResetInterface{interface_number, iface};
+            matched = true;
+        } else if (!picoboot) {
+            picoboot = picoboot_pipes(iface, interface_number);
+            matched = picoboot.has_value();
+        }
+        if (!matched) {
+            close_interface(iface);
+        }
+        if (picoboot && (reset || !applications)) {
+            break;
+        }
+    }
+
+    IOObjectRelease(iface_iterator);
+    if (!picoboot && !reset) {
+        return std::nullopt;
+    }
+    return DeviceMatch{std::move(device), identity, picoboot, reset};
+}
+
+std::vector<UsbDeviceEntry> enumerate_registry() {
+    std::vector<UsbDeviceEntry> entries;
+    for_each_pi_device([&](io_service_t device_service, const UsbDeviceIdentity &identity) {
+        UsbDeviceEntry entry{identity, 0};
+        IORegistryEntryGetRegistryEntryID(device_service, &entry.registry_id);
+        entries.push_back(std::move(entry));
+    });
+    return entries;
+}
+
+// The registry walk shared by every lookup in this process.
+DeviceEnumerationCache &registry_cache() {
+    static DeviceEnumerationCache cache(enumerate_registry);
+    return cache;
+}
+
+// Opens a device from a registry walk, or nullopt if it has since left the bus.
+std::optional<DeviceMatch> open_registry_entry(const UsbDeviceEntry &entry, bool applications, bool verbose) {
+    CFMutableDictionaryRef matching = IORegistryEntryIDMatching(entry.registry_id);
+    if (!matching) {
+        return std::nullopt;
+    }
+    // Consumes `matching`.
+    io_service_t device_service = IOServiceGetMatchingService(kIOMainPortDefault, matching);
+    if (!device_service) {
+        return std::nullopt;
+    }
+    auto match = open_iokit_device(device_service, entry.identity, applications, verbose);
+    IOObjectRelease(device_service);
+    return match;
+}
+
+// Opens the device `selector` picks among those with a PICOBOOT interface or,
+// when `applications` is set, running applications with the stdio_usb reset
+// interface. Nothing else is opened.
+std::optional<DeviceMatch> find_iokit_device(const DeviceSelector &selector, bool applications, bool verbose) {
+    ProductFilter accept = applications ? is_rebootable_product : is_bootsel_product;
+    return registry_cache().open_selected(selector, accept, [&](const UsbDeviceEntry &entry) {
+        return open_registry_entry(entry, applications, verbose);
+    });
+}
+
+IOReturn write_pipe(IOUSBInterfaceInterface **iface, UInt8 pipe, const void *data, UInt32 size, UInt32 timeout_ms) {
+    return (*iface)->WritePipeTO(iface, pipe, const_cast<void *>(data), size, timeout_ms, timeout_ms);
+}
+
+IOReturn read_pipe(IOUSBInterfaceInterface **iface, UInt8 pipe, void *data, UInt32 *size, UInt32 timeout_ms) {
+    return (*iface)->ReadPipeTO(iface, pipe, data, size, timeout_ms, timeout_ms);
+}
+
+class IOKitPicobootTransport : public PicobootTransport {
+public:
+    IOKitPicobootTransport(std::shared_ptr<IOKitDevice> device, const PicobootInterface &picoboot)
+        : device_(std::move(device)), picoboot_(picoboot) {}
+
+    ~IOKitPicobootTransport() override { close_interface(picoboot_.iface); }
+
+    TransportResult reset_interface() override {
+        IOUSBInterfaceInterface **iface = picoboot_.iface;
+        IOUSBDevRequest request{};
+        request.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBVendor, kUSBInterface);
+        request.bRequest = PICOBOOT_IF_RESET;
+        request.wValue = 0;
+        request.wIndex = picoboot_.interface_number;
+        request.wLength = 0;
+        request.pData = nullptr;
+        return (*iface)->ControlRequest(iface, 0, &request);
+    }
+
+    TransportResult get_cmd_status(picoboot_cmd_status &status) override {
+        IOUSBInterfaceInterface **iface = picoboot_.iface;
+        IOUSBDevRequest request{};
+        request.bmRequestType = USBmakebmRequestType(kUSBIn, kUSBVendor, kUSBInterface);
+        request.bRequest = PICOBOOT_IF_CMD_STATUS;
+        request.wValue = 0;
+        request.wIndex = picoboot_.interface_number;
+        request.wLength = sizeof(status);
+        request.pData = &status;
+        IOReturn ret = (*iface)->ControlRequest(iface, 0, &request);
+        if (ret != kIOReturnSuccess || request.wLenDone != sizeof(status)) {
+            return ret != kIOReturnSuccess ? ret : kIOReturnError;
+        }
+        return ret;
+    }
+
+    TransportResult transfer(const picoboot_cmd &cmd, uint8_t *buffer) override {
+        IOUSBInterfaceInterface **iface = picoboot_.iface;
+        const PicobootInterface &picoboot = picoboot_;
+        const TransferTimeouts &timeouts = timeouts_;
+        IOReturn ret = write_pipe(iface, picoboot.pipe_out, &cmd, sizeof(cmd), timeouts.command_ms);
+        if (ret != kIOReturnSuccess) {
+            return ret;
+        }
+
+        if (cmd.dTransferLength != 0) {
+            UInt32 data_timeout_ms = timeouts.data_ms(cmd.dTransferLength);
+            if (cmd.bCmdId & 0x80u) {
+                UInt32 expected = cmd.dTransferLength;
+                ret = read_pipe(iface, picoboot.pipe_in, buffer, &expected, data_timeout_ms);
+                if (ret != kIOReturnSuccess || expected != cmd.dTransferLength) {
+                    return ret != kIOReturnSuccess ? ret : kIOReturnError;
+                }
+            } else {
+                ret = write_pipe(iface, picoboot.pipe_out, buffer, cmd.dTransferLength, data_timeout_ms);
+                if (ret != kIOReturnSuccess) {
+                    return ret;
+                }
+            }
+        }
+
+        uint8_t ack = 0;
+        if (cmd.bCmdId & 0x80u) {
+            ret = write_pipe(iface, picoboot.pipe_out, &ack, 1, timeouts.command_ms);
+        } else {
+            UInt32 ack_len = 1;
+            ret = read_pipe(iface, picoboot.pipe_in, &ack, &ack_len, timeouts.command_ms);
+        }
+        return ret;
+    }
+
+private:
+    std::shared_ptr<IOKitDevice> device_;
+    PicobootInterface picoboot_;
+};
+
+class IOKitResetTransport : public ResetInterfaceTransport {
+public:
+    IOKitResetTransport(std::shared_ptr<IOKitDevice> device, const ResetInterface &reset)
+        : device_(std::move(device)), reset_(reset) {}
+
+    ~IOKitResetTransport() override { close_interface(reset_.iface); }
+
+    TransportResult reset_request(uint8_t request_id, uint16_t value) override {
+        IOUSBInterfaceInterface **iface = reset_.iface;
+        IOUSBDevRequest request{};
+        request.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBVendor, kUSBInterface);
+        request.bRequest = request_id;
+        request.wValue = value;
+        request.wIndex = reset_.interface_number;
+        request.wLength = 0;
+        request.pData = nullptr;
+        return (*iface)->ControlRequest(iface, 0, &request);
+    }
+
+private:
+    std::shared_ptr<IOKitDevice> device_;
+    ResetInterface reset_;
+};
+} // namespace
+
+namespace {
+UsbRebootDevice make_reboot_device(DeviceMatch &match) {
+    UsbRebootDevice device;
+    device.identity = match.identity;
+    if (match.picoboot) {
+        device.picoboot = std::make_unique<IOKitPicobootTransport>(match.device, *match.picoboot);
+    }
+    if (match.reset) {
+        device.reset = std::make_unique<IOKitResetTransport>(match.device, *match.reset);
+    }
+    return device;
+}
+} // namespace
+
+std::optional<UsbPicobootDevice> find_device(const DeviceSelector &selector) {
+    auto match = find_iokit_device(selector, false, false);
+    if (!match) {
+        return std::nullopt;
+    }
+    return UsbPicobootDevice{match->identity.product_id,
+                             std::make_unique<IOKitPicobootTransport>(match->device, *match->picoboot),
+                             match->identity.location};
+}
+
+std::optional<UsbRebootDevice> find_reboot_device(bool verbose, const DeviceSelector &selector) {
+    auto match = find_iokit_device(selector, true, verbose);
+    if (!match) {
+        return std::nullopt;
+    }
+    return make_reboot_device(*match);
+}
+
+std::vector<UsbRebootDevice> find_reboot_devices(const DeviceFilter &filter, bool verbose) {
+    std::vector<UsbRebootDevice> devices;
+    for (const auto &entry : matching_devices(registry_cache().refresh(), filter, is_rebootable_product)) {
+        if (auto match = open_registry_entry(entry, true, verbose)) {
+            devices.push_back(make_reboot_device(*match));
+        }
+    }
+    return devices;
+}
+
+std::vector<UsbDeviceIdentity> enumerate_usb_devices() {
+    std::vector<UsbDeviceIdentity> identities;
+    for (auto &entry : registry_cache().refresh()) {
+        identities.push_back(std::move(entry.identity));
+    }
+    return identities;
+}
@@ -0,0 +1,208 @@
+#include "load_image.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "byte_source.h"
+#include "elf/elf.h"
+#include "ihex.h"
+#include "mapped_file.h"
+#include "uf2.h"
+
+namespace {
+constexpr uint32_t kBoot2Size = 256;
+
+bool read_image_word(const std::vector<ImageSegment> &segments, uint32_t addr, uint32_t &value) {
+    for (const auto &segment : segments) {
+        if (addr >= segment.addr && addr - segment.addr + 4 <= segment.size) {
+            std::memcpy(&value, segment.data + (addr - segment.addr), sizeof(value));
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses an ELF from a forward-only source; the segment bytes are copied out
+// of the stream, so nothing else needs to stay alive.
+LoadImage stream_elf_image(ByteSource &source) {
+    auto elf = std::make_shared<elf_file>();
+    StreamElfReader reader(source);
+    elf->read(reader);
+    LoadImage image;
+    image.segments = elf_image_segments(*elf);
+    image.entry_point = elf->header().entry;
+    image.storage = std::move(elf);
+    return image;
+}
+
+bool has_elf_magic(const std::string &filename) {
+    char magic[4] = {};
+    std::ifstream file(filename, std::ios::binary);
+    file.read(magic, sizeof(magic));
+    return file && magic[0] == 0x7f && magic[1] == 'E' && magic[2] == 'L' && magic[3] == 'F';
+}
+
+bool has_suffix(const std::string &value, const std::string &suffix) {
+    return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+} // namespace
+
+LoadImage open_load_image(const std::string &filename, uint16_t product_id, const ImageOptions &options) {
+    if (filename == "-") {
+        std::vector<uint8_t> magic(4);
+        auto input = fd_source(STDIN_FILENO);
+        magic.resize(input->read(magic.data(), magic.size()));
+        Compression compression = detect_compression(magic.data(), magic.size());
+        auto source = decompressing_source(prefixed_source(std::move(magic), std::move(input)), compression);
+        return stream_elf_image(*source);
+    }
+
+    LoadImage image;
+    bool raw_binary = options.raw_binary || has_suffix(filename, ".bin");
+    if (!raw_binary && has_elf_magic(filename)) {
+        // Unstripped builds are mostly debug info; read only what gets loaded.
+        auto elf = std::make_shared<elf_file>();
+        read_elf_file(filename, *elf);
+        image.segments = elf_image_segments(*elf);
+        image.entry_point = elf->header().entry;
+        image.storage = std::move(elf);
+        return image;
+    }
+
+    auto mapping = std::make_shared<MappedFile>(filename);
+    const uint8_t *data = mapping->data();
+    size_t size = mapping->size();
+    ImageOptions raw_options = options;
+    raw_options.raw_binary = raw_binary;
+    return load_image_from_memory(data, size, std::move(mapping), product_id, raw_options);
+}
+
+LoadImage load_image_from_memory(const uint8_t *data, size_t size, std::shared_ptr<const void> storage,
+                                 uint16_t product_id, const ImageOptions &options) {
+    LoadImage image;
+    // Raw bytes are taken as given, even when they start like a gzip or zstd stream.
+    if (options.raw_binary) {
+        if (size > UINT32_MAX - options.raw_base) {
+            throw std::runtime_error("Binary does not fit in the address space at the given base");
+        }
+        image.segments.push_back(ImageSegment{options.raw_base, data, static_cast<uint32_t>(size)});
+        image.entry_point = vector_table_entry_point(image.segments, product_id);
+        image.storage = std::move(storage);
+        return image;
+    }
+    Compression compression = detect_compression(data, size);
+    if (compression != Compression::none) {
+        auto source = decompressing_source(memory_source(data, size), compression);
+        return stream_elf_image(*source);
+    }
+    if (size >= 4 && data[0] == 0x7f && data[1] == 'E' && data[2] == 'L' && data[3] == 'F') {
+        auto elf = std::make_shared<elf_file>();
+        MemoryElfReader reader(data, size);
+        elf->read(reader);
+        image.segments = elf_image_segments(*elf);
+        image.entry_point = elf->header().entry;
+        image.storage = std::move(elf);
+        return image;
+    }
+    if (is_intel_hex(data, size)) {
+        auto payload = std::make_shared<std::vector<uint8_t>>();
+        image.segments = intel_hex_image_segments(data, size, *payload, image.entry_point);
+        if (image.entry_point == 0) {
+            image.entry_point = vector_table_entry_point(image.segments, product_id);
+        }
+        image.storage = std::move(payload);
+        return image;
+    }
+    if (!is_uf2(data, size)) {
+        throw std::runtime_error("Unrecognized image format (expected ELF, UF2, Intel HEX or --base for raw binaries)");
+    }
+    image.segments = uf2_image_segments(data, size, product_id);
+    image.entry_point = vector_table_entry_point(image.segments, product_id);
+    image.storage = std::move(storage);
+    return image;
+}
+
+ImageSet open_image_set(const std::vector<std::string> &filenames, uint16_t product_id, const ImageOptions &options) {
+    ImageSet set;
+    set.filenames = filenames;
+    for (const auto &spec : filenames) {
+        ImageOptions image_options = options;
+        std::string filename = spec;
+        size_t at = spec.rfind('@');
+        if (at != std::string::npos && at + 1 < spec.size()) {
+            char *end = nullptr;
+            unsigned long long base = std::strtoull(spec.c_str() + at + 1, &end, 0);
+            if (*end == '\0' && base <= UINT32_MAX) {
+                filename = spec.substr(0, at);
+                image_options.raw_binary = true;
+                image_options.raw_base = static_cast<uint32_t>(base);
+            }
+        }
+        set.images.push_back(open_load_image(filename, product_id, image_options));
+        if (set.entry_point == 0) {
+            set.entry_point = set.images.back().entry_point;
+        }
+    }
+    if (options.entry_point != 0) {
+        set.entry_point = options.entry_point;
+    }
+
+    struct Owned {
+        ImageSegment segment;
+        size_t image;
+    };
+    std::vector<Owned> owned;
+    for (size_t i = 0; i < set.images.size(); ++i) {
+        for (const auto &segment : set.images[i].segments) {
+            set.segments.push_back(segment);
+            owned.push_back(Owned{segment, i});
+        }
+    }
+    std::sort(owned.begin(), owned.end(), [](const Owned &a, const Owned &b) {
+        return a.segment.addr < b.segment.addr;
+    });
+    // Compare each segment against the furthest-reaching one before it from
+    // another image; overlaps inside one image keep their last-wins meaning.
+    auto segment_end = [](const Owned &owned_segment) {
+        return static_cast<uint64_t>(owned_segment.segment.addr) + owned_segment.segment.size;
+    };
+    std::vector<const Owned *> reach(set.images.size(), nullptr);
+    for (const auto &current : owned) {
+        for (size_t i = 0; i < reach.size(); ++i) {
+            const Owned *other = reach[i];
+            if (i == current.image || !other || segment_end(*other) <= current.segment.addr) {
+                continue;
+            }
+            std::ostringstream message;
+            message << set.filenames[other->image] << " and " << set.filenames[current.image]
+                    << " both write 0x" << std::hex << current.segment.addr;
+            throw std::runtime_error(message.str());
+        }
+        const Owned *&mine = reach[current.image];
+        if (!mine || segment_end(current) > segment_end(*mine)) {
+            mine = &current;
+        }
+    }
+    return set;
+}
+
+uint32_t vector_table_entry_point(const std::vector<ImageSegment> &segments, uint16_t product_id) {
+    if (segments.empty()) {
+        return 0;
+    }
+    uint32_t base = std::min_element(segments.begin(), segments.end(), [](const ImageSegment &a,
+                                                                           const ImageSegment &b) {
+                        return a.addr < b.addr;
+                    })->addr;
+    if (product_id == kProductIdRp2040UsbBoot && base == kFlashStart) {
+        base += kBoot2Size;
+    }
+    uint32_t entry = 0;
+    return read_image_word(segments, base + 4, entry) ? entry : 0;
+}
@@ -0,0 +1,196 @@
+#include "load_plan.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "byte_source.h"
+
+namespace {
+uint32_t segment_address(const elf32_ph_entry &segment) {
+    if (segment.paddr != 0) {
+        return segment.paddr;
+    }
+    return segment.vaddr;
+}
+} // namespace
+
+size_t LoadPlan::flash_page_count() const {
+    size_t pages = 0;
+    for (const auto &extent : flash_extents) {
+        pages += extent.data.size() / kFlashPageSize;
+    }
+    return pages;
+}
+
+uint32_t align_down(uint32_t value, uint32_t align) {
+    return value & ~(align - 1);
+}
+
+uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+MemoryLayout memory_layout_for_product(uint16_t product_id) {
+    if (product_id == kProductIdRp2040UsbBoot) {
+        return MemoryLayout{kFlashEndRp2040, kSramEndRp2040};
+    }
+    return MemoryLayout{kFlashEndRp2350, kSramEndRp2350};
+}
+
+bool product_id_for_chip(const std::string &chip, uint16_t &product_id) {
+    if (chip == "rp2040") {
+        product_id = kProductIdRp2040UsbBoot;
+        return true;
+    }
+    if (chip == "rp2350") {
+        product_id = kProductIdRp2350UsbBoot;
+        return true;
+    }
+    return false;
+}
+
+const char *chip_name_for_product(uint16_t product_id) {
+    return product_id == kProductIdRp2040UsbBoot ? "rp2040" : "rp2350";
+}
+
+bool is_flash_address(uint32_t addr, const MemoryLayout &layout) {
+    return addr >= kFlashStart && addr < layout.flash_end;
+}
+
+bool is_sram_address(uint32_t addr, const MemoryLayout &layout) {
+    return addr >= kSramStart && addr < layout.sram_end;
+}
+
+bool map_flash_to_sram(uint32_t addr, uint32_t size, const MemoryLayout &layout, uint32_t &mapped_addr) {
+    if (addr < kFlashStart) {
+        return false;
+    }
+    uint32_t offset = addr - kFlashStart;
+    mapped_addr = kSramStart + offset;
+    if (mapped_addr < kSramStart || mapped_addr + size > layout.sram_end) {
+        return false;
+    }
+    return true;
+}
+
+std::vector<Range> merge_ranges(std::vector<Range> ranges) {
+    if (ranges.empty()) {
+        return ranges;
+    }
+    std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) { return a.start < b.start; });
+    std::vector<Range> merged;
+    merged.push_back(ranges.front());
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        Range &last = merged.back();
+        if (ranges[i].start <= last.end) {
+            last.end = std::max(last.end, ranges[i].end);
+        } else {
+            merged.push_back(ranges[i]);
+        }
+    }
+    return merged;
+}
+
+void read_elf_file(const std::string &filename, elf_file &elf) {
+    PreadElfReader reader(filename);
+    elf.read(reader);
+}
+
+std::vector<ImageSegment> elf_image_segments(const elf_file &elf) {
+    std::vector<ImageSegment> segments;
+    for (const auto &segment : elf.segments()) {
+        if (!segment.is_load() || segment.filez == 0) {
+            continue;
+        }
+        uint32_t addr = segment_address(segment);
+        if (addr == 0) {
+            throw std::runtime_error("ELF segment has no load address");
+        }
+        segments.push_back(ImageSegment{addr, elf.segment_data(segment), segment.filez});
+    }
+    return segments;
+}
+
+LoadPlan build_load_plan(const std::vector<ImageSegment> &segments, uint32_t entry_point, const MemoryLayout &layout,
+                         bool allow_flash) {
+    LoadPlan plan;
+    plan.entry_point = entry_point;
+
+    std::vector<ImageSegment> flash_segments;
+    std::vector<Range> page_ranges;
+    std::vector<Range> erase_ranges;
+    for (const auto &segment : segments) {
+        if (segment.size == 0) {
+            continue;
+        }
+        if (!is_flash_address(segment.addr, layout)) {
+            plan.ram_segments.push_back(segment);
+            continue;
+        }
+        if (!allow_flash) {
+            uint32_t mapped_addr = 0;
+            if (!map_flash_to_sram(segment.addr, segment.size, layout, mapped_addr)) {
+                plan.skipped_flash_segments = true;
+                continue;
+            }
+            plan.mirrored_flash_segments = true;
+            plan.ram_segments.push_back(ImageSegment{mapped_addr, segment.data, segment.size});
+            continue;
+        }
+        uint32_t end = segment.addr + segment.size;
+        flash_segments.push_back(segment);
+        page_ranges.push_back(Range{align_down(segment.addr, kFlashPageSize), align_up(end, kFlashPageSize)});
+        erase_ranges.push_back(Range{align_down(segment.addr, kFlashSectorSize), align_up(end, kFlashSectorSize)});
+    }
+
+    for (const auto &range : merge_ranges(std::move(page_ranges))) {
+        plan.flash_extents.push_back(FlashExtent{range.start, std::vector<uint8_t>(range.end - range.start, 0)});
+    }
+    for (const auto &segment : flash_segments) {
+        auto it = std::upper_bound(plan.flash_extents.begin(), plan.flash_extents.end(), segment.addr,
+                                   [](uint32_t addr, const FlashExtent &extent) { return addr < extent.addr; });
+        FlashExtent &extent = *std::prev(it);
+        std::memcpy(extent.data.data() + (segment.addr - extent.addr), segment.data, segment.size);
+    }
+    plan.erase_ranges = merge_ranges(std::move(erase_ranges));
+    return plan;
+}
+
+bool resolve_exec_address(const LoadPlan &plan, const MemoryLayout &layout, bool allow_flash, uint32_t &exec_addr) {
+    std::string error;
+    if (!resolve_exec_address(plan, layout, allow_flash, exec_addr, error)) {
+        std::cerr << error << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool resolve_exec_address(const LoadPlan &plan, const MemoryLayout &layout, bool allow_flash, uint32_t &exec_addr,
+                          std::string &error) {
+    if (plan.entry_point == 0) {
+        error = "Image entry point is zero; cannot execute.";
+        return false;
+    }
+    exec_addr = plan.entry_point;
+    if (!allow_flash && is_flash_address(plan.entry_point, layout)) {
+        uint32_t mapped_addr = 0;
+        if (!map_flash_to_sram(plan.entry_point, 4, layout, mapped_addr)) {
+            std::ostringstream message;
+            message << "Entry point 0x" << std::hex << plan.entry_point
+                    << " cannot be mirrored into SRAM. Use --flash to run from flash.";
+            error = message.str();
+            return false;
+        }
+        exec_addr = mapped_addr;
+    } else if (!allow_flash && !is_sram_address(plan.entry_point, layout) &&
+               !is_flash_address(plan.entry_point, layout)) {
+        std::ostringstream message;
+        message << "Entry point 0x" << std::hex << plan.entry_point << " is not in flash or SRAM.";
+        error = message.str();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,209 @@
+#include "loader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "progress.h"
+
+namespace {
+// Streams RAM segments out as options.ram_write_chunk writes. Full chunks go
+// straight from the image; short or split pieces of a contiguous run are
+// gathered first.
+class RamWriter {
+public:
+    RamWriter(PicobootTransport &transport, const LoadOptions &options, uint64_t total)
+        : transport_(transport), options_(options), total_(total), chunk_(std::max(options.ram_write_chunk, 1u)),
+          buffer_(chunk_), patched_(chunk_) {}
+
+    TransportResult write(uint32_t addr, const uint8_t *data, uint32_t size) {
+        while (size > 0) {
+            if (buffered_ != 0 && buffered_addr_ + buffered_ != addr) {
+                TransportResult ret = flush();
+                if (ret != kTransportOk) {
+                    return ret;
+                }
+            }
+            uint32_t take;
+            if (buffered_ == 0 && size >= chunk_) {
+                take = chunk_;
+                TransportResult ret = write_chunk(addr, data, take);
+                if (ret != kTransportOk) {
+                    return ret;
+                }
+            } else {
+                if (buffered_ == 0) {
+                    buffered_addr_ = addr;
+                }
+                take = std::min(chunk_ - buffered_, size);
+                std::memcpy(buffer_.data() + buffered_, data, take);
+                buffered_ += take;
+                if (buffered_ == chunk_) {
+                    TransportResult ret = flush();
+                    if (ret != kTransportOk) {
+                        return ret;
+                    }
+                }
+            }
+            addr += take;
+            data += take;
+            size -= take;
+        }
+        return kTransportOk;
+    }
+
+    TransportResult flush() {
+        if (buffered_ == 0) {
+            return kTransportOk;
+        }
+        uint32_t size = buffered_;
+        buffered_ = 0;
+        return write_chunk(buffered_addr_, buffer_.data(), size);
+    }
+
+private:
+    TransportResult write_chunk(uint32_t addr, const uint8_t *data, uint32_t size) {
+        if (options_.patches) {
+            data = options_.patches->apply(addr, data, size, patched_.data());
+        }
+        TransportResult ret = picoboot_write(transport_, addr, data, size);
+        if (ret != kTransportOk) {
+            std::cerr << "RAM write failed at 0x" << std::hex << addr << " (IOKit error " << std::dec << ret
+                      << ").\n";
+            return ret;
+        }
+        if (options_.counters) {
+            options_.counters->add_write(size);
+        }
+        if (options_.progress) {
+            done_ += size;
+            options_.progress(LoadPhase::ram, done_, total_);
+        }
+        return ret;
+    }
+
+    PicobootTransport &transport_;
+    const LoadOptions &options_;
+    uint64_t total_;
+    uint64_t done_ = 0;
+    uint32_t chunk_;
+    std::vector<uint8_t> buffer_;
+    std::vector<uint8_t> patched_;
+    uint32_t buffered_addr_ = 0;
+    uint32_t buffered_ = 0;
+};
+} // namespace
+
+uint32_t ram_write_command_count(const LoadPlan &plan, uint32_t chunk) {
+    uint32_t commands = 0;
+    uint64_t run_size = 0;
+    uint32_t run_end = 0;
+    for (const auto &segment : plan.ram_segments) {
+        if (run_size != 0 && segment.addr != run_end) {
+            commands += static_cast<uint32_t>((run_size + chunk - 1) / chunk);
+            run_size = 0;
+        }
+        run_size += segment.size;
+        run_end = segment.addr + segment.size;
+    }
+    return commands + static_cast<uint32_t>((run_size + chunk - 1) / chunk);
+}
+
+TransportResult load_plan_to_device(PicobootTransport &transport, const LoadPlan &plan, const LoadOptions &options) {
+    TransportResult ret = transport.reset_interface();
+    if (ret != kTransportOk) {
+        std::cerr << "Warning: reset interface failed (IOKit error " << ret << ").\n";
+    }
+    ExclusiveAccess exclusive(transport, options.exclusive);
+
+    ret = kTransportOk;
+    if (!plan.flash_extents.empty()) {
+        ret = picoboot_exit_xip(transport);
+        if (ret != kTransportOk) {
+            std::cerr << "Failed to exit XIP mode (IOKit error " << ret << ").\n";
+        } else if (options.counters) {
+            options.counters->add_command();
+        }
+
+        uint64_t erase_total = 0;
+        for (const auto &range : plan.erase_ranges) {
+            erase_total += range.end - range.start;
+        }
+        uint64_t erased = 0;
+        for (const auto &range : plan.erase_ranges) {
+            ret = picoboot_flash_erase(transport, range.start, range.end - range.start);
+            if (ret != kTransportOk) {
+                std::cerr << "Flash erase failed at 0x" << std::hex << range.start << " (IOKit error " << std::dec << ret
+                          << ").\n";
+                return ret;
+            }
+            erased += range.end - range.start;
+            if (options.counters) {
+                options.counters->add_erase(range.end - range.start);
+            }
+            if (options.progress) {
+                options.progress(LoadPhase::erase, erased, erase_total);
+            }
+        }
+    }
+
+    uint64_t ram_total = 0;
+    for (const auto &segment : plan.ram_segments) {
+        ram_total += segment.size;
+    }
+    RamWriter ram_writer(transport, options, ram_total);
+    for (const auto &segment : plan.ram_segments) {
+        ret = ram_writer.write(segment.addr, segment.data, segment.size);
+        if (ret != kTransportOk) {
+            return ret;
+        }
+    }
+    ret = ram_writer.flush();
+    if (ret != kTransportOk) {
+        return ret;
+    }
+
+    // Whole pages per write; an extent is always a whole number of pages.
+    uint32_t flash_chunk = std::max(options.flash_write_chunk / kFlashPageSize, 1u) * kFlashPageSize;
+    std::vector<uint8_t> patched(options.patches ? flash_chunk : 0);
+    uint64_t flash_total = static_cast<uint64_t>(plan.flash_page_count()) * kFlashPageSize;
+    uint64_t flashed = 0;
+    for (const auto &extent : plan.flash_extents) {
+        uint32_t extent_size = static_cast<uint32_t>(extent.data.size());
+        for (uint32_t offset = 0; offset < extent_size; offset += flash_chunk) {
+            uint32_t size = std::min(flash_chunk, extent_size - offset);
+            const uint8_t *data = extent.data.data() + offset;
+            if (options.patches) {
+                data = options.patches->apply(extent.addr + offset, data, size, patched.data());
+            }
+            ret = picoboot_write(transport, extent.addr + offset, data, size);
+            if (ret != kTransportOk) {
+                std::cerr << "Flash write failed at 0x" << std::hex << (extent.addr + offset) << " (IOKit error "
+                          << std::dec << ret << ").\n";
+                return ret;
+            }
+            flashed += size;
+            if (options.counters) {
+                options.counters->add_write(size);
+            }
+            if (options.progress) {
+                options.progress(LoadPhase::flash, flashed, flash_total);
+            }
+        }
+    }
+
+    if (options.exec_after) {
+        ret = picoboot_exec(transport, options.exec_addr);
+        if (ret != kTransportOk) {
+            std::cerr << "Exec failed at 0x" << std::hex << options.exec_addr << " (IOKit error " << std::dec << ret
+                      << ").\n";
+        } else {
+            if (options.counters) {
+                options.counters->add_command();
+            }
+            exclusive.dismiss();
+        }
+    }
+    return ret;
+}
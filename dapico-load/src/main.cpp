@@ -1,642 +1,1131 @@
-#include <CoreFoundation/CoreFoundation.h>
-#include <IOKit/IOCFPlugIn.h>
-#include <IOKit/IOKitLib.h>
-#include <IOKit/usb/IOUSBLib.h>
-#include <IOKit/usb/USBSpec.h>
-
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <map>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include "boot/picoboot.h"
+#include "batch_dryrun.h"
 #include "dryrun.h"
-#include "elf/elf.h"
+#include "flash_dump.h"
+#include "format_util.h"
+#include "image_diff.h"
+#include "iokit_device.h"
+#include "load_image.h"
+#include "load_plan.h"
+#include "loader.h"
+#include "metrics.h"
+#include "otp.h"
+#include "partition_table.h"
+#include "patch_overlay.h"
+#include "progress.h"
+#include "ram_image.h"
+#include "reboot.h"
+#include "session_script.h"
+#include "sim_device.h"
+#include "transfer_profile.h"
+#include "watch.h"
 
 namespace {
-constexpr uint16_t kVendorIdRaspberryPi = 0x2e8a;
-constexpr uint16_t kProductIdRp2040UsbBoot = 0x0003;
-constexpr uint16_t kProductIdRp2350UsbBoot = 0x000f;
-constexpr uint32_t kFlashSectorSize = 4096;
-constexpr uint32_t kFlashPageSize = 256;
-constexpr uint32_t kUsbTimeoutMs = 3000;
-constexpr uint32_t kFlashStart = 0x10000000;
-constexpr uint32_t kSramStart = 0x20000000;
-constexpr uint32_t kFlashEndRp2040 = 0x11000000;
-constexpr uint32_t kFlashEndRp2350 = 0x14000000;
-constexpr uint32_t kSramEndRp2040 = 0x20042000;
-constexpr uint32_t kSramEndRp2350 = 0x20082000;
-
-struct PicobootInterface {
-    UInt8 interface_number{};
-    UInt8 pipe_in{};
-    UInt8 pipe_out{};
-    IOUSBInterfaceInterface **iface{};
-};
-
-struct DeviceMatch {
-    IOUSBDeviceInterface **device{};
-    uint16_t product_id{};
-    PicobootInterface picoboot{};
-};
-
-struct Range {
-    uint32_t start;
-    uint32_t end;
-};
-
-struct MemoryLayout {
-    uint32_t flash_end;
-    uint32_t sram_end;
-};
-
 void print_usage(const char *argv0) {
-    std::cout << "Usage: " << argv0 << " [--flash] [--no-exec] [--dryrun] <file.elf>\n"
+    std::cout << "Usage: " << argv0
+              << " [--flash] [--no-exec] [--eject|--shared] [--base <addr>] [--entry <addr>] [--dryrun [dryrun options]] <file>...\n"
+              << "       " << argv0 << " --ab-update [--sim rp2350] <file>...\n"
+              << "       " << argv0 << " --ram-image [--sim rp2350] <file>...\n"
+              << "       " << argv0 << " --dryrun --batch [--jobs <n>] [dryrun options] <file|dir>...\n"
+              << "       " << argv0 << " --diff-elf <old.elf> <new.elf> [dryrun options]\n"
+              << "       " << argv0 << " --script <file|-> [--sim <chip>]\n"
+              << "       " << argv0 << " --dump <start:len> <out.bin> [--dump-fill] [--sim <chip>]\n"
+              << "       " << argv0 << " --otp-read <row:count> [--otp-raw] [--sim <chip>]\n"
+              << "       " << argv0 << " --otp-write <manifest|-> [--dryrun] [--verbose] [--sim <chip>]\n"
+              << "       " << argv0 << " --watch [--flash] [--no-exec] [--debounce-ms <ms>] [--sim <chip>] <file>\n"
+              << "       " << argv0 << " --autotune [--profile <file>] [--sim <chip>]\n"
               << "  --flash    Allow writing flash segments instead of RAM-mirroring\n"
               << "  --no-exec  Skip executing the loaded image\n"
-              << "  --dryrun   Print planned operations without using a connected device\n";
+              << "  --eject    Also eject the BOOTSEL drive for the session, so the host stops probing it\n"
+              << "  --shared   Load without exclusive access, sharing the link with the BOOTSEL drive\n"
+              << "  --base     Load address of a raw binary (implied for *.bin, default 0x10000000)\n"
+              << "  --entry    Execute at this address instead of the first image's entry point\n"
+              << "  --ab-update  Write flash contents into the inactive A/B partition of an RP2350 and reboot into it\n"
+              << "             with FLASH_UPDATE, erasing only what the image covers in that slot\n"
+              << "  --ram-image  Pack an SRAM-linked image into one region of an RP2350 and boot it with REBOOT2\n"
+              << "             RAM_IMAGE, so the bootrom validates it\n"
+              << "  --dryrun   Summarize planned operations and predicted load time without a device\n"
+              << "  --script   Run a command script (erase, write, read, load, exec, reboot, status, wait) on one\n"
+              << "             open session, timing each step\n"
+              << "  --sim      Use a simulated rp2040 or rp2350 instead of a USB device\n"
+              << "  --dump     Read device memory to a file; erased (0xff) 4 KiB blocks are left as holes\n"
+              << "  --dump-fill  Write erased blocks out as 0xff instead of leaving holes\n"
+              << "  --otp-read   Print RP2350 OTP rows as a manifest, decoding ECC rows (raw 24-bit rows with --otp-raw)\n"
+              << "  --otp-write  Program the manifest's rows that differ from the device; --dryrun only lists them\n"
+              << "  --watch    Stay resident and reload <file> each time it is rebuilt, sending only what changed\n"
+              << "  --debounce-ms  Quiet time after the last write before reloading (default 30)\n"
+              << "  --autotune Time writes and reads of 256 B-64 KiB against SRAM and store the best transfer sizes\n"
+              << "             and timeouts for this chip and host; loads and dumps then use them\n"
+              << "  --profile  Transfer profile file (default $DAPICO_PROFILES or ~/.dapico-load-profiles)\n"
+              << "  --metrics  Keep load, byte, retry, failure and per-command latency counters and write them to\n"
+              << "             this Prometheus textfile after every load (serialized units and --watch)\n"
+              << "  --retries  Start a failed load again on the same device up to this many times (default 0)\n"
+              << "  --progress Progress while loading: tty (a bar on stderr, the default on a terminal), json\n"
+              << "             (one object per line on stderr) or none\n"
+              << "Device selection (from USB metadata; other devices are never opened):\n"
+              << "  --serial <s>      The BOOTSEL device with this USB serial number\n"
+              << "  --location <hex>  The device at this USB location ID, or the first below it for a hub\n"
+              << "  --index <n>       The n-th matching device in location order, from 0 (default 0)\n"
+              << "Serialization options (one load per unit, sharing one parsed plan):\n"
+              << "  --patch-csv <file>                 Per-unit patches, one row per unit: addr,hexbytes[,...]\n"
+              << "  --patch-serial <addr:first[:width]> Write an incrementing little-endian serial (default 4 bytes)\n"
+              << "  --units <n>                        Number of units (default: CSV rows, or 1)\n"
+              << "Dry run options:\n"
+              << "  --chip <rp2040|rp2350>       Target memory layout and timings (default rp2040)\n"
+              << "  --cost-model <file|k=v,...>  Override cost model parameters\n"
+              << "  --budget-ms <ms>             Exit with status 3 if the predicted time exceeds this\n"
+              << "  --json                       Print the summary as a single JSON object\n"
+              << "  --verbose                    Also list every planned erase and write\n"
+              << "  --batch                      Check every file (and *.elf/*.uf2/*.hex under each directory) as\n"
+              << "                               a separate image, in parallel, and print one summary\n"
+              << "  --jobs <n>                   Worker threads for --batch (default: one per core)\n"
+              << "<file> may be an ELF (optionally .gz/.zst compressed), UF2, Intel HEX or raw binary image;\n"
+              << "'-' reads an ELF from stdin. Several files are merged into one session; file@addr loads a\n"
+              << "raw binary at addr.\n"
+              << "--diff-elf compares the flash contents of two builds and predicts the differential flash time.\n";
 }
 
-uint32_t cf_number_to_uint32(CFTypeRef value) {
-    if (!value || CFGetTypeID(value) != CFNumberGetTypeID()) {
-        return 0;
-    }
-    uint32_t out = 0;
-    CFNumberGetValue(static_cast<CFNumberRef>(value), kCFNumberSInt32Type, &out);
-    return out;
+bool parse_positive_double(const std::string &text, double &value) {
+    char *end = nullptr;
+    value = std::strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0' && value > 0;
 }
 
-IOUSBDeviceInterface **create_device_interface(io_service_t device_service) {
-    IOCFPlugInInterface **plug_in = nullptr;
-    SInt32 score = 0;
-    IOReturn ret = IOCreatePlugInInterfaceForService(device_service, kIOUSBDeviceUserClientTypeID,
-                                                     kIOCFPlugInInterfaceID, &plug_in, &score);
-    if (ret != kIOReturnSuccess || !plug_in) {
-        return nullptr;
-    }
-
-    IOUSBDeviceInterface **device = nullptr;
-    HRESULT result = (*plug_in)->QueryInterface(plug_in, CFUUIDGetUUIDBytes(kIOUSBDeviceInterfaceID),
-                                                reinterpret_cast<void **>(&device));
-    (*plug_in)->Release(plug_in);
-    if (result || !device) {
-        return nullptr;
+bool parse_address(const std::string &text, uint32_t &addr) {
+    char *end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0' || value > UINT32_MAX) {
+        return false;
     }
-    return device;
+    addr = static_cast<uint32_t>(value);
+    return true;
 }
 
-IOUSBInterfaceInterface **create_interface_interface(io_service_t interface_service) {
-    IOCFPlugInInterface **plug_in = nullptr;
-    SInt32 score = 0;
-    IOReturn ret = IOCreatePlugInInterfaceForService(interface_service, kIOUSBInterfaceUserClientTypeID,
-                                                     kIOCFPlugInInterfaceID, &plug_in, &score);
-    if (ret != kIOReturnSuccess || !plug_in) {
-        return nullptr;
-    }
-
-    IOUSBInterfaceInterface **iface = nullptr;
-    HRESULT result = (*plug_in)->QueryInterface(plug_in, CFUUIDGetUUIDBytes(kIOUSBInterfaceInterfaceID),
-                                                reinterpret_cast<void **>(&iface));
-    (*plug_in)->Release(plug_in);
-    if (result || !iface) {
-        return nullptr;
-    }
-    return iface;
+// start:len, e.g. 0x10000000:0x1000000
+bool parse_range(const std::string &text, uint32_t &start, uint32_t &size) {
+    size_t colon = text.find(':');
+    return colon != std::string::npos && parse_address(text.substr(0, colon), start) &&
+           parse_address(text.substr(colon + 1), size) && size != 0;
 }
 
-std::optional<DeviceMatch> find_device() {
-    CFMutableDictionaryRef matching = IOServiceMatching(kIOUSBDeviceClassName);
-    if (!matching) {
-        return std::nullopt;
-    }
+struct SerialPatchSpec {
+    bool enabled = false;
+    uint32_t addr = 0;
+    uint64_t first = 0;
+    uint32_t width = 4;
+};
 
-    io_iterator_t iterator = 0;
-    if (IOServiceGetMatchingServices(kIOMainPortDefault, matching, &iterator) != kIOReturnSuccess) {
-        return std::nullopt;
+// addr:first[:width]
+bool parse_serial_spec(const std::string &text, SerialPatchSpec &spec) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos || !parse_address(text.substr(0, colon), spec.addr)) {
+        return false;
     }
-
-    std::optional<DeviceMatch> match;
-    io_service_t device_service = 0;
-    while ((device_service = IOIteratorNext(iterator)) != 0) {
-        CFTypeRef vendor_ref = IORegistryEntryCreateCFProperty(device_service, CFSTR(kUSBVendorID),
-                                                               kCFAllocatorDefault, 0);
-        CFTypeRef product_ref = IORegistryEntryCreateCFProperty(device_service, CFSTR(kUSBProductID),
-                                                                kCFAllocatorDefault, 0);
-        uint32_t vendor_id = cf_number_to_uint32(vendor_ref);
-        uint32_t product_id = cf_number_to_uint32(product_ref);
-        if (vendor_ref) {
-            CFRelease(vendor_ref);
-        }
-        if (product_ref) {
-            CFRelease(product_ref);
-        }
-
-        if (vendor_id != kVendorIdRaspberryPi) {
-            IOObjectRelease(device_service);
-            continue;
-        }
-        if (product_id != kProductIdRp2040UsbBoot && product_id != kProductIdRp2350UsbBoot) {
-            IOObjectRelease(device_service);
-            continue;
+    std::string rest = text.substr(colon + 1);
+    size_t width_colon = rest.find(':');
+    std::string first = rest.substr(0, width_colon);
+    char *end = nullptr;
+    spec.first = std::strtoull(first.c_str(), &end, 0);
+    if (first.empty() || *end != '\0') {
+        return false;
+    }
+    if (width_colon != std::string::npos) {
+        std::string width = rest.substr(width_colon + 1);
+        spec.width = static_cast<uint32_t>(std::strtoul(width.c_str(), &end, 0));
+        if (width.empty() || *end != '\0' || spec.width == 0 || spec.width > 8) {
+            return false;
         }
+    }
+    spec.enabled = true;
+    return true;
+}
 
-        IOUSBDeviceInterface **device = create_device_interface(device_service);
-        if (!device) {
-            IOObjectRelease(device_service);
-            continue;
-        }
-        if ((*device)->USBDeviceOpen(device) != kIOReturnSuccess) {
-            (*device)->Release(device);
-            IOObjectRelease(device_service);
-            continue;
+// One patch list per unit: the CSV row (if any) followed by the unit's serial.
+std::vector<std::vector<DevicePatch>> unit_patch_lists(const std::string &csv_filename, const SerialPatchSpec &serial,
+                                                       size_t units) {
+    std::vector<std::vector<DevicePatch>> lists;
+    if (!csv_filename.empty()) {
+        lists = read_patch_csv(csv_filename);
+        if (units > lists.size()) {
+            throw std::runtime_error(csv_filename + " has " + std::to_string(lists.size()) + " units, not " +
+                                     std::to_string(units));
         }
-
-        IOUSBFindInterfaceRequest request;
-        request.bInterfaceClass = 0xff;
-        request.bInterfaceSubClass = kIOUSBFindInterfaceDontCare;
-        request.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
-        request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
-
-        io_iterator_t iface_iterator = 0;
-        if ((*device)->CreateInterfaceIterator(device, &request, &iface_iterator) != kIOReturnSuccess) {
-            (*device)->USBDeviceClose(device);
-            (*device)->Release(device);
-            IOObjectRelease(device_service);
-            continue;
+    }
+    if (units == 0) {
+        units = lists.empty() ? 1 : lists.size();
+    }
+    lists.resize(units);
+    if (serial.enabled) {
+        for (size_t unit = 0; unit < units; ++unit) {
+            lists[unit].push_back(serial_patch(serial.addr, serial.first + unit, serial.width));
         }
+    }
+    return lists;
+}
 
-        io_service_t interface_service = 0;
-        while ((interface_service = IOIteratorNext(iface_iterator)) != 0) {
-            IOUSBInterfaceInterface **iface = create_interface_interface(interface_service);
-            IOObjectRelease(interface_service);
-            if (!iface) {
-                continue;
-            }
-            if ((*iface)->USBInterfaceOpen(iface) != kIOReturnSuccess) {
-                (*iface)->Release(iface);
-                continue;
-            }
-
-            UInt8 num_endpoints = 0;
-            (*iface)->GetNumEndpoints(iface, &num_endpoints);
-
-            UInt8 interface_number = 0;
-            (*iface)->GetInterfaceNumber(iface, &interface_number);
-
-            UInt8 pipe_in = 0;
-            UInt8 pipe_out = 0;
-            for (UInt8 pipe_ref = 1; pipe_ref <= num_endpoints; ++pipe_ref) {
-                UInt8 direction = 0;
-                UInt8 number = 0;
-                UInt8 transfer_type = 0;
-                UInt16 max_packet = 0;
-                UInt8 interval = 0;
-                if ((*iface)->GetPipeProperties(iface, pipe_ref, &direction, &number, &transfer_type,
-                                                &max_packet, &interval) != kIOReturnSuccess) {
-                    continue;
-                }
-                if (transfer_type != kUSBBulk) {
-                    continue;
-                }
-                if (direction == kUSBIn) {
-                    pipe_in = pipe_ref;
-                } else if (direction == kUSBOut) {
-                    pipe_out = pipe_ref;
-                }
-            }
-
-            if (pipe_in != 0 && pipe_out != 0) {
-                match = DeviceMatch{device, static_cast<uint16_t>(product_id),
-                                    PicobootInterface{interface_number, pipe_in, pipe_out, iface}};
-                break;
-            }
+// The BOOTSEL device `selector` picks, or a fresh SimulatedDevice when
+// sim_product_id is set.
+std::optional<UsbPicobootDevice> open_device(uint16_t sim_product_id, const DeviceSelector &selector) {
+    if (sim_product_id != 0) {
+        return UsbPicobootDevice{sim_product_id,
+                                 std::make_unique<SimulatedDevice>(sim_profile_for_product(sim_product_id))};
+    }
+    return find_device(selector);
+}
 
-            (*iface)->USBInterfaceClose(iface);
-            (*iface)->Release(iface);
+// Waits for the device just loaded to leave BOOTSEL (it executed, or was
+// unplugged) and for the next one to arrive. Both polls go through `selector`,
+// so a station pinned to one hub port with --location only sees that port.
+std::optional<UsbPicobootDevice> wait_for_next_device(uint16_t sim_product_id, const DeviceSelector &selector) {
+    constexpr auto kPollInterval = std::chrono::milliseconds(250);
+    if (sim_product_id != 0) {
+        return open_device(sim_product_id, selector);
+    }
+    while (find_device(selector)) {
+        std::this_thread::sleep_for(kPollInterval);
+    }
+    for (;;) {
+        auto match = find_device(selector);
+        if (match) {
+            return match;
         }
+        std::this_thread::sleep_for(kPollInterval);
+    }
+}
 
-        IOObjectRelease(iface_iterator);
+// Waits for a BOOTSEL device. A running application that exposes the stdio_usb
+// reset interface is asked to reboot into BOOTSEL, so a rebuild reloads without
+// touching the board. Only PICOBOOT is needed, so the drive is left out.
+std::optional<UsbPicobootDevice> wait_for_bootsel_device(const DeviceSelector &selector) {
+    constexpr auto kPollInterval = std::chrono::milliseconds(50);
+    auto match = find_device(selector);
+    if (match) {
+        return match;
+    }
+    if (auto app = find_reboot_device(false, selector)) {
+        RebootOutcome outcome = RebootOutcome::no_interface;
+        reboot_device(app->target(), true, true, outcome);
+    }
+    std::cout << "Waiting for a device in BOOTSEL...\n";
+    for (;;) {
+        std::this_thread::sleep_for(kPollInterval);
+        match = find_device(selector);
         if (match) {
-            IOObjectRelease(device_service);
-            break;
+            return match;
         }
-
-        (*device)->USBDeviceClose(device);
-        (*device)->Release(device);
-        IOObjectRelease(device_service);
     }
-
-    IOObjectRelease(iterator);
-    return match;
 }
 
-IOReturn write_pipe(IOUSBInterfaceInterface **iface, UInt8 pipe, const void *data, UInt32 size, UInt32 timeout_ms) {
-    return (*iface)->WritePipeTO(iface, pipe, const_cast<void *>(data), size, timeout_ms, timeout_ms);
+// The --autotune profile stored for this chip and host, if any.
+std::optional<TransferProfile> stored_transfer_profile(uint16_t product_id, bool simulated,
+                                                       const std::string &profile_path) {
+    try {
+        std::vector<TransferProfile> profiles = read_transfer_profiles(profile_path);
+        std::string host = simulated ? kSimulatedProfileHost : transfer_profile_host();
+        if (const TransferProfile *profile = find_transfer_profile(profiles, product_id, host)) {
+            return *profile;
+        }
+    } catch (const std::runtime_error &err) {
+        std::cerr << "Warning: ignoring transfer profiles: " << err.what() << "\n";
+    }
+    return std::nullopt;
 }
 
-IOReturn read_pipe(IOUSBInterfaceInterface **iface, UInt8 pipe, void *data, UInt32 *size, UInt32 timeout_ms) {
-    return (*iface)->ReadPipeTO(iface, pipe, data, size, timeout_ms, timeout_ms);
+// The stored profile for the device, with its timeouts applied to the
+// device's transport straight away.
+std::optional<TransferProfile> use_transfer_profile(UsbPicobootDevice &device, bool simulated,
+                                                    const std::string &profile_path) {
+    std::optional<TransferProfile> profile = stored_transfer_profile(device.product_id, simulated, profile_path);
+    if (profile) {
+        device.transport->set_timeouts(profile->timeouts);
+    }
+    return profile;
 }
 
-IOReturn send_picoboot_command(IOUSBInterfaceInterface **iface, const PicobootInterface &picoboot,
-                               picoboot_cmd &cmd, uint8_t *buffer, uint32_t buffer_len) {
-    (void)buffer_len;
-    static uint32_t token = 1;
-    cmd.dMagic = PICOBOOT_MAGIC;
-    cmd.dToken = token++;
-
-    IOReturn ret = write_pipe(iface, picoboot.pipe_out, &cmd, sizeof(cmd), kUsbTimeoutMs);
-    if (ret != kIOReturnSuccess) {
-        return ret;
+// Dry runs count the commands the load itself would send.
+void set_dryrun_transfers(DryrunOptions &options, picoboot_exclusive_type exclusive, bool simulated,
+                          const std::string &profile_path) {
+    options.exclusive = exclusive;
+    if (auto profile = stored_transfer_profile(options.product_id, simulated, profile_path)) {
+        options.ram_write_chunk = profile->ram_write_chunk;
+        options.flash_write_chunk = profile->flash_write_chunk;
     }
+}
 
-    if (cmd.dTransferLength != 0) {
-        if (cmd.bCmdId & 0x80u) {
-            UInt32 expected = cmd.dTransferLength;
-            ret = read_pipe(iface, picoboot.pipe_in, buffer, &expected, kUsbTimeoutMs * 3);
-            if (ret != kIOReturnSuccess || expected != cmd.dTransferLength) {
-                return ret != kIOReturnSuccess ? ret : kIOReturnError;
-            }
-        } else {
-            ret = write_pipe(iface, picoboot.pipe_out, buffer, cmd.dTransferLength, kUsbTimeoutMs * 3);
-            if (ret != kIOReturnSuccess) {
-                return ret;
-            }
-        }
+int run_autotune(uint16_t sim_product_id, const DeviceSelector &selector, const std::string &profile_path) {
+    auto match = open_device(sim_product_id, selector);
+    if (!match) {
+        std::cerr << "No Raspberry Pi BOOTSEL device found.\n";
+        return 1;
     }
-
-    uint8_t ack = 0;
-    if (cmd.bCmdId & 0x80u) {
-        ret = write_pipe(iface, picoboot.pipe_out, &ack, 1, kUsbTimeoutMs);
+    std::function<double()> now_us;
+    if (sim_product_id != 0) {
+        auto *sim = static_cast<SimulatedDevice *>(match->transport.get());
+        now_us = [sim] { return sim->stats().elapsed_us; };
     } else {
-        UInt32 ack_len = 1;
-        ret = read_pipe(iface, picoboot.pipe_in, &ack, &ack_len, kUsbTimeoutMs);
+        auto start = std::chrono::steady_clock::now();
+        now_us = [start] {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        };
+    }
+    AutotuneResult result;
+    if (autotune_transfers(*match->transport, match->product_id, AutotuneOptions{}, now_us, result) != kTransportOk) {
+        return 1;
     }
-    return ret;
-}
-
-IOReturn picoboot_reset(IOUSBInterfaceInterface **iface, const PicobootInterface &picoboot) {
-    IOUSBDevRequest request{};
-    request.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBVendor, kUSBInterface);
-    request.bRequest = PICOBOOT_IF_RESET;
-    request.wValue = 0;
-    request.wIndex = picoboot.interface_number;
-    request.wLength = 0;
-    request.pData = nullptr;
-    return (*iface)->ControlRequest(iface, 0, &request);
-}
-
-IOReturn picoboot_get_cmd_status(IOUSBInterfaceInterface **iface, const PicobootInterface &picoboot,
-                                 picoboot_cmd_status &status) {
-    IOUSBDevRequest request{};
-    request.bmRequestType = USBmakebmRequestType(kUSBIn, kUSBVendor, kUSBInterface);
-    request.bRequest = PICOBOOT_IF_CMD_STATUS;
-    request.wValue = 0;
-    request.wIndex = picoboot.interface_number;
-    request.wLength = sizeof(status);
-    request.pData = &status;
-    IOReturn ret = (*iface)->ControlRequest(iface, 0, &request);
-    if (ret != kIOReturnSuccess || request.wLenDone != sizeof(status)) {
-        return ret != kIOReturnSuccess ? ret : kIOReturnError;
-    }
-    return ret;
-}
 
-IOReturn picoboot_exit_xip(IOUSBInterfaceInterface **iface, const PicobootInterface &picoboot) {
-    picoboot_cmd cmd{};
-    cmd.bCmdId = PC_EXIT_XIP;
-    cmd.bCmdSize = 0;
-    cmd.dTransferLength = 0;
-    return send_picoboot_command(iface, picoboot, cmd, nullptr, 0);
+    std::printf("%8s  %10s  %9s  %10s  %9s\n", "bytes", "write us", "KiB/s", "read us", "KiB/s");
+    for (const auto &point : result.points) {
+        std::printf("%8u  %10.1f  %9.1f  %10.1f  %9.1f\n", point.bytes, point.write_us,
+                    point.bytes * 1e6 / 1024 / point.write_us, point.read_us, point.bytes * 1e6 / 1024 / point.read_us);
+    }
+    TransferProfile &profile = result.profile;
+    profile.host = sim_product_id != 0 ? kSimulatedProfileHost : transfer_profile_host();
+    std::printf("Fit: write %.1f us + %.3f us/KiB, read %.1f us + %.3f us/KiB.\n", profile.write.fixed_us,
+                profile.write.us_per_byte * 1024, profile.read.fixed_us, profile.read.us_per_byte * 1024);
+    std::printf("Chunks: RAM writes %u, flash writes %u, reads %u bytes; data timeout %u ms + %.2f ms/KiB.\n",
+                profile.ram_write_chunk, profile.flash_write_chunk, profile.read_chunk, profile.timeouts.data_fixed_ms,
+                profile.timeouts.data_ms_per_kib);
+    try {
+        store_transfer_profile(profile_path, profile);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+    std::printf("Saved the %s profile for %s to %s.\n", chip_name_for_product(profile.product_id),
+                profile.host.c_str(), profile_path.c_str());
+    return 0;
 }
 
-IOReturn picoboot_flash_erase(IOUSBInterfaceInterface **iface, const PicobootInterface &picoboot, uint32_t addr,
-                              uint32_t size) {
-    picoboot_cmd cmd{};
-    cmd.bCmdId = PC_FLASH_ERASE;
-    cmd.bCmdSize = sizeof(cmd.range_cmd);
-    cmd.range_cmd.dAddr = addr;
-    cmd.range_cmd.dSize = size;
-    cmd.dTransferLength = 0;
-    return send_picoboot_command(iface, picoboot, cmd, nullptr, 0);
+// The clock commands are timed on for metrics: the simulated device's, or the wall clock.
+std::function<double()> metrics_clock(UsbPicobootDevice &device, bool simulated) {
+    if (simulated) {
+        auto *sim = static_cast<SimulatedDevice *>(device.transport.get());
+        return [sim] { return sim->stats().elapsed_us; };
+    }
+    auto start = std::chrono::steady_clock::now();
+    return [start] {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    };
 }
 
-IOReturn picoboot_write(IOUSBInterfaceInterface **iface, const PicobootInterface &picoboot, uint32_t addr,
-                        const uint8_t *buffer, uint32_t size) {
-    picoboot_cmd cmd{};
-    cmd.bCmdId = PC_WRITE;
-    cmd.bCmdSize = sizeof(cmd.range_cmd);
-    cmd.range_cmd.dAddr = addr;
-    cmd.range_cmd.dSize = size;
-    cmd.dTransferLength = size;
-    return send_picoboot_command(iface, picoboot, cmd, const_cast<uint8_t *>(buffer), size);
+// Rewrites the --metrics textfile; a failure is reported and the run goes on.
+void export_metrics(const std::string &path, const LoaderMetrics &metrics) {
+    try {
+        write_prometheus_textfile(path, metrics);
+    } catch (const std::runtime_error &err) {
+        std::cerr << "Warning: metrics not exported: " << err.what() << "\n";
+    }
 }
 
-IOReturn picoboot_exec(IOUSBInterfaceInterface **iface, const PicobootInterface &picoboot, uint32_t addr) {
-    picoboot_cmd cmd{};
-    cmd.bCmdId = PC_EXEC;
-    cmd.bCmdSize = sizeof(cmd.address_only_cmd);
-    cmd.address_only_cmd.dAddr = addr;
-    cmd.dTransferLength = 0;
-    IOReturn ret = send_picoboot_command(iface, picoboot, cmd, nullptr, 0);
-    if (ret == kIOReturnSuccess || ret == kIOReturnNoDevice) {
-        return kIOReturnSuccess;
-    }
-    picoboot_cmd_status status{};
-    IOReturn status_ret = picoboot_get_cmd_status(iface, picoboot, status);
-    if (status_ret == kIOReturnSuccess) {
-        if (status.dStatusCode == PICOBOOT_OK || status.dStatusCode == PICOBOOT_REBOOTING) {
-            return kIOReturnSuccess;
-        }
-    } else if (status_ret == kIOReturnNoDevice) {
-        return kIOReturnSuccess;
-    }
-    return ret;
+int run_watch_mode(const std::string &filename, const WatchOptions &options, uint16_t sim_product_id,
+                   const DeviceSelector &selector, const std::string &metrics_path) {
+    WatchEnvironment env;
+    std::optional<UsbPicobootDevice> device;
+    if (sim_product_id != 0) {
+        // One simulated board for the whole session, so flash deltas land on
+        // what the previous load left behind.
+        device = open_device(sim_product_id, selector);
+        auto *sim = static_cast<SimulatedDevice *>(device->transport.get());
+        env.acquire = [sim]() -> PicobootTransport * {
+            sim->reconnect();
+            return sim;
+        };
+        env.device_us = [sim] { return sim->stats().elapsed_us; };
+    } else {
+        device = wait_for_bootsel_device(selector);
+        bool fresh = true;
+        env.acquire = [&device, &selector, fresh]() mutable -> PicobootTransport * {
+            if (!fresh) {
+                uint16_t product_id = device->product_id;
+                device.reset();
+                device = wait_for_bootsel_device(selector);
+                if (device->product_id != product_id) {
+                    std::cerr << "A different chip is in BOOTSEL; the watch was started for "
+                              << chip_name_for_product(product_id) << ".\n";
+                    return nullptr;
+                }
+            }
+            fresh = false;
+            return device->transport.get();
+        };
+    }
+    env.product_id = device->product_id;
+
+    // Every acquired device is wrapped, so the meter sees all commands.
+    LoaderMetrics metrics;
+    std::unique_ptr<MeteredTransport> metered;
+    if (!metrics_path.empty()) {
+        env.acquire = [acquire = env.acquire, &metrics, &metered, &device, sim_product_id]() -> PicobootTransport * {
+            PicobootTransport *transport = acquire();
+            if (!transport) {
+                return nullptr;
+            }
+            metered = std::make_unique<MeteredTransport>(*transport, metrics,
+                                                         metrics_clock(*device, sim_product_id != 0));
+            return metered.get();
+        };
+        env.on_load = [&metrics, &device, &metrics_path](bool ok, double device_ms) {
+            metrics.record_load(device->location, ok, device_ms * 1000.0);
+            export_metrics(metrics_path, metrics);
+        };
+    }
+    return run_watch(filename, options, env);
 }
 
-uint32_t align_down(uint32_t value, uint32_t align) {
-    return value & ~(align - 1);
-}
+int run_dump(uint32_t addr, uint32_t size, const std::string &filename, DumpOptions options,
+             uint16_t sim_product_id, const DeviceSelector &selector, const std::string &profile_path) {
+    auto match = open_device(sim_product_id, selector);
+    if (!match) {
+        std::cerr << "No Raspberry Pi BOOTSEL device found.\n";
+        return 1;
+    }
+    if (auto profile = use_transfer_profile(*match, sim_product_id != 0, profile_path)) {
+        apply_transfer_profile(*profile, options);
+    }
+    MemoryLayout layout = memory_layout_for_product(match->product_id);
+    uint64_t end = static_cast<uint64_t>(addr) + size;
+    bool in_flash = addr >= kFlashStart && end <= layout.flash_end;
+    bool in_sram = addr >= kSramStart && end <= layout.sram_end;
+    if (!in_flash && !in_sram) {
+        std::cerr << "Dump range " << hex32(addr) << ":" << hex32(size) << " is not within "
+                  << chip_name_for_product(match->product_id) << " flash or SRAM.\n";
+        return 2;
+    }
 
-uint32_t align_up(uint32_t value, uint32_t align) {
-    return (value + align - 1) & ~(align - 1);
+    DumpStats stats;
+    try {
+        if (dump_memory(*match->transport, addr, size, filename, options, stats) != kTransportOk) {
+            return 1;
+        }
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+    double seconds = stats.elapsed_s;
+    if (sim_product_id != 0) {
+        seconds = static_cast<SimulatedDevice *>(match->transport.get())->stats().elapsed_us / 1e6;
+    }
+    constexpr double kMiB = 1024.0 * 1024.0;
+    std::printf("Dumped %.2f MiB from %s to %s in %u reads, %.2f s (%.2f MiB/s%s).\n", stats.bytes / kMiB,
+                hex32(addr).c_str(), filename.c_str(), stats.reads, seconds, stats.bytes / kMiB / seconds,
+                sim_product_id != 0 ? ", simulated" : "");
+    std::printf("%.2f MiB data, %.2f MiB erased%s.\n", stats.data_bytes / kMiB, stats.hole_bytes / kMiB,
+                options.erased_as_holes ? " left as holes" : "");
+    return 0;
 }
 
-MemoryLayout memory_layout_for_product(uint16_t product_id) {
-    if (product_id == kProductIdRp2040UsbBoot) {
-        return MemoryLayout{kFlashEndRp2040, kSramEndRp2040};
+// OTP commands exist on RP2350 only; the bootrom would reject them anyway.
+std::optional<UsbPicobootDevice> open_otp_device(uint16_t sim_product_id, const DeviceSelector &selector) {
+    auto match = open_device(sim_product_id, selector);
+    if (!match) {
+        std::cerr << "No Raspberry Pi BOOTSEL device found.\n";
+    } else if (match->product_id == kProductIdRp2040UsbBoot) {
+        std::cerr << "The rp2040 has no OTP.\n";
+        match.reset();
     }
-    return MemoryLayout{kFlashEndRp2350, kSramEndRp2350};
+    return match;
 }
 
-bool is_flash_address(uint32_t addr, const MemoryLayout &layout) {
-    return addr >= kFlashStart && addr < layout.flash_end;
+int run_otp_read(uint32_t row, uint32_t count, OtpLayout layout, uint16_t sim_product_id,
+                 const DeviceSelector &selector) {
+    if (row >= kOtpRowCount || count > kOtpRowCount - row) {
+        std::cerr << "OTP rows 0x" << std::hex << row << ":0x" << count << " are outside the 0x" << kOtpRowCount
+                  << std::dec << " rows.\n";
+        return 2;
+    }
+    auto match = open_otp_device(sim_product_id, selector);
+    if (!match) {
+        return 1;
+    }
+    TransportResult ret = match->transport->reset_interface();
+    if (ret != kTransportOk) {
+        std::cerr << "Warning: reset interface failed (IOKit error " << ret << ").\n";
+    }
+    std::vector<uint32_t> values;
+    if (read_otp_rows(*match->transport, static_cast<uint16_t>(row), count, layout, values) != kTransportOk) {
+        return 1;
+    }
+    write_otp_manifest(std::cout, static_cast<uint16_t>(row), layout, values);
+    return 0;
 }
 
-bool is_sram_address(uint32_t addr, const MemoryLayout &layout) {
-    return addr >= kSramStart && addr < layout.sram_end;
-}
+int run_otp_write(const std::string &filename, bool dryrun, bool verbose, uint16_t sim_product_id,
+                  const DeviceSelector &selector) {
+    std::vector<OtpEntry> entries;
+    try {
+        std::ifstream file;
+        if (filename != "-") {
+            file.open(filename);
+            if (!file.is_open()) {
+                throw std::runtime_error("Failed to open " + filename);
+            }
+        }
+        entries = parse_otp_manifest(filename == "-" ? std::cin : file, filename);
+    } catch (const std::runtime_error &err) {
+        std::cerr << "Manifest error: " << err.what() << "\n";
+        return 2;
+    }
+    auto match = open_otp_device(sim_product_id, selector);
+    if (!match) {
+        return 1;
+    }
 
-std::vector<Range> merge_ranges(std::vector<Range> ranges) {
-    if (ranges.empty()) {
-        return ranges;
-    }
-    std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) { return a.start < b.start; });
-    std::vector<Range> merged;
-    merged.push_back(ranges.front());
-    for (size_t i = 1; i < ranges.size(); ++i) {
-        Range &last = merged.back();
-        if (ranges[i].start <= last.end) {
-            last.end = std::max(last.end, ranges[i].end);
-        } else {
-            merged.push_back(ranges[i]);
+    // Clear a stall left by an earlier session before asking for exclusive
+    // access, which is then held from the plan's reads through the verified
+    // writes.
+    TransportResult ret = match->transport->reset_interface();
+    if (ret != kTransportOk) {
+        std::cerr << "Warning: reset interface failed (IOKit error " << ret << ").\n";
+    }
+    ExclusiveAccess exclusive(*match->transport, EXCLUSIVE);
+    OtpPlan plan;
+    if (plan_otp_update(*match->transport, entries, plan) != kTransportOk) {
+        return 1;
+    }
+    std::printf("OTP manifest: %u rows, %u unchanged, %u to write in %zu commands (read in %u).\n", plan.rows,
+                plan.unchanged, plan.changed, plan.writes.size(), plan.read_commands);
+    if (plan.corrected) {
+        std::printf("%u unchanged ECC rows read back through a single-bit correction.\n", plan.corrected);
+    }
+    if (verbose) {
+        for (const auto &write : plan.writes) {
+            write_otp_manifest(std::cout, write.row, OtpLayout::raw, write.rows);
         }
     }
-    return merged;
+    for (const auto &conflict : plan.conflicts) {
+        std::cerr << "Cannot program OTP " << conflict << ".\n";
+    }
+    if (!plan.conflicts.empty()) {
+        return 1;
+    }
+    if (dryrun || plan.writes.empty()) {
+        return 0;
+    }
+    if (write_otp_plan(*match->transport, plan) != kTransportOk) {
+        return 1;
+    }
+    std::printf("Wrote and verified %u OTP rows.\n", plan.changed);
+    if (sim_product_id != 0) {
+        std::printf("Simulated device time: %.1f ms.\n",
+                    static_cast<SimulatedDevice *>(match->transport.get())->stats().elapsed_us / 1000.0);
+    }
+    return 0;
 }
 
-uint32_t segment_address(const elf32_ph_entry &segment) {
-    if (segment.paddr != 0) {
-        return segment.paddr;
+int run_ram_image(const ImageSet &images, UsbPicobootDevice &device, uint16_t sim_product_id) {
+    RamImage image;
+    try {
+        image = pack_ram_image(images.segments, memory_layout_for_product(device.product_id));
+    } catch (const std::runtime_error &err) {
+        std::cerr << "RAM image: " << err.what() << ".\n";
+        return 1;
+    }
+    std::printf("RAM image %s-%s: %u segments, %.1f KiB in %u writes (%.1f KiB of gaps filled).\n",
+                hex32(image.region.start).c_str(), hex32(image.region.end).c_str(), image.segments,
+                image.bytes / 1024.0, image.write_count(), image.filled_bytes / 1024.0);
+    if (!image.has_block) {
+        std::cout << "Warning: no PICOBIN block in the first 4 KiB of the region; the bootrom will not find an "
+                     "IMAGE_DEF to boot.\n";
+    }
+    if (boot_ram_image(*device.transport, image, LoadProgress{}) != kTransportOk) {
+        return 1;
     }
-    return segment.vaddr;
+    std::cout << "Booting the RAM image with REBOOT2 RAM_IMAGE.\n";
+    if (sim_product_id != 0) {
+        std::printf("Simulated device time: %.1f ms.\n",
+                    static_cast<SimulatedDevice *>(device.transport.get())->stats().elapsed_us / 1000.0);
+    }
+    std::cout << "Load complete.\n";
+    return 0;
 }
 
-bool map_flash_to_sram(uint32_t addr, uint32_t size, const MemoryLayout &layout, uint32_t &mapped_addr) {
-    if (addr < kFlashStart) {
-        return false;
+int run_script_file(const std::string &filename, UsbPicobootDevice &device, uint16_t sim_product_id,
+                    const DeviceSelector &selector) {
+    std::vector<ScriptStep> steps;
+    try {
+        std::ifstream file;
+        if (filename != "-") {
+            file.open(filename);
+            if (!file.is_open()) {
+                throw std::runtime_error("Failed to open " + filename);
+            }
+        }
+        steps = parse_script(filename == "-" ? std::cin : file, device.product_id);
+    } catch (const std::runtime_error &err) {
+        std::cerr << "Script error: " << err.what() << "\n";
+        return 2;
     }
-    uint32_t offset = addr - kFlashStart;
-    mapped_addr = kSramStart + offset;
-    if (mapped_addr < kSramStart || mapped_addr + size > layout.sram_end) {
-        return false;
+
+    ScriptEnvironment env;
+    env.product_id = device.product_id;
+    double idle_us = 0;
+    if (sim_product_id != 0) {
+        // Steps are timed on the simulated clock; waits advance it without sleeping.
+        auto *sim = static_cast<SimulatedDevice *>(device.transport.get());
+        env.now_us = [sim, &idle_us] { return sim->stats().elapsed_us + idle_us; };
+        env.sleep_ms = [&idle_us](uint32_t ms) { idle_us += ms * 1000.0; };
+        env.reconnect = [sim](uint32_t) -> PicobootTransport * {
+            sim->reconnect();
+            return sim;
+        };
+    } else {
+        auto start = std::chrono::steady_clock::now();
+        env.now_us = [start] {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        };
+        env.sleep_ms = [](uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); };
+        env.reconnect = [&device, &selector](uint32_t timeout_ms) -> PicobootTransport * {
+            device.transport.reset();
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            do {
+                auto match = find_device(selector);
+                if (match) {
+                    device = std::move(*match);
+                    return device.transport.get();
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            } while (std::chrono::steady_clock::now() < deadline);
+            return nullptr;
+        };
     }
-    return true;
+    return run_script(*device.transport, steps, env);
 }
 } // namespace
 
 int main(int argc, char **argv) {
     bool allow_flash = false;
     bool exec_after = true;
+    picoboot_exclusive_type exclusive = EXCLUSIVE;
     bool dryrun = false;
-    std::string filename;
+    bool batch = false;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    DryrunOptions dryrun_options;
+    std::vector<std::string> filenames;
+    std::string diff_old_filename;
+    std::string diff_new_filename;
+    std::string patch_csv_filename;
+    SerialPatchSpec serial_patch_spec;
+    size_t units = 0;
+    std::string script_filename;
+    uint16_t sim_product_id = 0;
+    DeviceSelector selector;
+    bool selected = false;
+    bool autotune = false;
+    std::string profile_path = default_transfer_profile_path();
+    ProgressFormat progress_format = default_progress_format();
+    std::string metrics_path;
+    uint32_t retries = 0;
+    bool watch = false;
+    bool ab_update = false;
+    bool ram_image = false;
+    std::string dump_filename;
+    uint32_t dump_addr = 0;
+    uint32_t dump_size = 0;
+    DumpOptions dump_options;
+    uint32_t otp_row = 0;
+    uint32_t otp_count = 0;
+    OtpLayout otp_layout = OtpLayout::ecc;
+    std::string otp_manifest;
+    uint32_t debounce_ms = WatchOptions{}.debounce_ms;
 
     for (int i = 1; i < argc; ++i) {
         const std::string arg = argv[i];
-        if (arg == "--flash") {
+        bool has_value = i + 1 < argc;
+        if ((arg == "--chip" || arg == "--cost-model" || arg == "--budget-ms" || arg == "--base" ||
+             arg == "--entry" || arg == "--patch-csv" || arg == "--patch-serial" || arg == "--units" ||
+             arg == "--script" || arg == "--sim" || arg == "--debounce-ms" || arg == "--otp-read" ||
+             arg == "--otp-write" || arg == "--serial" || arg == "--location" || arg == "--index" ||
+             arg == "--profile" || arg == "--progress" || arg == "--metrics" || arg == "--retries" ||
+             arg == "--jobs") &&
+            !has_value) {
+            std::cerr << "Missing value for " << arg << "\n";
+            print_usage(argv[0]);
+            return 2;
+        }
+        if (arg == "--chip") {
+            if (!product_id_for_chip(argv[++i], dryrun_options.product_id)) {
+                std::cerr << "Unknown chip: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--cost-model") {
+            dryrun_options.cost_model_spec = argv[++i];
+        } else if (arg == "--budget-ms") {
+            if (!parse_positive_double(argv[++i], dryrun_options.budget_ms)) {
+                std::cerr << "Invalid budget: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--base") {
+            if (!parse_address(argv[++i], dryrun_options.image.raw_base)) {
+                std::cerr << "Invalid base address: " << argv[i] << "\n";
+                return 2;
+            }
+            dryrun_options.image.raw_binary = true;
+        } else if (arg == "--entry") {
+            if (!parse_address(argv[++i], dryrun_options.image.entry_point) || dryrun_options.image.entry_point == 0) {
+                std::cerr << "Invalid entry address: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--patch-csv") {
+            patch_csv_filename = argv[++i];
+        } else if (arg == "--patch-serial") {
+            if (!parse_serial_spec(argv[++i], serial_patch_spec)) {
+                std::cerr << "Invalid serial patch: " << argv[i] << " (expected addr:first[:width])\n";
+                return 2;
+            }
+        } else if (arg == "--units") {
+            char *end = nullptr;
+            units = std::strtoul(argv[++i], &end, 10);
+            if (units == 0 || *end != '\0') {
+                std::cerr << "Invalid unit count: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--script") {
+            script_filename = argv[++i];
+        } else if (arg == "--sim") {
+            if (!product_id_for_chip(argv[++i], sim_product_id)) {
+                std::cerr << "Unknown chip: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--serial") {
+            selector.filter.serial = argv[++i];
+            selected = true;
+        } else if (arg == "--location") {
+            char *end = nullptr;
+            selector.filter.location = static_cast<uint32_t>(std::strtoul(argv[++i], &end, 16));
+            if (*end != '\0' || selector.filter.location == 0) {
+                std::cerr << "Invalid location: " << argv[i] << "\n";
+                return 2;
+            }
+            selected = true;
+        } else if (arg == "--index") {
+            char *end = nullptr;
+            selector.index = std::strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0') {
+                std::cerr << "Invalid device index: " << argv[i] << "\n";
+                return 2;
+            }
+            selected = true;
+        } else if (arg == "--debounce-ms") {
+            char *end = nullptr;
+            unsigned long value = std::strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || value > 10000) {
+                std::cerr << "Invalid debounce time: " << argv[i] << "\n";
+                return 2;
+            }
+            debounce_ms = static_cast<uint32_t>(value);
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "--autotune") {
+            autotune = true;
+        } else if (arg == "--profile") {
+            profile_path = argv[++i];
+        } else if (arg == "--metrics") {
+            metrics_path = argv[++i];
+        } else if (arg == "--retries") {
+            char *end = nullptr;
+            unsigned long value = std::strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || value > 100) {
+                std::cerr << "Invalid retry count: " << argv[i] << "\n";
+                return 2;
+            }
+            retries = static_cast<uint32_t>(value);
+        } else if (arg == "--jobs") {
+            char *end = nullptr;
+            unsigned long value = std::strtoul(argv[++i], &end, 10);
+            if (value == 0 || *end != '\0' || value > 1024) {
+                std::cerr << "Invalid job count: " << argv[i] << "\n";
+                return 2;
+            }
+            jobs = static_cast<unsigned>(value);
+        } else if (arg == "--progress") {
+            if (!parse_progress_format(argv[++i], progress_format)) {
+                std::cerr << "Unknown progress format: " << argv[i] << " (expected tty, json or none)\n";
+                return 2;
+            }
+        } else if (arg == "--dump") {
+            if (i + 2 >= argc) {
+                std::cerr << "--dump needs a range and an output file\n";
+                print_usage(argv[0]);
+                return 2;
+            }
+            if (!parse_range(argv[++i], dump_addr, dump_size)) {
+                std::cerr << "Invalid dump range: " << argv[i] << " (expected start:len)\n";
+                return 2;
+            }
+            dump_filename = argv[++i];
+        } else if (arg == "--dump-fill") {
+            dump_options.erased_as_holes = false;
+        } else if (arg == "--otp-read") {
+            if (!parse_range(argv[++i], otp_row, otp_count)) {
+                std::cerr << "Invalid OTP rows: " << argv[i] << " (expected row:count)\n";
+                return 2;
+            }
+        } else if (arg == "--otp-raw") {
+            otp_layout = OtpLayout::raw;
+        } else if (arg == "--otp-write") {
+            otp_manifest = argv[++i];
+        } else if (arg == "--diff-elf") {
+            if (i + 2 >= argc) {
+                std::cerr << "--diff-elf needs two files\n";
+                print_usage(argv[0]);
+                return 2;
+            }
+            diff_old_filename = argv[++i];
+            diff_new_filename = argv[++i];
+        } else if (arg == "--json") {
+            dryrun_options.json = true;
+        } else if (arg == "--verbose" || arg == "-v") {
+            dryrun_options.verbose = true;
+        } else if (arg == "--flash") {
             allow_flash = true;
+        } else if (arg == "--ab-update") {
+            ab_update = true;
+        } else if (arg == "--ram-image") {
+            ram_image = true;
         } else if (arg == "--no-exec") {
             exec_after = false;
+        } else if (arg == "--eject") {
+            exclusive = EXCLUSIVE_AND_EJECT;
+        } else if (arg == "--shared") {
+            exclusive = NOT_EXCLUSIVE;
         } else if (arg == "--dryrun") {
             dryrun = true;
+        } else if (arg == "--batch") {
+            batch = true;
         } else if (arg == "--help" || arg == "-h") {
             print_usage(argv[0]);
             return 0;
-        } else if (filename.empty()) {
-            filename = arg;
-        } else {
+        } else if (arg.size() > 1 && arg[0] == '-') {
             std::cerr << "Unknown argument: " << arg << "\n";
             print_usage(argv[0]);
             return 2;
+        } else {
+            filenames.push_back(arg);
+        }
+    }
+
+    if (selected && sim_product_id != 0) {
+        std::cerr << "--serial, --location and --index select a USB device and cannot be used with --sim\n";
+        return 2;
+    }
+
+    if (!diff_old_filename.empty()) {
+        if (!filenames.empty()) {
+            std::cerr << "--diff-elf takes exactly two files\n";
+            return 2;
+        }
+        return run_diff_elf(diff_old_filename, diff_new_filename, dryrun_options);
+    }
+
+    if (autotune) {
+        if (!filenames.empty()) {
+            std::cerr << "--autotune takes no image files\n";
+            return 2;
         }
+        return run_autotune(sim_product_id, selector, profile_path);
     }
 
-    if (filename.empty()) {
+    if (!dump_filename.empty()) {
+        if (!filenames.empty()) {
+            std::cerr << "--dump takes no image files\n";
+            return 2;
+        }
+        return run_dump(dump_addr, dump_size, dump_filename, dump_options, sim_product_id, selector, profile_path);
+    }
+
+    if (otp_count != 0 || !otp_manifest.empty()) {
+        if (!filenames.empty() || (otp_count != 0 && !otp_manifest.empty())) {
+            std::cerr << "--otp-read and --otp-write take no image files and cannot be combined\n";
+            return 2;
+        }
+        if (otp_count != 0) {
+            return run_otp_read(otp_row, otp_count, otp_layout, sim_product_id, selector);
+        }
+        return run_otp_write(otp_manifest, dryrun, dryrun_options.verbose, sim_product_id, selector);
+    }
+
+    if (!script_filename.empty()) {
+        if (!filenames.empty()) {
+            std::cerr << "--script takes no image files; use 'load' in the script\n";
+            return 2;
+        }
+        auto match = open_device(sim_product_id, selector);
+        if (!match) {
+            std::cerr << "No Raspberry Pi BOOTSEL device found.\n";
+            return 1;
+        }
+        return run_script_file(script_filename, *match, sim_product_id, selector);
+    }
+
+    if (filenames.empty()) {
         print_usage(argv[0]);
         return 2;
     }
 
+    if (batch) {
+        if (!dryrun || watch || ab_update || ram_image || !patch_csv_filename.empty() || serial_patch_spec.enabled) {
+            std::cerr << "--batch checks images with --dryrun and takes no watch, A/B, RAM image or patch options\n";
+            return 2;
+        }
+        dryrun_options.allow_flash = allow_flash;
+        dryrun_options.exec_after = exec_after;
+        set_dryrun_transfers(dryrun_options, exclusive, sim_product_id != 0, profile_path);
+        return run_dryrun_batch(filenames, dryrun_options, jobs);
+    }
+
+    if (watch) {
+        if (filenames.size() != 1 || filenames[0] == "-" || dryrun || !patch_csv_filename.empty() ||
+            serial_patch_spec.enabled) {
+            std::cerr << "--watch takes one image file and no dry run or patch options\n";
+            return 2;
+        }
+        WatchOptions watch_options;
+        watch_options.allow_flash = allow_flash;
+        watch_options.exec_after = exec_after;
+        watch_options.image = dryrun_options.image;
+        watch_options.debounce_ms = debounce_ms;
+        watch_options.exclusive = exclusive;
+        return run_watch_mode(filenames[0], watch_options, sim_product_id, selector, metrics_path);
+    }
+
+    if (ab_update && (dryrun || !patch_csv_filename.empty() || serial_patch_spec.enabled)) {
+        std::cerr << "--ab-update reads the partition table from the device and takes no dry run or patch options\n";
+        return 2;
+    }
+
+    if (ram_image && (ab_update || allow_flash || !exec_after || dryrun || !patch_csv_filename.empty() ||
+                      serial_patch_spec.enabled || dryrun_options.image.entry_point != 0)) {
+        std::cerr << "--ram-image boots the image from SRAM and takes no flash, exec, dry run or patch options\n";
+        return 2;
+    }
+
+    if (!patch_csv_filename.empty() || serial_patch_spec.enabled) {
+        try {
+            dryrun_options.unit_patches = unit_patch_lists(patch_csv_filename, serial_patch_spec, units);
+        } catch (const std::runtime_error &err) {
+            std::cerr << "Patch error: " << err.what() << "\n";
+            return 2;
+        }
+    } else if (units > 1) {
+        std::cerr << "--units needs --patch-csv or --patch-serial\n";
+        return 2;
+    }
+    if (!selector.filter.serial.empty() && dryrun_options.unit_patches.size() > 1) {
+        std::cerr << "Serializing several units loads a different board each time; drop --serial (--location can "
+                     "pin the units to one hub port)\n";
+        return 2;
+    }
+
     if (dryrun) {
-        return run_dryrun(filename, allow_flash, exec_after);
+        dryrun_options.allow_flash = allow_flash;
+        dryrun_options.exec_after = exec_after;
+        set_dryrun_transfers(dryrun_options, exclusive, sim_product_id != 0, profile_path);
+        return run_dryrun(filenames, dryrun_options);
     }
 
-    auto match = find_device();
+    auto match = open_device(sim_product_id, selector);
     if (!match) {
         std::cerr << "No Raspberry Pi BOOTSEL device found.\n";
         return 1;
     }
 
     MemoryLayout memory_layout = memory_layout_for_product(match->product_id);
+    if (ram_image && match->product_id == kProductIdRp2040UsbBoot) {
+        std::cerr << "--ram-image needs an rp2350; the rp2040 bootrom cannot boot RAM images.\n";
+        return 2;
+    }
+    if (ab_update) {
+        if (match->product_id == kProductIdRp2040UsbBoot) {
+            std::cerr << "--ab-update needs an rp2350; the rp2040 has no partition table.\n";
+            return 2;
+        }
+        // The image runs after the FLASH_UPDATE reboot, not through PC_EXEC.
+        allow_flash = true;
+        exec_after = false;
+    }
 
-    IOReturn reset_ret = picoboot_reset(match->picoboot.iface, match->picoboot);
-    if (reset_ret != kIOReturnSuccess) {
-        std::cerr << "Warning: reset interface failed (IOKit error " << reset_ret << ").\n";
+    ImageSet images;
+    LoadPlan plan;
+    try {
+        images = open_image_set(filenames, match->product_id, dryrun_options.image);
+        plan = build_load_plan(images.segments, images.entry_point, memory_layout, allow_flash);
+    } catch (const std::runtime_error &err) {
+        std::cerr << "Image parse failed: " << err.what() << "\n";
+        return 1;
     }
 
-    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> ram_segments;
-    std::map<uint32_t, std::vector<uint8_t>> flash_pages;
-    std::vector<Range> flash_erase_ranges;
-    bool skipped_flash_segments = false;
-    bool mirrored_flash_segments = false;
-    uint32_t entry_point = 0;
+    if (ram_image) {
+        return run_ram_image(images, *match, sim_product_id);
+    }
 
-    try {
-        auto stream = std::make_shared<std::fstream>(filename, std::ios::in | std::ios::binary);
-        if (!stream->is_open()) {
-            throw std::runtime_error("Failed to open file: " + filename);
+    PartitionUpdate update;
+    if (ab_update) {
+        try {
+            if (plan_partition_update(*match->transport, plan, update) != kTransportOk) {
+                return 1;
+            }
+        } catch (const std::runtime_error &err) {
+            std::cerr << "Partition update: " << err.what() << ".\n";
+            return 1;
         }
-        elf_file elf;
-        elf.read_file(stream);
+        const Partition &target = update.table.partitions[update.target];
+        std::printf("Partition table: %zu partitions; booted from %d, updating %d at %s-%s.\n",
+                    update.table.partitions.size(), update.booted, update.target, hex32(target.start()).c_str(),
+                    hex32(target.end()).c_str());
+        std::printf("Relocated flash contents from %s to %s; erasing %u of the slot's %u sectors.\n",
+                    hex32(update.image_base).c_str(), hex32(update.target_base).c_str(), update.erase_sectors,
+                    update.slot_sectors);
+    }
 
-        entry_point = elf.header().entry;
-        for (const auto &segment : elf.segments()) {
-            if (!segment.is_load() || segment.filez == 0) {
-                continue;
-            }
-            uint32_t addr = segment_address(segment);
-            if (addr == 0) {
-                throw std::runtime_error("ELF segment has no load address");
-            }
-            std::vector<uint8_t> data = elf.content(segment);
-            if (data.empty()) {
-                continue;
-            }
-            if (is_flash_address(addr, memory_layout)) {
-                if (!allow_flash) {
-                    uint32_t mapped_addr = 0;
-                    if (!map_flash_to_sram(addr, static_cast<uint32_t>(data.size()), memory_layout, mapped_addr)) {
-                        skipped_flash_segments = true;
-                        continue;
-                    }
-                    mirrored_flash_segments = true;
-                    ram_segments.emplace_back(mapped_addr, std::move(data));
-                    continue;
-                }
-                uint32_t end = addr + static_cast<uint32_t>(data.size());
-                uint32_t erase_start = align_down(addr, kFlashSectorSize);
-                uint32_t erase_end = align_up(end, kFlashSectorSize);
-                flash_erase_ranges.push_back(Range{erase_start, erase_end});
-                for (size_t i = 0; i < data.size(); ++i) {
-                    uint32_t byte_addr = addr + static_cast<uint32_t>(i);
-                    uint32_t page_base = align_down(byte_addr, kFlashPageSize);
-                    uint32_t page_offset = byte_addr - page_base;
-                    auto &page = flash_pages[page_base];
-                    if (page.empty()) {
-                        page.assign(kFlashPageSize, 0);
-                    }
-                    page[page_offset] = data[i];
-                }
-            } else {
-                ram_segments.emplace_back(addr, std::move(data));
-            }
+    // Every unit shares the plan; check all patch lists before the first load.
+    std::vector<PatchOverlay> overlays;
+    for (size_t unit = 0; unit < dryrun_options.unit_patches.size(); ++unit) {
+        try {
+            overlays.emplace_back(plan, dryrun_options.unit_patches[unit]);
+        } catch (const std::runtime_error &err) {
+            std::cerr << "Unit " << (unit + 1) << ": " << err.what() << "\n";
+            return 1;
         }
-    } catch (const std::runtime_error &err) {
-        std::cerr << "ELF parse failed: " << err.what() << "\n";
-        (*match->picoboot.iface)->USBInterfaceClose(match->picoboot.iface);
-        (*match->picoboot.iface)->Release(match->picoboot.iface);
-        (*match->device)->USBDeviceClose(match->device);
-        (*match->device)->Release(match->device);
-        return 1;
     }
 
-    IOReturn ret = kIOReturnSuccess;
-    if (!allow_flash && flash_pages.empty() && ram_segments.empty()) {
+    if (!allow_flash && plan.flash_extents.empty() && plan.ram_segments.empty()) {
         std::cerr << "No loadable RAM segments found (flash segments skipped). Use --flash to enable flash writes.\n";
-        (*match->picoboot.iface)->USBInterfaceClose(match->picoboot.iface);
-        (*match->picoboot.iface)->Release(match->picoboot.iface);
-        (*match->device)->USBDeviceClose(match->device);
-        (*match->device)->Release(match->device);
         return 1;
     }
-    if (mirrored_flash_segments) {
+    if (plan.mirrored_flash_segments) {
         std::cout << "Mirroring flash segments into SRAM (use --flash to write flash instead).\n";
     }
-    if (skipped_flash_segments) {
+    if (plan.skipped_flash_segments) {
         std::cout << "Skipping flash segments that do not fit in SRAM (use --flash to enable flash writes).\n";
     }
-    if (!flash_pages.empty()) {
-        ret = picoboot_exit_xip(match->picoboot.iface, match->picoboot);
-        if (ret != kIOReturnSuccess) {
-            std::cerr << "Failed to exit XIP mode (IOKit error " << ret << ").\n";
-        }
 
-        auto merged_ranges = merge_ranges(std::move(flash_erase_ranges));
-        for (const auto &range : merged_ranges) {
-            ret = picoboot_flash_erase(match->picoboot.iface, match->picoboot, range.start, range.end - range.start);
-            if (ret != kIOReturnSuccess) {
-                std::cerr << "Flash erase failed at 0x" << std::hex << range.start << " (IOKit error " << std::dec << ret
-                          << ").\n";
-                break;
-            }
+    LoadOptions options;
+    options.exec_after = exec_after;
+    options.exclusive = exclusive;
+    std::optional<TransferProfile> profile = use_transfer_profile(*match, sim_product_id != 0, profile_path);
+    if (profile) {
+        apply_transfer_profile(*profile, options);
+    }
+    if (exec_after && !resolve_exec_address(plan, memory_layout, allow_flash, options.exec_addr)) {
+        return 1;
+    }
+
+    CostModel model;
+    if (images.images.size() > 1 || progress_format != ProgressFormat::none) {
+        try {
+            model = cost_model_for_product(match->product_id, dryrun_options.cost_model_spec);
+        } catch (const std::runtime_error &err) {
+            std::cerr << "Cost model error: " << err.what() << "\n";
+            return 2;
+        }
+    }
+    if (images.images.size() > 1) {
+        try {
+            double session_ms = estimate_load_cost(plan, model, options).predicted_ms;
+            double sequential_ms = estimate_sequential_ms(images, memory_layout, allow_flash, options, model);
+            std::printf("Loading %zu images in one session: %.1f ms predicted, %.1f ms less than separate loads.\n",
+                        images.images.size(), session_ms, sequential_ms - session_ms);
+        } catch (const std::runtime_error &err) {
+            std::cerr << "Cost model error: " << err.what() << "\n";
+            return 2;
         }
     }
 
-    if (ret == kIOReturnSuccess) {
-        for (const auto &segment : ram_segments) {
-            uint32_t addr = segment.first;
-            const auto &data = segment.second;
-            for (size_t offset = 0; offset < data.size();) {
-                uint32_t chunk_size = static_cast<uint32_t>(std::min<size_t>(1024, data.size() - offset));
-                ret = picoboot_write(match->picoboot.iface, match->picoboot, addr + static_cast<uint32_t>(offset),
-                                     data.data() + offset, chunk_size);
-                if (ret != kIOReturnSuccess) {
-                    std::cerr << "RAM write failed at 0x" << std::hex << (addr + offset) << " (IOKit error " << std::dec
-                              << ret << ").\n";
-                    break;
-                }
-                offset += chunk_size;
+    // The load only bumps counters; the bar or JSON lines come from the reporter's thread.
+    LoadCounters counters;
+    ProgressTotals totals;
+    if (progress_format != ProgressFormat::none) {
+        totals = progress_totals(plan, model, options);
+        options.counters = &counters;
+    }
+
+    LoaderMetrics metrics;
+    size_t unit_count = std::max<size_t>(overlays.size(), 1);
+    for (size_t unit = 0; unit < unit_count; ++unit) {
+        if (unit > 0) {
+            uint16_t product_id = match->product_id;
+            match.reset();
+            std::cout << "Waiting for unit " << (unit + 1) << " of " << unit_count << "...\n";
+            match = wait_for_next_device(sim_product_id, selector);
+            if (match->product_id != product_id) {
+                std::cerr << "Unit " << (unit + 1) << " is a different chip; the plan was built for "
+                          << chip_name_for_product(product_id) << ".\n";
+                return 1;
             }
-            if (ret != kIOReturnSuccess) {
-                break;
+            if (profile) {
+                match->transport->set_timeouts(profile->timeouts);
             }
         }
-    }
-
-    if (ret == kIOReturnSuccess) {
-        for (const auto &page : flash_pages) {
-            ret = picoboot_write(match->picoboot.iface, match->picoboot, page.first, page.second.data(), kFlashPageSize);
-            if (ret != kIOReturnSuccess) {
-                std::cerr << "Flash write failed at 0x" << std::hex << page.first << " (IOKit error " << std::dec << ret
-                          << ").\n";
+        options.patches = overlays.empty() ? nullptr : &overlays[unit];
+
+        // With --metrics, commands go through the meter; it costs a clock read per command.
+        PicobootTransport *transport = match->transport.get();
+        std::unique_ptr<MeteredTransport> metered;
+        std::function<double()> clock;
+        double load_start_us = 0.0;
+        if (!metrics_path.empty()) {
+            clock = metrics_clock(*match, sim_product_id != 0);
+            metered = std::make_unique<MeteredTransport>(*transport, metrics, clock);
+            transport = metered.get();
+            load_start_us = clock();
+        }
+        TransportResult ret;
+        for (uint32_t attempt = 0;; ++attempt) {
+            counters.reset();
+            {
+                ProgressReporter reporter(counters, totals, progress_format, stderr);
+                ret = load_plan_to_device(*transport, plan, options);
+            }
+            if (ret == kTransportOk || attempt == retries) {
                 break;
             }
+            metrics.retries.fetch_add(1, std::memory_order_relaxed);
+            std::cerr << "Load failed; starting again (retry " << (attempt + 1) << " of " << retries << ").\n";
+            transport->reset_interface();
         }
-    }
-
-    if (ret == kIOReturnSuccess && exec_after) {
-        if (entry_point == 0) {
-            std::cerr << "ELF entry point is zero; cannot execute.\n";
-            ret = kIOReturnError;
-        } else {
-            uint32_t exec_addr = entry_point;
-            if (!allow_flash && is_flash_address(entry_point, memory_layout)) {
-                uint32_t mapped_addr = 0;
-                if (map_flash_to_sram(entry_point, 4, memory_layout, mapped_addr)) {
-                    exec_addr = mapped_addr;
-                } else {
-                    std::cerr << "Entry point 0x" << std::hex << entry_point
-                              << " cannot be mirrored into SRAM. Use --flash to run from flash.\n";
-                    ret = kIOReturnError;
-                }
-            } else if (!allow_flash && !is_sram_address(entry_point, memory_layout) &&
-                       !is_flash_address(entry_point, memory_layout)) {
-                std::cerr << "Entry point 0x" << std::hex << entry_point << " is not in flash or SRAM.\n";
-                ret = kIOReturnError;
+        if (metered) {
+            metrics.record_load(match->location, ret == kTransportOk, clock() - load_start_us);
+            export_metrics(metrics_path, metrics);
+        }
+        if (ret != kTransportOk) {
+            if (unit_count > 1) {
+                std::cerr << "Unit " << (unit + 1) << " of " << unit_count << " failed.\n";
             }
-            if (ret == kIOReturnSuccess) {
-                ret = picoboot_exec(match->picoboot.iface, match->picoboot, exec_addr);
-                if (ret != kIOReturnSuccess) {
-                    std::cerr << "Exec failed at 0x" << std::hex << exec_addr << " (IOKit error " << std::dec << ret
-                              << ").\n";
-                } else {
-                    std::cout << "Executing at 0x" << std::hex << exec_addr << ".\n";
-                }
+            return 1;
+        }
+        if (exec_after) {
+            std::cout << "Executing at 0x" << std::hex << options.exec_addr << std::dec << ".\n";
+        }
+        if (ab_update) {
+            ret = picoboot_reboot2(*match->transport, REBOOT2_FLAG_REBOOT_TYPE_FLASH_UPDATE, kRebootDelayMs,
+                                   update.target_base, 0);
+            if (ret != kTransportOk) {
+                std::cerr << "FLASH_UPDATE reboot failed (IOKit error " << ret << ").\n";
+                return 1;
             }
+            std::printf("Rebooting with FLASH_UPDATE into partition %d.\n", update.target);
+        }
+        if (sim_product_id != 0) {
+            std::printf("Simulated device time: %.1f ms.\n",
+                        static_cast<SimulatedDevice *>(match->transport.get())->stats().elapsed_us / 1000.0);
+        }
+        if (unit_count > 1) {
+            std::cout << "Unit " << (unit + 1) << " of " << unit_count << " complete.\n";
+        } else {
+            std::cout << "Load complete.\n";
         }
     }
-
-    if (ret == kIOReturnSuccess) {
-        std::cout << "Load complete.\n";
-    }
-
-    (*match->picoboot.iface)->USBInterfaceClose(match->picoboot.iface);
-    (*match->picoboot.iface)->Release(match->picoboot.iface);
-    (*match->device)->USBDeviceClose(match->device);
-    (*match->device)->Release(match->device);
-    return ret == kIOReturnSuccess ? 0 : 1;
+    return 0;
 }
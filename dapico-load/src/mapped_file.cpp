@@ -0,0 +1,33 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+MappedFile::MappedFile(const std::string &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        throw std::runtime_error("File is empty: " + filename);
+    }
+    void *mapping = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Failed to map file: " + filename);
+    }
+    data_ = static_cast<const uint8_t *>(mapping);
+    size_ = static_cast<size_t>(st.st_size);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        ::munmap(const_cast<uint8_t *>(data_), size_);
+    }
+}
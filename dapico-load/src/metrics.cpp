@@ -0,0 +1,214 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "format_util.h"
+
+namespace {
+const char *const kCommandNames[] = {"exit_xip", "erase", "write", "read", "exec", "reboot", "exclusive", "other"};
+
+MetricCommand metric_command(uint8_t cmd_id) {
+    switch (cmd_id) {
+    case PC_EXIT_XIP:
+        return MetricCommand::exit_xip;
+    case PC_FLASH_ERASE:
+        return MetricCommand::erase;
+    case PC_WRITE:
+        return MetricCommand::write;
+    case PC_READ:
+        return MetricCommand::read;
+    case PC_EXEC:
+        return MetricCommand::exec;
+    case PC_REBOOT:
+    case PC_REBOOT2:
+        return MetricCommand::reboot;
+    case PC_EXCLUSIVE_ACCESS:
+        return MetricCommand::exclusive;
+    default:
+        return MetricCommand::other;
+    }
+}
+
+void add(std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t get(const std::atomic<uint64_t> &counter) {
+    return counter.load(std::memory_order_relaxed);
+}
+
+// Microseconds as seconds, e.g. 0.000512.
+std::string seconds(double us) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9g", us / 1e6);
+    return text;
+}
+
+void write_histogram(std::ostream &out, const char *name, const std::string &labels, const LogHistogram &histogram) {
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < LogHistogram::kBuckets; ++i) {
+        cumulative += histogram.bucket(i);
+        out << name << "_bucket{" << prefix << "le=\"" << seconds(LogHistogram::bucket_bound(i)) << "\"} "
+            << cumulative << "\n";
+    }
+    cumulative += histogram.bucket(LogHistogram::kBuckets);
+    out << name << "_bucket{" << prefix << "le=\"+Inf\"} " << cumulative << "\n";
+    std::string braces = labels.empty() ? "" : "{" + labels + "}";
+    out << name << "_sum" << braces << " " << seconds(static_cast<double>(histogram.sum())) << "\n";
+    out << name << "_count" << braces << " " << histogram.count() << "\n";
+}
+
+void write_header(std::ostream &out, const char *name, const char *type, const char *help) {
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+} // namespace
+
+void LogHistogram::observe(uint64_t value) {
+    // ceil(log2(value)): the smallest i with value <= 2^i.
+    size_t i = value <= 1 ? 0 : 64 - static_cast<size_t>(__builtin_clzll(value - 1));
+    buckets_[std::min(i, kBuckets)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t LogHistogram::count() const {
+    uint64_t count = 0;
+    for (const auto &bucket : buckets_) {
+        count += bucket.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+const char *metric_command_name(MetricCommand command) {
+    return kCommandNames[static_cast<size_t>(command)];
+}
+
+void LoaderMetrics::record_load(uint32_t location, bool ok, double us) {
+    add(ok ? loads_ok : loads_failed, 1);
+    load_us.observe(static_cast<uint64_t>(std::max(us, 0.0) + 0.5));
+    std::lock_guard<std::mutex> lock(locations_mutex_);
+    LocationCounts &counts = locations_[location];
+    (ok ? counts.ok : counts.failed)++;
+}
+
+std::map<uint32_t, LoaderMetrics::LocationCounts> LoaderMetrics::locations() const {
+    std::lock_guard<std::mutex> lock(locations_mutex_);
+    return locations_;
+}
+
+MeteredTransport::MeteredTransport(PicobootTransport &inner, LoaderMetrics &metrics, std::function<double()> now_us)
+    : inner_(inner), metrics_(metrics), now_us_(std::move(now_us)) {}
+
+TransportResult MeteredTransport::reset_interface() {
+    return inner_.reset_interface();
+}
+
+TransportResult MeteredTransport::get_cmd_status(picoboot_cmd_status &status) {
+    return inner_.get_cmd_status(status);
+}
+
+TransportResult MeteredTransport::transfer(const picoboot_cmd &cmd, uint8_t *buffer) {
+    double start_us = now_us_();
+    TransportResult ret = inner_.transfer(cmd, buffer);
+    double us = now_us_() - start_us;
+    MetricCommand command = metric_command(cmd.bCmdId);
+    metrics_.command_us[static_cast<size_t>(command)].observe(static_cast<uint64_t>(std::max(us, 0.0) + 0.5));
+
+    if (ret == kTransportOk) {
+        if (command == MetricCommand::erase) {
+            add(metrics_.bytes_erased, cmd.range_cmd.dSize);
+        } else if (command == MetricCommand::write) {
+            add(metrics_.bytes_written, cmd.dTransferLength);
+        } else if (command == MetricCommand::read) {
+            add(metrics_.bytes_read, cmd.dTransferLength);
+        }
+        return ret;
+    }
+    // A device that executed or rebooted leaves the bus before its ACK.
+    if (ret == kTransportNoDevice && (command == MetricCommand::exec || command == MetricCommand::reboot)) {
+        return ret;
+    }
+    // A status that still reads PICOBOOT_OK says nothing about this failure.
+    picoboot_cmd_status status{};
+    if (ret != kTransportNoDevice && inner_.get_cmd_status(status) == kTransportOk &&
+        status.dStatusCode != PICOBOOT_OK && status.dStatusCode < LoaderMetrics::kStatusCodes) {
+        add(metrics_.failures_by_status[status.dStatusCode], 1);
+    } else {
+        add(metrics_.failures_without_status, 1);
+    }
+    return ret;
+}
+
+std::string format_prometheus(const LoaderMetrics &metrics) {
+    std::ostringstream out;
+    write_header(out, "dapico_loads_total", "counter", "Load sessions by result.");
+    out << "dapico_loads_total{result=\"ok\"} " << get(metrics.loads_ok) << "\n";
+    out << "dapico_loads_total{result=\"failed\"} " << get(metrics.loads_failed) << "\n";
+    write_header(out, "dapico_load_retries_total", "counter", "Failed loads started again on the same device.");
+    out << "dapico_load_retries_total " << get(metrics.retries) << "\n";
+    write_header(out, "dapico_bytes_total", "counter", "Bytes erased, written and read by completed commands.");
+    out << "dapico_bytes_total{op=\"erase\"} " << get(metrics.bytes_erased) << "\n";
+    out << "dapico_bytes_total{op=\"write\"} " << get(metrics.bytes_written) << "\n";
+    out << "dapico_bytes_total{op=\"read\"} " << get(metrics.bytes_read) << "\n";
+
+    write_header(out, "dapico_load_duration_seconds", "histogram", "Time per load session.");
+    write_histogram(out, "dapico_load_duration_seconds", "", metrics.load_us);
+    write_header(out, "dapico_command_duration_seconds", "histogram",
+                 "Time per PICOBOOT command, including its data phase and ACK.");
+    for (size_t i = 0; i < LoaderMetrics::kCommands; ++i) {
+        if (metrics.command_us[i].count() != 0) {
+            MetricCommand command = static_cast<MetricCommand>(i);
+            std::string labels = std::string("command=\"") + metric_command_name(command) + "\"";
+            write_histogram(out, "dapico_command_duration_seconds", labels, metrics.command_us[i]);
+        }
+    }
+
+    write_header(out, "dapico_command_failures_total", "counter",
+                 "Failed commands by the picoboot_status the device reported (UNAVAILABLE: no failure status read).");
+    for (size_t code = 0; code < LoaderMetrics::kStatusCodes; ++code) {
+        uint64_t failures = get(metrics.failures_by_status[code]);
+        if (failures != 0) {
+            const char *name = picoboot_status_name(static_cast<uint32_t>(code));
+            out << "dapico_command_failures_total{status=\"" << (name ? std::string(name) : std::to_string(code))
+                << "\"} " << failures << "\n";
+        }
+    }
+    out << "dapico_command_failures_total{status=\"UNAVAILABLE\"} " << get(metrics.failures_without_status) << "\n";
+
+    std::map<uint32_t, LoaderMetrics::LocationCounts> locations = metrics.locations();
+    write_header(out, "dapico_location_loads_total", "counter", "Load sessions by USB location ID and result.");
+    for (const auto &[location, counts] : locations) {
+        out << "dapico_location_loads_total{location=\"" << hex32(location) << "\",result=\"ok\"} " << counts.ok
+            << "\n";
+        out << "dapico_location_loads_total{location=\"" << hex32(location) << "\",result=\"failed\"} "
+            << counts.failed << "\n";
+    }
+    write_header(out, "dapico_location_success_ratio", "gauge", "Share of loads that succeeded, by USB location ID.");
+    for (const auto &[location, counts] : locations) {
+        out << "dapico_location_success_ratio{location=\"" << hex32(location) << "\"} "
+            << static_cast<double>(counts.ok) / static_cast<double>(counts.ok + counts.failed) << "\n";
+    }
+    return out.str();
+}
+
+void write_prometheus_textfile(const std::string &filename, const LoaderMetrics &metrics) {
+    std::string temp = filename + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Failed to create " + temp);
+        }
+        out << format_prometheus(metrics);
+        if (!out.flush()) {
+            throw std::runtime_error("Failed to write " + temp);
+        }
+    }
+    if (std::rename(temp.c_str(), filename.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("Failed to replace " + filename);
+    }
+}
@@ -0,0 +1,327 @@
+#include "otp.h"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+constexpr uint32_t kEccDataMask = 0x3fffff;
+constexpr uint32_t kBrbpBits = 0xc00000;
+
+// Data bits covered by Hamming parity bits 0-4; parity bit 5 makes the whole
+// 22-bit codeword even.
+constexpr uint16_t kParityMasks[5] = {0xad5b, 0x366d, 0xc78e, 0x07f0, 0xf800};
+
+struct EccTables {
+    // Parity bits 0-5 contributed by the low and high data byte.
+    std::array<uint8_t, 256> low{};
+    std::array<uint8_t, 256> high{};
+    // Codeword bit to flip for each Hamming syndrome, or -1 if none matches.
+    std::array<int8_t, 32> syndrome_bit{};
+
+    EccTables() {
+        auto parity = [](uint32_t data) {
+            uint32_t bits = 0;
+            for (int j = 0; j < 5; ++j) {
+                bits |= static_cast<uint32_t>(__builtin_parity(data & kParityMasks[j])) << j;
+            }
+            bits |= static_cast<uint32_t>(__builtin_parity(data ^ bits)) << 5;
+            return static_cast<uint8_t>(bits);
+        };
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            low[byte] = parity(byte);
+            high[byte] = parity(byte << 8);
+        }
+        syndrome_bit.fill(-1);
+        for (int bit = 0; bit < 16; ++bit) {
+            syndrome_bit[parity(1u << bit) & 0x1f] = static_cast<int8_t>(bit);
+        }
+        for (int j = 0; j < 5; ++j) {
+            syndrome_bit[1u << j] = static_cast<int8_t>(16 + j);
+        }
+        // A flipped overall parity bit leaves the Hamming syndrome clear.
+        syndrome_bit[0] = 21;
+    }
+};
+
+const EccTables &ecc_tables() {
+    static const EccTables tables;
+    return tables;
+}
+
+uint32_t parity_bits(const EccTables &tables, uint32_t data) {
+    return tables.low[data & 0xff] ^ tables.high[(data >> 8) & 0xff];
+}
+
+// Decodes a 22-bit codeword without BRBP flags.
+OtpEccStatus decode_codeword(const EccTables &tables, uint32_t word, uint16_t &value) {
+    uint32_t syndrome = (parity_bits(tables, word & 0xffff) ^ (word >> 16)) & 0x1f;
+    bool odd = __builtin_parity(word) != 0;
+    if (syndrome == 0 && !odd) {
+        value = static_cast<uint16_t>(word);
+        return OtpEccStatus::ok;
+    }
+    // Any single flip makes the codeword odd; an even one with a syndrome has
+    // at least two.
+    int bit = tables.syndrome_bit[syndrome];
+    if (!odd || bit < 0) {
+        return OtpEccStatus::uncorrectable;
+    }
+    value = static_cast<uint16_t>(word ^ (1u << bit));
+    return OtpEccStatus::corrected;
+}
+
+std::string row_name(uint32_t row) {
+    char text[8];
+    std::snprintf(text, sizeof(text), "0x%03x", row);
+    return text;
+}
+
+std::string value_name(uint32_t value, OtpLayout layout) {
+    char text[12];
+    std::snprintf(text, sizeof(text), layout == OtpLayout::ecc ? "0x%04x" : "0x%06x", value);
+    return text;
+}
+
+[[noreturn]] void manifest_error(const std::string &name, size_t line, const std::string &what) {
+    throw std::runtime_error(name + " line " + std::to_string(line) + ": " + what);
+}
+
+struct DesiredRow {
+    uint16_t row;
+    OtpLayout layout;
+    uint32_t value;
+};
+} // namespace
+
+uint32_t otp_ecc_encode(uint16_t value) {
+    return value | parity_bits(ecc_tables(), value) << 16;
+}
+
+OtpEccStatus otp_ecc_decode(uint32_t row, uint16_t &value) {
+    const EccTables &tables = ecc_tables();
+    uint32_t brbp = row & kBrbpBits;
+    if (brbp == 0) {
+        return decode_codeword(tables, row & kEccDataMask, value);
+    }
+    if (brbp == kBrbpBits) {
+        return decode_codeword(tables, ~row & kEccDataMask, value);
+    }
+    // One flag flipped: that is the single error, so one polarity must be clean.
+    if (decode_codeword(tables, row & kEccDataMask, value) == OtpEccStatus::ok ||
+        decode_codeword(tables, ~row & kEccDataMask, value) == OtpEccStatus::ok) {
+        return OtpEccStatus::corrected;
+    }
+    return OtpEccStatus::uncorrectable;
+}
+
+bool otp_ecc_program_value(uint32_t current, uint16_t value, uint32_t &row) {
+    uint32_t codeword = otp_ecc_encode(value);
+    if ((current & ~codeword) == 0) {
+        row = codeword;
+        return true;
+    }
+    uint32_t inverted = (~codeword & kEccDataMask) | kBrbpBits;
+    if ((current & ~inverted) == 0) {
+        row = inverted;
+        return true;
+    }
+    return false;
+}
+
+TransportResult read_otp_rows(PicobootTransport &transport, uint16_t row, uint32_t count, OtpLayout layout,
+                              std::vector<uint32_t> &values) {
+    uint32_t row_bytes = otp_row_bytes(layout);
+    std::vector<uint8_t> buffer(static_cast<size_t>(count) * row_bytes);
+    TransportResult ret = picoboot_otp_read(transport, row, static_cast<uint16_t>(count), layout == OtpLayout::ecc,
+                                            buffer.data());
+    if (ret != kTransportOk) {
+        std::cerr << "OTP read failed at row " << row_name(row) << " (IOKit error " << ret << ").\n";
+        return ret;
+    }
+    values.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *bytes = buffer.data() + i * row_bytes;
+        uint32_t value = bytes[0] | bytes[1] << 8;
+        if (layout == OtpLayout::raw) {
+            value |= static_cast<uint32_t>(bytes[2]) << 16;
+        }
+        values[i] = value;
+    }
+    return kTransportOk;
+}
+
+std::vector<OtpEntry> parse_otp_manifest(std::istream &input, const std::string &name) {
+    std::vector<OtpEntry> entries;
+    std::bitset<kOtpRowCount> listed;
+    std::string text;
+    size_t line = 0;
+    while (std::getline(input, text)) {
+        ++line;
+        size_t comment = text.find('#');
+        if (comment != std::string::npos) {
+            text.resize(comment);
+        }
+        std::istringstream fields(text);
+        std::string row_text;
+        if (!(fields >> row_text)) {
+            continue;
+        }
+        char *end = nullptr;
+        unsigned long row = std::strtoul(row_text.c_str(), &end, 0);
+        if (*end != '\0' || row >= kOtpRowCount) {
+            manifest_error(name, line, "invalid row '" + row_text + "'");
+        }
+        std::string layout_text;
+        fields >> layout_text;
+        OtpEntry entry;
+        entry.row = static_cast<uint16_t>(row);
+        if (layout_text == "ecc") {
+            entry.layout = OtpLayout::ecc;
+        } else if (layout_text == "raw") {
+            entry.layout = OtpLayout::raw;
+        } else {
+            manifest_error(name, line, "expected 'ecc' or 'raw' after the row, not '" + layout_text + "'");
+        }
+        uint32_t limit = entry.layout == OtpLayout::ecc ? 0xffff : kOtpRowMask;
+        std::string value_text;
+        while (fields >> value_text) {
+            unsigned long value = std::strtoul(value_text.c_str(), &end, 0);
+            if (*end != '\0' || value > limit) {
+                manifest_error(name, line, "invalid " + layout_text + " value '" + value_text + "'");
+            }
+            entry.values.push_back(static_cast<uint32_t>(value));
+        }
+        if (entry.values.empty()) {
+            manifest_error(name, line, "no values for row " + row_name(entry.row));
+        }
+        if (entry.row + entry.values.size() > kOtpRowCount) {
+            manifest_error(name, line, "values run past the last OTP row");
+        }
+        for (size_t i = 0; i < entry.values.size(); ++i) {
+            if (listed.test(entry.row + i)) {
+                manifest_error(name, line, "row " + row_name(static_cast<uint32_t>(entry.row + i)) +
+                                               " is listed twice");
+            }
+            listed.set(entry.row + i);
+        }
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+void write_otp_manifest(std::ostream &output, uint16_t row, OtpLayout layout, const std::vector<uint32_t> &values) {
+    constexpr size_t kValuesPerLine = 8;
+    for (size_t i = 0; i < values.size(); i += kValuesPerLine) {
+        output << row_name(static_cast<uint32_t>(row + i)) << (layout == OtpLayout::ecc ? " ecc" : " raw");
+        for (size_t j = i; j < std::min(values.size(), i + kValuesPerLine); ++j) {
+            output << ' ' << value_name(values[j], layout);
+        }
+        output << '\n';
+    }
+}
+
+TransportResult plan_otp_update(PicobootTransport &transport, const std::vector<OtpEntry> &entries, OtpPlan &plan) {
+    plan = OtpPlan{};
+    std::vector<DesiredRow> desired;
+    for (const auto &entry : entries) {
+        for (size_t i = 0; i < entry.values.size(); ++i) {
+            desired.push_back(DesiredRow{static_cast<uint16_t>(entry.row + i), entry.layout, entry.values[i]});
+        }
+    }
+    std::sort(desired.begin(), desired.end(), [](const DesiredRow &a, const DesiredRow &b) { return a.row < b.row; });
+    plan.rows = static_cast<uint32_t>(desired.size());
+
+    // Raw reads, so both layouts come back in one command per run and ECC rows
+    // show which bits are already programmed.
+    std::vector<uint32_t> current(desired.size());
+    for (size_t begin = 0; begin < desired.size();) {
+        size_t end = begin + 1;
+        while (end < desired.size() && desired[end].row == desired[end - 1].row + 1) {
+            ++end;
+        }
+        std::vector<uint32_t> run;
+        TransportResult ret =
+            read_otp_rows(transport, desired[begin].row, static_cast<uint32_t>(end - begin), OtpLayout::raw, run);
+        if (ret != kTransportOk) {
+            return ret;
+        }
+        plan.read_commands++;
+        std::copy(run.begin(), run.end(), current.begin() + static_cast<std::ptrdiff_t>(begin));
+        begin = end;
+    }
+
+    for (size_t i = 0; i < desired.size(); ++i) {
+        const DesiredRow &want = desired[i];
+        uint32_t row_value = want.value;
+        bool possible = true;
+        if (want.layout == OtpLayout::ecc) {
+            uint16_t value = 0;
+            OtpEccStatus status = otp_ecc_decode(current[i], value);
+            if (status != OtpEccStatus::uncorrectable && value == want.value) {
+                plan.unchanged++;
+                plan.corrected += status == OtpEccStatus::corrected;
+                continue;
+            }
+            possible = otp_ecc_program_value(current[i], static_cast<uint16_t>(want.value), row_value);
+        } else {
+            if (current[i] == want.value) {
+                plan.unchanged++;
+                continue;
+            }
+            possible = (current[i] & ~want.value) == 0;
+        }
+        if (!possible) {
+            plan.conflicts.push_back("row " + row_name(want.row) + " holds " +
+                                     value_name(current[i], OtpLayout::raw) + ", which cannot become " +
+                                     (want.layout == OtpLayout::ecc ? "ECC " : "raw ") +
+                                     value_name(want.value, want.layout) + " (OTP bits cannot be cleared)");
+            continue;
+        }
+        plan.changed++;
+        if (plan.writes.empty() || plan.writes.back().row + plan.writes.back().rows.size() != want.row) {
+            plan.writes.push_back(OtpWrite{want.row, {}});
+        }
+        plan.writes.back().rows.push_back(row_value);
+    }
+    return kTransportOk;
+}
+
+TransportResult write_otp_plan(PicobootTransport &transport, const OtpPlan &plan) {
+    for (const auto &write : plan.writes) {
+        std::vector<uint8_t> buffer(write.rows.size() * 4, 0);
+        for (size_t i = 0; i < write.rows.size(); ++i) {
+            buffer[4 * i] = static_cast<uint8_t>(write.rows[i]);
+            buffer[4 * i + 1] = static_cast<uint8_t>(write.rows[i] >> 8);
+            buffer[4 * i + 2] = static_cast<uint8_t>(write.rows[i] >> 16);
+        }
+        TransportResult ret = picoboot_otp_write(transport, write.row, static_cast<uint16_t>(write.rows.size()),
+                                                 false, buffer.data());
+        if (ret != kTransportOk) {
+            std::cerr << "OTP write failed at row " << row_name(write.row) << " (IOKit error " << ret << ").\n";
+            return ret;
+        }
+    }
+    for (const auto &write : plan.writes) {
+        std::vector<uint32_t> readback;
+        TransportResult ret = read_otp_rows(transport, write.row, static_cast<uint32_t>(write.rows.size()),
+                                            OtpLayout::raw, readback);
+        if (ret != kTransportOk) {
+            return ret;
+        }
+        for (size_t i = 0; i < write.rows.size(); ++i) {
+            if (readback[i] != write.rows[i]) {
+                std::cerr << "OTP row " << row_name(static_cast<uint32_t>(write.row + i)) << " reads back "
+                          << value_name(readback[i], OtpLayout::raw) << " instead of "
+                          << value_name(write.rows[i], OtpLayout::raw) << ".\n";
+                return kTransportError;
+            }
+        }
+    }
+    return kTransportOk;
+}
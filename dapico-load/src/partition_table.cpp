@@ -0,0 +1,195 @@
+#include "partition_table.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "format_util.h"
+
+namespace {
+constexpr uint32_t kTableInfoWords = 2;
+constexpr uint32_t kWordsPerPartition = 2;
+constexpr uint32_t kGetInfoBufferSize = 256;
+
+bool contains(const Partition &partition, uint32_t addr) {
+    return addr >= partition.start() && addr < partition.end();
+}
+
+TransportResult get_info_words(PicobootTransport &transport, const picoboot_get_info_cmd &info,
+                               std::vector<uint32_t> &words) {
+    uint8_t buffer[kGetInfoBufferSize] = {};
+    TransportResult ret = picoboot_get_info(transport, info, buffer, sizeof(buffer));
+    if (ret != kTransportOk) {
+        std::cerr << "GET_INFO failed (IOKit error " << ret << ").\n";
+        return ret;
+    }
+    words.resize(sizeof(buffer) / 4);
+    std::memcpy(words.data(), buffer, sizeof(buffer));
+    words.resize(std::min<size_t>(words.size(), 1 + words[0]));
+    return kTransportOk;
+}
+} // namespace
+
+uint32_t Partition::start() const {
+    return kFlashStart + (permissions_and_location & kPartitionFirstSectorMask) * kFlashSectorSize;
+}
+
+uint32_t Partition::end() const {
+    uint32_t last = (permissions_and_location & kPartitionLastSectorMask) >> kPartitionLastSectorShift;
+    return kFlashStart + (last + 1) * kFlashSectorSize;
+}
+
+int Partition::a_partition() const {
+    uint32_t type = (permissions_and_flags & kPartitionLinkTypeMask) >> kPartitionLinkTypeShift;
+    if (type != kPartitionLinkTypeAPartition) {
+        return -1;
+    }
+    return static_cast<int>((permissions_and_flags & kPartitionLinkValueMask) >> kPartitionLinkValueShift);
+}
+
+int PartitionTable::ab_partner(int index) const {
+    if (index < 0 || static_cast<size_t>(index) >= partitions.size()) {
+        return -1;
+    }
+    int a = partitions[index].a_partition();
+    if (a >= 0) {
+        return static_cast<size_t>(a) < partitions.size() ? a : -1;
+    }
+    for (size_t i = 0; i < partitions.size(); ++i) {
+        if (partitions[i].a_partition() == index) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+Partition make_partition(uint32_t offset, uint32_t size, int a_partition) {
+    Partition partition;
+    uint32_t first = offset / kFlashSectorSize;
+    uint32_t last = (offset + size) / kFlashSectorSize - 1;
+    partition.permissions_and_location = first | last << kPartitionLastSectorShift;
+    if (a_partition >= 0) {
+        partition.permissions_and_flags = kPartitionLinkTypeAPartition << kPartitionLinkTypeShift |
+                                          static_cast<uint32_t>(a_partition) << kPartitionLinkValueShift;
+    }
+    return partition;
+}
+
+PartitionTable parse_partition_table_info(const uint32_t *words, size_t count) {
+    constexpr uint32_t kFlags = kPtInfoPtInfo | kPtInfoLocationAndFlags;
+    if (count < 2 + kTableInfoWords || words[0] + 1 > count || words[1] != kFlags) {
+        throw std::runtime_error("Malformed partition table info from the device");
+    }
+    PartitionTable table;
+    uint32_t partition_count = words[2] & 0xff;
+    table.present = (words[2] & 0x100) != 0;
+    if (words[0] != 1 + kTableInfoWords + partition_count * kWordsPerPartition) {
+        throw std::runtime_error("Partition table info from the device is truncated");
+    }
+    const uint32_t *entry = words + 2 + kTableInfoWords;
+    for (uint32_t i = 0; i < partition_count; ++i, entry += kWordsPerPartition) {
+        table.partitions.push_back(Partition{entry[0], entry[1]});
+    }
+    return table;
+}
+
+std::vector<uint32_t> partition_table_info_words(const PartitionTable &table) {
+    std::vector<uint32_t> words = {0, kPtInfoPtInfo | kPtInfoLocationAndFlags,
+                                   static_cast<uint32_t>(table.partitions.size()) | (table.present ? 0x100u : 0u), 0};
+    for (const auto &partition : table.partitions) {
+        words.push_back(partition.permissions_and_location);
+        words.push_back(partition.permissions_and_flags);
+    }
+    words[0] = static_cast<uint32_t>(words.size() - 1);
+    return words;
+}
+
+TransportResult query_partition_table(PicobootTransport &transport, PartitionTable &table) {
+    picoboot_get_info_cmd info{};
+    info.bType = PICOBOOT_GET_INFO_PARTTION_TABLE;
+    info.dParams[0] = kPtInfoPtInfo | kPtInfoLocationAndFlags;
+    std::vector<uint32_t> words;
+    TransportResult ret = get_info_words(transport, info, words);
+    if (ret == kTransportOk) {
+        table = parse_partition_table_info(words.data(), words.size());
+    }
+    return ret;
+}
+
+TransportResult query_uf2_target_partition(PicobootTransport &transport, uint32_t family_id, int &index) {
+    picoboot_get_info_cmd info{};
+    info.bType = PICOBOOT_GET_INFO_UF2_TARGET_PARTITION;
+    info.dParams[0] = family_id;
+    std::vector<uint32_t> words;
+    TransportResult ret = get_info_words(transport, info, words);
+    if (ret == kTransportOk) {
+        index = words.size() > 1 ? static_cast<int32_t>(words[1]) : -1;
+    }
+    return ret;
+}
+
+void relocate_load_plan(LoadPlan &plan, uint32_t from, uint32_t to, const Range &slot) {
+    auto move = [&](uint32_t addr, uint32_t size) {
+        uint64_t moved = static_cast<uint64_t>(addr) - from + to;
+        if (addr < from || moved < slot.start || moved + size > slot.end) {
+            throw std::runtime_error("Flash contents at " + hex32(addr) + " do not fit in the partition at " +
+                                     hex32(slot.start) + "-" + hex32(slot.end));
+        }
+        return static_cast<uint32_t>(moved);
+    };
+    for (auto &extent : plan.flash_extents) {
+        extent.addr = move(extent.addr, static_cast<uint32_t>(extent.data.size()));
+    }
+    for (auto &range : plan.erase_ranges) {
+        uint32_t size = range.end - range.start;
+        range.start = move(range.start, size);
+        range.end = range.start + size;
+    }
+}
+
+TransportResult plan_partition_update(PicobootTransport &transport, LoadPlan &plan, PartitionUpdate &update) {
+    if (plan.flash_extents.empty()) {
+        throw std::runtime_error("The image has no flash contents to put in a partition");
+    }
+    TransportResult ret = query_partition_table(transport, update.table);
+    if (ret != kTransportOk) {
+        return ret;
+    }
+    if (!update.table.present) {
+        throw std::runtime_error("The device has no partition table; load with --flash instead");
+    }
+    ret = query_uf2_target_partition(transport, kFamilyIdRp2350ArmSecure, update.target);
+    if (ret != kTransportOk) {
+        return ret;
+    }
+    update.booted = update.table.ab_partner(update.target);
+    if (update.booted < 0) {
+        throw std::runtime_error("The partition table has no A/B pair to update");
+    }
+
+    const Partition &target = update.table.partitions[update.target];
+    const Partition &booted = update.table.partitions[update.booted];
+    if (target.start() < booted.end() && booted.start() < target.end()) {
+        throw std::runtime_error("The A/B partitions overlap; writing one would overwrite the other");
+    }
+    uint32_t lowest = std::min_element(plan.flash_extents.begin(), plan.flash_extents.end(),
+                                       [](const FlashExtent &a, const FlashExtent &b) { return a.addr < b.addr; })
+                          ->addr;
+    if (contains(target, lowest)) {
+        update.image_base = target.start();
+    } else if (contains(booted, lowest)) {
+        update.image_base = booted.start();
+    } else {
+        update.image_base = kFlashStart;
+    }
+    update.target_base = target.start();
+    relocate_load_plan(plan, update.image_base, update.target_base, Range{target.start(), target.end()});
+
+    update.erase_sectors = 0;
+    for (const auto &range : plan.erase_ranges) {
+        update.erase_sectors += (range.end - range.start) / kFlashSectorSize;
+    }
+    update.slot_sectors = (target.end() - target.start()) / kFlashSectorSize;
+    return kTransportOk;
+}
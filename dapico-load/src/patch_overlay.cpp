@@ -0,0 +1,171 @@
+#include "patch_overlay.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "format_util.h"
+
+namespace {
+std::string trim(const std::string &text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+[[noreturn]] void row_error(const std::string &filename, size_t line, const std::string &what) {
+    throw std::runtime_error(filename + " line " + std::to_string(line) + ": " + what);
+}
+
+DevicePatch parse_patch(const std::string &filename, size_t line, const std::string &addr_text,
+                        const std::string &bytes_text) {
+    char *end = nullptr;
+    unsigned long long addr = std::strtoull(addr_text.c_str(), &end, 0);
+    if (addr_text.empty() || *end != '\0' || addr > UINT32_MAX) {
+        row_error(filename, line, "invalid address '" + addr_text + "'");
+    }
+    std::string hex = bytes_text.compare(0, 2, "0x") == 0 ? bytes_text.substr(2) : bytes_text;
+    if (hex.empty() || hex.size() % 2 != 0 || addr + hex.size() / 2 > UINT32_MAX + 1ull) {
+        row_error(filename, line, "invalid patch bytes '" + bytes_text + "'");
+    }
+    DevicePatch patch{static_cast<uint32_t>(addr), std::vector<uint8_t>(hex.size() / 2)};
+    for (size_t i = 0; i < patch.bytes.size(); ++i) {
+        int high = hex_digit(hex[2 * i]);
+        int low = hex_digit(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            row_error(filename, line, "invalid patch bytes '" + bytes_text + "'");
+        }
+        patch.bytes[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+    return patch;
+}
+} // namespace
+
+PatchOverlay::PatchOverlay(const LoadPlan &plan, std::vector<DevicePatch> patches) : patches_(std::move(patches)) {
+    std::vector<Range> written;
+    for (const auto &extent : plan.flash_extents) {
+        written.push_back(Range{extent.addr, extent.addr + static_cast<uint32_t>(extent.data.size())});
+    }
+    for (const auto &segment : plan.ram_segments) {
+        written.push_back(Range{segment.addr, segment.addr + segment.size});
+    }
+    written = merge_ranges(std::move(written));
+
+    for (const auto &patch : patches_) {
+        uint32_t end = patch.addr + static_cast<uint32_t>(patch.bytes.size());
+        auto it = std::upper_bound(written.begin(), written.end(), patch.addr,
+                                   [](uint32_t addr, const Range &range) { return addr < range.start; });
+        if (patch.bytes.empty() || it == written.begin() || std::prev(it)->end < end) {
+            throw std::runtime_error("Patch at " + hex32(patch.addr) + " (" + std::to_string(patch.bytes.size()) +
+                                     " bytes) is outside the image; reserve the block in the firmware");
+        }
+        low_ = std::min(low_, patch.addr);
+        high_ = std::max(high_, end);
+    }
+}
+
+const uint8_t *PatchOverlay::apply(uint32_t addr, const uint8_t *data, uint32_t size, uint8_t *scratch) const {
+    uint32_t end = addr + size;
+    if (end <= low_ || addr >= high_) {
+        return data;
+    }
+    const uint8_t *out = data;
+    for (const auto &patch : patches_) {
+        uint32_t from = std::max(addr, patch.addr);
+        uint32_t to = std::min(end, patch.addr + static_cast<uint32_t>(patch.bytes.size()));
+        if (from >= to) {
+            continue;
+        }
+        if (out == data) {
+            std::memcpy(scratch, data, size);
+            out = scratch;
+        }
+        std::memcpy(scratch + (from - addr), patch.bytes.data() + (from - patch.addr), to - from);
+    }
+    return out;
+}
+
+uint32_t PatchOverlay::patched_bytes() const {
+    std::vector<Range> ranges;
+    for (const auto &patch : patches_) {
+        ranges.push_back(Range{patch.addr, patch.addr + static_cast<uint32_t>(patch.bytes.size())});
+    }
+    uint32_t bytes = 0;
+    for (const auto &range : merge_ranges(std::move(ranges))) {
+        bytes += range.end - range.start;
+    }
+    return bytes;
+}
+
+uint32_t PatchOverlay::patched_pages() const {
+    std::vector<Range> pages;
+    for (const auto &patch : patches_) {
+        uint32_t end = patch.addr + static_cast<uint32_t>(patch.bytes.size());
+        pages.push_back(Range{align_down(patch.addr, kFlashPageSize), align_up(end, kFlashPageSize)});
+    }
+    uint32_t count = 0;
+    for (const auto &range : merge_ranges(std::move(pages))) {
+        count += (range.end - range.start) / kFlashPageSize;
+    }
+    return count;
+}
+
+std::vector<std::vector<DevicePatch>> read_patch_csv(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open patch file: " + filename);
+    }
+    std::vector<std::vector<DevicePatch>> units;
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); ++number) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<std::string> fields;
+        std::stringstream row(line);
+        std::string field;
+        while (std::getline(row, field, ',')) {
+            fields.push_back(trim(field));
+        }
+        if (fields.size() % 2 != 0) {
+            row_error(filename, number, "expected addr,hexbytes pairs");
+        }
+        std::vector<DevicePatch> patches;
+        for (size_t i = 0; i < fields.size(); i += 2) {
+            patches.push_back(parse_patch(filename, number, fields[i], fields[i + 1]));
+        }
+        units.push_back(std::move(patches));
+    }
+    if (units.empty()) {
+        throw std::runtime_error("Patch file has no units: " + filename);
+    }
+    return units;
+}
+
+DevicePatch serial_patch(uint32_t addr, uint64_t serial, uint32_t width) {
+    DevicePatch patch{addr, std::vector<uint8_t>(width)};
+    for (uint32_t i = 0; i < width; ++i) {
+        patch.bytes[i] = static_cast<uint8_t>(serial >> (8 * i));
+    }
+    return patch;
+}
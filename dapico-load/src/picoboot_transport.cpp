@@ -0,0 +1,197 @@
+#include "picoboot_transport.h"
+
+#include <iostream>
+#include <iterator>
+
+#include "load_plan.h"
+
+namespace {
+const char *const kStatusNames[] = {
+    "OK",
+    "UNKNOWN_CMD",
+    "INVALID_CMD_LENGTH",
+    "INVALID_TRANSFER_LENGTH",
+    "INVALID_ADDRESS",
+    "BAD_ALIGNMENT",
+    "INTERLEAVED_WRITE",
+    "REBOOTING",
+    "UNKNOWN_ERROR",
+    "INVALID_STATE",
+    "NOT_PERMITTED",
+    "INVALID_ARG",
+    "BUFFER_TOO_SMALL",
+    "PRECONDITION_NOT_MET",
+    "MODIFIED_DATA",
+    "INVALID_DATA",
+    "NOT_FOUND",
+    "UNSUPPORTED_MODIFICATION",
+};
+} // namespace
+
+const char *picoboot_status_name(uint32_t status_code) {
+    return status_code < std::size(kStatusNames) ? kStatusNames[status_code] : nullptr;
+}
+
+TransportResult send_picoboot_command(PicobootTransport &transport, picoboot_cmd &cmd, uint8_t *buffer) {
+    static uint32_t token = 1;
+    cmd.dMagic = PICOBOOT_MAGIC;
+    cmd.dToken = token++;
+    return transport.transfer(cmd, buffer);
+}
+
+TransportResult picoboot_exit_xip(PicobootTransport &transport) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_EXIT_XIP;
+    cmd.bCmdSize = 0;
+    cmd.dTransferLength = 0;
+    return send_picoboot_command(transport, cmd, nullptr);
+}
+
+TransportResult picoboot_flash_erase(PicobootTransport &transport, uint32_t addr, uint32_t size) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_FLASH_ERASE;
+    cmd.bCmdSize = sizeof(cmd.range_cmd);
+    cmd.range_cmd.dAddr = addr;
+    cmd.range_cmd.dSize = size;
+    cmd.dTransferLength = 0;
+    return send_picoboot_command(transport, cmd, nullptr);
+}
+
+TransportResult picoboot_write(PicobootTransport &transport, uint32_t addr, const uint8_t *buffer, uint32_t size) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_WRITE;
+    cmd.bCmdSize = sizeof(cmd.range_cmd);
+    cmd.range_cmd.dAddr = addr;
+    cmd.range_cmd.dSize = size;
+    cmd.dTransferLength = size;
+    return send_picoboot_command(transport, cmd, const_cast<uint8_t *>(buffer));
+}
+
+TransportResult picoboot_read(PicobootTransport &transport, uint32_t addr, uint8_t *buffer, uint32_t size) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_READ;
+    cmd.bCmdSize = sizeof(cmd.range_cmd);
+    cmd.range_cmd.dAddr = addr;
+    cmd.range_cmd.dSize = size;
+    cmd.dTransferLength = size;
+    return send_picoboot_command(transport, cmd, buffer);
+}
+
+TransportResult picoboot_exclusive_access(PicobootTransport &transport, picoboot_exclusive_type type) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_EXCLUSIVE_ACCESS;
+    cmd.bCmdSize = sizeof(cmd.exclusive_cmd);
+    cmd.exclusive_cmd.bExclusive = static_cast<uint8_t>(type);
+    cmd.dTransferLength = 0;
+    return send_picoboot_command(transport, cmd, nullptr);
+}
+
+TransportResult picoboot_otp_read(PicobootTransport &transport, uint16_t row, uint16_t count, bool ecc,
+                                  uint8_t *buffer) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_OTP_READ;
+    cmd.bCmdSize = sizeof(cmd.otp_cmd);
+    cmd.otp_cmd.wRow = row;
+    cmd.otp_cmd.wRowCount = count;
+    cmd.otp_cmd.bEcc = ecc ? 1 : 0;
+    cmd.dTransferLength = static_cast<uint32_t>(count) * (ecc ? 2 : 4);
+    return send_picoboot_command(transport, cmd, buffer);
+}
+
+TransportResult picoboot_otp_write(PicobootTransport &transport, uint16_t row, uint16_t count, bool ecc,
+                                   const uint8_t *buffer) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_OTP_WRITE;
+    cmd.bCmdSize = sizeof(cmd.otp_cmd);
+    cmd.otp_cmd.wRow = row;
+    cmd.otp_cmd.wRowCount = count;
+    cmd.otp_cmd.bEcc = ecc ? 1 : 0;
+    cmd.dTransferLength = static_cast<uint32_t>(count) * (ecc ? 2 : 4);
+    return send_picoboot_command(transport, cmd, const_cast<uint8_t *>(buffer));
+}
+
+TransportResult picoboot_exec(PicobootTransport &transport, uint32_t addr) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_EXEC;
+    cmd.bCmdSize = sizeof(cmd.address_only_cmd);
+    cmd.address_only_cmd.dAddr = addr;
+    cmd.dTransferLength = 0;
+    TransportResult ret = send_picoboot_command(transport, cmd, nullptr);
+    if (ret == kTransportOk || ret == kTransportNoDevice) {
+        return kTransportOk;
+    }
+    picoboot_cmd_status status{};
+    TransportResult status_ret = transport.get_cmd_status(status);
+    if (status_ret == kTransportOk) {
+        if (status.dStatusCode == PICOBOOT_OK || status.dStatusCode == PICOBOOT_REBOOTING) {
+            return kTransportOk;
+        }
+    } else if (status_ret == kTransportNoDevice) {
+        return kTransportOk;
+    }
+    return ret;
+}
+
+TransportResult picoboot_reboot(PicobootTransport &transport, uint16_t product_id, uint32_t delay_ms) {
+    if (product_id != kProductIdRp2040UsbBoot) {
+        return picoboot_reboot2(transport, REBOOT2_FLAG_REBOOT_TYPE_NORMAL, delay_ms, 0, 0);
+    }
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_REBOOT;
+    cmd.bCmdSize = sizeof(cmd.reboot_cmd);
+    cmd.reboot_cmd.dPC = 0;
+    cmd.reboot_cmd.dSP = 0;
+    cmd.reboot_cmd.dDelayMS = delay_ms;
+    cmd.dTransferLength = 0;
+    TransportResult ret = send_picoboot_command(transport, cmd, nullptr);
+    // The device may drop off the bus before the ACK arrives.
+    return ret == kTransportNoDevice ? kTransportOk : ret;
+}
+
+TransportResult picoboot_reboot2(PicobootTransport &transport, uint32_t flags, uint32_t delay_ms, uint32_t param0,
+                                 uint32_t param1) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_REBOOT2;
+    cmd.bCmdSize = sizeof(cmd.reboot2_cmd);
+    cmd.reboot2_cmd.dFlags = flags;
+    cmd.reboot2_cmd.dDelayMS = delay_ms;
+    cmd.reboot2_cmd.dParam0 = param0;
+    cmd.reboot2_cmd.dParam1 = param1;
+    cmd.dTransferLength = 0;
+    TransportResult ret = send_picoboot_command(transport, cmd, nullptr);
+    return ret == kTransportNoDevice ? kTransportOk : ret;
+}
+
+TransportResult picoboot_get_info(PicobootTransport &transport, const picoboot_get_info_cmd &info, uint8_t *buffer,
+                                  uint32_t size) {
+    picoboot_cmd cmd{};
+    cmd.bCmdId = PC_GET_INFO;
+    cmd.bCmdSize = sizeof(cmd.get_info_cmd);
+    cmd.get_info_cmd = info;
+    cmd.dTransferLength = size;
+    return send_picoboot_command(transport, cmd, buffer);
+}
+
+ExclusiveAccess::ExclusiveAccess(PicobootTransport &transport, picoboot_exclusive_type type) : transport_(transport) {
+    if (type == NOT_EXCLUSIVE) {
+        return;
+    }
+    TransportResult ret = picoboot_exclusive_access(transport_, type);
+    if (ret != kTransportOk) {
+        std::cerr << "Warning: exclusive access failed (IOKit error " << ret << "); continuing shared.\n";
+        transport_.reset_interface();
+        return;
+    }
+    held_ = true;
+}
+
+ExclusiveAccess::~ExclusiveAccess() {
+    if (!held_) {
+        return;
+    }
+    // A failed command leaves the endpoints stalled; clear them and retry.
+    if (picoboot_exclusive_access(transport_, NOT_EXCLUSIVE) != kTransportOk &&
+        transport_.reset_interface() == kTransportOk) {
+        picoboot_exclusive_access(transport_, NOT_EXCLUSIVE);
+    }
+}
@@ -0,0 +1,216 @@
+#include "progress.h"
+
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <pthread.h>
+#include <sys/qos.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr int kBarWidth = 30;
+constexpr double kMiB = 1024.0 * 1024.0;
+
+// Rendering must not take time from the thread driving the transfer.
+void lower_thread_priority() {
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#elif defined(__linux__)
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+#endif
+}
+
+std::string format_duration(double seconds) {
+    long total = std::lround(std::max(seconds, 0.0));
+    char text[32];
+    if (total >= 3600) {
+        std::snprintf(text, sizeof(text), "%ld:%02ld:%02ld", total / 3600, total / 60 % 60, total % 60);
+    } else {
+        std::snprintf(text, sizeof(text), "%ld:%02ld", total / 60, total % 60);
+    }
+    return text;
+}
+
+std::string format_rate(double bytes_per_s) {
+    char text[32];
+    if (bytes_per_s >= kMiB) {
+        std::snprintf(text, sizeof(text), "%.1f MiB/s", bytes_per_s / kMiB);
+    } else {
+        std::snprintf(text, sizeof(text), "%.0f KiB/s", bytes_per_s / 1024.0);
+    }
+    return text;
+}
+} // namespace
+
+void LoadCounters::reset() {
+    erased.store(0, std::memory_order_relaxed);
+    written.store(0, std::memory_order_relaxed);
+    commands.store(0, std::memory_order_relaxed);
+}
+
+ProgressTotals progress_totals(const LoadPlan &plan, const CostModel &model, const LoadOptions &options) {
+    CostEstimate estimate = estimate_load_cost(plan, model, options);
+    ProgressTotals totals;
+    totals.erase_bytes = estimate.erase_bytes;
+    totals.write_bytes = estimate.payload_bytes();
+    // LoadCounters does not see the exclusive access commands.
+    totals.commands = estimate.erase_commands + estimate.write_commands + estimate.other_commands;
+
+    totals.erase_us = estimate.erase_commands * model.command_overhead_us +
+                      estimate.erase_sectors * model.sector_erase_ms * 1000.0 +
+                      estimate.erase_blocks * model.block_erase_ms * 1000.0;
+    totals.write_us = estimate.write_commands * model.command_overhead_us +
+                      estimate.payload_bytes() / model.bytes_per_second * 1e6 +
+                      estimate.flash_pages * model.page_program_us;
+    return totals;
+}
+
+ProgressEstimator::ProgressEstimator(const ProgressTotals &totals, double half_life_s)
+    : totals_(totals), half_life_s_(half_life_s) {}
+
+double ProgressEstimator::work_us(uint64_t erased, uint64_t written) const {
+    double work = 0;
+    if (totals_.erase_bytes != 0) {
+        work += totals_.erase_us * std::min<double>(erased, totals_.erase_bytes) / totals_.erase_bytes;
+    }
+    if (totals_.write_bytes != 0) {
+        work += totals_.write_us * std::min<double>(written, totals_.write_bytes) / totals_.write_bytes;
+    }
+    return work;
+}
+
+ProgressSample ProgressEstimator::update(double elapsed_s, uint64_t erased, uint64_t written, uint32_t commands) {
+    ProgressSample sample;
+    sample.elapsed_s = elapsed_s;
+    sample.erased = erased;
+    sample.written = written;
+    sample.commands = commands;
+
+    double total_us = totals_.erase_us + totals_.write_us;
+    double work = work_us(erased, written);
+    sample.fraction = total_us > 0 ? std::min(work / total_us, 1.0) : 1.0;
+
+    // Rates are measured between completions; a long erase is one command.
+    double dt = elapsed_s - last_s_;
+    uint64_t bytes = erased + written;
+    if (dt > 0 && work > last_work_us_) {
+        double work_rate = (work - last_work_us_) / dt;
+        double byte_rate = static_cast<double>(bytes - last_bytes_) / dt;
+        if (rated_) {
+            double alpha = 1.0 - std::exp2(-dt / half_life_s_);
+            work_rate_ += alpha * (work_rate - work_rate_);
+            byte_rate_ += alpha * (byte_rate - byte_rate_);
+        } else {
+            work_rate_ = work_rate;
+            byte_rate_ = byte_rate;
+            rated_ = true;
+        }
+        last_s_ = elapsed_s;
+        last_work_us_ = work;
+        last_bytes_ = bytes;
+    }
+    sample.bytes_per_s = byte_rate_;
+    // Counts down through the command in flight instead of waiting for it.
+    sample.eta_s = std::max(std::max(total_us - work, 0.0) / work_rate_ - (elapsed_s - last_s_), 0.0);
+    return sample;
+}
+
+ProgressFormat default_progress_format() {
+    return isatty(STDERR_FILENO) ? ProgressFormat::tty : ProgressFormat::none;
+}
+
+bool parse_progress_format(const std::string &text, ProgressFormat &format) {
+    if (text == "tty") {
+        format = ProgressFormat::tty;
+    } else if (text == "json") {
+        format = ProgressFormat::json;
+    } else if (text == "none") {
+        format = ProgressFormat::none;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string format_progress(const ProgressSample &sample, const ProgressTotals &totals, ProgressFormat format,
+                            bool done) {
+    char text[320];
+    if (format == ProgressFormat::json) {
+        std::snprintf(text, sizeof(text),
+                      "{\"elapsed_ms\":%.0f,\"erased\":%llu,\"erase_total\":%llu,\"written\":%llu,"
+                      "\"write_total\":%llu,\"commands\":%u,\"command_total\":%u,\"percent\":%.1f,"
+                      "\"bytes_per_s\":%.0f,\"eta_ms\":%.0f,\"done\":%s}\n",
+                      sample.elapsed_s * 1000.0, static_cast<unsigned long long>(sample.erased),
+                      static_cast<unsigned long long>(totals.erase_bytes),
+                      static_cast<unsigned long long>(sample.written),
+                      static_cast<unsigned long long>(totals.write_bytes), sample.commands, totals.commands,
+                      sample.fraction * 100.0, sample.bytes_per_s, done ? 0.0 : sample.eta_s * 1000.0, done ? "true" : "false");
+        return text;
+    }
+
+    int filled = static_cast<int>(sample.fraction * kBarWidth);
+    std::string bar = std::string(filled, '#') + std::string(kBarWidth - filled, '-');
+    std::string when = done ? "in " + format_duration(sample.elapsed_s) : "ETA " + format_duration(sample.eta_s);
+    std::string erase;
+    if (totals.erase_bytes != 0) {
+        char part[64];
+        std::snprintf(part, sizeof(part), "  erase %.1f/%.1f MiB", sample.erased / kMiB, totals.erase_bytes / kMiB);
+        erase = part;
+    }
+    // Carriage return and erase-to-end-of-line redraw the bar in place.
+    std::snprintf(text, sizeof(text), "\r[%s] %3.0f%%%s  write %.1f/%.1f MiB  %s  %s\x1b[K%s", bar.c_str(),
+                  sample.fraction * 100.0, erase.c_str(), sample.written / kMiB, totals.write_bytes / kMiB,
+                  format_rate(sample.bytes_per_s).c_str(), when.c_str(), done ? "\n" : "");
+    return text;
+}
+
+ProgressReporter::ProgressReporter(const LoadCounters &counters, const ProgressTotals &totals, ProgressFormat format,
+                                   FILE *out, uint32_t interval_ms)
+    : counters_(counters), totals_(totals), format_(format), out_(out), interval_ms_(std::max(interval_ms, 1u)),
+      estimator_(totals), start_(std::chrono::steady_clock::now()) {
+    if (format_ != ProgressFormat::none) {
+        thread_ = std::thread([this] { run(); });
+    }
+}
+
+ProgressReporter::~ProgressReporter() {
+    stop();
+}
+
+void ProgressReporter::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+}
+
+void ProgressReporter::run() {
+    lower_thread_priority();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!wake_.wait_for(lock, std::chrono::milliseconds(interval_ms_), [this] { return stopping_; })) {
+        render(false);
+    }
+    render(true);
+}
+
+void ProgressReporter::render(bool done) {
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    ProgressSample sample =
+        estimator_.update(elapsed_s, counters_.erased.load(std::memory_order_relaxed),
+                          counters_.written.load(std::memory_order_relaxed),
+                          counters_.commands.load(std::memory_order_relaxed));
+    std::string line = format_progress(sample, totals_, format_, done);
+    std::fputs(line.c_str(), out_);
+    std::fflush(out_);
+}
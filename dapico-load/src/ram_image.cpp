@@ -0,0 +1,123 @@
+#include "ram_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "format_util.h"
+
+namespace {
+bool run_has_block_marker(const RamImageRun &run, const Range &search) {
+    uint32_t begin = std::max(run.addr, search.start);
+    uint32_t end = std::min(run.addr + static_cast<uint32_t>(run.data.size()), search.end);
+    for (uint32_t addr = align_up(begin, 4); addr + 4 <= end; addr += 4) {
+        uint32_t word = 0;
+        std::memcpy(&word, run.data.data() + (addr - run.addr), sizeof(word));
+        if (word == kPicobinBlockMarkerStart) {
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+uint32_t RamImage::write_count() const {
+    uint32_t writes = 0;
+    for (const auto &run : runs) {
+        writes += static_cast<uint32_t>((run.data.size() + kRamImageWriteSize - 1) / kRamImageWriteSize);
+    }
+    return writes;
+}
+
+RamImage pack_ram_image(const std::vector<ImageSegment> &segments, const MemoryLayout &layout) {
+    RamImage image;
+    std::vector<Range> covered;
+    for (const auto &segment : segments) {
+        if (segment.size == 0) {
+            continue;
+        }
+        if (segment.addr < kSramStart || segment.addr > layout.sram_end ||
+            segment.size > layout.sram_end - segment.addr) {
+            throw std::runtime_error("Segment at " + hex32(segment.addr) + " (" + std::to_string(segment.size) +
+                                     " bytes) is not in SRAM; RAM images must be linked to run from SRAM");
+        }
+        covered.push_back(Range{segment.addr, segment.addr + segment.size});
+        image.segments++;
+    }
+    if (covered.empty()) {
+        throw std::runtime_error("The image has no loadable segments");
+    }
+    covered = merge_ranges(std::move(covered));
+
+    std::vector<Range> runs;
+    for (const auto &range : covered) {
+        image.bytes += range.end - range.start;
+        if (!runs.empty() && range.start - runs.back().end <= kRamImageGapFill) {
+            image.filled_bytes += range.start - runs.back().end;
+            runs.back().end = range.end;
+        } else {
+            runs.push_back(range);
+        }
+    }
+    for (const auto &range : runs) {
+        image.runs.push_back(RamImageRun{range.start, std::vector<uint8_t>(range.end - range.start, 0)});
+    }
+    // In image order, so later segments win where they overlap.
+    for (const auto &segment : segments) {
+        if (segment.size == 0) {
+            continue;
+        }
+        auto it = std::upper_bound(image.runs.begin(), image.runs.end(), segment.addr,
+                                   [](uint32_t addr, const RamImageRun &run) { return addr < run.addr; });
+        RamImageRun &run = *std::prev(it);
+        std::memcpy(run.data.data() + (segment.addr - run.addr), segment.data, segment.size);
+    }
+
+    image.region.start = align_down(runs.front().start, kFlashSectorSize);
+    image.region.end = std::min(align_up(runs.back().end, kFlashSectorSize), layout.sram_end);
+    Range search{image.region.start, image.region.start + kRamImageBlockSearch};
+    for (const auto &run : image.runs) {
+        image.has_block = image.has_block || run_has_block_marker(run, search);
+    }
+    return image;
+}
+
+TransportResult boot_ram_image(PicobootTransport &transport, const RamImage &image, const LoadProgress &progress) {
+    TransportResult ret = transport.reset_interface();
+    if (ret != kTransportOk) {
+        std::cerr << "Warning: reset interface failed (IOKit error " << ret << ").\n";
+    }
+    ExclusiveAccess exclusive(transport, EXCLUSIVE);
+
+    uint64_t total = 0;
+    for (const auto &run : image.runs) {
+        total += run.data.size();
+    }
+    uint64_t done = 0;
+    for (const auto &run : image.runs) {
+        for (size_t offset = 0; offset < run.data.size(); offset += kRamImageWriteSize) {
+            uint32_t addr = run.addr + static_cast<uint32_t>(offset);
+            uint32_t size = static_cast<uint32_t>(std::min<size_t>(kRamImageWriteSize, run.data.size() - offset));
+            ret = picoboot_write(transport, addr, run.data.data() + offset, size);
+            if (ret != kTransportOk) {
+                std::cerr << "RAM write failed at 0x" << std::hex << addr << " (IOKit error " << std::dec << ret
+                          << ").\n";
+                return ret;
+            }
+            done += size;
+            if (progress) {
+                progress(LoadPhase::ram, done, total);
+            }
+        }
+    }
+
+    ret = picoboot_reboot2(transport, REBOOT2_FLAG_REBOOT_TYPE_RAM_IMAGE, kRamImageRebootDelayMs, image.region.start,
+                           image.region.end - image.region.start);
+    if (ret != kTransportOk) {
+        std::cerr << "RAM image reboot failed (IOKit error " << ret << ").\n";
+    } else {
+        exclusive.dismiss();
+    }
+    return ret;
+}
@@ -0,0 +1,35 @@
+#include "reboot.h"
+
+#include "load_plan.h"
+#include "pico/usb_reset_interface.h"
+
+TransportResult reboot_device(const RebootTarget &target, bool bootsel, bool picoboot_only, RebootOutcome &outcome) {
+    if (bootsel) {
+        if (target.reset) {
+            outcome = RebootOutcome::bootsel_requested;
+            return target.reset->reset_request(RESET_REQUEST_BOOTSEL, picoboot_only ? kResetBootselDisableMsd : 0);
+        }
+        if (target.picoboot && picoboot_only && target.product_id == kProductIdRp2350UsbBoot) {
+            outcome = RebootOutcome::bootsel_reentered;
+            // The flags go in param0 and the activity GPIO in param1, as the
+            // SDK's rom_reset_usb_boot_extra passes them.
+            return picoboot_reboot2(*target.picoboot, REBOOT2_FLAG_REBOOT_TYPE_BOOTSEL, kBootselRebootDelayMs,
+                                    BOOTSEL_FLAG_DISABLE_MSD_INTERFACE, 0);
+        }
+        if (target.picoboot) {
+            outcome = RebootOutcome::already_in_bootsel;
+            return kTransportOk;
+        }
+    } else {
+        if (target.picoboot) {
+            outcome = RebootOutcome::sent;
+            return picoboot_reboot(*target.picoboot, target.product_id, kRebootDelayMs);
+        }
+        if (target.reset) {
+            outcome = RebootOutcome::sent;
+            return target.reset->reset_request(RESET_REQUEST_FLASH, 0);
+        }
+    }
+    outcome = RebootOutcome::no_interface;
+    return kTransportError;
+}
@@ -0,0 +1,265 @@
+#include "session_script.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include "format_util.h"
+#include "loader.h"
+
+namespace {
+constexpr uint32_t kScriptReadChunkSize = kFlashSectorSize;
+constexpr uint32_t kDefaultRebootDelayMs = 500;
+constexpr uint32_t kDefaultReconnectTimeoutMs = 10000;
+
+[[noreturn]] void script_error(uint32_t line, const std::string &what) {
+    throw std::runtime_error("Script line " + std::to_string(line) + ": " + what);
+}
+
+uint32_t parse_number(const std::string &text, uint32_t line, const char *what) {
+    char *end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0' || value > UINT32_MAX) {
+        script_error(line, std::string("invalid ") + what + " '" + text + "'");
+    }
+    return static_cast<uint32_t>(value);
+}
+
+std::vector<uint8_t> read_whole_file(const std::string &filename, uint32_t line) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        script_error(line, "failed to open " + filename);
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.empty()) {
+        script_error(line, filename + " is empty");
+    }
+    return data;
+}
+
+class ScriptRunner {
+public:
+    ScriptRunner(PicobootTransport &transport, const ScriptEnvironment &env) : device_(&transport), env_(env) {}
+
+    // Returns false on failure, with the reason already printed.
+    bool run(const ScriptStep &step, std::string &detail) {
+        switch (step.op) {
+        case ScriptOp::erase:
+            return exit_xip() && check(picoboot_flash_erase(*device_, step.addr, step.size), "erase", step.addr);
+        case ScriptOp::write:
+            return write(step.addr, step.data);
+        case ScriptOp::read:
+            return read(step.addr, step.size, step.filename);
+        case ScriptOp::load: {
+            LoadOptions options;
+            options.exec_after = false;
+            xip_exited_ = xip_exited_ || !step.plan.flash_extents.empty();
+            return load_plan_to_device(*device_, step.plan, options) == kTransportOk;
+        }
+        case ScriptOp::exec:
+            return check(picoboot_exec(*device_, step.addr), "exec", step.addr);
+        case ScriptOp::reboot:
+            return check(picoboot_reboot(*device_, env_.product_id, step.size), "reboot", 0);
+        case ScriptOp::status:
+            return status(detail);
+        case ScriptOp::wait_ms:
+            env_.sleep_ms(step.size);
+            return true;
+        case ScriptOp::wait_device:
+            device_ = env_.reconnect(step.size);
+            xip_exited_ = false;
+            if (!device_) {
+                std::cerr << "Device did not return to BOOTSEL within " << step.size << " ms.\n";
+                return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    bool check(TransportResult ret, const char *what, uint32_t addr) {
+        if (ret != kTransportOk) {
+            std::cerr << "Step failed: " << what << " at " << hex32(addr) << " (IOKit error " << ret << ").\n";
+        }
+        return ret == kTransportOk;
+    }
+
+    bool exit_xip() {
+        if (!xip_exited_) {
+            if (!check(picoboot_exit_xip(*device_), "exit XIP", 0)) {
+                return false;
+            }
+            xip_exited_ = true;
+        }
+        return true;
+    }
+
+    bool write(uint32_t addr, const std::vector<uint8_t> &data) {
+        uint32_t size = static_cast<uint32_t>(data.size());
+        if (addr < kSramStart) {
+            // Flash programs whole pages; padding with 0xff leaves the rest erased.
+            if (!exit_xip()) {
+                return false;
+            }
+            uint32_t start = align_down(addr, kFlashPageSize);
+            std::vector<uint8_t> pages(align_up(addr + size, kFlashPageSize) - start, 0xff);
+            std::copy(data.begin(), data.end(), pages.begin() + (addr - start));
+            for (uint32_t offset = 0; offset < pages.size(); offset += kFlashPageSize) {
+                if (!check(picoboot_write(*device_, start + offset, pages.data() + offset, kFlashPageSize), "write",
+                           start + offset)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        for (uint32_t offset = 0; offset < size; offset += kRamWriteChunkSize) {
+            uint32_t chunk = std::min(kRamWriteChunkSize, size - offset);
+            if (!check(picoboot_write(*device_, addr + offset, data.data() + offset, chunk), "write", addr + offset)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool read(uint32_t addr, uint32_t size, const std::string &filename) {
+        if (addr < kSramStart && !exit_xip()) {
+            return false;
+        }
+        std::vector<uint8_t> data(size);
+        for (uint32_t offset = 0; offset < size; offset += kScriptReadChunkSize) {
+            uint32_t chunk = std::min(kScriptReadChunkSize, size - offset);
+            if (!check(picoboot_read(*device_, addr + offset, data.data() + offset, chunk), "read", addr + offset)) {
+                return false;
+            }
+        }
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()))) {
+            std::cerr << "Failed to write " << filename << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool status(std::string &detail) {
+        picoboot_cmd_status status{};
+        if (!check(device_->get_cmd_status(status), "status", 0)) {
+            return false;
+        }
+        std::ostringstream out;
+        out << "token " << status.dToken << ", cmd 0x" << std::hex << static_cast<unsigned>(status.bCmdId) << ", ";
+        if (const char *name = picoboot_status_name(status.dStatusCode)) {
+            out << name;
+        } else {
+            out << "status " << std::dec << status.dStatusCode;
+        }
+        detail = out.str();
+        return true;
+    }
+
+    PicobootTransport *device_;
+    const ScriptEnvironment &env_;
+    bool xip_exited_ = false;
+};
+} // namespace
+
+std::vector<ScriptStep> parse_script(std::istream &input, uint16_t product_id) {
+    MemoryLayout layout = memory_layout_for_product(product_id);
+    std::vector<ScriptStep> steps;
+    std::string text;
+    for (uint32_t line = 1; std::getline(input, text); ++line) {
+        text = text.substr(0, text.find('#'));
+        std::istringstream words(text);
+        std::vector<std::string> args;
+        for (std::string word; words >> word;) {
+            args.push_back(word);
+        }
+        if (args.empty()) {
+            continue;
+        }
+
+        ScriptStep step{};
+        step.line = line;
+        for (const auto &arg : args) {
+            step.text += (step.text.empty() ? "" : " ") + arg;
+        }
+        const std::string &command = args[0];
+        size_t argc = args.size() - 1;
+        if (command == "erase" && argc == 2) {
+            step.op = ScriptOp::erase;
+            step.addr = parse_number(args[1], line, "address");
+            step.size = parse_number(args[2], line, "size");
+            if (step.addr % kFlashSectorSize != 0 || step.size % kFlashSectorSize != 0 || step.size == 0) {
+                script_error(line, "erase range must be whole 4 KiB sectors");
+            }
+        } else if (command == "write" && argc == 2) {
+            step.op = ScriptOp::write;
+            step.addr = parse_number(args[1], line, "address");
+            step.data = read_whole_file(args[2], line);
+        } else if (command == "read" && argc == 3) {
+            step.op = ScriptOp::read;
+            step.addr = parse_number(args[1], line, "address");
+            step.size = parse_number(args[2], line, "size");
+            step.filename = args[3];
+        } else if (command == "load" && argc == 1) {
+            step.op = ScriptOp::load;
+            try {
+                step.image = open_load_image(args[1], product_id);
+                step.plan = build_load_plan(step.image.segments, step.image.entry_point, layout, true);
+            } catch (const std::runtime_error &err) {
+                script_error(line, err.what());
+            }
+        } else if (command == "exec" && argc == 1) {
+            step.op = ScriptOp::exec;
+            step.addr = parse_number(args[1], line, "address");
+        } else if (command == "reboot" && argc <= 1) {
+            step.op = ScriptOp::reboot;
+            step.size = argc == 1 ? parse_number(args[1], line, "delay") : kDefaultRebootDelayMs;
+        } else if (command == "status" && argc == 0) {
+            step.op = ScriptOp::status;
+        } else if (command == "wait" && argc >= 1 && args[1] == "device" && argc <= 2) {
+            step.op = ScriptOp::wait_device;
+            step.size = argc == 2 ? parse_number(args[2], line, "timeout") : kDefaultReconnectTimeoutMs;
+        } else if (command == "wait" && argc == 1) {
+            step.op = ScriptOp::wait_ms;
+            step.size = parse_number(args[1], line, "wait time");
+        } else {
+            script_error(line, "unknown or malformed command '" + step.text + "'");
+        }
+        steps.push_back(std::move(step));
+    }
+    if (steps.empty()) {
+        throw std::runtime_error("Script has no commands");
+    }
+    return steps;
+}
+
+int run_script(PicobootTransport &transport, const std::vector<ScriptStep> &steps, const ScriptEnvironment &env) {
+    TransportResult ret = transport.reset_interface();
+    if (ret != kTransportOk) {
+        std::cerr << "Warning: reset interface failed (IOKit error " << ret << ").\n";
+    }
+
+    ScriptRunner runner(transport, env);
+    double session_start = env.now_us();
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const ScriptStep &step = steps[i];
+        std::string detail;
+        double start = env.now_us();
+        bool ok = runner.run(step, detail);
+        double ms = (env.now_us() - start) / 1000.0;
+        std::printf("%3zu  %-44s %10.1f ms%s%s\n", i + 1, step.text.c_str(), ms, detail.empty() ? "" : "  ",
+                    detail.c_str());
+        if (!ok) {
+            std::fprintf(stderr, "Script stopped at line %u.\n", step.line);
+            return 1;
+        }
+    }
+    std::printf("Script: %zu steps in %.1f ms.\n", steps.size(), (env.now_us() - session_start) / 1000.0);
+    return 0;
+}
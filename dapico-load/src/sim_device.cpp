@@ -0,0 +1,448 @@
+#include "sim_device.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include "otp.h"
+
+namespace {
+constexpr uint32_t kFlashBlockSize = 65536;
+
+bool range_within(uint32_t addr, uint32_t size, uint32_t start, uint32_t end) {
+    return addr >= start && addr <= end && size <= end - addr;
+}
+} // namespace
+
+SimDeviceProfile sim_profile_rp2040() {
+    SimDeviceProfile profile;
+    profile.name = "rp2040";
+    profile.product_id = kProductIdRp2040UsbBoot;
+    profile.layout = MemoryLayout{kFlashEndRp2040, kSramEndRp2040};
+    return profile;
+}
+
+SimDeviceProfile sim_profile_rp2350() {
+    SimDeviceProfile profile;
+    profile.name = "rp2350";
+    profile.product_id = kProductIdRp2350UsbBoot;
+    profile.layout = MemoryLayout{kFlashEndRp2350, kSramEndRp2350};
+    profile.flash.command_us = 15.0;
+    profile.flash.exit_xip_us = 30.0;
+    profile.flash.ram_write_us_per_kib = 1.0;
+    // Two 2 MiB slots after the 64 KiB block holding the partition table, so
+    // the slots can use block erases.
+    profile.partition_table.present = true;
+    profile.partition_table.partitions = {make_partition(0x10000, 0x200000),
+                                          make_partition(0x210000, 0x200000, 0)};
+    return profile;
+}
+
+SimDeviceProfile sim_profile_for_product(uint16_t product_id) {
+    return product_id == kProductIdRp2040UsbBoot ? sim_profile_rp2040() : sim_profile_rp2350();
+}
+
+SimulatedDevice::SimulatedDevice(SimDeviceProfile profile)
+    : profile_(std::move(profile)), sram_(profile_.layout.sram_end - kSramStart, 0),
+      next_msd_us_(profile_.mass_storage.interval_us) {
+    if (profile_.product_id != kProductIdRp2040UsbBoot) {
+        otp_.assign(kOtpRowCount, 0);
+    }
+}
+
+TransportResult SimulatedDevice::reset_interface() {
+    stats_.control_requests++;
+    stats_.elapsed_us += profile_.link.control_request_us;
+    halted_ = false;
+    return kTransportOk;
+}
+
+TransportResult SimulatedDevice::get_cmd_status(picoboot_cmd_status &status) {
+    stats_.control_requests++;
+    stats_.elapsed_us += profile_.link.control_request_us;
+    status = last_status_;
+    return kTransportOk;
+}
+
+TransportResult SimulatedDevice::transfer(const picoboot_cmd &cmd, uint8_t *buffer) {
+    serve_mass_storage();
+    stats_.elapsed_us += bulk_us(sizeof(cmd));
+    stats_.bytes_out += sizeof(cmd);
+    if (executed_ || rebooted_) {
+        return kTransportNoDevice;
+    }
+    if (halted_) {
+        return kTransportStalled;
+    }
+    stats_.commands++;
+    stats_.by_command[cmd.bCmdId]++;
+
+    if (cmd.dTransferLength != 0) {
+        double data_us = data_phase_us(cmd.dTransferLength, (cmd.bCmdId & 0x80u) != 0);
+        double timeout_us = timeouts_.data_ms(cmd.dTransferLength) * 1000.0;
+        if (data_us > timeout_us) {
+            // The host gives up mid-transfer; the endpoints need a reset.
+            stats_.elapsed_us += timeout_us;
+            stats_.failed_commands++;
+            halted_ = true;
+            return kTransportTimeout;
+        }
+        stats_.elapsed_us += data_us;
+        if (cmd.bCmdId & 0x80u) {
+            stats_.bytes_in += cmd.dTransferLength;
+        } else {
+            stats_.bytes_out += cmd.dTransferLength;
+        }
+    }
+
+    stats_.elapsed_us += profile_.flash.command_us;
+    uint32_t status =
+        cmd.dMagic == PICOBOOT_MAGIC ? execute(cmd, buffer) : static_cast<uint32_t>(PICOBOOT_INVALID_CMD_LENGTH);
+    last_status_ = picoboot_cmd_status{};
+    last_status_.dToken = cmd.dToken;
+    last_status_.dStatusCode = status;
+    last_status_.bCmdId = cmd.bCmdId;
+    if (status != PICOBOOT_OK) {
+        stats_.failed_commands++;
+        halted_ = true;
+        return kTransportStalled;
+    }
+
+    stats_.elapsed_us += bulk_us(0);
+    return kTransportOk;
+}
+
+void SimulatedDevice::reconnect() {
+    executed_ = false;
+    rebooted_ = false;
+    halted_ = false;
+    xip_exited_ = false;
+    exclusive_ = NOT_EXCLUSIVE;
+}
+
+void SimulatedDevice::serve_mass_storage() {
+    const MassStorageTraffic &msd = profile_.mass_storage;
+    if (msd.interval_us <= 0 || stats_.elapsed_us < next_msd_us_ || exclusive_ == EXCLUSIVE_AND_EJECT) {
+        return;
+    }
+    if (exclusive_ == EXCLUSIVE) {
+        stats_.msd_refused++;
+        stats_.elapsed_us += bulk_us(0);
+    } else {
+        stats_.msd_accesses++;
+        stats_.elapsed_us += bulk_us(msd.read_bytes);
+        msd_random_ = msd_random_ * 1664525u + 1013904223u;
+        if (msd.write_every != 0 && (msd_random_ >> 8) % msd.write_every == 0) {
+            interleaved_ = true;
+        }
+    }
+    // The host waits out the interval after each access rather than queueing.
+    next_msd_us_ = stats_.elapsed_us + msd.interval_us;
+}
+
+bool SimulatedDevice::read_memory(uint32_t addr, uint8_t *out, uint32_t size) const {
+    if (range_within(addr, size, kSramStart, profile_.layout.sram_end)) {
+        std::memcpy(out, sram_.data() + (addr - kSramStart), size);
+        return true;
+    }
+    if (!range_within(addr, size, kFlashStart, profile_.layout.flash_end)) {
+        return false;
+    }
+    while (size > 0) {
+        uint32_t sector_addr = align_down(addr, kFlashSectorSize);
+        uint32_t offset = addr - sector_addr;
+        uint32_t chunk = std::min(size, kFlashSectorSize - offset);
+        auto it = flash_sectors_.find(sector_addr);
+        if (it == flash_sectors_.end()) {
+            std::memset(out, 0xff, chunk);
+        } else {
+            std::memcpy(out, it->second.data() + offset, chunk);
+        }
+        out += chunk;
+        addr += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+double SimulatedDevice::bulk_us(uint32_t bytes) const {
+    const UsbLinkModel &link = profile_.link;
+    uint32_t packets = std::max<uint32_t>(1, (bytes + link.max_packet_size - 1) / link.max_packet_size);
+    return link.transfer_turnaround_us + packets * link.packet_us;
+}
+
+double SimulatedDevice::data_phase_us(uint32_t bytes, bool in) const {
+    const std::vector<BandwidthPoint> &curve = in ? profile_.link.in_curve : profile_.link.out_curve;
+    if (curve.empty()) {
+        return bulk_us(bytes);
+    }
+    double kib_per_s = curve.front().kib_per_s;
+    if (bytes >= curve.back().bytes) {
+        kib_per_s = curve.back().kib_per_s;
+    } else {
+        for (size_t i = 1; i < curve.size(); ++i) {
+            if (bytes < curve[i].bytes) {
+                const BandwidthPoint &lo = curve[i - 1];
+                const BandwidthPoint &hi = curve[i];
+                double t = bytes <= lo.bytes ? 0.0
+                                             : std::log2(static_cast<double>(bytes) / lo.bytes) /
+                                                   std::log2(static_cast<double>(hi.bytes) / lo.bytes);
+                kib_per_s = lo.kib_per_s + t * (hi.kib_per_s - lo.kib_per_s);
+                break;
+            }
+        }
+    }
+    return profile_.link.transfer_turnaround_us + bytes / 1024.0 / kib_per_s * 1e6;
+}
+
+uint32_t SimulatedDevice::execute(const picoboot_cmd &cmd, uint8_t *buffer) {
+    switch (cmd.bCmdId) {
+    case PC_EXIT_XIP:
+        xip_exited_ = true;
+        stats_.elapsed_us += profile_.flash.exit_xip_us;
+        return PICOBOOT_OK;
+    case PC_ENTER_CMD_XIP:
+        xip_exited_ = false;
+        return PICOBOOT_OK;
+    case PC_EXCLUSIVE_ACCESS:
+        if (cmd.bCmdSize != sizeof(cmd.exclusive_cmd)) {
+            return PICOBOOT_INVALID_CMD_LENGTH;
+        }
+        if (cmd.exclusive_cmd.bExclusive > EXCLUSIVE_AND_EJECT) {
+            return PICOBOOT_INVALID_ARG;
+        }
+        exclusive_ = static_cast<picoboot_exclusive_type>(cmd.exclusive_cmd.bExclusive);
+        return PICOBOOT_OK;
+    case PC_FLASH_ERASE:
+        if (cmd.bCmdSize != sizeof(cmd.range_cmd)) {
+            return PICOBOOT_INVALID_CMD_LENGTH;
+        }
+        if (interleaved_) {
+            interleaved_ = false;
+            return PICOBOOT_INTERLEAVED_WRITE;
+        }
+        return erase_flash(cmd.range_cmd.dAddr, cmd.range_cmd.dSize);
+    case PC_WRITE:
+        if (cmd.bCmdSize != sizeof(cmd.range_cmd)) {
+            return PICOBOOT_INVALID_CMD_LENGTH;
+        }
+        if (cmd.dTransferLength != cmd.range_cmd.dSize) {
+            return PICOBOOT_INVALID_TRANSFER_LENGTH;
+        }
+        return write_memory(cmd.range_cmd.dAddr, buffer, cmd.range_cmd.dSize);
+    case PC_READ:
+        if (cmd.bCmdSize != sizeof(cmd.range_cmd)) {
+            return PICOBOOT_INVALID_CMD_LENGTH;
+        }
+        if (cmd.dTransferLength != cmd.range_cmd.dSize) {
+            return PICOBOOT_INVALID_TRANSFER_LENGTH;
+        }
+        return read_memory(cmd.range_cmd.dAddr, buffer, cmd.range_cmd.dSize) ? PICOBOOT_OK
+                                                                              : PICOBOOT_INVALID_ADDRESS;
+    case PC_EXEC:
+        if (cmd.bCmdSize != sizeof(cmd.address_only_cmd)) {
+            return PICOBOOT_INVALID_CMD_LENGTH;
+        }
+        executed_ = true;
+        exec_address_ = cmd.address_only_cmd.dAddr;
+        return PICOBOOT_OK;
+    case PC_REBOOT:
+        if (cmd.bCmdSize != sizeof(cmd.reboot_cmd)) {
+            return PICOBOOT_INVALID_CMD_LENGTH;
+        }
+        rebooted_ = true;
+        return PICOBOOT_OK;
+    case PC_REBOOT2:
+        if (profile_.product_id == kProductIdRp2040UsbBoot) {
+            return PICOBOOT_UNKNOWN_CMD;
+        }
+        if (cmd.bCmdSize != sizeof(cmd.reboot2_cmd)) {
+            return PICOBOOT_INVALID_CMD_LENGTH;
+        }
+        if ((cmd.reboot2_cmd.dFlags & REBOOT2_TYPE_MASK) == REBOOT2_FLAG_REBOOT_TYPE_RAM_IMAGE &&
+            !range_within(cmd.reboot2_cmd.dParam0, cmd.reboot2_cmd.dParam1, kSramStart, profile_.layout.sram_end)) {
+            return PICOBOOT_INVALID_ADDRESS;
+        }
+        reboot_flags_ = cmd.reboot2_cmd.dFlags;
+        reboot_param0_ = cmd.reboot2_cmd.dParam0;
+        reboot_param1_ = cmd.reboot2_cmd.dParam1;
+        if ((reboot_flags_ & REBOOT2_TYPE_MASK) == REBOOT2_FLAG_REBOOT_TYPE_FLASH_UPDATE) {
+            const auto &partitions = profile_.partition_table.partitions;
+            for (size_t i = 0; i < partitions.size(); ++i) {
+                if (partitions[i].start() == reboot_param0_ &&
+                    profile_.partition_table.ab_partner(static_cast<int>(i)) >= 0) {
+                    booted_partition_ = static_cast<int>(i);
+                }
+            }
+        }
+        rebooted_ = true;
+        return PICOBOOT_OK;
+    case PC_GET_INFO:
+        if (profile_.product_id == kProductIdRp2040UsbBoot) {
+            return PICOBOOT_UNKNOWN_CMD;
+        }
+        if (cmd.bCmdSize != sizeof(cmd.get_info_cmd)) {
+            return PICOBOOT_INVALID_CMD_LENGTH;
+        }
+        return get_info(cmd, buffer);
+    case PC_OTP_READ:
+    case PC_OTP_WRITE:
+        if (otp_.empty()) {
+            return PICOBOOT_UNKNOWN_CMD;
+        }
+        if (cmd.bCmdSize != sizeof(cmd.otp_cmd)) {
+            return PICOBOOT_INVALID_CMD_LENGTH;
+        }
+        return otp_access(cmd, buffer);
+    default:
+        return PICOBOOT_UNKNOWN_CMD;
+    }
+}
+
+uint32_t SimulatedDevice::erase_flash(uint32_t addr, uint32_t size) {
+    if (addr % kFlashSectorSize != 0 || size % kFlashSectorSize != 0) {
+        return PICOBOOT_BAD_ALIGNMENT;
+    }
+    if (!range_within(addr, size, kFlashStart, profile_.layout.flash_end)) {
+        return PICOBOOT_INVALID_ADDRESS;
+    }
+    uint32_t end = addr + size;
+    while (addr < end) {
+        uint32_t step = kFlashSectorSize;
+        if (addr % kFlashBlockSize == 0 && end - addr >= kFlashBlockSize) {
+            step = kFlashBlockSize;
+            stats_.elapsed_us += profile_.flash.block_erase_us;
+        } else {
+            stats_.elapsed_us += profile_.flash.sector_erase_us;
+        }
+        for (uint32_t sector = addr; sector < addr + step; sector += kFlashSectorSize) {
+            flash_sectors_.erase(sector);
+        }
+        addr += step;
+    }
+    return PICOBOOT_OK;
+}
+
+uint32_t SimulatedDevice::write_memory(uint32_t addr, const uint8_t *data, uint32_t size) {
+    if (range_within(addr, size, kSramStart, profile_.layout.sram_end)) {
+        std::memcpy(sram_.data() + (addr - kSramStart), data, size);
+        stats_.elapsed_us += profile_.flash.ram_write_us_per_kib * size / 1024.0;
+        return PICOBOOT_OK;
+    }
+    if (!range_within(addr, size, kFlashStart, profile_.layout.flash_end)) {
+        return PICOBOOT_INVALID_ADDRESS;
+    }
+    if (addr % kFlashPageSize != 0 || size % kFlashPageSize != 0) {
+        return PICOBOOT_BAD_ALIGNMENT;
+    }
+    if (interleaved_) {
+        interleaved_ = false;
+        return PICOBOOT_INTERLEAVED_WRITE;
+    }
+    for (uint32_t offset = 0; offset < size; offset += kFlashPageSize) {
+        uint32_t page_addr = addr + offset;
+        uint8_t *sector = flash_sector(align_down(page_addr, kFlashSectorSize));
+        uint8_t *page = sector + (page_addr % kFlashSectorSize);
+        // NOR programming can only clear bits.
+        for (uint32_t i = 0; i < kFlashPageSize; ++i) {
+            page[i] &= data[offset + i];
+        }
+        stats_.elapsed_us += profile_.flash.page_program_us;
+    }
+    return PICOBOOT_OK;
+}
+
+uint8_t *SimulatedDevice::flash_sector(uint32_t sector_addr) {
+    auto &sector = flash_sectors_[sector_addr];
+    if (sector.empty()) {
+        sector.assign(kFlashSectorSize, 0xff);
+    }
+    return sector.data();
+}
+
+uint32_t SimulatedDevice::otp_access(const picoboot_cmd &cmd, uint8_t *buffer) {
+    const picoboot_otp_cmd &otp = cmd.otp_cmd;
+    bool ecc = otp.bEcc != 0;
+    uint32_t row_bytes = ecc ? 2 : 4;
+    if (cmd.dTransferLength != static_cast<uint32_t>(otp.wRowCount) * row_bytes) {
+        return PICOBOOT_INVALID_TRANSFER_LENGTH;
+    }
+    if (otp.wRow >= otp_.size() || otp.wRowCount > otp_.size() - otp.wRow) {
+        return PICOBOOT_INVALID_ADDRESS;
+    }
+    bool write = cmd.bCmdId == PC_OTP_WRITE;
+    // Validate every row first so a rejected write leaves the array untouched.
+    std::vector<uint32_t> rows(otp.wRowCount);
+    for (uint32_t i = 0; i < otp.wRowCount; ++i) {
+        uint32_t &current = otp_[otp.wRow + i];
+        uint8_t *bytes = buffer + i * row_bytes;
+        if (!write) {
+            uint32_t value = current;
+            if (ecc) {
+                uint16_t data = 0;
+                if (otp_ecc_decode(current, data) == OtpEccStatus::uncorrectable) {
+                    return PICOBOOT_INVALID_DATA;
+                }
+                value = data;
+            }
+            for (uint32_t b = 0; b < row_bytes; ++b) {
+                bytes[b] = static_cast<uint8_t>(value >> (8 * b));
+            }
+            continue;
+        }
+        uint32_t value = bytes[0] | bytes[1] << 8;
+        if (ecc) {
+            if (!otp_ecc_program_value(current, static_cast<uint16_t>(value), value)) {
+                return PICOBOOT_UNSUPPORTED_MODIFICATION;
+            }
+        } else {
+            value |= static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+            if (value > kOtpRowMask) {
+                return PICOBOOT_INVALID_ARG;
+            }
+            // Programming only sets bits.
+            if ((current & ~value) != 0) {
+                return PICOBOOT_UNSUPPORTED_MODIFICATION;
+            }
+        }
+        rows[i] = value;
+    }
+    if (write) {
+        std::copy(rows.begin(), rows.end(), otp_.begin() + otp.wRow);
+        stats_.elapsed_us += profile_.flash.otp_program_us_per_row * otp.wRowCount;
+    } else {
+        stats_.elapsed_us += profile_.flash.otp_read_us_per_row * otp.wRowCount;
+    }
+    return PICOBOOT_OK;
+}
+
+uint32_t SimulatedDevice::get_info(const picoboot_cmd &cmd, uint8_t *buffer) {
+    const PartitionTable &table = profile_.partition_table;
+    std::vector<uint32_t> words;
+    switch (cmd.get_info_cmd.bType) {
+    case PICOBOOT_GET_INFO_PARTTION_TABLE:
+        if (cmd.get_info_cmd.dParams[0] != (kPtInfoPtInfo | kPtInfoLocationAndFlags)) {
+            return PICOBOOT_INVALID_ARG;
+        }
+        words = partition_table_info_words(table);
+        break;
+    case PICOBOOT_GET_INFO_UF2_TARGET_PARTITION: {
+        int target = table.present ? table.ab_partner(booted_partition_) : -1;
+        words = {3, static_cast<uint32_t>(target), 0, 0};
+        if (target >= 0) {
+            words[2] = table.partitions[target].permissions_and_location;
+            words[3] = table.partitions[target].permissions_and_flags;
+        }
+        break;
+    }
+    default:
+        return PICOBOOT_INVALID_ARG;
+    }
+    if (words.size() * 4 > cmd.dTransferLength) {
+        return PICOBOOT_BUFFER_TOO_SMALL;
+    }
+    std::memset(buffer, 0, cmd.dTransferLength);
+    std::memcpy(buffer, words.data(), words.size() * 4);
+    return PICOBOOT_OK;
+}
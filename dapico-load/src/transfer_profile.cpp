@@ -0,0 +1,331 @@
+#include "transfer_profile.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+constexpr uint32_t kMaxChunkSize = 1024 * 1024;
+
+std::string trim(const std::string &value) {
+    size_t begin = value.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return {};
+    }
+    size_t end = value.find_last_not_of(" \t\r\n");
+    return value.substr(begin, end - begin + 1);
+}
+
+double median(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    size_t mid = samples.size() / 2;
+    return samples.size() % 2 ? samples[mid] : (samples[mid - 1] + samples[mid]) / 2;
+}
+
+// The smallest size whose throughput is within `plateau` of the best one.
+uint32_t plateau_size(const std::vector<SweepPoint> &points, double SweepPoint::*us, double plateau) {
+    double best = 0;
+    for (const auto &point : points) {
+        best = std::max(best, point.bytes / (point.*us));
+    }
+    for (const auto &point : points) {
+        if (point.bytes / (point.*us) >= plateau * best) {
+            return point.bytes;
+        }
+    }
+    return points.back().bytes;
+}
+
+TransferTimeouts fitted_timeouts(const LatencyFit &write, const LatencyFit &read, const AutotuneOptions &options) {
+    TransferTimeouts timeouts;
+    double fixed_ms = options.timeout_margin * std::max(write.fixed_us, read.fixed_us) / 1000.0;
+    timeouts.data_fixed_ms = std::max(options.min_timeout_ms, static_cast<uint32_t>(std::ceil(fixed_ms)));
+    timeouts.data_ms_per_kib = options.timeout_margin * std::max(write.us_per_byte, read.us_per_byte) * 1024 / 1000.0;
+    return timeouts;
+}
+
+uint32_t parse_chunk(const std::string &key, const std::string &text) {
+    char *end = nullptr;
+    unsigned long value = std::strtoul(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0' || value == 0 || value > kMaxChunkSize) {
+        throw std::runtime_error("Invalid " + key + ": " + text);
+    }
+    return static_cast<uint32_t>(value);
+}
+
+double parse_non_negative(const std::string &key, const std::string &text) {
+    char *end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0' || !(value >= 0)) {
+        throw std::runtime_error("Invalid " + key + ": " + text);
+    }
+    return value;
+}
+
+void apply_profile_entry(TransferProfile &profile, const std::string &key, const std::string &text) {
+    if (key == "ram_write_chunk") {
+        profile.ram_write_chunk = parse_chunk(key, text);
+    } else if (key == "flash_write_chunk") {
+        profile.flash_write_chunk = parse_chunk(key, text);
+        if (profile.flash_write_chunk % kFlashPageSize != 0) {
+            throw std::runtime_error("flash_write_chunk must be a multiple of " + std::to_string(kFlashPageSize));
+        }
+    } else if (key == "read_chunk") {
+        profile.read_chunk = parse_chunk(key, text);
+    } else if (key == "write_fixed_us") {
+        profile.write.fixed_us = parse_non_negative(key, text);
+    } else if (key == "write_us_per_kib") {
+        profile.write.us_per_byte = parse_non_negative(key, text) / 1024;
+    } else if (key == "read_fixed_us") {
+        profile.read.fixed_us = parse_non_negative(key, text);
+    } else if (key == "read_us_per_kib") {
+        profile.read.us_per_byte = parse_non_negative(key, text) / 1024;
+    } else if (key == "command_timeout_ms") {
+        profile.timeouts.command_ms = parse_chunk(key, text);
+    } else if (key == "data_timeout_ms") {
+        profile.timeouts.data_fixed_ms = parse_chunk(key, text);
+    } else if (key == "data_timeout_ms_per_kib") {
+        profile.timeouts.data_ms_per_kib = parse_non_negative(key, text);
+    } else {
+        throw std::runtime_error("Unknown profile key: " + key);
+    }
+}
+
+// "[0x0003 host]"
+TransferProfile parse_section(const std::string &line) {
+    std::istringstream header(line.substr(1, line.size() - 2));
+    std::string product;
+    TransferProfile profile;
+    char *end = nullptr;
+    unsigned long product_id = 0;
+    if (header >> product >> profile.host) {
+        product_id = std::strtoul(product.c_str(), &end, 16);
+    }
+    std::string rest;
+    if (!end || *end != '\0' || product_id == 0 || product_id > 0xffff || header >> rest) {
+        throw std::runtime_error("Expected [0xPID host]: " + line);
+    }
+    profile.product_id = static_cast<uint16_t>(product_id);
+    return profile;
+}
+
+void write_profile(std::ostream &out, const TransferProfile &profile) {
+    char product[8];
+    std::snprintf(product, sizeof(product), "0x%04x", profile.product_id);
+    out << "[" << product << " " << profile.host << "]\n"
+        << "ram_write_chunk = " << profile.ram_write_chunk << "\n"
+        << "flash_write_chunk = " << profile.flash_write_chunk << "\n"
+        << "read_chunk = " << profile.read_chunk << "\n"
+        << "write_fixed_us = " << profile.write.fixed_us << "\n"
+        << "write_us_per_kib = " << profile.write.us_per_byte * 1024 << "\n"
+        << "read_fixed_us = " << profile.read.fixed_us << "\n"
+        << "read_us_per_kib = " << profile.read.us_per_byte * 1024 << "\n"
+        << "command_timeout_ms = " << profile.timeouts.command_ms << "\n"
+        << "data_timeout_ms = " << profile.timeouts.data_fixed_ms << "\n"
+        << "data_timeout_ms_per_kib = " << profile.timeouts.data_ms_per_kib << "\n";
+}
+} // namespace
+
+LatencyFit fit_latency(const std::vector<uint32_t> &bytes, const std::vector<double> &us) {
+    LatencyFit fit;
+    size_t n = std::min(bytes.size(), us.size());
+    if (n == 0) {
+        return fit;
+    }
+    double mean_x = 0;
+    double mean_y = 0;
+    for (size_t i = 0; i < n; ++i) {
+        mean_x += bytes[i];
+        mean_y += us[i];
+    }
+    mean_x /= n;
+    mean_y /= n;
+    double sxx = 0;
+    double sxy = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sxx += (bytes[i] - mean_x) * (bytes[i] - mean_x);
+        sxy += (bytes[i] - mean_x) * (us[i] - mean_y);
+    }
+    fit.us_per_byte = sxx > 0 ? std::max(sxy / sxx, 0.0) : 0.0;
+    fit.fixed_us = std::max(mean_y - fit.us_per_byte * mean_x, 0.0);
+    return fit;
+}
+
+TransportResult autotune_transfers(PicobootTransport &transport, uint16_t product_id, const AutotuneOptions &options,
+                                   const std::function<double()> &now_us, AutotuneResult &result) {
+    result = AutotuneResult{};
+    std::vector<uint32_t> sizes = options.sizes;
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    MemoryLayout layout = memory_layout_for_product(product_id);
+    if (sizes.empty() || sizes.front() == 0 || options.repeats == 0 || options.scratch_addr < kSramStart ||
+        sizes.back() > layout.sram_end - options.scratch_addr) {
+        std::cerr << "Autotune sizes must be non-empty and fit in SRAM from 0x" << std::hex << options.scratch_addr
+                  << std::dec << ".\n";
+        return kTransportError;
+    }
+
+    TransportResult ret = transport.reset_interface();
+    if (ret != kTransportOk) {
+        std::cerr << "Warning: reset interface failed (IOKit error " << ret << ").\n";
+    }
+    ExclusiveAccess exclusive(transport, EXCLUSIVE);
+
+    std::vector<uint8_t> pattern(sizes.back());
+    uint32_t state = 0x2e8a;
+    for (auto &byte : pattern) {
+        state = state * 1664525u + 1013904223u;
+        byte = static_cast<uint8_t>(state >> 24);
+    }
+    std::vector<uint8_t> readback(sizes.back());
+    std::vector<uint32_t> fit_bytes;
+    std::vector<double> write_us;
+    std::vector<double> read_us;
+    for (uint32_t size : sizes) {
+        std::vector<double> writes;
+        std::vector<double> reads;
+        for (uint32_t i = 0; i < options.repeats; ++i) {
+            double start = now_us();
+            ret = picoboot_write(transport, options.scratch_addr, pattern.data(), size);
+            if (ret != kTransportOk) {
+                std::cerr << "Autotune write of " << size << " bytes failed (IOKit error " << ret << ").\n";
+                return ret;
+            }
+            double written = now_us();
+            ret = picoboot_read(transport, options.scratch_addr, readback.data(), size);
+            if (ret != kTransportOk) {
+                std::cerr << "Autotune read of " << size << " bytes failed (IOKit error " << ret << ").\n";
+                return ret;
+            }
+            writes.push_back(written - start);
+            reads.push_back(now_us() - written);
+            if (std::memcmp(pattern.data(), readback.data(), size) != 0) {
+                std::cerr << "Autotune read back " << size << " bytes that differ from what was written.\n";
+                return kTransportError;
+            }
+        }
+        result.points.push_back(SweepPoint{size, median(writes), median(reads)});
+        fit_bytes.push_back(size);
+        write_us.push_back(result.points.back().write_us);
+        read_us.push_back(result.points.back().read_us);
+    }
+
+    TransferProfile &profile = result.profile;
+    profile.product_id = product_id;
+    profile.write = fit_latency(fit_bytes, write_us);
+    profile.read = fit_latency(fit_bytes, read_us);
+    profile.ram_write_chunk = plateau_size(result.points, &SweepPoint::write_us, options.plateau);
+    profile.read_chunk = plateau_size(result.points, &SweepPoint::read_us, options.plateau);
+    // A flash write's ACK also waits for every page to program, so flash
+    // writes stop at a sector.
+    profile.flash_write_chunk =
+        std::min(std::max(profile.ram_write_chunk / kFlashPageSize, 1u) * kFlashPageSize, kFlashSectorSize);
+    profile.timeouts = fitted_timeouts(profile.write, profile.read, options);
+    return kTransportOk;
+}
+
+std::string transfer_profile_host() {
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0 || name[0] == '\0') {
+        return "unknown";
+    }
+    // Section headers are space-separated.
+    std::string host = name;
+    std::replace(host.begin(), host.end(), ' ', '_');
+    return host;
+}
+
+std::string default_transfer_profile_path() {
+    if (const char *path = std::getenv("DAPICO_PROFILES")) {
+        return path;
+    }
+    const char *home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.dapico-load-profiles";
+}
+
+std::vector<TransferProfile> read_transfer_profiles(const std::string &filename) {
+    std::vector<TransferProfile> profiles;
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        return profiles;
+    }
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        try {
+            if (line.front() == '[' && line.back() == ']') {
+                profiles.push_back(parse_section(line));
+                continue;
+            }
+            size_t eq = line.find('=');
+            if (eq == std::string::npos || profiles.empty()) {
+                throw std::runtime_error("Expected key = value in a [0xPID host] section: " + line);
+            }
+            apply_profile_entry(profiles.back(), trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+        } catch (const std::runtime_error &err) {
+            throw std::runtime_error(filename + ":" + std::to_string(line_number) + ": " + err.what());
+        }
+    }
+    return profiles;
+}
+
+void store_transfer_profile(const std::string &filename, const TransferProfile &profile) {
+    std::vector<TransferProfile> profiles = read_transfer_profiles(filename);
+    auto same = [&](const TransferProfile &other) {
+        return other.product_id == profile.product_id && other.host == profile.host;
+    };
+    profiles.erase(std::remove_if(profiles.begin(), profiles.end(), same), profiles.end());
+    profiles.push_back(profile);
+
+    std::string temp = filename + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Failed to create " + temp);
+        }
+        out << "# dapico-load transfer profiles, written by --autotune\n";
+        for (const auto &entry : profiles) {
+            out << "\n";
+            write_profile(out, entry);
+        }
+        if (!out.flush()) {
+            throw std::runtime_error("Failed to write " + temp);
+        }
+    }
+    if (std::rename(temp.c_str(), filename.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("Failed to replace " + filename);
+    }
+}
+
+const TransferProfile *find_transfer_profile(const std::vector<TransferProfile> &profiles, uint16_t product_id,
+                                             const std::string &host) {
+    for (const auto &profile : profiles) {
+        if (profile.product_id == product_id && profile.host == host) {
+            return &profile;
+        }
+    }
+    return nullptr;
+}
+
+void apply_transfer_profile(const TransferProfile &profile, LoadOptions &options) {
+    options.ram_write_chunk = profile.ram_write_chunk;
+    options.flash_write_chunk = profile.flash_write_chunk;
+}
+
+void apply_transfer_profile(const TransferProfile &profile, DumpOptions &options) {
+    options.read_size = profile.read_chunk;
+}
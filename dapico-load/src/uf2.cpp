@@ -0,0 +1,119 @@
+#include "uf2.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+constexpr size_t kUf2FlagsOffset = 8;
+constexpr size_t kUf2TargetAddrOffset = 12;
+constexpr size_t kUf2PayloadSizeOffset = 16;
+constexpr size_t kUf2FamilyIdOffset = 28;
+constexpr size_t kUf2DataOffset = 32;
+constexpr size_t kUf2MagicEndOffset = kUf2BlockSize - 4;
+
+uint32_t load32(const uint8_t *p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Non-zero when any block in [begin, end) has a bad magic. Written without
+// branches so the whole file is checked in one tight load-bound pass.
+uint32_t magic_mismatch(const uint8_t *data, size_t begin, size_t end) {
+    uint32_t bad = 0;
+    for (size_t i = begin; i < end; ++i) {
+        const uint8_t *block = data + i * kUf2BlockSize;
+        bad |= (load32(block) ^ kUf2MagicStart0) | (load32(block + 4) ^ kUf2MagicStart1) |
+               (load32(block + kUf2MagicEndOffset) ^ kUf2MagicEnd);
+    }
+    return bad;
+}
+
+// Families each chip accepts besides kUf2FamilyData, padded to four entries so
+// membership is a fixed set of compares.
+constexpr uint32_t kRp2040Families[4] = {kUf2FamilyRp2040, kUf2FamilyRp2040, kUf2FamilyRp2040, kUf2FamilyRp2040};
+constexpr uint32_t kRp2350Families[4] = {kUf2FamilyRp2350ArmSecure, kUf2FamilyRp2350ArmNonSecure,
+                                         kUf2FamilyRp2350RiscV, kUf2FamilyAbsolute};
+
+struct BlockRef {
+    ImageSegment segment;
+    size_t index;
+};
+} // namespace
+
+bool is_uf2(const uint8_t *data, size_t size) {
+    return size >= kUf2BlockSize && load32(data) == kUf2MagicStart0 && load32(data + 4) == kUf2MagicStart1;
+}
+
+std::vector<ImageSegment> uf2_image_segments(const uint8_t *data, size_t size, uint16_t product_id) {
+    if (size % kUf2BlockSize != 0) {
+        throw std::runtime_error("UF2 file size is not a multiple of 512 bytes");
+    }
+    size_t count = size / kUf2BlockSize;
+    if (magic_mismatch(data, 0, count) != 0) {
+        for (size_t i = 0; i < count; ++i) {
+            if (magic_mismatch(data, i, i + 1) != 0) {
+                throw std::runtime_error("UF2 block " + std::to_string(i) + " has a bad magic");
+            }
+        }
+    }
+
+    // Branch-free accept mask first; only accepted blocks are looked at again.
+    const uint32_t *families = product_id == kProductIdRp2040UsbBoot ? kRp2040Families : kRp2350Families;
+    std::vector<uint8_t> accept(count);
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *block = data + i * kUf2BlockSize;
+        uint32_t flags = load32(block + kUf2FlagsOffset);
+        uint32_t family = load32(block + kUf2FamilyIdOffset);
+        bool family_ok = (family == families[0]) | (family == families[1]) | (family == families[2]) |
+                         (family == families[3]) | (family == kUf2FamilyData);
+        bool main_flash = (flags & (kUf2FlagNotMainFlash | kUf2FlagFileContainer)) == 0;
+        bool no_family = (flags & kUf2FlagFamilyIdPresent) == 0;
+        accept[i] = static_cast<uint8_t>(main_flash & (no_family | family_ok));
+    }
+
+    std::vector<BlockRef> blocks;
+    blocks.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (!accept[i]) {
+            continue;
+        }
+        const uint8_t *block = data + i * kUf2BlockSize;
+        uint32_t addr = load32(block + kUf2TargetAddrOffset);
+        uint32_t payload_size = load32(block + kUf2PayloadSizeOffset);
+        if (payload_size > kUf2MaxPayloadSize || addr + payload_size < addr) {
+            throw std::runtime_error("UF2 block " + std::to_string(i) + " has an invalid payload");
+        }
+        if (payload_size != 0) {
+            blocks.push_back(BlockRef{ImageSegment{addr, block + kUf2DataOffset, payload_size}, i});
+        }
+    }
+    if (blocks.empty()) {
+        throw std::runtime_error(std::string("UF2 file has no blocks for ") + chip_name_for_product(product_id));
+    }
+
+    std::sort(blocks.begin(), blocks.end(), [](const BlockRef &a, const BlockRef &b) {
+        return a.segment.addr != b.segment.addr ? a.segment.addr < b.segment.addr : a.index < b.index;
+    });
+
+    std::vector<ImageSegment> segments;
+    segments.reserve(blocks.size());
+    for (const auto &block : blocks) {
+        if (!segments.empty() && segments.back().addr == block.segment.addr &&
+            segments.back().size == block.segment.size) {
+            segments.back() = block.segment;
+            continue;
+        }
+        if (!segments.empty() && segments.back().addr + segments.back().size > block.segment.addr) {
+            std::ostringstream message;
+            message << "UF2 block " << block.index << " overlaps another block at 0x" << std::hex
+                    << block.segment.addr;
+            throw std::runtime_error(message.str());
+        }
+        segments.push_back(block.segment);
+    }
+    return segments;
+}
@@ -0,0 +1,204 @@
+#include "watch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include "block_hash.h"
+#include "file_watcher.h"
+#include "image_diff.h"
+#include "loader.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+} // namespace
+
+std::vector<SegmentDigest> digest_segments(const std::vector<ImageSegment> &segments) {
+    std::vector<SegmentDigest> digests;
+    digests.reserve(segments.size());
+    for (const auto &segment : segments) {
+        digests.push_back(SegmentDigest{segment.addr, segment.size, hash_bytes(segment.data, segment.size)});
+    }
+    return digests;
+}
+
+IncrementalPlanner::IncrementalPlanner(const MemoryLayout &layout, bool allow_flash)
+    : layout_(layout), allow_flash_(allow_flash) {}
+
+LoadPlan IncrementalPlanner::plan(const std::vector<ImageSegment> &segments, uint32_t entry_point,
+                                  WatchCycle &cycle) {
+    pending_digests_ = digest_segments(segments);
+    pending_plan_ = build_load_plan(segments, entry_point, layout_, allow_flash_);
+
+    bool flash_changed = !loaded_;
+    cycle.segments = segments.size();
+    cycle.changed_segments = 0;
+    for (const auto &digest : pending_digests_) {
+        if (loaded_ && std::find(loaded_digests_.begin(), loaded_digests_.end(), digest) != loaded_digests_.end()) {
+            continue;
+        }
+        cycle.changed_segments++;
+        flash_changed = flash_changed || (allow_flash_ && is_flash_address(digest.addr, layout_));
+    }
+
+    LoadPlan delta;
+    delta.ram_segments = pending_plan_.ram_segments;
+    delta.entry_point = pending_plan_.entry_point;
+    delta.skipped_flash_segments = pending_plan_.skipped_flash_segments;
+    delta.mirrored_flash_segments = pending_plan_.mirrored_flash_segments;
+    if (!loaded_) {
+        delta.flash_extents = pending_plan_.flash_extents;
+        delta.erase_ranges = pending_plan_.erase_ranges;
+        cycle.flash_sectors = 0;
+        for (const auto &range : delta.erase_ranges) {
+            cycle.flash_sectors += (range.end - range.start) / kFlashSectorSize;
+        }
+    } else if (flash_changed) {
+        FlashDiff diff = diff_flash_plans(loaded_plan_, pending_plan_, std::thread::hardware_concurrency());
+        delta.flash_extents = std::move(diff.update_plan.flash_extents);
+        delta.erase_ranges = std::move(diff.update_plan.erase_ranges);
+        cycle.flash_sectors = diff.changed_sectors;
+    } else {
+        cycle.flash_sectors = 0;
+    }
+    cycle.ram_bytes = 0;
+    for (const auto &segment : delta.ram_segments) {
+        cycle.ram_bytes += segment.size;
+    }
+    return delta;
+}
+
+bool IncrementalPlanner::loadable() const {
+    return !pending_plan_.ram_segments.empty() || !pending_plan_.flash_extents.empty();
+}
+
+bool IncrementalPlanner::unchanged() const {
+    return loaded_ && pending_digests_ == loaded_digests_ && pending_plan_.entry_point == loaded_entry_;
+}
+
+void IncrementalPlanner::commit() {
+    loaded_ = true;
+    loaded_digests_ = pending_digests_;
+    loaded_entry_ = pending_plan_.entry_point;
+    loaded_plan_ = std::move(pending_plan_);
+    // RAM segments borrow from the image, which is about to be replaced.
+    loaded_plan_.ram_segments.clear();
+    pending_plan_ = LoadPlan{};
+}
+
+void IncrementalPlanner::reset() {
+    loaded_ = false;
+    loaded_digests_.clear();
+    loaded_plan_ = LoadPlan{};
+}
+
+int run_watch(const std::string &filename, const WatchOptions &options, const WatchEnvironment &env) {
+    MemoryLayout layout = memory_layout_for_product(env.product_id);
+    IncrementalPlanner planner(layout, options.allow_flash);
+    std::unique_ptr<FileWatcher> watcher;
+    try {
+        watcher = std::make_unique<FileWatcher>(filename);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+    std::cout << "Watching " << filename << " (Ctrl-C to stop).\n";
+
+    size_t reloads = 0;
+    for (bool first = true;; first = false) {
+        Clock::time_point changed = Clock::now();
+        if (!first) {
+            watcher->wait_for_change(options.debounce_ms);
+            changed = watcher->last_change();
+        }
+        Clock::time_point settled = Clock::now();
+
+        WatchCycle cycle;
+        LoadImage image;
+        LoadPlan plan;
+        try {
+            image = open_load_image(filename, env.product_id, options.image);
+            if (options.image.entry_point != 0) {
+                image.entry_point = options.image.entry_point;
+            }
+            plan = planner.plan(image.segments, image.entry_point, cycle);
+        } catch (const std::runtime_error &err) {
+            std::cerr << "Image parse failed: " << err.what() << "\n";
+            if (first) {
+                return 1;
+            }
+            std::cout << "Waiting for the next change.\n";
+            continue;
+        }
+        if (!planner.loadable()) {
+            std::cerr << "No loadable segments found" << (options.allow_flash ? "" : " (use --flash to write flash)")
+                      << ".\n";
+            if (first) {
+                return 1;
+            }
+            continue;
+        }
+        if (planner.unchanged()) {
+            std::cout << "No loadable bytes changed; not reloading.\n";
+            continue;
+        }
+
+        LoadOptions load_options;
+        load_options.exec_after = options.exec_after;
+        load_options.exclusive = options.exclusive;
+        if (options.exec_after && !resolve_exec_address(plan, layout, options.allow_flash, load_options.exec_addr)) {
+            if (first) {
+                return 1;
+            }
+            continue;
+        }
+        cycle.host_ms = elapsed_ms(settled, Clock::now());
+
+        PicobootTransport *device = env.acquire();
+        if (!device) {
+            return 0;
+        }
+        double device_start_us = env.device_us ? env.device_us() : 0;
+        Clock::time_point load_start = Clock::now();
+        bool loaded = load_plan_to_device(*device, plan, load_options) == kTransportOk;
+        Clock::time_point done = Clock::now();
+        cycle.device_ms = env.device_us ? (env.device_us() - device_start_us) / 1000.0 : elapsed_ms(load_start, done);
+        if (env.on_load) {
+            env.on_load(loaded, cycle.device_ms);
+        }
+        if (!loaded) {
+            planner.reset();
+            return 1;
+        }
+        planner.commit();
+
+        cycle.debounce_ms = elapsed_ms(changed, settled);
+        cycle.latency_ms = elapsed_ms(changed, done) + (env.device_us ? cycle.device_ms : 0);
+
+        if (first) {
+            std::printf("Loaded %s: %zu segments, %u flash sectors, %.1f KiB RAM in %.1f ms.\n", filename.c_str(),
+                        cycle.segments, cycle.flash_sectors, cycle.ram_bytes / 1024.0, cycle.latency_ms);
+        } else {
+            std::printf("Reloaded %s: %zu of %zu segments changed, %u flash sectors, %.1f KiB RAM in %.1f ms "
+                        "(debounce %.1f, host %.1f, device %.1f ms).\n",
+                        filename.c_str(), cycle.changed_segments, cycle.segments, cycle.flash_sectors,
+                        cycle.ram_bytes / 1024.0, cycle.latency_ms, cycle.debounce_ms, cycle.host_ms,
+                        cycle.device_ms);
+            if (env.on_reload) {
+                env.on_reload(cycle);
+            }
+            if (options.max_reloads != 0 && ++reloads >= options.max_reloads) {
+                return 0;
+            }
+        }
+        std::fflush(stdout);
+    }
+}
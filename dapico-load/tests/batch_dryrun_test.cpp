@@ -0,0 +1,66 @@
+// Batch dry runs: one file that cannot be checked is one failed entry, not
+// the end of the batch, however it fails.
+
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "batch_dryrun.h"
+#include "test_elf.h"
+#include "test_util.h"
+
+namespace {
+constexpr uint32_t kSparseSegmentSize = 1536u * 1024 * 1024;
+
+void write_file(const std::string &path, const std::vector<uint8_t> &bytes) {
+    std::ofstream(path, std::ios::binary)
+        .write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
+
+void test_failing_image() {
+    char dir_template[] = "/tmp/dapico-batch-test-XXXXXX";
+    CHECK(mkdtemp(dir_template) != nullptr);
+    std::string dir = dir_template;
+    std::string good = dir + "/good.elf";
+    std::string large = dir + "/large.elf";
+    write_file(good, elf_with_segment(16));
+    // A sparse file that really is as long as its 1.5 GiB segment: reading it
+    // needs more memory than the limit below allows, so the check throws
+    // std::bad_alloc rather than std::runtime_error.
+    write_file(large, elf_with_segment(kSparseSegmentSize));
+    CHECK(::truncate(large.c_str(), 84 + static_cast<off_t>(kSparseSegmentSize)) == 0);
+
+    rlimit saved{};
+    ::getrlimit(RLIMIT_AS, &saved);
+    rlimit capped = saved;
+    capped.rlim_cur = std::min<rlim_t>(saved.rlim_cur, rlim_t{1} << 30);
+    ::setrlimit(RLIMIT_AS, &capped);
+
+    DryrunOptions options;
+    options.product_id = kProductIdRp2040UsbBoot;
+    options.allow_flash = true;
+    // The second worker to reach large.elf waits on the first one's result.
+    BatchReport report = validate_images({large, good, large}, options, CostModel{}, 3);
+    ::setrlimit(RLIMIT_AS, &saved);
+
+    CHECK(report.images.size() == 3);
+    if (report.images.size() == 3) {
+        CHECK(!report.images[0].error.empty() && report.images[0].error == report.images[2].error);
+        CHECK(report.images[1].error.empty() && report.images[1].estimate.commands() > 0);
+    }
+    CHECK(report.parses == 2);
+
+    ::unlink(good.c_str());
+    ::unlink(large.c_str());
+    ::rmdir(dir_template);
+}
+} // namespace
+
+int main() {
+    test_failing_image();
+    return test_result();
+}
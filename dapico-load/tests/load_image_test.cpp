@@ -0,0 +1,112 @@
+// Recognizing input formats: raw binaries taken as given, whatever their
+// first bytes look like, and ELF headers that promise more than the file holds
+// refused without allocating what they promise.
+
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "load_image.h"
+#include "test_elf.h"
+#include "test_util.h"
+
+namespace {
+constexpr uint32_t kAssetBase = 0x10100000;
+
+// Bytes that open like a gzip stream (1f 8b) and a zstd frame (28 b5 2f fd).
+const std::vector<uint8_t> kGzipLike = {0x1f, 0x8b, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+const std::vector<uint8_t> kZstdLike = {0x28, 0xb5, 0x2f, 0xfd, 0x01, 0x02, 0x03, 0x04};
+
+bool loaded_raw(const LoadImage &image, uint32_t base, const std::vector<uint8_t> &bytes) {
+    return image.segments.size() == 1 && image.segments[0].addr == base &&
+           std::vector<uint8_t>(image.segments[0].data, image.segments[0].data + image.segments[0].size) == bytes;
+}
+
+void test_raw_from_memory() {
+    ImageOptions raw;
+    raw.raw_binary = true;
+    raw.raw_base = kAssetBase;
+    for (const auto &bytes : {kGzipLike, kZstdLike}) {
+        CHECK(loaded_raw(load_image_from_memory(bytes.data(), bytes.size(), nullptr, kProductIdRp2040UsbBoot, raw),
+                         kAssetBase, bytes));
+        // Without --base the same bytes are taken for a compressed ELF.
+        CHECK_THROWS(load_image_from_memory(bytes.data(), bytes.size(), nullptr, kProductIdRp2040UsbBoot));
+    }
+}
+
+void test_raw_from_file() {
+    char dir_template[] = "/tmp/dapico-load-image-test-XXXXXX";
+    CHECK(mkdtemp(dir_template) != nullptr);
+    std::string asset = std::string(dir_template) + "/asset.bin";
+    std::ofstream(asset, std::ios::binary)
+        .write(reinterpret_cast<const char *>(kGzipLike.data()), static_cast<std::streamsize>(kGzipLike.size()));
+
+    CHECK(loaded_raw(open_load_image(asset, kProductIdRp2040UsbBoot), kFlashStart, kGzipLike));
+    ImageSet set = open_image_set({asset + "@0x10100000"}, kProductIdRp2040UsbBoot, ImageOptions{});
+    CHECK(set.images.size() == 1 && loaded_raw(set.images[0], kAssetBase, kGzipLike));
+
+    ::unlink(asset.c_str());
+    ::rmdir(dir_template);
+}
+
+std::vector<uint8_t> gzip(const std::vector<uint8_t> &bytes) {
+    z_stream stream{};
+    std::vector<uint8_t> out(bytes.size() + 256);
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    stream.next_in = const_cast<uint8_t *>(bytes.data());
+    stream.avail_in = static_cast<uInt>(bytes.size());
+    stream.next_out = out.data();
+    stream.avail_out = static_cast<uInt>(out.size());
+    deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+void test_oversized_elf() {
+    // Capped so that sizing a buffer from the header fails the test outright.
+    rlimit saved{};
+    ::getrlimit(RLIMIT_AS, &saved);
+    rlimit capped = saved;
+    capped.rlim_cur = std::min<rlim_t>(saved.rlim_cur, rlim_t{1} << 30);
+    ::setrlimit(RLIMIT_AS, &capped);
+
+    std::vector<uint8_t> good = elf_with_segment(16);
+    CHECK(load_image_from_memory(good.data(), good.size(), nullptr, kProductIdRp2040UsbBoot).segments.size() == 1);
+
+    std::vector<uint8_t> huge = elf_with_segment(0xfffffff0);
+    CHECK_THROWS(load_image_from_memory(huge.data(), huge.size(), nullptr, kProductIdRp2040UsbBoot));
+    std::vector<uint8_t> compressed = gzip(huge);
+    CHECK_THROWS(load_image_from_memory(compressed.data(), compressed.size(), nullptr, kProductIdRp2040UsbBoot));
+
+    // 65535 entries of 65535 bytes: a 4 GiB program header table.
+    std::vector<uint8_t> table = elf_with_segment(16);
+    put_u16(table, 42, 0xffff);
+    put_u16(table, 44, 0xffff);
+    CHECK_THROWS(load_image_from_memory(table.data(), table.size(), nullptr, kProductIdRp2040UsbBoot));
+
+    char dir_template[] = "/tmp/dapico-load-image-test-XXXXXX";
+    CHECK(mkdtemp(dir_template) != nullptr);
+    std::string path = std::string(dir_template) + "/huge.elf";
+    std::ofstream(path, std::ios::binary)
+        .write(reinterpret_cast<const char *>(huge.data()), static_cast<std::streamsize>(huge.size()));
+    CHECK_THROWS(open_load_image(path, kProductIdRp2040UsbBoot));
+    ::unlink(path.c_str());
+    ::rmdir(dir_template);
+
+    ::setrlimit(RLIMIT_AS, &saved);
+}
+} // namespace
+
+int main() {
+    test_raw_from_memory();
+    test_raw_from_file();
+    test_oversized_elf();
+    return test_result();
+}
@@ -0,0 +1,125 @@
+// OTP ECC codewords and manifest-driven programming against the simulated
+// RP2350 OTP array.
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "otp.h"
+#include "sim_device.h"
+#include "test_util.h"
+
+namespace {
+std::vector<OtpEntry> manifest(const std::string &text) {
+    std::istringstream input(text);
+    return parse_otp_manifest(input, "test.otp");
+}
+
+bool program(SimulatedDevice &device, const std::string &text, OtpPlan &plan) {
+    return plan_otp_update(device, manifest(text), plan) == kTransportOk && plan.conflicts.empty() &&
+           write_otp_plan(device, plan) == kTransportOk;
+}
+
+void test_ecc() {
+    // Worked from the parity masks: bit 0 of the data is covered by parity
+    // bits 0 and 1, and bit 5 evens out the whole codeword.
+    CHECK(otp_ecc_encode(0x0000) == 0x000000);
+    CHECK(otp_ecc_encode(0x0001) == 0x230001);
+    CHECK(otp_ecc_encode(0x1234) == 0x191234);
+    CHECK(otp_ecc_encode(0xffff) == 0x1effff);
+
+    int bad_round_trips = 0;
+    int bad_corrections = 0;
+    for (uint32_t value = 0; value <= 0xffff; ++value) {
+        uint32_t codeword = otp_ecc_encode(static_cast<uint16_t>(value));
+        uint16_t decoded = 0;
+        bad_round_trips += otp_ecc_decode(codeword, decoded) != OtpEccStatus::ok || decoded != value;
+        // Inverted with both BRBP flags set reads back the same.
+        bad_round_trips += otp_ecc_decode((~codeword & 0x3fffff) | 0xc00000, decoded) != OtpEccStatus::ok ||
+                           decoded != value;
+        if (value % 257 == 0) {
+            for (int bit = 0; bit < 24; ++bit) {
+                decoded = 0;
+                bad_corrections += otp_ecc_decode(codeword ^ (1u << bit), decoded) != OtpEccStatus::corrected ||
+                                   decoded != value;
+            }
+        }
+    }
+    CHECK(bad_round_trips == 0);
+    CHECK(bad_corrections == 0);
+
+    uint16_t decoded = 0;
+    CHECK(otp_ecc_decode(otp_ecc_encode(0x1234) ^ 0x3, decoded) == OtpEccStatus::uncorrectable);
+
+    // 0x0001 over a row already holding 0x1234 would clear bits either way.
+    uint32_t row = 0;
+    CHECK(otp_ecc_program_value(0, 0x1234, row) && row == 0x191234);
+    CHECK(!otp_ecc_program_value(otp_ecc_encode(0x1234), 0x0001, row));
+}
+
+void test_manifest_parsing() {
+    std::vector<OtpEntry> entries = manifest("# keys\n0x0c0 ecc 0x1234 0x5678\n0x200 raw 0xabcdef  # cal\n");
+    CHECK(entries.size() == 2);
+    CHECK(entries[0].row == 0x0c0 && entries[0].layout == OtpLayout::ecc && entries[0].values.size() == 2);
+    CHECK(entries[1].row == 0x200 && entries[1].layout == OtpLayout::raw && entries[1].values[0] == 0xabcdef);
+
+    CHECK_THROWS(manifest("0x0c0 ecc 0x10000\n"));
+    CHECK_THROWS(manifest("0x0c0 raw 0x1000000\n"));
+    CHECK_THROWS(manifest("0x0c0 ecc 1 2\n0x0c1 ecc 3\n"));
+    CHECK_THROWS(manifest("0x1000 raw 1\n"));
+    CHECK_THROWS(manifest("0xfff raw 1 2\n"));
+    CHECK_THROWS(manifest("0x0c0 crc 1\n"));
+}
+
+void test_diff_ranges() {
+    SimulatedDevice device(sim_profile_rp2350());
+    OtpPlan plan;
+    CHECK(program(device, "0x0c1 ecc 0x5678\n", plan));
+    CHECK(device.otp()[0x0c1] == otp_ecc_encode(0x5678));
+
+    // One read per run of consecutive rows (0x0c0-0x0c3 spans both layouts);
+    // only rows that differ are written, split around the unchanged 0x0c1.
+    const std::string wanted = "0x0c0 ecc 0x1234 0x5678 0x9abc\n0x0c3 raw 0x000f00\n0x200 raw 0x1 0x2\n";
+    CHECK(plan_otp_update(device, manifest(wanted), plan) == kTransportOk);
+    CHECK(plan.rows == 6 && plan.changed == 5 && plan.unchanged == 1 && plan.conflicts.empty());
+    CHECK(plan.read_commands == 2);
+    CHECK(plan.writes.size() == 3);
+    if (plan.writes.size() == 3) {
+        CHECK(plan.writes[0].row == 0x0c0 && plan.writes[0].rows == std::vector<uint32_t>{otp_ecc_encode(0x1234)});
+        CHECK(plan.writes[1].row == 0x0c2 &&
+              plan.writes[1].rows == (std::vector<uint32_t>{otp_ecc_encode(0x9abc), 0x000f00}));
+        CHECK(plan.writes[2].row == 0x200 && plan.writes[2].rows == (std::vector<uint32_t>{0x1, 0x2}));
+    }
+    CHECK(write_otp_plan(device, plan) == kTransportOk);
+
+    // Programmed once, the same manifest plans nothing.
+    CHECK(plan_otp_update(device, manifest(wanted), plan) == kTransportOk);
+    CHECK(plan.changed == 0 && plan.unchanged == 6 && plan.writes.empty());
+}
+
+void test_raw_row_not_cleared() {
+    SimulatedDevice device(sim_profile_rp2350());
+    OtpPlan plan;
+    CHECK(program(device, "0x300 raw 0x00f0f0\n", plan));
+
+    // Setting more bits is fine; clearing any is a conflict and is not planned.
+    CHECK(plan_otp_update(device, manifest("0x300 raw 0x00f0ff\n"), plan) == kTransportOk);
+    CHECK(plan.changed == 1 && plan.conflicts.empty());
+    CHECK(plan_otp_update(device, manifest("0x300 raw 0x000f0f\n0x301 raw 0x1\n"), plan) == kTransportOk);
+    CHECK(plan.conflicts.size() == 1 && plan.changed == 1);
+    CHECK(plan.writes.size() == 1 && plan.writes[0].row == 0x301);
+
+    // The device refuses the write too, and leaves the row alone.
+    const uint8_t clear[4] = {0x0f, 0x0f, 0x00, 0x00};
+    CHECK(picoboot_otp_write(device, 0x300, 1, false, clear) != kTransportOk);
+    CHECK(device.otp()[0x300] == 0x00f0f0);
+}
+} // namespace
+
+int main() {
+    test_ecc();
+    test_manifest_parsing();
+    test_diff_ranges();
+    test_raw_row_not_cleared();
+    return test_result();
+}
@@ -0,0 +1,122 @@
+// RP2350 partition table decoding and A/B plan relocation against the
+// simulated device.
+
+#include <vector>
+
+#include "load_plan.h"
+#include "loader.h"
+#include "partition_table.h"
+#include "sim_device.h"
+#include "test_util.h"
+
+namespace {
+constexpr uint32_t kSlotA = kFlashStart + 0x10000;
+constexpr uint32_t kSlotB = kFlashStart + 0x210000;
+constexpr uint32_t kSlotSize = 0x200000;
+
+std::vector<uint8_t> payload_bytes(size_t size, uint8_t seed) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<uint8_t>(i * 131 + seed + (i >> 8));
+    }
+    return data;
+}
+
+LoadPlan flash_plan(uint32_t addr, const std::vector<uint8_t> &payload) {
+    std::vector<ImageSegment> segments = {ImageSegment{addr, payload.data(), static_cast<uint32_t>(payload.size())}};
+    return build_load_plan(segments, addr + 0x101, memory_layout_for_product(kProductIdRp2350UsbBoot), true);
+}
+
+void test_pt_info() {
+    // Two partitions: sectors 0x10-0x20f, and 0x210-0x40f as the B of 0.
+    const uint32_t words[] = {7, kPtInfoPtInfo | kPtInfoLocationAndFlags, 0x102, 0, 0x41e010, 0, 0x81e210, 0x2};
+    PartitionTable table = parse_partition_table_info(words, 8);
+    CHECK(table.present);
+    CHECK(table.partitions.size() == 2);
+    if (table.partitions.size() == 2) {
+        CHECK(table.partitions[0].start() == kSlotA && table.partitions[0].end() == kSlotA + kSlotSize);
+        CHECK(table.partitions[1].start() == kSlotB && table.partitions[1].end() == kSlotB + kSlotSize);
+        CHECK(table.partitions[0].a_partition() == -1 && table.partitions[1].a_partition() == 0);
+    }
+    CHECK(table.ab_partner(0) == 1 && table.ab_partner(1) == 0 && table.ab_partner(2) == -1);
+    CHECK(partition_table_info_words(table) == std::vector<uint32_t>(words, words + 8));
+
+    CHECK_THROWS(parse_partition_table_info(words, 6));
+    const uint32_t wrong_flags[] = {3, kPtInfoPtInfo, 0x100, 0};
+    CHECK_THROWS(parse_partition_table_info(wrong_flags, 4));
+    const uint32_t short_count[] = {5, kPtInfoPtInfo | kPtInfoLocationAndFlags, 0x102, 0, 0x41e010, 0};
+    CHECK_THROWS(parse_partition_table_info(short_count, 6));
+
+    SimulatedDevice device(sim_profile_rp2350());
+    PartitionTable queried;
+    CHECK(query_partition_table(device, queried) == kTransportOk);
+    CHECK(partition_table_info_words(queried) == std::vector<uint32_t>(words, words + 8));
+    int target = -1;
+    CHECK(query_uf2_target_partition(device, kFamilyIdRp2350ArmSecure, target) == kTransportOk && target == 1);
+}
+
+void test_relocation_bounds() {
+    const Range slot_b{kSlotB, kSlotB + kSlotSize};
+    std::vector<uint8_t> payload = payload_bytes(0x3000, 1);
+
+    LoadPlan plan = flash_plan(kFlashStart, payload);
+    relocate_load_plan(plan, kFlashStart, kSlotB, slot_b);
+    CHECK(plan.flash_extents.size() == 1 && plan.flash_extents[0].addr == kSlotB);
+    CHECK(plan.erase_ranges.size() == 1 && plan.erase_ranges[0].start == kSlotB &&
+          plan.erase_ranges[0].end == kSlotB + 0x3000);
+
+    // Exactly filling the slot fits; one page more does not, nor does
+    // anything below the image base.
+    std::vector<uint8_t> full = payload_bytes(kSlotSize, 2);
+    LoadPlan fits = flash_plan(kFlashStart, full);
+    relocate_load_plan(fits, kFlashStart, kSlotB, slot_b);
+    std::vector<uint8_t> over = payload_bytes(kSlotSize + kFlashPageSize, 3);
+    LoadPlan too_big = flash_plan(kFlashStart, over);
+    CHECK_THROWS(relocate_load_plan(too_big, kFlashStart, kSlotB, slot_b));
+    LoadPlan below = flash_plan(kSlotA, payload);
+    CHECK_THROWS(relocate_load_plan(below, kSlotA + 0x1000, kSlotB, slot_b));
+}
+
+void test_partition_update() {
+    std::vector<uint8_t> payload = payload_bytes(0x20000, 4);
+    for (uint32_t base : {kFlashStart, kSlotA, kSlotB}) {
+        SimulatedDevice device(sim_profile_rp2350());
+        LoadPlan plan = flash_plan(base, payload);
+        PartitionUpdate update;
+        CHECK(plan_partition_update(device, plan, update) == kTransportOk);
+        CHECK(update.target == 1 && update.booted == 0);
+        CHECK(update.image_base == base && update.target_base == kSlotB);
+        CHECK(update.erase_sectors == 0x20 && update.slot_sectors == 0x200);
+
+        LoadOptions options;
+        options.exec_after = false;
+        CHECK(load_plan_to_device(device, plan, options) == kTransportOk);
+        std::vector<uint8_t> readback(payload.size());
+        CHECK(device.read_memory(kSlotB, readback.data(), static_cast<uint32_t>(readback.size())) &&
+              readback == payload);
+        CHECK(device.read_memory(kSlotA, readback.data(), static_cast<uint32_t>(readback.size())) &&
+              readback == std::vector<uint8_t>(payload.size(), 0xff));
+    }
+
+    // B starting inside A: writing B would erase the running image.
+    SimDeviceProfile overlapping = sim_profile_rp2350();
+    overlapping.partition_table.partitions = {make_partition(0x10000, 0x200000),
+                                              make_partition(0x200000, 0x200000, 0)};
+    SimulatedDevice device(overlapping);
+    LoadPlan plan = flash_plan(kFlashStart, payload);
+    PartitionUpdate update;
+    CHECK_THROWS(plan_partition_update(device, plan, update));
+
+    SimDeviceProfile no_pair = sim_profile_rp2350();
+    no_pair.partition_table.partitions = {make_partition(0x10000, 0x200000)};
+    SimulatedDevice single(no_pair);
+    CHECK_THROWS(plan_partition_update(single, plan, update));
+}
+} // namespace
+
+int main() {
+    test_pt_info();
+    test_relocation_bounds();
+    test_partition_update();
+    return test_result();
+}
@@ -0,0 +1,128 @@
+// Packing SRAM-linked images for REBOOT2 RAM_IMAGE, and booting them on the
+// simulated RP2350.
+
+#include <vector>
+
+#include "load_plan.h"
+#include "ram_image.h"
+#include "sim_device.h"
+#include "test_util.h"
+
+namespace {
+const MemoryLayout kLayout = memory_layout_for_product(kProductIdRp2350UsbBoot);
+
+ImageSegment segment(uint32_t addr, const std::vector<uint8_t> &bytes) {
+    return ImageSegment{addr, bytes.data(), static_cast<uint32_t>(bytes.size())};
+}
+
+void test_gap_fill() {
+    std::vector<uint8_t> a(0x100, 0xaa);
+    std::vector<uint8_t> b(0x40, 0xbb);
+    std::vector<uint8_t> c(0x40, 0xcc);
+    // b sits exactly kRamImageGapFill after a and joins its run; c is one
+    // byte further from b and starts a new one.
+    uint32_t b_addr = kSramStart + 0x100 + kRamImageGapFill;
+    uint32_t c_addr = b_addr + 0x40 + kRamImageGapFill + 1;
+    RamImage image = pack_ram_image({segment(kSramStart, a), segment(b_addr, b), segment(c_addr, c)}, kLayout);
+    CHECK(image.segments == 3);
+    CHECK(image.bytes == 0x180 && image.filled_bytes == kRamImageGapFill);
+    CHECK(image.runs.size() == 2);
+    if (image.runs.size() == 2) {
+        const RamImageRun &run = image.runs[0];
+        CHECK(run.addr == kSramStart && run.data.size() == 0x140 + kRamImageGapFill);
+        CHECK(run.data[0xff] == 0xaa && run.data[0x100] == 0 && run.data[0x100 + kRamImageGapFill - 1] == 0);
+        CHECK(run.data[0x100 + kRamImageGapFill] == 0xbb && run.data.back() == 0xbb);
+        CHECK(image.runs[1].addr == c_addr && image.runs[1].data == c);
+    }
+    CHECK(image.region.start == kSramStart && image.region.end == kSramStart + kFlashSectorSize);
+    CHECK(image.write_count() == 2);
+}
+
+void test_overlap_order() {
+    std::vector<uint8_t> first(16, 0x11);
+    std::vector<uint8_t> second(16, 0x22);
+    RamImage later_second = pack_ram_image({segment(0x20001000, first), segment(0x20001008, second)}, kLayout);
+    RamImage later_first = pack_ram_image({segment(0x20001008, second), segment(0x20001000, first)}, kLayout);
+    CHECK(later_second.runs.size() == 1 && later_first.runs.size() == 1);
+    if (later_second.runs.size() == 1 && later_first.runs.size() == 1) {
+        CHECK(later_second.runs[0].data.size() == 24 && later_first.runs[0].data.size() == 24);
+        CHECK(later_second.runs[0].data[7] == 0x11 && later_second.runs[0].data[8] == 0x22);
+        CHECK(later_first.runs[0].data[15] == 0x11 && later_first.runs[0].data[16] == 0x22);
+    }
+    CHECK(later_second.bytes == 24 && later_second.filled_bytes == 0);
+}
+
+void test_outside_sram() {
+    std::vector<uint8_t> bytes(0x100, 1);
+    CHECK_THROWS(pack_ram_image({segment(kFlashStart, bytes)}, kLayout));
+    CHECK_THROWS(pack_ram_image({segment(kSramStart - 0x80, bytes)}, kLayout));
+    CHECK_THROWS(pack_ram_image({segment(kLayout.sram_end - 0x80, bytes)}, kLayout));
+    // Above SRAM: the size check alone would wrap around and accept these.
+    CHECK_THROWS(pack_ram_image({segment(0x20090000, bytes)}, kLayout));
+    CHECK_THROWS(pack_ram_image({segment(0x50000000, bytes)}, kLayout));
+    CHECK_THROWS(pack_ram_image({segment(kSramStart, bytes), segment(0xd0000000, bytes)}, kLayout));
+    CHECK_THROWS(pack_ram_image({}, kLayout));
+
+    RamImage last = pack_ram_image({segment(kLayout.sram_end - 0x100, bytes)}, kLayout);
+    CHECK(last.region.end == kLayout.sram_end && last.region.start == kLayout.sram_end - kFlashSectorSize);
+}
+
+void test_block_marker() {
+    std::vector<uint8_t> code(0x2000, 0);
+    const uint8_t marker[4] = {0xd3, 0xde, 0xff, 0xff};
+    std::copy(marker, marker + 4, code.begin() + 0x1100);
+    CHECK(!pack_ram_image({segment(kSramStart, code)}, kLayout).has_block);
+    std::copy(marker, marker + 4, code.begin() + 0x100);
+    CHECK(pack_ram_image({segment(kSramStart, code)}, kLayout).has_block);
+}
+
+void test_boot() {
+    // Code in main SRAM and a stack image in SCRATCH_X: two runs, one
+    // region spanning the SRAM between them.
+    std::vector<uint8_t> code(0x18000);
+    for (size_t i = 0; i < code.size(); ++i) {
+        code[i] = static_cast<uint8_t>(i * 7 + (i >> 9));
+    }
+    std::vector<uint8_t> data(0x300, 0x5a);
+    std::vector<uint8_t> stack(0x1000, 0xc3);
+    const uint32_t data_addr = kSramStart + 0x18000 + 0x100;
+    const uint32_t scratch = 0x20080000;
+    RamImage image =
+        pack_ram_image({segment(kSramStart, code), segment(data_addr, data), segment(scratch, stack)}, kLayout);
+    CHECK(image.runs.size() == 2);
+
+    SimulatedDevice device(sim_profile_rp2350());
+    CHECK(boot_ram_image(device, image, nullptr) == kTransportOk);
+    CHECK((device.reboot_flags() & REBOOT2_TYPE_MASK) == REBOOT2_FLAG_REBOOT_TYPE_RAM_IMAGE);
+    CHECK(device.reboot_param0() == kSramStart && device.reboot_param1() == 0x81000);
+    CHECK(device.stats().count(PC_WRITE) == image.write_count() && image.write_count() == 3);
+    CHECK(device.stats().count(PC_REBOOT2) == 1 && device.stats().count(PC_EXEC) == 0);
+
+    std::vector<uint8_t> readback(code.size());
+    CHECK(device.read_memory(kSramStart, readback.data(), static_cast<uint32_t>(readback.size())) &&
+          readback == code);
+    readback.resize(0x100);
+    CHECK(device.read_memory(kSramStart + 0x18000, readback.data(), 0x100) &&
+          readback == std::vector<uint8_t>(0x100, 0));
+    readback.resize(data.size());
+    CHECK(device.read_memory(data_addr, readback.data(), static_cast<uint32_t>(readback.size())) &&
+          readback == data);
+    readback.resize(stack.size());
+    CHECK(device.read_memory(scratch, readback.data(), static_cast<uint32_t>(readback.size())) &&
+          readback == stack);
+
+    // The RP2040 bootrom has no REBOOT2.
+    SimulatedDevice rp2040(sim_profile_rp2040());
+    RamImage small = pack_ram_image({segment(kSramStart, data)}, memory_layout_for_product(kProductIdRp2040UsbBoot));
+    CHECK(boot_ram_image(rp2040, small, nullptr) != kTransportOk);
+}
+} // namespace
+
+int main() {
+    test_gap_fill();
+    test_overlap_order();
+    test_outside_sram();
+    test_block_marker();
+    test_boot();
+    return test_result();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "load_plan.h"
+
+// Tiny hand-built ELF files for the tests in this directory.
+inline void put_u16(std::vector<uint8_t> &bytes, size_t offset, uint16_t value) {
+    bytes[offset] = static_cast<uint8_t>(value);
+    bytes[offset + 1] = static_cast<uint8_t>(value >> 8);
+}
+
+inline void put_u32(std::vector<uint8_t> &bytes, size_t offset, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        bytes[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+// A 100-byte ELF with one PT_LOAD at flash start, read from file offset 84, of
+// `filesz` bytes. Only the first 16 are actually in the file.
+inline std::vector<uint8_t> elf_with_segment(uint32_t filesz) {
+    std::vector<uint8_t> elf(100);
+    const uint8_t ident[] = {0x7f, 'E', 'L', 'F', 1, 1, 1};
+    std::copy(ident, ident + sizeof(ident), elf.begin());
+    put_u32(elf, 24, kFlashStart + 0x101);
+    put_u32(elf, 28, 52);
+    put_u16(elf, 42, 32);
+    put_u16(elf, 44, 1);
+    put_u32(elf, 52, 1);
+    put_u32(elf, 56, 84);
+    put_u32(elf, 60, kFlashStart);
+    put_u32(elf, 64, kFlashStart);
+    put_u32(elf, 68, filesz);
+    put_u32(elf, 72, filesz);
+    return elf;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdio>
+#include <stdexcept>
+
+// Minimal checks for the CTest executables in this directory. A failed CHECK
+// prints its location and expression and the test keeps going; main returns
+// test_result().
+inline int &test_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline void check(bool ok, const char *expression, const char *file, int line) {
+    if (!ok) {
+        std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expression);
+        test_failures()++;
+    }
+}
+
+#define CHECK(expression) check(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
+
+// Checks that `statement` throws std::runtime_error.
+#define CHECK_THROWS(statement)                                                                                        \
+    do {                                                                                                               \
+        bool thrown = false;                                                                                           \
+        try {                                                                                                          \
+            statement;                                                                                                 \
+        } catch (const std::runtime_error &) {                                                                         \
+            thrown = true;                                                                                             \
+        }                                                                                                              \
+        check(thrown, #statement " throws", __FILE__, __LINE__);                                                       \
+    } while (0)
+
+inline int test_result() {
+    if (test_failures() != 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", test_failures());
+        return 1;
+    }
+    return 0;
+}
@@ -1,344 +1,173 @@
-#include <CoreFoundation/CoreFoundation.h>
-#include <IOKit/IOCFPlugIn.h>
-#include <IOKit/IOKitLib.h>
-#include <IOKit/usb/IOUSBLib.h>
-#include <IOKit/usb/USBSpec.h>
-
-#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
-#include <optional>
 #include <string>
+#include <thread>
+#include <vector>
 
-#include "boot/picoboot.h"
-#include "pico/stdio_usb/reset_interface.h"
+#include "dapico.h"
 
 namespace {
-constexpr uint16_t kVendorIdRaspberryPi = 0x2e8a;
-constexpr uint16_t kProductIdRp2040UsbBoot = 0x0003;
-constexpr uint16_t kProductIdRp2350UsbBoot = 0x000f;
-constexpr uint16_t kProductIdRp2040StdioUsb = 0x000a;
-constexpr uint16_t kProductIdRp2350StdioUsb = 0x0009;
-constexpr uint32_t kUsbTimeoutMs = 3000;
-
-struct PicobootInterface {
-    UInt8 interface_number{};
-    UInt8 pipe_in{};
-    UInt8 pipe_out{};
-    IOUSBInterfaceInterface **iface{};
-};
-
-struct ResetInterface {
-    UInt8 interface_number{};
-    IOUSBInterfaceInterface **iface{};
-};
+using Clock = std::chrono::steady_clock;
 
-struct DeviceMatch {
-    IOUSBDeviceInterface **device{};
-    uint16_t product_id{};
-    std::optional<PicobootInterface> picoboot;
-    std::optional<ResetInterface> reset;
-};
+constexpr auto kPollInterval = std::chrono::milliseconds(5);
+constexpr auto kReadyTimeout = std::chrono::seconds(10);
+constexpr size_t kMaxFleetSize = 256;
 
 void print_usage(const char *argv0) {
-    std::cout << "Usage: " << argv0 << " [--bootsel] [--verbose]\n"
-              << "  --bootsel  Reboot into BOOTSEL mode (if reset interface is available)\n"
-              << "  --verbose  Enable extra logging\n";
-}
-
-uint32_t cf_number_to_uint32(CFTypeRef value) {
-    if (!value || CFGetTypeID(value) != CFNumberGetTypeID()) {
-        return 0;
-    }
-    uint32_t out = 0;
-    CFNumberGetValue(static_cast<CFNumberRef>(value), kCFNumberSInt32Type, &out);
-    return out;
-}
-
-IOUSBDeviceInterface **create_device_interface(io_service_t device_service) {
-    IOCFPlugInInterface **plug_in = nullptr;
-    SInt32 score = 0;
-    IOReturn ret = IOCreatePlugInInterfaceForService(device_service, kIOUSBDeviceUserClientTypeID,
-                                                     kIOCFPlugInInterfaceID, &plug_in, &score);
-    if (ret != kIOReturnSuccess || !plug_in) {
-        return nullptr;
-    }
-
-    IOUSBDeviceInterface **device = nullptr;
-    HRESULT result = (*plug_in)->QueryInterface(plug_in, CFUUIDGetUUIDBytes(kIOUSBDeviceInterfaceID),
-                                                reinterpret_cast<void **>(&device));
-    (*plug_in)->Release(plug_in);
-    if (result || !device) {
-        return nullptr;
-    }
-    return device;
+    std::cout << "Usage: " << argv0
+              << " [--serial <s>] [--location <hex>] [--index <n>] [--bootsel [--picoboot-only] [--wait]] [--verbose]\n"
+              << "       " << argv0
+              << " --all [--serial <s>] [--location <hex>] [--bootsel [--picoboot-only]] [--wait] [--verbose]\n"
+              << "  --bootsel        Reboot into BOOTSEL mode (if reset interface is available)\n"
+              << "  --picoboot-only  Come up in BOOTSEL without the mass-storage drive, so only PICOBOOT\n"
+              << "                   enumerates; an RP2350 already in BOOTSEL reboots into it again\n"
+              << "  --wait           Wait until PICOBOOT can be opened and print how long that took\n"
+              << "  --all            Reboot every matching device at once; with --wait, report each device's\n"
+              << "                   reboot-to-ready latency and the percentiles over all of them\n"
+              << "  --serial         Only the device with this USB serial number\n"
+              << "  --location       Only devices at this USB location ID, or below it for a hub\n"
+              << "  --index          Without --all, the n-th matching device in location order, from 0\n"
+              << "                   (default 0); devices are chosen from USB metadata before any is opened\n"
+              << "  --verbose        Enable extra logging\n";
 }
 
-IOUSBInterfaceInterface **create_interface_interface(io_service_t interface_service) {
-    IOCFPlugInInterface **plug_in = nullptr;
-    SInt32 score = 0;
-    IOReturn ret = IOCreatePlugInInterfaceForService(interface_service, kIOUSBInterfaceUserClientTypeID,
-                                                     kIOCFPlugInInterfaceID, &plug_in, &score);
-    if (ret != kIOReturnSuccess || !plug_in) {
-        return nullptr;
-    }
-
-    IOUSBInterfaceInterface **iface = nullptr;
-    HRESULT result = (*plug_in)->QueryInterface(plug_in, CFUUIDGetUUIDBytes(kIOUSBInterfaceInterfaceID),
-                                                reinterpret_cast<void **>(&iface));
-    (*plug_in)->Release(plug_in);
-    if (result || !iface) {
-        return nullptr;
-    }
-    return iface;
+const char *outcome_name(dapico_reboot_outcome outcome) {
+    switch (outcome) {
+    case DAPICO_REBOOT_SENT:
+        return "reboot sent";
+    case DAPICO_REBOOT_BOOTSEL_REQUESTED:
+        return "BOOTSEL requested";
+    case DAPICO_REBOOT_BOOTSEL_REENTERED:
+        return "BOOTSEL re-entered";
+    case DAPICO_REBOOT_ALREADY_IN_BOOTSEL:
+        return "already in BOOTSEL";
+    }
+    return "unknown";
 }
 
-bool is_supported_product(uint32_t product_id) {
-    return product_id == kProductIdRp2040UsbBoot || product_id == kProductIdRp2350UsbBoot ||
-           product_id == kProductIdRp2040StdioUsb || product_id == kProductIdRp2350StdioUsb;
-}
-
-std::optional<DeviceMatch> find_device(bool verbose) {
-    CFMutableDictionaryRef matching = IOServiceMatching(kIOUSBDeviceClassName);
-    if (!matching) {
-        return std::nullopt;
-    }
-
-    io_iterator_t iterator = 0;
-    if (IOServiceGetMatchingServices(kIOMainPortDefault, matching, &iterator) != kIOReturnSuccess) {
-        return std::nullopt;
+int reboot_all(uint32_t flags, const dapico_device_filter &filter) {
+    std::vector<dapico_reboot_result> results(kMaxFleetSize);
+    size_t count = 0;
+    dapico_latency_summary summary{};
+    dapico_error error{};
+    uint32_t timeout_ms = static_cast<uint32_t>(std::chrono::milliseconds(kReadyTimeout).count());
+    dapico_status status =
+        dapico_reboot_all(flags, &filter, timeout_ms, results.data(), results.size(), &count, &summary, &error);
+    if (status == DAPICO_ERROR_NO_DEVICE || status == DAPICO_ERROR_NO_BACKEND) {
+        std::cerr << error.message << "\n";
+        return 1;
     }
-
-    std::optional<DeviceMatch> match;
-    io_service_t device_service = 0;
-    while ((device_service = IOIteratorNext(iterator)) != 0) {
-        CFTypeRef vendor_ref = IORegistryEntryCreateCFProperty(device_service, CFSTR(kUSBVendorID),
-                                                               kCFAllocatorDefault, 0);
-        CFTypeRef product_ref = IORegistryEntryCreateCFProperty(device_service, CFSTR(kUSBProductID),
-                                                                kCFAllocatorDefault, 0);
-        uint32_t vendor_id = cf_number_to_uint32(vendor_ref);
-        uint32_t product_id = cf_number_to_uint32(product_ref);
-        if (vendor_ref) {
-            CFRelease(vendor_ref);
-        }
-        if (product_ref) {
-            CFRelease(product_ref);
-        }
-
-        if (vendor_id != kVendorIdRaspberryPi || !is_supported_product(product_id)) {
-            IOObjectRelease(device_service);
-            continue;
-        }
-
-        IOUSBDeviceInterface **device = create_device_interface(device_service);
-        if (!device) {
-            IOObjectRelease(device_service);
-            continue;
-        }
-        if ((*device)->USBDeviceOpen(device) != kIOReturnSuccess) {
-            (*device)->Release(device);
-            IOObjectRelease(device_service);
-            continue;
-        }
-
-        IOUSBFindInterfaceRequest request;
-        request.bInterfaceClass = kIOUSBFindInterfaceDontCare;
-        request.bInterfaceSubClass = kIOUSBFindInterfaceDontCare;
-        request.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
-        request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
-
-        io_iterator_t iface_iterator = 0;
-        if ((*device)->CreateInterfaceIterator(device, &request, &iface_iterator) != kIOReturnSuccess) {
-            (*device)->USBDeviceClose(device);
-            (*device)->Release(device);
-            IOObjectRelease(device_service);
-            continue;
-        }
-
-        std::optional<PicobootInterface> picoboot;
-        std::optional<ResetInterface> reset;
-
-        io_service_t interface_service = 0;
-        while ((interface_service = IOIteratorNext(iface_iterator)) != 0) {
-            IOUSBInterfaceInterface **iface = create_interface_interface(interface_service);
-            IOObjectRelease(interface_service);
-            if (!iface) {
-                continue;
-            }
-            if ((*iface)->USBInterfaceOpen(iface) != kIOReturnSuccess) {
-                (*iface)->Release(iface);
-                continue;
-            }
-
-            UInt8 interface_class = 0;
-            UInt8 interface_subclass = 0;
-            UInt8 interface_protocol = 0;
-            UInt8 interface_number = 0;
-            (*iface)->GetInterfaceClass(iface, &interface_class);
-            (*iface)->GetInterfaceSubClass(iface, &interface_subclass);
-            (*iface)->GetInterfaceProtocol(iface, &interface_protocol);
-            (*iface)->GetInterfaceNumber(iface, &interface_number);
-
-            if (verbose) {
-                std::cout << "Found interface " << static_cast<int>(interface_number)
-                          << " class=" << static_cast<int>(interface_class)
-                          << " subclass=" << static_cast<int>(interface_subclass)
-                          << " protocol=" << static_cast<int>(interface_protocol) << "\n";
-            }
-
-            bool matched = false;
-            if (interface_class == 0xff && interface_subclass == RESET_INTERFACE_SUBCLASS &&
-                interface_protocol == RESET_INTERFACE_PROTOCOL) {
-                reset = ResetInterface{interface_number, iface};
-                matched = true;
-            }
-
-            if (interface_class == 0xff && !picoboot) {
-                UInt8 num_endpoints = 0;
-                (*iface)->GetNumEndpoints(iface, &num_endpoints);
-
-                UInt8 pipe_in = 0;
-                UInt8 pipe_out = 0;
-                for (UInt8 pipe_ref = 1; pipe_ref <= num_endpoints; ++pipe_ref) {
-                    UInt8 direction = 0;
-                    UInt8 number = 0;
-                    UInt8 transfer_type = 0;
-                    UInt16 max_packet = 0;
-                    UInt8 interval = 0;
-                    if ((*iface)->GetPipeProperties(iface, pipe_ref, &direction, &number, &transfer_type,
-                                                    &max_packet, &interval) != kIOReturnSuccess) {
-                        continue;
-                    }
-                    if (transfer_type != kUSBBulk) {
-                        continue;
-                    }
-                    if (direction == kUSBIn) {
-                        pipe_in = pipe_ref;
-                    } else if (direction == kUSBOut) {
-                        pipe_out = pipe_ref;
-                    }
-                }
-
-                if (pipe_in != 0 && pipe_out != 0) {
-                    picoboot = PicobootInterface{interface_number, pipe_in, pipe_out, iface};
-                    matched = true;
-                }
-            }
-
-            if (!matched) {
-                (*iface)->USBInterfaceClose(iface);
-                (*iface)->Release(iface);
+    bool wait = (flags & DAPICO_REBOOT_WAIT) != 0;
+    size_t not_ready = 0;
+    for (size_t i = 0; i < std::min(count, results.size()); ++i) {
+        const dapico_reboot_result &result = results[i];
+        std::printf("%-24s 0x%08x  %-20s", result.serial[0] ? result.serial : "-", result.location,
+                    result.transport_result == 0 ? outcome_name(result.outcome) : "request failed");
+        if (result.transport_result != 0) {
+            std::printf(" (IOReturn %d)", result.transport_result);
+        } else if (wait && result.outcome != DAPICO_REBOOT_ALREADY_IN_BOOTSEL) {
+            if (result.ready) {
+                std::printf(" ready %.0f ms", result.ready_ms);
+            } else {
+                std::printf(" not back");
+                not_ready++;
             }
-
-            if (picoboot && reset) {
-                break;
-            }
-        }
-
-        IOObjectRelease(iface_iterator);
-        if (picoboot || reset) {
-            match = DeviceMatch{device, static_cast<uint16_t>(product_id), picoboot, reset};
-            IOObjectRelease(device_service);
-            break;
-        }
-
-        if (picoboot) {
-            (*picoboot->iface)->USBInterfaceClose(picoboot->iface);
-            (*picoboot->iface)->Release(picoboot->iface);
         }
-        if (reset) {
-            (*reset->iface)->USBInterfaceClose(reset->iface);
-            (*reset->iface)->Release(reset->iface);
-        }
-        (*device)->USBDeviceClose(device);
-        (*device)->Release(device);
-        IOObjectRelease(device_service);
+        std::printf("\n");
     }
-
-    IOObjectRelease(iterator);
-    return match;
-}
-
-IOReturn send_picoboot_command(IOUSBInterfaceInterface **iface, const PicobootInterface &picoboot,
-                               picoboot_cmd &cmd) {
-    static uint32_t token = 1;
-    cmd.dMagic = PICOBOOT_MAGIC;
-    cmd.dToken = token++;
-
-    IOReturn ret = (*iface)->WritePipeTO(iface, picoboot.pipe_out, &cmd, sizeof(cmd), kUsbTimeoutMs, kUsbTimeoutMs);
-    if (ret != kIOReturnSuccess) {
-        return ret;
+    std::printf("%zu devices", count);
+    if (wait && summary.count) {
+        std::printf("; %u ready: p50 %.0f ms, p90 %.0f ms, p99 %.0f ms, max %.0f ms", summary.count,
+                    summary.p50_ms, summary.p90_ms, summary.p99_ms, summary.max_ms);
     }
-
-    uint8_t ack = 0;
-    UInt32 ack_len = 1;
-    return (*iface)->ReadPipeTO(iface, picoboot.pipe_in, &ack, &ack_len, kUsbTimeoutMs, kUsbTimeoutMs);
-}
-
-IOReturn reboot_via_picoboot(IOUSBInterfaceInterface **iface, uint16_t product_id,
-                             const PicobootInterface &picoboot, bool bootsel) {
-    if (bootsel) {
-        std::cout << "Device is already in BOOTSEL mode.\n";
-        return kIOReturnSuccess;
+    std::printf("\n");
+    if (status != DAPICO_OK) {
+        std::cerr << error.message << "\n";
+        return 1;
     }
-
-    picoboot_cmd cmd{};
-    cmd.dTransferLength = 0;
-
-    if (product_id == kProductIdRp2350UsbBoot) {
-        cmd.bCmdId = PC_REBOOT2;
-        cmd.bCmdSize = sizeof(cmd.reboot2_cmd);
-        cmd.reboot2_cmd.dFlags = REBOOT2_FLAG_REBOOT_TYPE_NORMAL;
-        cmd.reboot2_cmd.dDelayMS = 500;
-        cmd.reboot2_cmd.dParam0 = 0;
-        cmd.reboot2_cmd.dParam1 = 0;
-    } else {
-        cmd.bCmdId = PC_REBOOT;
-        cmd.bCmdSize = sizeof(cmd.reboot_cmd);
-        cmd.reboot_cmd.dPC = 0;
-        cmd.reboot_cmd.dSP = 0;
-        cmd.reboot_cmd.dDelayMS = 500;
+    if (not_ready) {
+        std::cerr << not_ready << " devices did not come back within "
+                  << std::chrono::duration_cast<std::chrono::seconds>(kReadyTimeout).count() << " s.\n";
+        return 1;
     }
-
-    return send_picoboot_command(iface, picoboot, cmd);
-}
-
-IOReturn reboot_via_reset_interface(IOUSBInterfaceInterface **iface, const ResetInterface &reset_iface,
-                                    bool bootsel) {
-    IOUSBDevRequest request{};
-    request.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBVendor, kUSBInterface);
-    request.bRequest = bootsel ? RESET_REQUEST_BOOTSEL : RESET_REQUEST_FLASH;
-    request.wValue = 0;
-    request.wIndex = reset_iface.interface_number;
-    request.wLength = 0;
-    request.pData = nullptr;
-    return (*iface)->ControlRequest(iface, 0, &request);
+    return 0;
 }
 
-void close_interface(IOUSBInterfaceInterface **iface) {
-    if (!iface) {
-        return;
+bool bootsel_device_present(const dapico_device_filter &filter) {
+    dapico_device *device = nullptr;
+    if (dapico_open_selected(&filter, 0, &device, nullptr) != DAPICO_OK) {
+        return false;
     }
-    (*iface)->USBInterfaceClose(iface);
-    (*iface)->Release(iface);
+    dapico_close(device);
+    return true;
 }
 
-void close_device(IOUSBDeviceInterface **device) {
-    if (!device) {
-        return;
+// Polls until a BOOTSEL device the filter matches opens. A device rebooting
+// out of BOOTSEL stays on the bus until its reboot delay runs out, so with
+// `gone_first` it has to disappear before the next one counts.
+bool wait_until_ready(const dapico_device_filter &filter, bool gone_first, Clock::time_point sent, double &ready_ms) {
+    while (gone_first && bootsel_device_present(filter)) {
+        if (Clock::now() - sent > kReadyTimeout) {
+            return false;
+        }
+        std::this_thread::sleep_for(kPollInterval);
+    }
+    while (!bootsel_device_present(filter)) {
+        if (Clock::now() - sent > kReadyTimeout) {
+            return false;
+        }
+        std::this_thread::sleep_for(kPollInterval);
     }
-    (*device)->USBDeviceClose(device);
-    (*device)->Release(device);
+    ready_ms = std::chrono::duration<double, std::milli>(Clock::now() - sent).count();
+    return true;
 }
 } // namespace
 
 int main(int argc, char **argv) {
     bool bootsel = false;
+    bool picoboot_only = false;
+    bool wait = false;
     bool verbose = false;
+    bool all = false;
+    std::string serial;
+    uint32_t location = 0;
+    uint32_t index = 0;
+    bool indexed = false;
 
     for (int i = 1; i < argc; ++i) {
         const std::string arg = argv[i];
         if (arg == "--bootsel" || arg == "-u") {
             bootsel = true;
+        } else if (arg == "--picoboot-only") {
+            picoboot_only = true;
+        } else if (arg == "--wait") {
+            wait = true;
+        } else if (arg == "--all") {
+            all = true;
+        } else if ((arg == "--serial" || arg == "--location" || arg == "--index") && i + 1 >= argc) {
+            std::cerr << arg << " needs a value\n";
+            print_usage(argv[0]);
+            return 2;
+        } else if (arg == "--serial") {
+            serial = argv[++i];
+        } else if (arg == "--location") {
+            char *end = nullptr;
+            location = static_cast<uint32_t>(std::strtoul(argv[++i], &end, 16));
+            if (*end != '\0' || location == 0) {
+                std::cerr << "Invalid location: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--index") {
+            char *end = nullptr;
+            index = static_cast<uint32_t>(std::strtoul(argv[++i], &end, 10));
+            if (*argv[i] == '\0' || *end != '\0') {
+                std::cerr << "Invalid device index: " << argv[i] << "\n";
+                return 2;
+            }
+            indexed = true;
         } else if (arg == "--verbose" || arg == "-v") {
             verbose = true;
         } else if (arg == "--help" || arg == "-h") {
@@ -350,49 +179,60 @@ int main(int argc, char **argv) {
             return 2;
         }
     }
-
-    auto match = find_device(verbose);
-    if (!match) {
-        std::cerr << "No Raspberry Pi USB device found.\n";
-        return 1;
+    if (picoboot_only && !bootsel) {
+        std::cerr << "--picoboot-only needs --bootsel\n";
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (all && indexed) {
+        std::cerr << "--index picks one device and cannot be used with --all\n";
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (wait && !bootsel && !all) {
+        std::cerr << "--wait needs --bootsel or --all\n";
+        print_usage(argv[0]);
+        return 2;
     }
 
-    IOReturn ret = kIOReturnSuccess;
-    if (bootsel) {
-        if (match->reset) {
-            ret = reboot_via_reset_interface(match->reset->iface, *match->reset, true);
-        } else if (match->picoboot) {
-            ret = reboot_via_picoboot(match->picoboot->iface, match->product_id, *match->picoboot, true);
-        } else {
-            std::cerr << "Device does not expose a reset or picoboot interface.\n";
-            ret = kIOReturnError;
-        }
-    } else {
-        if (match->picoboot) {
-            ret = reboot_via_picoboot(match->picoboot->iface, match->product_id, *match->picoboot, false);
-        } else if (match->reset) {
-            ret = reboot_via_reset_interface(match->reset->iface, *match->reset, false);
-        } else {
-            std::cerr << "Device does not expose a reset or picoboot interface.\n";
-            ret = kIOReturnError;
-        }
+    uint32_t flags = (bootsel ? DAPICO_REBOOT_TO_BOOTSEL : 0u) | (picoboot_only ? DAPICO_REBOOT_PICOBOOT_ONLY : 0u) |
+                     (verbose ? DAPICO_REBOOT_VERBOSE : 0u);
+    dapico_device_filter filter{serial.c_str(), location};
+    if (all) {
+        return reboot_all(flags | (wait ? DAPICO_REBOOT_WAIT : 0u), filter);
+    }
+    dapico_reboot_outcome outcome = DAPICO_REBOOT_SENT;
+    dapico_error error{};
+    if (dapico_reboot_selected(flags, &filter, index, &outcome, &error) != DAPICO_OK) {
+        std::cerr << error.message << "\n";
+        return 1;
     }
+    Clock::time_point sent = Clock::now();
 
-    if (ret != kIOReturnSuccess) {
-        std::cerr << "Reboot request failed (IOReturn " << ret << ").\n";
-    } else if (!bootsel) {
+    switch (outcome) {
+    case DAPICO_REBOOT_SENT:
         std::cout << "Reboot request sent.\n";
-    } else if (match->reset) {
-        std::cout << "Requested reboot into BOOTSEL mode.\n";
+        break;
+    case DAPICO_REBOOT_BOOTSEL_REQUESTED:
+        std::cout << "Requested reboot into BOOTSEL mode" << (picoboot_only ? " without the mass-storage drive" : "")
+                  << ".\n";
+        break;
+    case DAPICO_REBOOT_BOOTSEL_REENTERED:
+        std::cout << "Rebooting into BOOTSEL mode again without the mass-storage drive.\n";
+        break;
+    case DAPICO_REBOOT_ALREADY_IN_BOOTSEL:
+        std::cout << "Device is already in BOOTSEL mode.\n";
+        break;
     }
 
-    if (match->picoboot) {
-        close_interface(match->picoboot->iface);
-    }
-    if (match->reset) {
-        close_interface(match->reset->iface);
+    if (wait && outcome != DAPICO_REBOOT_ALREADY_IN_BOOTSEL) {
+        double ready_ms = 0;
+        if (!wait_until_ready(filter, outcome == DAPICO_REBOOT_BOOTSEL_REENTERED, sent, ready_ms)) {
+            std::cerr << "No BOOTSEL device came up within "
+                      << std::chrono::duration_cast<std::chrono::seconds>(kReadyTimeout).count() << " s.\n";
+            return 1;
+        }
+        std::printf("PICOBOOT ready %.0f ms after the request.\n", ready_ms);
     }
-    close_device(match->device);
-
-    return ret == kIOReturnSuccess ? 0 : 1;
+    return 0;
 }